@@ -0,0 +1,38 @@
+# Builds Guu scripts ahead of time into native executables.
+#
+#   include(path/to/aot/GuuAot.cmake)
+#   guu_add_executable(fib bench/fib.guu [OPT -O1])
+#
+# The script is translated with `Guu --emit-cpp` at build time and compiled
+# with the runtime header next to this file. Inside this project the Guu
+# target is used, elsewhere set GUU_EXECUTABLE to an installed Guu.
+
+set(GUU_AOT_RUNTIME_DIR ${CMAKE_CURRENT_LIST_DIR})
+
+function(guu_add_executable name script)
+    cmake_parse_arguments(PARSE_ARGV 2 GUU_AOT "" "OPT" "")
+
+    if (TARGET Guu)
+        set(guu $<TARGET_FILE:Guu>)
+        set(guu_depends Guu)
+    elseif (GUU_EXECUTABLE)
+        set(guu ${GUU_EXECUTABLE})
+        set(guu_depends ${GUU_EXECUTABLE})
+    else()
+        message(FATAL_ERROR "guu_add_executable: no Guu target, set GUU_EXECUTABLE")
+    endif()
+
+    get_filename_component(script ${script} ABSOLUTE)
+    set(cpp ${CMAKE_CURRENT_BINARY_DIR}/${name}.guu.cpp)
+
+    add_custom_command(
+        OUTPUT ${cpp}
+        COMMAND ${guu} ${GUU_AOT_OPT} --emit-cpp=${cpp} ${script}
+        DEPENDS ${guu_depends} ${script} ${GUU_AOT_RUNTIME_DIR}/guu_runtime.h
+        COMMENT "Translating ${script} to C++"
+        VERBATIM)
+
+    add_executable(${name} ${cpp})
+    target_include_directories(${name} PRIVATE ${GUU_AOT_RUNTIME_DIR})
+    target_compile_features(${name} PRIVATE cxx_std_17)
+endfunction()
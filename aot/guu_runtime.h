@@ -0,0 +1,518 @@
+#pragma once
+
+// Runtime of C++ translation units written by `Guu --emit-cpp`. Self-contained
+// so a generated file builds with nothing but this header, see GuuAot.cmake.
+//
+// Mirrors the interpreter: ints wrap, division truncates, arrays are shared
+// references and every runtime error carries the Guu function and line.
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#ifndef GUU_MAX_DEPTH
+#define GUU_MAX_DEPTH (1 << 14)
+#endif
+
+namespace guu
+{
+
+// Guu strings are immutable, a value copy behaves the same as sharing
+using Str = std::string;
+
+class Error : public std::runtime_error
+{
+public:
+    Error(const std::string& msg, const char* fn, int line)
+        : std::runtime_error(msg + " in '" + fn + "' on line " + std::to_string(line))
+    {
+    }
+};
+
+// Operands of a binary operator. Brace initialization evaluates them left to
+// right, which plain function arguments do not guarantee.
+struct Ints
+{
+    std::int64_t a_;
+    std::int64_t b_;
+};
+
+struct Strs
+{
+    const Str& a_;
+    const Str& b_;
+};
+
+inline std::int64_t wrap(std::uint64_t v)
+{
+    return static_cast<std::int64_t>(v);
+}
+
+inline std::int64_t add(Ints x)
+{
+    return wrap(static_cast<std::uint64_t>(x.a_) + static_cast<std::uint64_t>(x.b_));
+}
+
+inline std::int64_t sub(Ints x)
+{
+    return wrap(static_cast<std::uint64_t>(x.a_) - static_cast<std::uint64_t>(x.b_));
+}
+
+inline std::int64_t mul(Ints x)
+{
+    return wrap(static_cast<std::uint64_t>(x.a_) * static_cast<std::uint64_t>(x.b_));
+}
+
+inline std::int64_t neg(std::int64_t a)
+{
+    return wrap(0 - static_cast<std::uint64_t>(a));
+}
+
+inline std::int64_t div(Ints x, const char* fn, int line)
+{
+    if(x.b_ == 0)
+        throw Error("Division by zero", fn, line);
+
+    return x.b_ == -1 ? neg(x.a_) : x.a_ / x.b_;
+}
+
+inline std::int64_t mod(Ints x, const char* fn, int line)
+{
+    if(x.b_ == 0)
+        throw Error("Division by zero", fn, line);
+
+    return x.b_ == -1 ? 0 : x.a_ % x.b_;
+}
+
+// clang-format off
+inline std::int64_t lt(Ints x) { return x.a_ < x.b_; }
+inline std::int64_t gt(Ints x) { return x.a_ > x.b_; }
+inline std::int64_t le(Ints x) { return x.a_ <= x.b_; }
+inline std::int64_t ge(Ints x) { return x.a_ >= x.b_; }
+inline std::int64_t eq(Ints x) { return x.a_ == x.b_; }
+inline std::int64_t ne(Ints x) { return x.a_ != x.b_; }
+inline std::int64_t eq(Strs x) { return x.a_ == x.b_; }
+inline std::int64_t ne(Strs x) { return x.a_ != x.b_; }
+// clang-format on
+
+inline Str concat(Strs x)
+{
+    Str result;
+    result.reserve(x.a_.size() + x.b_.size());
+    result += x.a_;
+    result += x.b_;
+    return result;
+}
+
+// Reference to a fixed-length array of int or str, copies share the elements
+template <typename T>
+class Array
+{
+public:
+    // Arrays declared with a symbolic length start out empty
+    Array() : elements_(std::make_shared<std::vector<T>>())
+    {
+    }
+
+    explicit Array(std::int64_t size) : elements_(std::make_shared<std::vector<T>>(static_cast<size_t>(size)))
+    {
+    }
+
+    Array(std::initializer_list<T> elements) : elements_(std::make_shared<std::vector<T>>(elements))
+    {
+    }
+
+    explicit Array(std::vector<T> elements) : elements_(std::make_shared<std::vector<T>>(std::move(elements)))
+    {
+    }
+
+    // `int[n] a;` with n only known at runtime, limited like MAX_ARRAY_SIZE of the interpreter
+    static Array sized(std::int64_t size, const char* fn, int line)
+    {
+        if(size < 0)
+            throw Error("Negative array size " + std::to_string(size), fn, line);
+        if(size > (std::int64_t{1} << 32))
+            throw Error("Array size " + std::to_string(size) + " is too large", fn, line);
+
+        try
+        {
+            return Array(size);
+        } catch(const std::bad_alloc&)
+        {
+            throw Error("Not enough memory for an array of size " + std::to_string(size), fn, line);
+        }
+    }
+
+    T& at(std::int64_t i, const char* fn, int line) const
+    {
+        auto& elements = *elements_;
+        if(i < 0 || static_cast<size_t>(i) >= elements.size())
+        {
+            throw Error("Index " + std::to_string(i) + " is out of bounds of array of size "
+                            + std::to_string(elements.size()),
+                        fn,
+                        line);
+        }
+
+        return elements[static_cast<size_t>(i)];
+    }
+
+    const std::vector<T>& elements() const
+    {
+        return *elements_;
+    }
+
+private:
+    std::shared_ptr<std::vector<T>> elements_;
+};
+
+using IntArray = Array<std::int64_t>;
+
+// Operands of an operator of int arrays, one of them may be an int
+template <typename A, typename B>
+struct Pair
+{
+    A a_;
+    B b_;
+};
+
+namespace detail
+{
+
+inline std::int64_t element(const IntArray& a, size_t i)
+{
+    return a.elements()[i];
+}
+
+inline std::int64_t element(std::int64_t v, size_t)
+{
+    return v;
+}
+
+inline size_t size(const IntArray& a, const IntArray& b, const char* fn, int line)
+{
+    if(a.elements().size() != b.elements().size())
+    {
+        throw Error("Arrays of different sizes " + std::to_string(a.elements().size()) + " and "
+                        + std::to_string(b.elements().size()),
+                    fn,
+                    line);
+    }
+
+    return a.elements().size();
+}
+
+inline size_t size(const IntArray& a, std::int64_t, const char*, int)
+{
+    return a.elements().size();
+}
+
+inline size_t size(std::int64_t, const IntArray& b, const char*, int)
+{
+    return b.elements().size();
+}
+
+}
+
+// `f` applied to every pair of elements, an int operand is used for each of them
+template <typename A, typename B, typename F>
+IntArray elementwise(const Pair<A, B>& x, const char* fn, int line, F f)
+{
+    std::vector<std::int64_t> result(detail::size(x.a_, x.b_, fn, line));
+    for(size_t i = 0; i < result.size(); ++i)
+        result[i] = f(Ints{detail::element(x.a_, i), detail::element(x.b_, i)});
+
+    return IntArray(std::move(result));
+}
+
+// clang-format off
+#define GUU_ELEMENTWISE(name, ...)                                            \
+    template <typename A, typename B>                                         \
+    IntArray name(const Pair<A, B>& x, const char* fn, int line)              \
+    {                                                                         \
+        return elementwise(x, fn, line, [&](Ints v) { return __VA_ARGS__; }); \
+    }
+
+GUU_ELEMENTWISE(add, guu::add(v))
+GUU_ELEMENTWISE(sub, guu::sub(v))
+GUU_ELEMENTWISE(mul, guu::mul(v))
+GUU_ELEMENTWISE(div, guu::div(v, fn, line))
+GUU_ELEMENTWISE(mod, guu::mod(v, fn, line))
+GUU_ELEMENTWISE(lt, guu::lt(v))
+GUU_ELEMENTWISE(gt, guu::gt(v))
+GUU_ELEMENTWISE(le, guu::le(v))
+GUU_ELEMENTWISE(ge, guu::ge(v))
+GUU_ELEMENTWISE(eq, guu::eq(v))
+GUU_ELEMENTWISE(ne, guu::ne(v))
+
+#undef GUU_ELEMENTWISE
+// clang-format on
+
+inline IntArray neg(const IntArray& a)
+{
+    std::vector<std::int64_t> result(a.elements());
+    for(auto& v: result)
+        v = neg(v);
+
+    return IntArray(std::move(result));
+}
+
+// Command line arguments after the program name, for `fn main(args: str[N])`
+inline Array<Str> args(int argc, char** argv)
+{
+    Array<Str> result(argc > 1 ? argc - 1 : 0);
+    for(int i = 1; i < argc; ++i)
+        result.at(i - 1, "main", 0) = argv[i];
+
+    return result;
+}
+
+inline void printValue(std::int64_t v)
+{
+    std::cout << v;
+}
+
+inline void printValue(const Str& v)
+{
+    std::cout << v;
+}
+
+template <typename T>
+void printValue(const Array<T>& v)
+{
+    const auto& elements = v.elements();
+
+    std::cout << "[";
+    for(size_t i = 0; i < elements.size(); ++i)
+    {
+        if(i)
+            std::cout << ", ";
+
+        printValue(elements[i]);
+    }
+    std::cout << "]";
+}
+
+template <typename T>
+std::int64_t print(const T& v)
+{
+    printValue(v);
+    std::cout << '\n';
+    return 0;
+}
+
+inline std::int64_t len(const Str& v)
+{
+    return static_cast<std::int64_t>(v.size());
+}
+
+template <typename T>
+std::int64_t len(const Array<T>& v)
+{
+    return static_cast<std::int64_t>(v.elements().size());
+}
+
+inline std::int64_t sum(const IntArray& a)
+{
+    std::int64_t result = 0;
+    for(auto v: a.elements())
+        result = add(Ints{result, v});
+
+    return result;
+}
+
+inline std::int64_t min(const IntArray& a, const char* fn, int line)
+{
+    if(a.elements().empty())
+        throw Error("min of an empty array", fn, line);
+
+    std::int64_t result = a.elements()[0];
+    for(auto v: a.elements())
+        result = v < result ? v : result;
+
+    return result;
+}
+
+inline std::int64_t max(const IntArray& a, const char* fn, int line)
+{
+    if(a.elements().empty())
+        throw Error("max of an empty array", fn, line);
+
+    std::int64_t result = a.elements()[0];
+    for(auto v: a.elements())
+        result = v > result ? v : result;
+
+    return result;
+}
+
+inline std::int64_t find(const Pair<IntArray, std::int64_t>& x)
+{
+    const auto& elements = x.a_.elements();
+    for(size_t i = 0; i < elements.size(); ++i)
+    {
+        if(elements[i] == x.b_)
+            return static_cast<std::int64_t>(i);
+    }
+
+    return -1;
+}
+
+inline IntArray filter(const Pair<IntArray, IntArray>& x, const char* fn, int line)
+{
+    size_t n = detail::size(x.a_, x.b_, fn, line);
+
+    std::vector<std::int64_t> result;
+    for(size_t i = 0; i < n; ++i)
+    {
+        if(x.b_.elements()[i])
+            result.push_back(x.a_.elements()[i]);
+    }
+
+    return IntArray(std::move(result));
+}
+
+template <typename T>
+Array<T> copy(const Array<T>& a)
+{
+    return Array<T>(a.elements());
+}
+
+// Native programs start fast without images
+inline std::int64_t checkpoint()
+{
+    return 0;
+}
+
+// Guu call depth, checked by the caller before it evaluates the arguments
+inline size_t depth = 0;
+
+inline void checkDepth(const char* fn, int line)
+{
+    if(depth >= GUU_MAX_DEPTH)
+        throw Error("Stack overflow", fn, line);
+}
+
+// Counts the running function for as long as it is on the stack
+struct Frame
+{
+    Frame()
+    {
+        ++depth;
+    }
+
+    ~Frame()
+    {
+        --depth;
+    }
+
+    Frame(const Frame&)            = delete;
+    Frame& operator=(const Frame&) = delete;
+};
+
+// Runs functions tail calling one another one after the other, so a chain of
+// them takes no stack, like in the interpreter. A function ends in a tail call
+// by returning to(), with the callee and its arguments bound.
+template <typename T>
+class Bounce
+{
+public:
+    using Next = std::function<T(Bounce&)>;
+
+    // Runs `first` and then every callee it or those after it bounce to
+    template <typename F>
+    static T run(F first)
+    {
+        Bounce bounce;
+        T result = first(bounce);
+        while(bounce.next_)
+        {
+            Next next = std::move(bounce.next_);
+            bounce.next_ = nullptr;
+            result       = next(bounce);
+        }
+
+        return result;
+    }
+
+    // The value is dropped by run(), which calls `next` instead
+    T to(Next next)
+    {
+        next_ = std::move(next);
+        return T();
+    }
+
+private:
+    Next next_;
+};
+
+// A spawned call, run when it is joined like the interpreter does. Leaving the
+// scope of the variable joins it too, unless an error is on its way out.
+template <typename T>
+class Task
+{
+public:
+    Task(std::function<T()> run, const char* fn, int line)
+        : run_(std::move(run)), fn_(fn), line_(line), uncaught_(std::uncaught_exceptions())
+    {
+    }
+
+    Task(const Task&)            = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() noexcept(false)
+    {
+        if(!done_ && std::uncaught_exceptions() == uncaught_)
+            join(fn_, line_);
+    }
+
+    const T& join(const char* fn, int line)
+    {
+        if(!done_)
+        {
+            checkDepth(fn, line);
+            result_ = run_();
+            done_   = true;
+        }
+
+        return result_;
+    }
+
+private:
+    std::function<T()> run_;
+    const char* fn_;
+    int line_;
+    int uncaught_;
+
+    T result_{};
+    bool done_ = false;
+};
+
+template <typename T>
+const T& join(Task<T>& task, const char* fn, int line)
+{
+    return task.join(fn, line);
+}
+
+// The process exit status for the result of main
+inline int exitCode(std::int64_t v)
+{
+    return static_cast<int>(v);
+}
+
+template <typename T>
+int exitCode(const T&)
+{
+    return 0;
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// Shared by the libFuzzer targets of the front end and their replay driver.
+//
+// Build the fuzzers with Clang and -DGUU_BUILD_FUZZERS=ON, then run one on
+// its corpus, for example
+//
+//   fuzz_parser -max_len=65536 fuzz/corpus/parser
+//
+// Crashes, uncaught exceptions other than the std::runtime_error errors of
+// the front end and inputs slower per byte than GUU_FUZZ_NS_PER_BYTE all stop
+// the fuzzer with a reproducer. Fixed ones go into fuzz/corpus/<target>, which
+// CTest replays on every build.
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, size_t size);
+
+namespace GuuFuzz
+{
+
+// Aborts, which the fuzzer reports like a crash, if an input took longer per
+// byte than linear work could. Runs under MIN_MS are not judged: they are
+// mostly noise, or costs bounded by Parser::MAX_NESTING like unwinding an
+// error out of the deepest nesting allowed. Quadratic work still shows on
+// inputs of a few kilobytes.
+class TimePerByte
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr double DEFAULT_NS_PER_BYTE = 10000;
+    static constexpr double MIN_MS              = 250;
+
+    explicit TimePerByte(size_t size) : size_(size), start_(Clock::now())
+    {
+        static const double limit = [] {
+            const char* env = std::getenv("GUU_FUZZ_NS_PER_BYTE");
+            return env ? std::atof(env) : DEFAULT_NS_PER_BYTE;
+        }();
+
+        limit_ = limit;
+    }
+
+    void check(const char* target) const
+    {
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start_).count();
+        if(ns < MIN_MS * 1e6 || ns <= limit_ * static_cast<double>(size_ ? size_ : 1))
+            return;
+
+        std::fprintf(stderr, "%s: %.0f ns per byte on %zu bytes, the limit is %.0f\n", target,
+                     ns / static_cast<double>(size_ ? size_ : 1), size_, limit_);
+        std::abort();
+    }
+
+private:
+    size_t size_;
+    Clock::time_point start_;
+    double limit_;
+};
+
+}
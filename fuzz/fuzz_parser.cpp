@@ -0,0 +1,25 @@
+// libFuzzer target for Parser::buildAST(): parses the input and destroys the
+// AST, which must take time linear in its size however deep the input nests.
+// See fuzz.h.
+
+#include "fuzz.h"
+
+#include "../guu/parser.h"
+
+#include <stdexcept>
+#include <string>
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, size_t size)
+{
+    GuuFuzz::TimePerByte time(size);
+
+    try
+    {
+        Guu::Parser(Guu::Tokenizer(std::string(reinterpret_cast<const char*>(data), size))).buildAST();
+    } catch(const std::runtime_error&)
+    {
+    }
+
+    time.check("parser");
+    return 0;
+}
@@ -0,0 +1,35 @@
+// libFuzzer target for the Tokenizer: lexes the input up to its end or the
+// first error, which must take time linear in its size. See fuzz.h.
+
+#include "fuzz.h"
+
+#include "../guu/lexer.h"
+
+#include <stdexcept>
+#include <string>
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, size_t size)
+{
+    GuuFuzz::TimePerByte time(size);
+
+    try
+    {
+        Guu::Tokenizer tokenizer(std::string(reinterpret_cast<const char*>(data), size));
+
+        // Every token takes at least a byte
+        size_t tokens = 0;
+        while(tokenizer.getNext().type_ != Guu::TokenType::END)
+        {
+            if(++tokens > size)
+            {
+                std::fprintf(stderr, "tokenizer: more tokens than the %zu bytes of the input\n", size);
+                std::abort();
+            }
+        }
+    } catch(const std::runtime_error&)
+    {
+    }
+
+    time.check("tokenizer");
+    return 0;
+}
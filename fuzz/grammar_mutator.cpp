@@ -0,0 +1,258 @@
+// Mutator for the fuzz targets that knows the grammar of guu.ebnf. Random
+// bytes rarely get past the first token of a function, so most mutations
+// splice in statements and expressions generated from the productions, or
+// repeat and wrap spans of the input, which is how nesting and backtracking
+// get deep enough to show super-linear behavior. The rest are the byte-level
+// mutations of libFuzzer, to reach the error paths in between.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <utility>
+
+extern "C" size_t LLVMFuzzerMutate(std::uint8_t* data, size_t size, size_t maxSize);
+
+namespace
+{
+
+// Generates text for the productions of guu.ebnf, not necessarily well typed
+class Grammar
+{
+public:
+    explicit Grammar(std::minstd_rand& rng) : rng_(rng)
+    {
+    }
+
+    // program ::= (fn eol*)+
+    std::string program()
+    {
+        std::string s = fn();
+        while(chance(30))
+        {
+            s += "\n" + fn();
+        }
+        return s;
+    }
+
+    // fn ::= "fn" SPACE spaces fn_name fn_args fn_ret block
+    std::string fn()
+    {
+        std::string s = "fn " + id() + "(";
+        for(int i = 0, n = range(0, 3); i < n; ++i)
+        {
+            s += (i ? ", " : "") + id() + ": " + typeId();
+        }
+        return s + ") -> " + typeId() + " " + block(0) + "\n";
+    }
+
+    // block ::= o_brace statement* c_brace
+    std::string block(int depth)
+    {
+        std::string s = "{\n";
+        for(int i = 0, n = range(0, 3); i < n; ++i)
+        {
+            s += spaces() + statement(depth + 1);
+        }
+        return s + "}";
+    }
+
+    // statement ::= eol | var_decl | return_stmt | if_stmt | while_stmt | parallel_for | assign | call_stmt
+    std::string statement(int depth)
+    {
+        switch(range(0, depth > 3 ? 3 : 8))
+        {
+            case 0: return "\n";
+            case 1: return typeId() + " " + id() + (chance(70) ? " = " + expr(depth) : "") + ";\n";
+            case 2: return id() + (chance(20) ? "[" + expr(depth) + "]" : "") + " = " + expr(depth) + ";\n";
+            case 3: return id() + call(depth) + ";\n";
+            case 4: return "return " + expr(depth) + ";\n";
+            case 5: {
+                std::string s = "if " + expr(depth) + " " + block(depth);
+                while(chance(30))
+                {
+                    s += " else if " + expr(depth) + " " + block(depth);
+                }
+                return s + (chance(50) ? " else " + block(depth) : "") + "\n";
+            }
+            case 6: return "while " + expr(depth) + " " + block(depth) + "\n";
+            case 7:
+                return "parallel for " + id() + " in " + expr(depth) + ".." + expr(depth) + " " + block(depth) + "\n";
+            default: return "spawn " + id() + call(depth) + ";\n";
+        }
+    }
+
+    // expr ::= sum (spaces (LT | GT | LE | GE | EQEQ | NE) sum)?, down to primary
+    std::string expr(int depth)
+    {
+        static const char* const ops[] = {" + ", " - ", " * ", " / ", " % ", " < ", " > ", " <= ", " >= ", " == ",
+                                          " != "};
+
+        std::string s = primary(depth);
+        while(depth < 6 && chance(40))
+        {
+            s += ops[range(0, sizeof(ops) / sizeof(*ops) - 1)] + primary(depth);
+        }
+        return s;
+    }
+
+    // primary ::= const_decl | spawn | id call | id index* | o_paren expr c_paren, with unary
+    std::string primary(int depth)
+    {
+        switch(range(0, depth > 5 ? 2 : 7))
+        {
+            case 0: return std::to_string(range(0, 1000));
+            case 1: return id();
+            case 2: return stringLiteral();
+            case 3: return "(" + expr(depth + 1) + ")";
+            case 4: return "-" + primary(depth + 1);
+            case 5: return id() + call(depth + 1);
+            case 6: return id() + "[" + expr(depth + 1) + "]";
+            default: return constArray(depth + 1);
+        }
+    }
+
+    // call ::= O_PAREN (spaces | expr (comma expr)*) c_paren
+    std::string call(int depth)
+    {
+        std::string s = "(";
+        for(int i = 0, n = range(0, 3); i < n; ++i)
+        {
+            s += (i ? ", " : "") + expr(depth + 1);
+        }
+        return s + ")";
+    }
+
+    // const_array ::= o_brack const_decl (comma const_decl)* comma? c_brack
+    std::string constArray(int depth)
+    {
+        std::string s = "[";
+        for(int i = 0, n = range(1, 4); i < n; ++i)
+        {
+            s += (i ? ", " : "") + (depth < 6 && chance(20) ? constArray(depth + 1) : std::to_string(range(0, 9)));
+        }
+        return s + (chance(20) ? ",]" : "]");
+    }
+
+    // type_id ::= id (o_brack (int|id) c_brack)?
+    std::string typeId()
+    {
+        static const char* const types[] = {"int", "str", "int[3]", "str[N]", "int[n]"};
+        return types[range(0, sizeof(types) / sizeof(*types) - 1)];
+    }
+
+    // Mostly names the parser and the builtins look at
+    std::string id()
+    {
+        static const char* const ids[] = {"x", "y", "n", "main", "fib", "print", "len", "int", "str", "if", "else",
+                                          "while", "return", "parallel", "for", "in", "spawn", "fn", "a_1"};
+        return ids[range(0, sizeof(ids) / sizeof(*ids) - 1)];
+    }
+
+    // STRING_LITERAL with escapes, one ending in an escaped backslash and one
+    // spanning lines among them
+    std::string stringLiteral()
+    {
+        static const char* const bodies[] = {"", "text", "\\n\\t\\r", "\\\"q\\'", "\\\\", "a\\\\", "\\", "two\nlines"};
+        char quote = chance(50) ? '"' : '\'';
+        return quote + std::string(bodies[range(0, sizeof(bodies) / sizeof(*bodies) - 1)]) + quote;
+    }
+
+    // SPACE* indenting a statement
+    std::string spaces()
+    {
+        return std::string(range(0, 8), ' ');
+    }
+
+    int range(int lo, int hi)
+    {
+        return std::uniform_int_distribution<int>(lo, hi)(rng_);
+    }
+
+    bool chance(int percent)
+    {
+        return range(0, 99) < percent;
+    }
+
+private:
+    std::minstd_rand& rng_;
+};
+
+bool isIdChar(char c)
+{
+    return c == '_' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// A span of `text` starting at a random position, empty for empty text
+std::pair<size_t, size_t> randomSpan(Grammar& g, const std::string& text)
+{
+    if(text.empty())
+        return {0, 0};
+
+    size_t begin = static_cast<size_t>(g.range(0, static_cast<int>(text.size()) - 1));
+    size_t end   = begin + static_cast<size_t>(g.range(1, std::min<int>(64, static_cast<int>(text.size() - begin))));
+    return {begin, end};
+}
+
+}
+
+extern "C" size_t LLVMFuzzerCustomMutator(std::uint8_t* data, size_t size, size_t maxSize, unsigned int seed)
+{
+    std::minstd_rand rng(seed);
+    Grammar g(rng);
+
+    std::string text(reinterpret_cast<const char*>(data), size);
+    switch(g.range(0, 7))
+    {
+        case 0: {
+            // A statement at the start of a line
+            size_t line = text.find('\n', static_cast<size_t>(g.range(0, static_cast<int>(text.size()))));
+            text.insert(line == std::string::npos ? text.size() : line + 1, g.statement(1));
+        }
+        break;
+
+        case 1: {
+            // An identifier or number replaced by an expression
+            size_t begin = text.empty() ? 0 : static_cast<size_t>(g.range(0, static_cast<int>(text.size()) - 1));
+            size_t end   = begin;
+            while(end < text.size() && isIdChar(text[end]))
+            {
+                ++end;
+            }
+            text.replace(begin, end - begin, g.expr(0));
+        }
+        break;
+
+        case 2: {
+            // A span repeated, the shape of inputs that nest or chain deeply
+            auto [begin, end] = randomSpan(g, text);
+            std::string span  = text.substr(begin, end - begin);
+            for(int i = 0, n = g.range(1, 64); i < n; ++i)
+            {
+                text.insert(end, span);
+            }
+        }
+        break;
+
+        case 3: {
+            static const char* const wrappers[][2] = {{"(", ")"}, {"[", "]"}, {"-(", ")"}, {"if x {\n", "\n}\n"}};
+
+            auto [begin, end] = randomSpan(g, text);
+            const auto& w     = wrappers[g.range(0, 3)];
+            text.insert(end, w[1]);
+            text.insert(begin, w[0]);
+        }
+        break;
+
+        case 4: text = g.program(); break;
+
+        default: return LLVMFuzzerMutate(data, size, maxSize);
+    }
+
+    if(text.size() > maxSize)
+        return LLVMFuzzerMutate(data, size, maxSize);
+
+    std::memcpy(data, text.data(), text.size());
+    return text.size();
+}
@@ -0,0 +1,56 @@
+// Runs a fuzz target on files without libFuzzer, so every build checks the
+// regression corpus. Fails the way the fuzzer would, by aborting.
+//
+// Usage: fuzz_<target>_replay FILE|DIR...
+
+#include "fuzz.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+int main(int argc, char** argv)
+{
+    std::vector<fs::path> inputs;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!fs::is_directory(argv[i]))
+        {
+            inputs.emplace_back(argv[i]);
+            continue;
+        }
+
+        for(const auto& entry: fs::directory_iterator(argv[i]))
+        {
+            if(entry.is_regular_file())
+                inputs.push_back(entry.path());
+        }
+    }
+
+    // The same order everywhere, for reading the output
+    std::sort(inputs.begin(), inputs.end());
+
+    for(const auto& path: inputs)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if(!in)
+        {
+            std::cerr << "Cannot open '" << path.string() << "'" << std::endl;
+            return 1;
+        }
+
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+        std::cout << path.filename().string() << std::endl;
+        LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(data.data()), data.size());
+    }
+
+    std::cout << inputs.size() << " inputs" << std::endl;
+    return inputs.empty() ? 1 : 0;
+}
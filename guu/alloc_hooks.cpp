@@ -0,0 +1,168 @@
+// Allocation hooks: every heap allocation of the process goes through here.
+// Not part of guu_engine, whose embedders keep their own allocator; the Guu
+// driver and perf_regression link them as guu_alloc_hooks.
+
+#include "stats.h"
+
+#ifdef GUU_ENABLE_STATS
+
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+
+void* countedAlloc(std::size_t size)
+{
+    Guu::Stats::count(Guu::Stats::counters().allocations_);
+    Guu::Stats::count(Guu::Stats::counters().bytesAllocated_, size);
+
+    if(void* p = std::malloc(size ? size : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* countedAlignedAlloc(std::size_t size, std::align_val_t align)
+{
+    Guu::Stats::count(Guu::Stats::counters().allocations_);
+    Guu::Stats::count(Guu::Stats::counters().bytesAllocated_, size);
+
+    // aligned_alloc wants the size to be a multiple of the alignment
+    auto alignment = static_cast<std::size_t>(align);
+    auto rounded   = ((size ? size : 1) + alignment - 1) / alignment * alignment;
+    if(void* p = std::aligned_alloc(alignment, rounded))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+    return countedAlloc(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return countedAlloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    return countedAlignedAlloc(size, align);
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+    return countedAlignedAlloc(size, align);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+// The nothrow forms too, or the library's own would hand memory to the delete above
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return countedAlloc(size);
+    } catch(const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return countedAlloc(size);
+    } catch(const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return countedAlignedAlloc(size, align);
+    } catch(const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+    try
+    {
+        return countedAlignedAlloc(size, align);
+    } catch(const std::bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "token.h"
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+
+namespace Guu::Arith
+{
+
+// Guu ints are 64-bit two's complement and wrap on overflow.
+// Division truncates toward zero, INT64_MIN / -1 wraps to INT64_MIN.
+
+inline std::int64_t wrap(std::uint64_t v)
+{
+    return static_cast<std::int64_t>(v);
+}
+
+inline std::int64_t add(std::int64_t a, std::int64_t b)
+{
+    return wrap(static_cast<std::uint64_t>(a) + static_cast<std::uint64_t>(b));
+}
+
+inline std::int64_t sub(std::int64_t a, std::int64_t b)
+{
+    return wrap(static_cast<std::uint64_t>(a) - static_cast<std::uint64_t>(b));
+}
+
+inline std::int64_t mul(std::int64_t a, std::int64_t b)
+{
+    return wrap(static_cast<std::uint64_t>(a) * static_cast<std::uint64_t>(b));
+}
+
+inline std::int64_t neg(std::int64_t a)
+{
+    return wrap(0 - static_cast<std::uint64_t>(a));
+}
+
+// Callers must check b != 0
+inline std::int64_t div(std::int64_t a, std::int64_t b)
+{
+    if(b == -1)
+        return neg(a);
+
+    return a / b;
+}
+
+// Callers must check b != 0
+inline std::int64_t mod(std::int64_t a, std::int64_t b)
+{
+    if(b == -1)
+        return 0;
+
+    return a % b;
+}
+
+// Comparisons yield 1 for true and 0 for false
+inline std::int64_t fromBool(bool b)
+{
+    return b ? 1 : 0;
+}
+
+// Result of a binary operator, or nullopt if it would fail at runtime
+inline std::optional<std::int64_t> apply(TokenType op, std::int64_t a, std::int64_t b)
+{
+    switch(op)
+    {
+        case TokenType::PLUS: return add(a, b);
+        case TokenType::MINUS: return sub(a, b);
+        case TokenType::STAR: return mul(a, b);
+        case TokenType::SLASH: return b == 0 ? std::nullopt : std::optional(div(a, b));
+        case TokenType::PERCENT: return b == 0 ? std::nullopt : std::optional(mod(a, b));
+        case TokenType::LT: return fromBool(a < b);
+        case TokenType::GT: return fromBool(a > b);
+        case TokenType::LE: return fromBool(a <= b);
+        case TokenType::GE: return fromBool(a >= b);
+        case TokenType::EQEQ: return fromBool(a == b);
+        case TokenType::NE: return fromBool(a != b);
+
+        default: return std::nullopt;
+    }
+}
+
+}
@@ -0,0 +1,110 @@
+#include "array_ops.h"
+#include "arith.h"
+
+#include <optional>
+
+namespace Guu::ArrayOps
+{
+
+namespace
+{
+
+std::optional<Kernels::Op> kernelOp(TokenType op)
+{
+    switch(op)
+    {
+        case TokenType::PLUS: return Kernels::Op::Add;
+        case TokenType::MINUS: return Kernels::Op::Sub;
+        case TokenType::STAR: return Kernels::Op::Mul;
+        case TokenType::LT: return Kernels::Op::Lt;
+        case TokenType::LE: return Kernels::Op::Le;
+        case TokenType::GT: return Kernels::Op::Gt;
+        case TokenType::GE: return Kernels::Op::Ge;
+        case TokenType::EQEQ: return Kernels::Op::Eq;
+        case TokenType::NE: return Kernels::Op::Ne;
+
+        // There is no vector division, see apply()
+        default: return std::nullopt;
+    }
+}
+
+// `s op a[i]` as `a[i] op' s`
+Kernels::Op swapped(Kernels::Op op)
+{
+    switch(op)
+    {
+        case Kernels::Op::Sub: return Kernels::Op::RSub;
+        case Kernels::Op::RSub: return Kernels::Op::Sub;
+        case Kernels::Op::Lt: return Kernels::Op::Gt;
+        case Kernels::Op::Le: return Kernels::Op::Ge;
+        case Kernels::Op::Gt: return Kernels::Op::Lt;
+        case Kernels::Op::Ge: return Kernels::Op::Le;
+
+        default: return op;
+    }
+}
+
+ArrayRef intArray(size_t size, Heap* region)
+{
+    auto result = makeArray(ElemKind::Int, region);
+    result->ints_.resize(size);
+    return result;
+}
+
+}
+
+Value apply(TokenType op, const Value& a, const Value& b, Heap* region)
+{
+    // Data of an empty array may be null, so the tags tell arrays from ints
+    const std::int64_t* lhs = a.isArray() ? a.asArray().ints_.data() : nullptr;
+    const std::int64_t* rhs = b.isArray() ? b.asArray().ints_.data() : nullptr;
+
+    size_t n = a.isArray() ? a.asArray().size() : b.asArray().size();
+    if(a.isArray() && b.isArray() && b.asArray().size() != n)
+        throw RuntimeError("Arrays of different sizes " + std::to_string(n) + " and "
+                           + std::to_string(b.asArray().size()));
+
+    auto result       = intArray(n, region);
+    std::int64_t* dst = result->ints_.data();
+
+    if(auto k = kernelOp(op))
+    {
+        if(a.isArray() && b.isArray())
+        {
+            Kernels::apply(*k, dst, lhs, rhs, n);
+        }
+        else if(a.isArray())
+        {
+            Kernels::apply(*k, dst, lhs, b.asInt(), n);
+        }
+        else
+        {
+            Kernels::apply(swapped(*k), dst, rhs, a.asInt(), n);
+        }
+
+        return result;
+    }
+
+    // Division and modulo stay scalar, x86 has no vector integer division
+    for(size_t i = 0; i < n; ++i)
+    {
+        auto v = Arith::apply(op, lhs ? lhs[i] : a.asInt(), rhs ? rhs[i] : b.asInt());
+        if(!v)
+            throw RuntimeError("Division by zero");
+
+        dst[i] = *v;
+    }
+
+    return result;
+}
+
+Value neg(const Value& a, Heap* region)
+{
+    const auto& arr = a.asArray();
+
+    auto result = intArray(arr.size(), region);
+    Kernels::apply(Kernels::Op::RSub, result->ints_.data(), arr.ints_.data(), std::int64_t{0}, arr.size());
+    return result;
+}
+
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "token.h"
+#include "value.h"
+
+namespace Guu::ArrayOps
+{
+
+// Arithmetic and comparison operators of int arrays apply elementwise and
+// yield a new array. An int on either side stands for an array filled with
+// it. Each operator is one call to a vector kernel; errors are RuntimeErrors
+// without a location, which the engines add. Results go to `region` if given.
+Value apply(TokenType op, const Value& a, const Value& b, Heap* region = nullptr);
+
+Value neg(const Value& a, Heap* region = nullptr);
+
+}
@@ -31,6 +31,11 @@ void Printer::visit(FnDef& proc)
     {
         visit(*arg);
     }
+
+    for(auto& st: proc.statements_)
+    {
+        visit(*st);
+    }
     subIndent();
 }
 
@@ -39,7 +44,70 @@ void Printer::visit(Variable& proc)
     indent();
     os() << "(Variable id = '" << proc.id_ << "', typeId = '";
     visit(*proc.typeId_);
-    os() << "')" << std::endl;
+    os() << "'";
+    if(proc.slot_ != INVALID_SLOT)
+    {
+        os() << ", slot = " << proc.slot_;
+    }
+    os() << ")" << std::endl;
+
+    if(proc.init_)
+    {
+        addIndent();
+        visit(*proc.init_);
+        subIndent();
+    }
+}
+
+void Printer::visit(VarRef& ref)
+{
+    indent();
+    os() << "(VarRef id = '" << ref.id_ << "'";
+    if(ref.slot_ != INVALID_SLOT)
+    {
+        os() << ", slot = " << ref.slot_;
+    }
+    os() << ")" << std::endl;
+}
+
+void Printer::visit(Const& c)
+{
+    indent();
+    if(c.isNum())
+    {
+        os() << "(Const num = " << c.num_ << ")" << std::endl;
+    }
+    else
+    {
+        // Escaped back the way the lexer reads it, so every node stays on one line
+        os() << "(Const str = '";
+        for(char ch: c.str_)
+        {
+            switch(ch)
+            {
+                case '\n': os() << "\\n"; break;
+                case '\t': os() << "\\t"; break;
+                case '\r': os() << "\\r"; break;
+                case '\\': os() << "\\\\"; break;
+                case '\'': os() << "\\'"; break;
+                default: os() << ch;
+            }
+        }
+        os() << "')" << std::endl;
+    }
+}
+
+void Printer::visit(ConstArray& arr)
+{
+    indent();
+    os() << "(ConstArray size = " << arr.elements_.size() << ")" << std::endl;
+
+    addIndent();
+    for(auto& e: arr.elements_)
+    {
+        visit(*e);
+    }
+    subIndent();
 }
 
 void Printer::visit(TypeId& typeId)
@@ -51,16 +119,132 @@ void Printer::visit(TypeId& typeId)
     }
 }
 
-void Printer::visit(UnaryOp&)
+void Printer::visit(UnaryOp& op)
 {
     indent();
-    os() << "(UnaryOp)" << std::endl;
+    os() << "(UnaryOp op = " << op.opType_ << ")" << std::endl;
+
+    addIndent();
+    visit(*op.op_);
+    subIndent();
 }
 
-void Printer::visit(BinOp&)
+void Printer::visit(BinOp& op)
 {
     indent();
-    os() << "(BinOp)" << std::endl;
+    os() << "(BinOp op = " << op.opType_ << ")" << std::endl;
+
+    addIndent();
+    visit(*op.op1_);
+    visit(*op.op2_);
+    subIndent();
+}
+
+void Printer::visit(Call& call)
+{
+    indent();
+    os() << "(Call id = '" << call.id_ << "'" << (call.tail_ ? ", tail" : "") << ")" << std::endl;
+
+    addIndent();
+    for(auto& a: call.args_)
+    {
+        visit(*a);
+    }
+    subIndent();
+}
+
+void Printer::visit(If& stmt)
+{
+    indent();
+    os() << "(If)" << std::endl;
+
+    addIndent();
+    visit(*stmt.cond_);
+    printBlock("then", stmt.then_);
+    if(!stmt.else_.empty())
+    {
+        printBlock("else", stmt.else_);
+    }
+    subIndent();
+}
+
+void Printer::visit(While& stmt)
+{
+    indent();
+    os() << "(While)" << std::endl;
+
+    addIndent();
+    visit(*stmt.cond_);
+    printBlock("body", stmt.body_);
+    subIndent();
+}
+
+void Printer::visit(ParallelFor& stmt)
+{
+    indent();
+    os() << "(ParallelFor)" << std::endl;
+
+    addIndent();
+    visit(*stmt.var_);
+    visit(*stmt.from_);
+    visit(*stmt.to_);
+    printBlock("body", stmt.body_);
+    subIndent();
+}
+
+void Printer::visit(Spawn& spawn)
+{
+    indent();
+    os() << "(Spawn)" << std::endl;
+
+    addIndent();
+    visit(*spawn.call_);
+    subIndent();
+}
+
+void Printer::visit(Assign& stmt)
+{
+    indent();
+    os() << "(Assign)" << std::endl;
+
+    addIndent();
+    visit(*stmt.target_);
+    visit(*stmt.value_);
+    subIndent();
+}
+
+void Printer::visit(Index& idx)
+{
+    indent();
+    os() << "(Index)" << std::endl;
+
+    addIndent();
+    visit(*idx.array_);
+    visit(*idx.index_);
+    subIndent();
+}
+
+void Printer::printBlock(const char* name, NodeVec& block)
+{
+    indent();
+    os() << "(" << name << ")" << std::endl;
+
+    addIndent();
+    for(auto& st: block)
+    {
+        visit(*st);
+    }
+    subIndent();
+}
+
+void Printer::visit(Return& ret)
+{
+    indent();
+    os() << "(Return)" << std::endl;
+
+    addIndent();
+    visit(*ret.value_);
+    subIndent();
 }
 
 void Printer::indent()
@@ -1,26 +1,41 @@
 #pragma once
 
 #include "token.h"
+#include "types.h"
+#include "stats.h"
+#include "builtins.h"
+#include "value.h"
 
 #include <vector>
 #include <string>
 #include <iosfwd>
 #include <variant>
-#include <vector>
 #include <memory>
 #include <optional>
+#include <cstdint>
 
 #include "../util/visitor.h"
 
 namespace Guu::AST
 {
 
-#define GUU_NODE_TYPE_VALUES(_)        \
-    _(Root, "Root node")               \
-    _(BinOp, "Binary operations")      \
-    _(UnaryOp, "Unary operations")     \
-    _(FnDef, "Function definition")    \
-    _(Variable, "Variable definition") \
+#define GUU_NODE_TYPE_VALUES(_)         \
+    _(Root, "Root node")                \
+    _(BinOp, "Binary operations")       \
+    _(UnaryOp, "Unary operations")      \
+    _(FnDef, "Function definition")     \
+    _(Variable, "Variable definition")  \
+    _(VarRef, "Variable reference")     \
+    _(Call, "Function call")            \
+    _(Return, "Return statement")       \
+    _(If, "If statement")               \
+    _(While, "While loop")              \
+    _(ParallelFor, "Parallel for loop") \
+    _(Spawn, "Task spawn")              \
+    _(Assign, "Assignment")             \
+    _(Index, "Array element access")    \
+    _(Const, "Constant value")          \
+    _(ConstArray, "Constant array")     \
     _(TypeId, "Type Declaration")
 
 // clang-format off
@@ -38,9 +53,19 @@ struct Node
     using Ptr = std::unique_ptr<Node>;
 
     NodeType type_;
+    size_t line_ = 0;
+
+    // Filled in by the Resolver
+    TypeHandle resolvedType_ = INVALID_TYPE;
+
+    // Filled in by EscapeAnalysis. On an expression or Variable that allocates:
+    // the object lives in the region of the innermost loop body or function.
+    // On a While or FnDef: its body opens such a region.
+    bool region_ = false;
 
     Node(NodeType nt) : type_(nt)
     {
+        GUU_STATS_COUNT_NODE(nt);
     }
 
     Node(const Node&)            = delete;
@@ -64,20 +89,23 @@ struct Root : Node
 
 struct BinOp : Node
 {
-    BinOp() : Node(NodeType::BinOp)
+    BinOp(TokenType opType, Node::Ptr op1, Node::Ptr op2)
+        : Node(NodeType::BinOp), opType_(opType), op1_(std::move(op1)), op2_(std::move(op2))
     {
     }
 
+    TokenType opType_;
     Node::Ptr op1_;
     Node::Ptr op2_;
 };
 
 struct UnaryOp : Node
 {
-    UnaryOp() : Node(NodeType::UnaryOp)
+    UnaryOp(TokenType opType, Node::Ptr op) : Node(NodeType::UnaryOp), opType_(opType), op_(std::move(op))
     {
     }
 
+    TokenType opType_;
     Node::Ptr op_;
 };
 
@@ -90,6 +118,9 @@ struct TypeId : Node
     std::string tname_;
     bool isArray_;
     std::string arraySize_;
+
+    // Filled in by the Resolver when the size of a local array names an int variable
+    std::uint32_t sizeSlot_ = static_cast<std::uint32_t>(-1);
 };
 
 struct FnDef : Node
@@ -104,18 +135,190 @@ struct FnDef : Node
     Node::Ptr retTypeId_;
     NodeVec params_;
     NodeVec statements_;
+
+    // Filled in by the Resolver
+    std::uint32_t index_     = 0;
+    std::uint32_t frameSize_ = 0;
+
+    // A task variable is declared somewhere in the body
+    bool spawns_ = false;
 };
 
+using Slot = std::uint32_t;
+
+constexpr Slot INVALID_SLOT = static_cast<Slot>(-1);
+
+// Function parameter or local variable declaration
 struct Variable : Node
 {
-    Variable(std::string id, Node::Ptr typeId)
-        : Node(NodeType::Variable), id_(std::move(id)), typeId_(std::move(typeId))
+    Variable(std::string id, Node::Ptr typeId, Node::Ptr init = nullptr)
+        : Node(NodeType::Variable), id_(std::move(id)), typeId_(std::move(typeId)), init_(std::move(init))
     {
     }
 
     std::string id_;
     Node::Ptr typeId_;
-    std::optional<std::string> value;
+    Node::Ptr init_;
+
+    // Filled in by the Resolver
+    Slot slot_     = INVALID_SLOT;
+    bool assigned_ = false;
+};
+
+struct VarRef : Node
+{
+    VarRef(std::string id) : Node(NodeType::VarRef), id_(std::move(id))
+    {
+    }
+
+    std::string id_;
+
+    // Filled in by the Resolver
+    Slot slot_            = INVALID_SLOT;
+    const Variable* decl_ = nullptr;
+};
+
+struct Call : Node
+{
+    Call(std::string id, NodeVec args) : Node(NodeType::Call), id_(std::move(id)), args_(std::move(args))
+    {
+    }
+
+    std::string id_;
+    NodeVec args_;
+
+    // Filled in by the Resolver
+    std::uint32_t fnIndex_ = 0;
+    Builtin builtin_       = Builtin::None;
+
+    // Filled in by TailCalls: the value of a return, run in place of the caller
+    bool tail_ = false;
+};
+
+struct Return : Node
+{
+    Return(Node::Ptr value) : Node(NodeType::Return), value_(std::move(value))
+    {
+    }
+
+    Node::Ptr value_;
+};
+
+struct If : Node
+{
+    If(Node::Ptr cond, NodeVec then, NodeVec otherwise)
+        : Node(NodeType::If), cond_(std::move(cond)), then_(std::move(then)), else_(std::move(otherwise))
+    {
+    }
+
+    Node::Ptr cond_;
+    NodeVec then_;
+    NodeVec else_;
+};
+
+struct While : Node
+{
+    While(Node::Ptr cond, NodeVec body) : Node(NodeType::While), cond_(std::move(cond)), body_(std::move(body))
+    {
+    }
+
+    Node::Ptr cond_;
+    NodeVec body_;
+
+    // Filled in by the Resolver, the locals of the body take this slot and the ones above
+    std::uint32_t bodySlot_ = 0;
+};
+
+// `parallel for var_ in from_..to_ { body_ }`: the iterations may run
+// concurrently and in any order. The body can't assign the variables of the
+// enclosing scopes, including var_, nor return.
+struct ParallelFor : Node
+{
+    ParallelFor(Node::Ptr var, Node::Ptr from, Node::Ptr to, NodeVec body)
+        : Node(NodeType::ParallelFor)
+        , var_(std::move(var))
+        , from_(std::move(from))
+        , to_(std::move(to))
+        , body_(std::move(body))
+    {
+    }
+
+    // The int Variable of the index
+    Node::Ptr var_;
+    Node::Ptr from_;
+    Node::Ptr to_;
+    NodeVec body_;
+
+    // Filled in by the Resolver, the index takes the slot of var_, the end of the
+    // range the next one and the locals of the body the ones from here on
+    std::uint32_t bodySlot_ = 0;
+};
+
+// `spawn f(args)`: runs a call of a user function as a task, only allowed as the
+// initializer of a `task` variable. `join(t)` waits for the result, leaving the
+// scope of the variable waits as well.
+struct Spawn : Node
+{
+    explicit Spawn(Node::Ptr call) : Node(NodeType::Spawn), call_(std::move(call))
+    {
+    }
+
+    Node::Ptr call_;
+};
+
+// `target_` is a VarRef or an Index
+struct Assign : Node
+{
+    Assign(Node::Ptr target, Node::Ptr value)
+        : Node(NodeType::Assign), target_(std::move(target)), value_(std::move(value))
+    {
+    }
+
+    Node::Ptr target_;
+    Node::Ptr value_;
+};
+
+struct Index : Node
+{
+    Index(Node::Ptr array, Node::Ptr index) : Node(NodeType::Index), array_(std::move(array)), index_(std::move(index))
+    {
+    }
+
+    Node::Ptr array_;
+    Node::Ptr index_;
+};
+
+struct Const : Node
+{
+    Const(std::int64_t num) : Node(NodeType::Const), kind_(TokenType::NUM), num_(num)
+    {
+    }
+
+    Const(std::string str, Value value)
+        : Node(NodeType::Const), kind_(TokenType::STRING_LITERAL), str_(std::move(str)), value_(std::move(value))
+    {
+    }
+
+    bool isNum() const
+    {
+        return kind_ == TokenType::NUM;
+    }
+
+    TokenType kind_;
+    std::int64_t num_ = 0;
+    std::string str_;
+
+    // Runtime string of str_, the Parser interns it so equal literals share one
+    Value value_;
+};
+
+struct ConstArray : Node
+{
+    ConstArray(NodeVec elements) : Node(NodeType::ConstArray), elements_(std::move(elements))
+    {
+    }
+
+    NodeVec elements_;
 };
 
 namespace detail
@@ -154,6 +357,94 @@ struct Visitor : public detail::BaseVisitor
         }
     }
 
+    void visit(FnDef& fn) override
+    {
+        visit(*fn.retTypeId_);
+        visitAll(fn.params_);
+        visitAll(fn.statements_);
+    }
+
+    void visit(Variable& var) override
+    {
+        visit(*var.typeId_);
+        if(var.init_)
+        {
+            visit(*var.init_);
+        }
+    }
+
+    void visit(BinOp& op) override
+    {
+        visit(*op.op1_);
+        visit(*op.op2_);
+    }
+
+    void visit(UnaryOp& op) override
+    {
+        visit(*op.op_);
+    }
+
+    void visit(Call& call) override
+    {
+        visitAll(call.args_);
+    }
+
+    void visit(Return& ret) override
+    {
+        visit(*ret.value_);
+    }
+
+    void visit(ConstArray& arr) override
+    {
+        visitAll(arr.elements_);
+    }
+
+    void visit(If& stmt) override
+    {
+        visit(*stmt.cond_);
+        visitAll(stmt.then_);
+        visitAll(stmt.else_);
+    }
+
+    void visit(While& stmt) override
+    {
+        visit(*stmt.cond_);
+        visitAll(stmt.body_);
+    }
+
+    void visit(ParallelFor& stmt) override
+    {
+        visit(*stmt.from_);
+        visit(*stmt.to_);
+        visit(*stmt.var_);
+        visitAll(stmt.body_);
+    }
+
+    void visit(Spawn& spawn) override
+    {
+        visit(*spawn.call_);
+    }
+
+    void visit(Assign& stmt) override
+    {
+        visit(*stmt.target_);
+        visit(*stmt.value_);
+    }
+
+    void visit(Index& idx) override
+    {
+        visit(*idx.array_);
+        visit(*idx.index_);
+    }
+
+    void visitAll(NodeVec& nodes)
+    {
+        for(const auto& n: nodes)
+        {
+            visit(*n);
+        }
+    }
+
     virtual ~Visitor() = default;
 };
 
@@ -190,6 +481,7 @@ private:
 
 private:
     void indent();
+    void printBlock(const char* name, NodeVec& block);
 
     void addIndent()
     {
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace Guu
+{
+
+// The array builtins run on the vector kernels, see kernels.h. checkpoint()
+// is where the VM saves an image if asked to, see snapshot.h.
+#define GUU_BUILTIN_VALUES(_)                                            \
+    _(Print, "print", 1, "print(int|str|T[N]) -> int")                   \
+    _(Len, "len", 1, "len(str|T[N]) -> int")                             \
+    _(Sum, "sum", 1, "sum(int[N]) -> int")                               \
+    _(Min, "min", 1, "min(int[N]) -> int")                               \
+    _(Max, "max", 1, "max(int[N]) -> int")                               \
+    _(Find, "find", 2, "find(int[N], int) -> int")                       \
+    _(Filter, "filter", 2, "filter(int[N] values, int[N] mask) -> int[N]") \
+    _(Copy, "copy", 1, "copy(T[N]) -> T[N]")                             \
+    _(Join, "join", 1, "join(task<T>) -> T")                             \
+    _(Checkpoint, "checkpoint", 0, "checkpoint() -> int")
+
+// clang-format off
+enum class Builtin : std::uint8_t
+{
+    None,
+    #define MAKE_ENUM(name, _1, _2, _3) name,
+    GUU_BUILTIN_VALUES(MAKE_ENUM)
+    #undef MAKE_ENUM
+};
+// clang-format on
+
+// Builtins take at most this many arguments
+constexpr size_t MAX_BUILTIN_ARGS = 2;
+
+inline Builtin findBuiltin(std::string_view name)
+{
+    // clang-format off
+    #define CHECK_NAME(builtin, id, _1, _2) if(name == id) return Builtin::builtin;
+    GUU_BUILTIN_VALUES(CHECK_NAME)
+    #undef CHECK_NAME
+    // clang-format on
+
+    return Builtin::None;
+}
+
+inline size_t builtinArity(Builtin builtin)
+{
+    switch(builtin)
+    {
+        // clang-format off
+        #define ARITY(builtin, _1, arity, _2) case Builtin::builtin: return arity;
+        GUU_BUILTIN_VALUES(ARITY)
+        #undef ARITY
+        // clang-format on
+
+        case Builtin::None: break;
+    }
+
+    return 0;
+}
+
+}
@@ -0,0 +1,130 @@
+#include "bytecode.h"
+#include "token.h"
+
+#include <iomanip>
+#include <iostream>
+
+namespace Guu::Bytecode
+{
+
+std::ostream& operator<<(std::ostream& os, Op op)
+{
+    // clang-format off
+    switch(op)
+    {
+        #define PRINT_OP_NAME(x, _) case Op::x: return os << #x;
+        GUU_OPCODE_VALUES(PRINT_OP_NAME)
+        #undef PRINT_OP_NAME
+    }
+    // clang-format on
+
+    return os;
+}
+
+namespace
+{
+
+void dumpInstr(std::ostream& os, const Module& m, size_t pc, const Instr& i)
+{
+    os << "  " << std::setw(4) << pc << "  " << std::left << std::setw(12) << i.op_ << std::right;
+
+    switch(i.op_)
+    {
+        case Op::LoadK:
+            os << "r" << i.a_ << ", k" << i.bx() << "  ; ";
+            printValue(os, m.constants_[i.bx()]);
+            break;
+
+        case Op::LoadI: os << "r" << i.a_ << ", " << i.sbx(); break;
+
+        case Op::Jmp: os << "-> " << static_cast<std::int64_t>(pc) + 1 + i.sbx(); break;
+
+        case Op::JmpIf:
+        case Op::JmpIfNot: os << "r" << i.a_ << ", -> " << static_cast<std::int64_t>(pc) + 1 + i.sbx(); break;
+
+        case Op::JmpIfLt:
+        case Op::JmpIfLe:
+        case Op::JmpIfGt:
+        case Op::JmpIfGe:
+        case Op::JmpIfEq:
+        case Op::JmpIfNe:
+            os << "r" << i.a_ << ", r" << i.b_ << ", -> " << static_cast<std::int64_t>(pc) + 1 + i.sc();
+            break;
+
+        case Op::AddI: os << "r" << i.a_ << ", r" << i.b_ << ", " << i.sc(); break;
+
+        case Op::Call:
+        case Op::TailCall:
+        case Op::Spawn: os << "r" << i.a_ << ", " << m.functions_[i.bx()].name_; break;
+
+        // Outlined bodies are named after the function they came from
+        case Op::ParFor: os << "r" << i.a_ << ", " << m.functions_[i.bx()].name_ << " #" << i.bx(); break;
+
+        case Op::Move:
+        case Op::Join:
+        case Op::Neg:
+        case Op::ArrayNeg: os << "r" << i.a_ << ", r" << i.b_; break;
+
+        case Op::NewArray: os << "r" << i.a_ << ", r" << i.b_ << ", " << (i.c_ ? "str" : "int"); break;
+
+        case Op::MakeArray: os << "r" << i.a_ << ", r" << i.b_ << ", " << i.c_; break;
+
+        case Op::ArrayOp:
+            os << "r" << i.a_ << ", r" << i.b_ << ", " << static_cast<TokenType>(i.x_ & ~REGION) << ", r" << i.c_;
+            break;
+
+        case Op::CallBuiltin: {
+            // clang-format off
+            const char* name = "?";
+            switch(static_cast<Builtin>(i.b_))
+            {
+                #define BUILTIN_NAME(builtin, id, _1, _2) case Builtin::builtin: name = id; break;
+                GUU_BUILTIN_VALUES(BUILTIN_NAME)
+                #undef BUILTIN_NAME
+                case Builtin::None: break;
+            }
+            // clang-format on
+            os << "r" << i.a_ << ", " << name << ", r" << i.c_;
+            if(builtinArity(static_cast<Builtin>(i.b_)) > 1)
+                os << "..r" << i.c_ + builtinArity(static_cast<Builtin>(i.b_)) - 1;
+            break;
+        }
+
+        case Op::Ret:
+        case Op::LeaveRegion: os << "r" << i.a_; break;
+
+        case Op::EnterRegion: break;
+
+        default: os << "r" << i.a_ << ", r" << i.b_ << ", r" << i.c_; break;
+    }
+
+    if(i.x_ & REGION)
+        os << "  ; region";
+
+    os << std::endl;
+}
+
+}
+
+void Module::dump(std::ostream& os) const
+{
+    for(const auto& fn: functions_)
+    {
+        os << "fn " << fn.name_ << " (params: " << fn.numParams_ << ", regs: " << fn.numRegs_ << ")" << std::endl;
+
+        for(size_t pc = 0; pc < fn.code_.size(); ++pc)
+        {
+            dumpInstr(os, *this, pc, fn.code_[pc]);
+        }
+
+        for(const auto& var: fn.locals_)
+        {
+            os << "  ; " << var.name_ << " in r" << var.reg_ << " for [" << var.startPc_ << ", " << var.endPc_ << ")"
+               << std::endl;
+        }
+
+        os << std::endl;
+    }
+}
+
+}
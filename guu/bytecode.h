@@ -0,0 +1,176 @@
+#pragma once
+
+#include "value.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace Guu::Bytecode
+{
+
+// R[x] is register x of the current frame, K[x] is constant x of the module.
+// Registers [0, numParams_) hold the arguments, locals and temporaries follow.
+//
+// The second group are superinstructions the Compiler emits instead of common
+// pairs: LoadI + Add/Sub becomes AddI, and a comparison followed by a branch on
+// its result becomes a single compare-and-jump. `sc` is c as a signed 16-bit value.
+//
+// ParFor runs a parallel for whose body the Compiler outlined into a function
+// taking the variables visible at the loop, then the bounds of a chunk.
+#define GUU_OPCODE_VALUES(_)                                              \
+    _(LoadK, "R[a] = K[bx]")                                              \
+    _(LoadI, "R[a] = sbx")                                                \
+    _(Move, "R[a] = R[b]")                                                \
+    _(Add, "R[a] = R[b] + R[c]")                                          \
+    _(Sub, "R[a] = R[b] - R[c]")                                          \
+    _(Mul, "R[a] = R[b] * R[c]")                                          \
+    _(Div, "R[a] = R[b] / R[c]")                                          \
+    _(Mod, "R[a] = R[b] % R[c]")                                          \
+    _(Neg, "R[a] = -R[b]")                                                \
+    _(Lt, "R[a] = R[b] < R[c]")                                           \
+    _(Le, "R[a] = R[b] <= R[c]")                                          \
+    _(Gt, "R[a] = R[b] > R[c]")                                           \
+    _(Ge, "R[a] = R[b] >= R[c]")                                          \
+    _(Eq, "R[a] = R[b] == R[c]")                                          \
+    _(Ne, "R[a] = R[b] != R[c]")                                          \
+    _(Jmp, "pc += sbx")                                                   \
+    _(JmpIf, "if R[a] then pc += sbx")                                    \
+    _(JmpIfNot, "if !R[a] then pc += sbx")                                \
+    _(NewArray, "R[a] = new array of R[b] elements of ElemKind c")        \
+    _(MakeArray, "R[a] = [R[b], ..., R[b + c - 1]]")                      \
+    _(GetIndex, "R[a] = R[b][R[c]]")                                      \
+    _(SetIndex, "R[a][R[b]] = R[c]")                                      \
+    _(ArrayOp, "R[a] = R[b] x R[c] per element, x a TokenType")           \
+    _(ArrayNeg, "R[a] = -R[b] per element")                               \
+    _(Concat, "R[a] = R[b] + R[c] of strings")                            \
+    _(Call, "R[a] = functions[bx](R[a], ..., R[a + numParams - 1])")     \
+    _(TailCall, "return functions[bx](R[a], ...) in place of this frame") \
+    _(CallBuiltin, "R[a] = Builtin(b)(R[c], ..., R[c + arity - 1])")      \
+    _(Ret, "return R[a]")                                                 \
+    _(EnterRegion, "open a Heap region for the REGION allocations")       \
+    _(LeaveRegion, "R[a], ..., R[numRegs - 1] = 0 and leave the region")  \
+    _(ParFor, "functions[bx](R[0..a), lo, hi) per chunk of R[a]..R[a+1]") \
+    _(Spawn, "R[a] = task running functions[bx](R[a], ...)")              \
+    _(Join, "R[a] = result of task R[b]")                                 \
+                                                                          \
+    _(AddI, "R[a] = R[b] + sc")                                           \
+    _(JmpIfLt, "if R[a] < R[b] then pc += sc")                            \
+    _(JmpIfLe, "if R[a] <= R[b] then pc += sc")                           \
+    _(JmpIfGt, "if R[a] > R[b] then pc += sc")                            \
+    _(JmpIfGe, "if R[a] >= R[b] then pc += sc")                           \
+    _(JmpIfEq, "if R[a] == R[b] then pc += sc")                           \
+    _(JmpIfNe, "if R[a] != R[b] then pc += sc")                           \
+                                                                          \
+    _(Break, "trap into the Debugger, which patched this over another op")
+
+// clang-format off
+enum class Op : std::uint8_t
+{
+    #define MAKE_ENUM(x, _) x,
+    GUU_OPCODE_VALUES(MAKE_ENUM)
+    #undef MAKE_ENUM
+};
+// clang-format on
+
+// Compare-and-jump ops have the 16-bit offset in c
+inline bool isShortJump(Op op)
+{
+    return op >= Op::JmpIfLt && op <= Op::JmpIfNe;
+}
+
+std::ostream& operator<<(std::ostream& os, Op op);
+
+using Reg = std::uint16_t;
+
+// In x of NewArray, MakeArray, ArrayOp, ArrayNeg, Concat and CallBuiltin: the
+// result goes to the innermost Heap region, see EscapeAnalysis
+constexpr std::uint8_t REGION = 0x80;
+
+constexpr size_t MAX_REGS = 0xFFFF;
+
+// Fixed 8-byte instruction. Jumps and wide operands reuse b and c as one 32-bit field,
+// the operator of ArrayOp and the REGION flag sit in the otherwise unused byte x.
+struct Instr
+{
+    Op op_;
+    std::uint8_t x_ = 0;
+    Reg a_          = 0;
+    Reg b_          = 0;
+    Reg c_          = 0;
+
+    Instr(Op op, Reg a = 0, Reg b = 0, Reg c = 0) : op_(op), a_(a), b_(b), c_(c)
+    {
+    }
+
+    static Instr wide(Op op, Reg a, std::uint32_t bx)
+    {
+        return Instr(op, a, static_cast<Reg>(bx >> 16), static_cast<Reg>(bx & 0xFFFF));
+    }
+
+    std::uint32_t bx() const
+    {
+        return (static_cast<std::uint32_t>(b_) << 16) | c_;
+    }
+
+    std::int32_t sbx() const
+    {
+        return static_cast<std::int32_t>(bx());
+    }
+
+    std::int16_t sc() const
+    {
+        return static_cast<std::int16_t>(c_);
+    }
+
+    void setSbx(std::int32_t v)
+    {
+        auto bx = static_cast<std::uint32_t>(v);
+        b_      = static_cast<Reg>(bx >> 16);
+        c_      = static_cast<Reg>(bx & 0xFFFF);
+    }
+};
+
+static_assert(sizeof(Instr) == 8, "Instructions are expected to be 8 bytes");
+
+// Variable `name_` lives in register reg_ while startPc_ <= pc < endPc_
+struct LocalVar
+{
+    std::string name_;
+    Reg reg_;
+    std::uint32_t startPc_;
+    std::uint32_t endPc_;
+};
+
+struct Function
+{
+    std::string name_;
+    std::uint32_t numParams_ = 0;
+    std::uint32_t numRegs_   = 0;
+
+    std::vector<Instr> code_;
+
+    // Source line of every instruction, for runtime errors
+    std::vector<size_t> lines_;
+
+    // For the Debugger, ordered by declaration
+    std::vector<LocalVar> locals_;
+
+    // Variable registers never holding anything but an int, ascending
+    std::vector<Reg> intRegs_;
+};
+
+struct Module
+{
+    std::vector<Function> functions_;
+    std::vector<Value> constants_;
+
+    // Index of `main` in functions_, or NO_MAIN
+    static constexpr std::uint32_t NO_MAIN = static_cast<std::uint32_t>(-1);
+    std::uint32_t main_                    = NO_MAIN;
+
+    void dump(std::ostream& os) const;
+};
+
+}
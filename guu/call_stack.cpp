@@ -0,0 +1,92 @@
+#include "call_stack.h"
+
+#include <algorithm>
+#include <type_traits>
+
+namespace Guu
+{
+
+static_assert(std::is_trivially_default_constructible_v<CallStack::Frame>,
+              "The frame array must not be touched when it is allocated");
+
+CallStack::CallStack(size_t maxDepth)
+    : maxDepth_(std::clamp<size_t>(maxDepth, 1, MAX_MAX_DEPTH))
+    , frames_(new Frame[maxDepth_])
+    , top_(frames_.get())
+    , limit_(frames_.get() + maxDepth_)
+{
+}
+
+CallStack::Frame* CallStack::enter(const Bytecode::Function& fn, std::uint32_t regions, size_t resumePc)
+{
+    if(top_ == frames_.get())
+    {
+        ensureSegment(0, fn.numRegs_);
+        useSegment(0);
+
+        *top_ = Frame{&fn, segments_[0].regs_.get(), 0, nullptr, 0, regions};
+        return top_++;
+    }
+
+    if(top_ == limit_)
+        return nullptr;
+
+    // Above all registers of the running frame, which is suspended meanwhile
+    const Frame& running = top_[-1];
+    Value* regs          = running.regs_ + running.fn_->numRegs_;
+    if(regs + fn.numRegs_ > regsEnd_)
+    {
+        ensureSegment(segment_ + 1, fn.numRegs_);
+        useSegment(segment_ + 1);
+        regs = segments_[segment_].regs_.get();
+    }
+
+    *top_ = Frame{&fn, regs, resumePc, nullptr, segment_, regions};
+    return top_++;
+}
+
+void CallStack::unwind(size_t depth)
+{
+    Frame* bottom = frames_.get() + depth;
+    while(top_ != bottom)
+    {
+        --top_;
+        std::fill(top_->regs_, top_->regs_ + top_->fn_->numRegs_, Value());
+    }
+
+    if(depth)
+        useSegment(top_[-1].segment_);
+}
+
+Value* CallStack::nextSegment(const Bytecode::Function& fn, Value* args)
+{
+    std::uint32_t next = segment_ + 1;
+    ensureSegment(next, fn.numRegs_);
+    useSegment(next);
+
+    Value* regs = segments_[next].regs_.get();
+    std::move(args, args + fn.numParams_, regs);
+    return regs;
+}
+
+void CallStack::useSegment(std::uint32_t idx)
+{
+    segment_ = idx;
+    regsEnd_ = segments_[idx].regs_.get() + segments_[idx].size_;
+}
+
+void CallStack::ensureSegment(std::uint32_t idx, size_t size)
+{
+    if(segments_.size() <= idx)
+        segments_.resize(idx + 1);
+
+    auto& seg = segments_[idx];
+    if(seg.regs_ && seg.size_ >= size)
+        return;
+
+    // Only reached for segments above the current one, nothing points into them
+    seg.size_ = std::max(SEGMENT_REGS, size);
+    seg.regs_.reset(new Value[seg.size_]);
+}
+
+}
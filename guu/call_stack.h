@@ -0,0 +1,142 @@
+#pragma once
+
+#include "bytecode.h"
+#include "value.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Guu
+{
+
+// Frames and registers of the VM. Frames live in one array allocated up front
+// for the maximum depth; the OS only backs the pages that deep recursion
+// actually touches, so the depth check is a single pointer compare.
+//
+// Registers live in segments. A callee's frame normally starts at the
+// caller's argument base, so arguments are passed in place. When it does not
+// fit into the current segment, the arguments move to the start of the next
+// one. Segments are never reallocated, so register pointers stay valid and
+// neither call nor return allocates once the stack has warmed up.
+class CallStack
+{
+public:
+    static constexpr size_t DEFAULT_MAX_DEPTH = 1 << 16;
+    static constexpr size_t SEGMENT_REGS      = 1 << 16;
+
+    // Deeper limits would reserve gigabytes for the frames up front
+    static constexpr size_t MAX_MAX_DEPTH = 1 << 24;
+
+    struct Frame
+    {
+        const Bytecode::Function* fn_;
+        Value* regs_;
+
+        // Where the caller resumes and receives the result. In entry frames
+        // result_ is null, and a nested one's returnPc_ is where the frame
+        // suspended below it resumes.
+        size_t returnPc_;
+        Value* result_;
+
+        std::uint32_t segment_;
+
+        // Heap regions opened before the frame was entered
+        std::uint32_t regions_;
+    };
+
+    // maxDepth is clamped to [1, MAX_MAX_DEPTH]
+    explicit CallStack(size_t maxDepth = DEFAULT_MAX_DEPTH);
+
+    size_t maxDepth() const
+    {
+        return maxDepth_;
+    }
+
+    size_t depth() const
+    {
+        return static_cast<size_t>(top_ - frames_.get());
+    }
+
+    // Frame 0 is the entry frame, depth() - 1 the running one
+    const Frame& frame(size_t idx) const
+    {
+        return frames_[idx];
+    }
+
+    // Returns an entry frame for `fn`, whose arguments are to be stored in
+    // regs_[0, numParams_), or nullptr if the maximum depth is reached. On an
+    // empty stack it is frame 0, otherwise a run nested in the running frame,
+    // as when a thread waiting for other work runs some in the meantime. That
+    // one is suspended before `resumePc`.
+    Frame* enter(const Bytecode::Function& fn, std::uint32_t regions, size_t resumePc);
+
+    // Returns the callee frame, or nullptr if the maximum depth is reached
+    Frame* push(const Bytecode::Function& fn, Value* args, size_t returnPc, Value* result, std::uint32_t regions)
+    {
+        if(top_ == limit_)
+            return nullptr;
+
+        Value* regs = args + fn.numRegs_ <= regsEnd_ ? args : nextSegment(fn, args);
+
+        *top_ = Frame{&fn, regs, returnPc, result, segment_, regions};
+        return top_++;
+    }
+
+    // Turns the running frame into one of `fn` for a tail call, whose
+    // arguments are already in regs_[0, numParams_). They move along if the
+    // registers of `fn` don't fit into the segment.
+    Frame* replace(const Bytecode::Function& fn)
+    {
+        Frame* frame = top_ - 1;
+        if(frame->regs_ + fn.numRegs_ > regsEnd_)
+        {
+            frame->regs_    = nextSegment(fn, frame->regs_);
+            frame->segment_ = segment_;
+        }
+
+        frame->fn_ = &fn;
+        return frame;
+    }
+
+    // Pops frames until `depth` are left and drops the values of their
+    // registers, for a run that ended in an error
+    void unwind(size_t depth);
+
+    // Returns the caller frame, or nullptr if frame 0 was popped
+    Frame* pop()
+    {
+        --top_;
+        if(top_ == frames_.get())
+            return nullptr;
+
+        Frame* caller = top_ - 1;
+        if(caller->segment_ != segment_)
+            useSegment(caller->segment_);
+
+        return caller;
+    }
+
+private:
+    struct Segment
+    {
+        std::unique_ptr<Value[]> regs_;
+        size_t size_;
+    };
+
+    Value* nextSegment(const Bytecode::Function& fn, Value* args);
+    void useSegment(std::uint32_t idx);
+    void ensureSegment(std::uint32_t idx, size_t size);
+
+private:
+    size_t maxDepth_;
+    std::unique_ptr<Frame[]> frames_;
+    Frame* top_;
+    Frame* limit_;
+
+    std::vector<Segment> segments_;
+    std::uint32_t segment_ = 0;
+    Value* regsEnd_        = nullptr;
+};
+
+}
@@ -0,0 +1,726 @@
+#include "compiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+namespace Guu
+{
+
+using namespace Bytecode;
+
+Module Compiler::compile(AST::Node& root)
+{
+    return compile(root, {});
+}
+
+Module Compiler::compile(AST::Node& root, std::vector<bool> fns)
+{
+    only_   = std::move(fns);
+    module_ = Module();
+    intConsts_.clear();
+    strConsts_.clear();
+    outlined_.clear();
+
+    visit(root);
+
+    for(auto& body: outlined_)
+    {
+        module_.functions_.push_back(std::move(body));
+    }
+    outlined_.clear();
+
+    return std::move(module_);
+}
+
+void Compiler::visit(AST::Root& root)
+{
+    // Functions keep the indices the Resolver gave them, so Call needs no fixup
+    numFns_ = root.children_.size();
+    module_.functions_.resize(numFns_);
+
+    for(auto& c: root.children_)
+    {
+        auto& fn = static_cast<AST::FnDef&>(*c);
+        if(only_.empty() || only_[fn.index_])
+        {
+            visit(fn);
+        }
+        else
+        {
+            module_.functions_[fn.index_].name_ = fn.id_;
+        }
+    }
+}
+
+void Compiler::visit(AST::FnDef& fn)
+{
+    fn_             = &module_.functions_[fn.index_];
+    fn_->name_      = fn.id_;
+    fn_->numParams_ = static_cast<std::uint32_t>(fn.params_.size());
+    fn_->numRegs_   = fn.frameSize_;
+
+    firstTemp_ = fn.frameSize_;
+    nextReg_   = firstTemp_;
+
+    if(fn.id_ == "main")
+        module_.main_ = fn.index_;
+
+    size_t firstOutlined = outlined_.size();
+
+    slotKinds_.assign(fn.frameSize_, 0);
+
+    for(auto& p: fn.params_)
+    {
+        auto& param = static_cast<AST::Variable&>(*p);
+        fn_->locals_.push_back({param.id_, static_cast<Reg>(param.slot_), 0, 0});
+        declare(param);
+    }
+
+    // Ret leaves the regions of the frame
+    if(fn.region_)
+        emit(Instr(Op::EnterRegion), fn);
+
+    block(fn.statements_);
+
+    // Falling off the end returns the zero value of the return type
+    const Type& retType = types_.get(fn.resolvedType_);
+    Reg r               = allocTemps(1, fn);
+    switch(retType.kind_)
+    {
+        case TypeKind::Int: loadInt(r, 0, fn); break;
+        case TypeKind::Str: emit(Instr::wide(Op::LoadK, r, constant(Value(std::string()))), fn); break;
+        case TypeKind::Array: {
+            Reg size = allocTemps(1, fn);
+            loadInt(size, retType.size_ == Type::DYNAMIC_SIZE ? 0 : retType.size_, fn);
+            emit(Instr(Op::NewArray, r, size, static_cast<Reg>(elemKind(types_, fn.resolvedType_))), fn);
+            break;
+        }
+        case TypeKind::Task: throw error("Function '" + fn.id_ + "' cannot return a task", fn);
+    }
+    emit(Instr(Op::Ret, r), fn);
+
+    for(size_t i = 0; i < fn.params_.size(); ++i)
+    {
+        fn_->locals_[i].endPc_ = static_cast<std::uint32_t>(fn_->code_.size());
+    }
+
+    for(size_t slot = 0; slot < slotKinds_.size(); ++slot)
+    {
+        if(slotKinds_[slot] == 1)
+            fn_->intRegs_.push_back(static_cast<Reg>(slot));
+    }
+
+    // Outlined bodies share the slots, so they share what is known about them
+    for(size_t k = firstOutlined; k < outlined_.size(); ++k)
+    {
+        outlined_[k].intRegs_ = fn_->intRegs_;
+    }
+
+    fn_ = nullptr;
+}
+
+void Compiler::statement(AST::Node& st)
+{
+    nextReg_ = firstTemp_;
+
+    // A call statement is an expression whose value is dropped
+    if(st.type_ == AST::NodeType::Call)
+    {
+        expr(st);
+        return;
+    }
+
+    visit(st);
+}
+
+void Compiler::block(AST::NodeVec& stmts)
+{
+    size_t scope = openLocals_.size();
+    size_t tasks = openTasks_.size();
+
+    for(auto& st: stmts)
+    {
+        statement(*st);
+    }
+
+    if(openTasks_.size() > tasks)
+    {
+        joinTasks(tasks, *stmts.back());
+        openTasks_.resize(tasks);
+    }
+
+    // Locals of the block go out of scope
+    for(size_t i = scope; i < openLocals_.size(); ++i)
+    {
+        fn_->locals_[openLocals_[i]].endPc_ = static_cast<std::uint32_t>(fn_->code_.size());
+    }
+    openLocals_.resize(scope);
+}
+
+void Compiler::visit(AST::Variable& var)
+{
+    Reg slot = static_cast<Reg>(var.slot_);
+
+    if(var.init_)
+    {
+        exprTo(*var.init_, slot);
+    }
+    else
+    {
+        defaultInit(var, slot);
+    }
+
+    // Visible to the debugger once initialized
+    openLocals_.push_back(fn_->locals_.size());
+    fn_->locals_.push_back({var.id_, slot, static_cast<std::uint32_t>(fn_->code_.size()), 0});
+    declare(var);
+
+    if(types_.isTask(var.resolvedType_))
+        openTasks_.push_back(slot);
+}
+
+void Compiler::joinTasks(size_t first, const AST::Node& at)
+{
+    for(size_t k = openTasks_.size(); k-- > first;)
+    {
+        emit(Instr(Op::Join, openTasks_[k], openTasks_[k]), at);
+    }
+}
+
+void Compiler::declare(AST::Variable& var)
+{
+    // Slots are shared by variables of sibling scopes
+    auto& kind = slotKinds_[var.slot_];
+    if(types_.get(var.resolvedType_).kind_ != TypeKind::Int)
+    {
+        kind = 2;
+    }
+    else if(kind == 0)
+    {
+        kind = 1;
+    }
+}
+
+void Compiler::defaultInit(AST::Variable& var, Reg slot)
+{
+    const Type& t = types_.get(var.resolvedType_);
+    switch(t.kind_)
+    {
+        case TypeKind::Int: loadInt(slot, 0, var); break;
+        case TypeKind::Str: emit(Instr::wide(Op::LoadK, slot, constant(Value(std::string()))), var); break;
+        case TypeKind::Array: {
+            auto& typeId = static_cast<AST::TypeId&>(*var.typeId_);
+            auto kind    = static_cast<Reg>(elemKind(types_, var.resolvedType_));
+
+            Reg size;
+            if(typeId.sizeSlot_ != static_cast<std::uint32_t>(-1))
+            {
+                size = static_cast<Reg>(typeId.sizeSlot_);
+            }
+            else
+            {
+                size = allocTemps(1, var);
+                loadInt(size, t.size_, var);
+            }
+
+            emitAlloc(Instr(Op::NewArray, slot, size, kind), var);
+            break;
+        }
+        case TypeKind::Task: throw error("Task '" + var.id_ + "' must be initialized with a spawn", var);
+    }
+}
+
+void Compiler::visit(AST::Return& ret)
+{
+    // TailCalls only marks calls in functions without tasks, nothing is left to join
+    if(ret.value_->type_ == AST::NodeType::Call && static_cast<AST::Call&>(*ret.value_).tail_)
+    {
+        assert(openTasks_.empty());
+
+        auto& call = static_cast<AST::Call&>(*ret.value_);
+        Reg base   = allocTemps(std::max<size_t>(call.args_.size(), 1), call);
+        for(size_t i = 0; i < call.args_.size(); ++i)
+        {
+            exprTo(*call.args_[i], static_cast<Reg>(base + i));
+        }
+
+        emit(Instr::wide(Op::TailCall, base, call.fnIndex_), call);
+        return;
+    }
+
+    Reg value = expr(*ret.value_);
+    joinTasks(0, ret);
+    emit(Instr(Op::Ret, value), ret);
+}
+
+void Compiler::visit(AST::If& stmt)
+{
+    size_t skipThen = condJump(*stmt.cond_, false);
+    block(stmt.then_);
+
+    if(stmt.else_.empty())
+    {
+        patchJump(skipThen, fn_->code_.size());
+        return;
+    }
+
+    size_t skipElse = emitJump(Op::Jmp, 0, stmt);
+    patchJump(skipThen, fn_->code_.size());
+    block(stmt.else_);
+    patchJump(skipElse, fn_->code_.size());
+}
+
+void Compiler::visit(AST::While& stmt)
+{
+    // The condition is placed after the body, so an iteration takes a single branch
+    size_t toCond = emitJump(Op::Jmp, 0, stmt);
+    size_t body   = fn_->code_.size();
+
+    // Every iteration gets a region of its own, which drops the locals of the body
+    if(stmt.region_)
+        emit(Instr(Op::EnterRegion), stmt);
+
+    block(stmt.body_);
+
+    if(stmt.region_)
+        emit(Instr(Op::LeaveRegion, static_cast<Reg>(stmt.bodySlot_)), stmt);
+
+    patchJump(toCond, fn_->code_.size());
+    nextReg_ = firstTemp_;
+    patchJump(condJump(*stmt.cond_, true), body);
+}
+
+void Compiler::visit(AST::ParallelFor& stmt)
+{
+    auto& var = static_cast<AST::Variable&>(*stmt.var_);
+    auto idx  = static_cast<Reg>(var.slot_);
+    auto end  = static_cast<Reg>(idx + 1);
+
+    exprTo(*stmt.from_, idx);
+    exprTo(*stmt.to_, end);
+
+    declare(var);
+    if(slotKinds_[end] == 0)
+        slotKinds_[end] = 1;
+
+    // Nested loops add bodies of their own meanwhile, so this one is compiled aside
+    size_t index = outlined_.size();
+    outlined_.emplace_back();
+
+    Function body;
+    body.name_      = fn_->name_;
+    body.numParams_ = static_cast<std::uint32_t>(end) + 1;
+    body.numRegs_   = static_cast<std::uint32_t>(firstTemp_);
+
+    for(size_t local: openLocals_)
+    {
+        body.locals_.push_back(fn_->locals_[local]);
+        body.locals_.back().startPc_ = 0;
+    }
+    body.locals_.push_back({var.id_, idx, 0, 0});
+
+    Function* parent = std::exchange(fn_, &body);
+    auto savedLocals = std::move(openLocals_);
+    auto savedTasks  = std::move(openTasks_);
+    openLocals_.clear();
+    openTasks_.clear();
+
+    // Ret drops the registers of a frame only if it opened a region, which
+    // keeps the captured values from outliving the loop on the workers
+    emit(Instr(Op::EnterRegion), stmt);
+    size_t toCond = emitJump(Op::Jmp, 0, stmt);
+    size_t loop   = fn_->code_.size();
+
+    if(stmt.region_)
+        emit(Instr(Op::EnterRegion), stmt);
+
+    block(stmt.body_);
+
+    if(stmt.region_)
+        emit(Instr(Op::LeaveRegion, static_cast<Reg>(stmt.bodySlot_)), stmt);
+
+    emit(Instr(Op::AddI, idx, idx, 1), stmt);
+    patchJump(toCond, fn_->code_.size());
+    patchJump(emit(Instr(Op::JmpIfLt, idx, end), stmt), loop);
+
+    nextReg_ = firstTemp_;
+    Reg r    = allocTemps(1, stmt);
+    loadInt(r, 0, stmt);
+    emit(Instr(Op::Ret, r), stmt);
+
+    for(auto& local: body.locals_)
+    {
+        local.endPc_ = static_cast<std::uint32_t>(body.code_.size());
+    }
+
+    fn_         = parent;
+    openLocals_ = std::move(savedLocals);
+    openTasks_  = std::move(savedTasks);
+    outlined_[index] = std::move(body);
+
+    emit(Instr::wide(Op::ParFor, idx, static_cast<std::uint32_t>(numFns_ + index)), stmt);
+}
+
+void Compiler::visit(AST::Assign& stmt)
+{
+    if(stmt.target_->type_ == AST::NodeType::VarRef)
+    {
+        exprTo(*stmt.value_, static_cast<Reg>(static_cast<AST::VarRef&>(*stmt.target_).slot_));
+        return;
+    }
+
+    // The value is evaluated before the target, as in the Interpreter
+    auto& idx = static_cast<AST::Index&>(*stmt.target_);
+    Reg value = expr(*stmt.value_);
+    Reg array = expr(*idx.array_);
+    Reg index = expr(*idx.index_);
+    emit(Instr(Op::SetIndex, array, index, value), stmt);
+}
+
+void Compiler::visit(AST::BinOp& op)
+{
+    if(op.resolvedType_ == types_.strType())
+    {
+        Reg dst = dst_;
+        Reg lhs = expr(*op.op1_);
+        Reg rhs = expr(*op.op2_);
+        emitAlloc(Instr(Op::Concat, dst, lhs, rhs), op);
+        return;
+    }
+
+    // Operators of arrays are a single kernel call each
+    if(types_.isArray(op.resolvedType_))
+    {
+        Reg dst = dst_;
+        Reg lhs = expr(*op.op1_);
+        Reg rhs = expr(*op.op2_);
+
+        Instr i(Op::ArrayOp, dst, lhs, rhs);
+        i.x_ = static_cast<std::uint8_t>(op.opType_);
+        emitAlloc(i, op);
+        return;
+    }
+
+    // `x + 1` and `x - 1` take the immediate form instead of LoadI + Add/Sub
+    if(op.opType_ == TokenType::PLUS || op.opType_ == TokenType::MINUS)
+    {
+        auto imm = [](AST::Node& n, bool negate) -> std::optional<std::int16_t> {
+            if(n.type_ != AST::NodeType::Const || !static_cast<AST::Const&>(n).isNum())
+                return std::nullopt;
+
+            std::int64_t lo = std::numeric_limits<std::int16_t>::min();
+            std::int64_t hi = std::numeric_limits<std::int16_t>::max();
+            if(negate)
+                std::tie(lo, hi) = std::make_pair(-hi, -lo);
+
+            auto v = static_cast<AST::Const&>(n).num_;
+            if(v < lo || v > hi)
+                return std::nullopt;
+
+            return static_cast<std::int16_t>(negate ? -v : v);
+        };
+
+        bool sub = op.opType_ == TokenType::MINUS;
+        Reg dst  = dst_;
+        if(auto rhs = imm(*op.op2_, sub))
+        {
+            emit(Instr(Op::AddI, dst, expr(*op.op1_), static_cast<Reg>(*rhs)), op);
+            return;
+        }
+
+        if(auto lhs = imm(*op.op1_, false); lhs && !sub)
+        {
+            emit(Instr(Op::AddI, dst, expr(*op.op2_), static_cast<Reg>(*lhs)), op);
+            return;
+        }
+    }
+
+    Reg lhs = expr(*op.op1_);
+    Reg rhs = expr(*op.op2_);
+
+    Op code;
+    switch(op.opType_)
+    {
+        case TokenType::PLUS: code = Op::Add; break;
+        case TokenType::MINUS: code = Op::Sub; break;
+        case TokenType::STAR: code = Op::Mul; break;
+        case TokenType::SLASH: code = Op::Div; break;
+        case TokenType::PERCENT: code = Op::Mod; break;
+        case TokenType::LT: code = Op::Lt; break;
+        case TokenType::LE: code = Op::Le; break;
+        case TokenType::GT: code = Op::Gt; break;
+        case TokenType::GE: code = Op::Ge; break;
+        case TokenType::EQEQ: code = Op::Eq; break;
+        case TokenType::NE: code = Op::Ne; break;
+
+        default: throw error("Unsupported binary operator", op);
+    }
+
+    emit(Instr(code, dst_, lhs, rhs), op);
+}
+
+void Compiler::visit(AST::UnaryOp& op)
+{
+    Reg dst = dst_;
+    emitAlloc(Instr(types_.isArray(op.resolvedType_) ? Op::ArrayNeg : Op::Neg, dst, expr(*op.op_)), op);
+}
+
+void Compiler::visit(AST::Call& call)
+{
+    Reg dst = dst_;
+
+    if(call.builtin_ == Builtin::Join)
+    {
+        emit(Instr(Op::Join, dst, expr(*call.args_[0])), call);
+        return;
+    }
+
+    if(call.builtin_ != Builtin::None)
+    {
+        // A single argument is passed in place, several go to consecutive temporaries
+        Reg args;
+        if(call.args_.size() == 1)
+        {
+            args = expr(*call.args_[0]);
+        }
+        else
+        {
+            args = allocTemps(call.args_.size(), call);
+            for(size_t i = 0; i < call.args_.size(); ++i)
+            {
+                exprTo(*call.args_[i], static_cast<Reg>(args + i));
+            }
+        }
+
+        emitAlloc(Instr(Op::CallBuiltin, dst, static_cast<Reg>(call.builtin_), args), call);
+        return;
+    }
+
+    // Arguments go to consecutive registers, which the callee sees as its params.
+    // A fresh temporary destination doubles as the first of them.
+    Reg base;
+    if(dst + 1u == nextReg_ && dst >= firstTemp_)
+    {
+        base = dst;
+        if(call.args_.size() > 1)
+            allocTemps(call.args_.size() - 1, call);
+    }
+    else
+    {
+        base = allocTemps(std::max<size_t>(call.args_.size(), 1), call);
+    }
+
+    for(size_t i = 0; i < call.args_.size(); ++i)
+    {
+        exprTo(*call.args_[i], static_cast<Reg>(base + i));
+    }
+
+    emit(Instr::wide(Op::Call, base, call.fnIndex_), call);
+    if(dst != base)
+        emit(Instr(Op::Move, dst, base), call);
+}
+
+void Compiler::visit(AST::Spawn& spawn)
+{
+    auto& call = static_cast<AST::Call&>(*spawn.call_);
+
+    // The task takes the arguments from consecutive registers, as a call would
+    Reg dst  = dst_;
+    Reg base = allocTemps(std::max<size_t>(call.args_.size(), 1), spawn);
+    for(size_t i = 0; i < call.args_.size(); ++i)
+    {
+        exprTo(*call.args_[i], static_cast<Reg>(base + i));
+    }
+
+    emit(Instr::wide(Op::Spawn, base, call.fnIndex_), spawn);
+    if(dst != base)
+        emit(Instr(Op::Move, dst, base), spawn);
+}
+
+void Compiler::visit(AST::VarRef& ref)
+{
+    if(dst_ != ref.slot_)
+        emit(Instr(Op::Move, dst_, static_cast<Reg>(ref.slot_)), ref);
+}
+
+void Compiler::visit(AST::Index& idx)
+{
+    Reg dst   = dst_;
+    Reg array = expr(*idx.array_);
+    Reg index = expr(*idx.index_);
+    emit(Instr(Op::GetIndex, dst, array, index), idx);
+}
+
+void Compiler::visit(AST::Const& c)
+{
+    if(c.isNum())
+    {
+        loadInt(dst_, c.num_, c);
+    }
+    else
+    {
+        emit(Instr::wide(Op::LoadK, dst_, constant(c.value_)), c);
+    }
+}
+
+void Compiler::visit(AST::ConstArray& arr)
+{
+    Reg dst  = dst_;
+    Reg base = allocTemps(arr.elements_.size(), arr);
+    for(size_t i = 0; i < arr.elements_.size(); ++i)
+    {
+        exprTo(*arr.elements_[i], static_cast<Reg>(base + i));
+    }
+
+    emitAlloc(Instr(Op::MakeArray, dst, base, static_cast<Reg>(arr.elements_.size())), arr);
+}
+
+Reg Compiler::expr(AST::Node& e)
+{
+    if(e.type_ == AST::NodeType::VarRef)
+        return static_cast<Reg>(static_cast<AST::VarRef&>(e).slot_);
+
+    Reg dst = allocTemps(1, e);
+    exprTo(e, dst);
+    return dst;
+}
+
+void Compiler::exprTo(AST::Node& e, Reg dst)
+{
+    Reg saved = dst_;
+    dst_      = dst;
+    visit(e);
+    dst_ = saved;
+}
+
+Reg Compiler::allocTemps(size_t n, const AST::Node& at)
+{
+    if(nextReg_ + n > MAX_REGS)
+        throw error("Function '" + fn_->name_ + "' needs too many registers", at);
+
+    auto first = static_cast<Reg>(nextReg_);
+    nextReg_ += n;
+    fn_->numRegs_ = std::max(fn_->numRegs_, static_cast<std::uint32_t>(nextReg_));
+    return first;
+}
+
+size_t Compiler::emit(Instr instr, const AST::Node& at)
+{
+    fn_->code_.push_back(instr);
+    fn_->lines_.push_back(at.line_);
+    return fn_->code_.size() - 1;
+}
+
+size_t Compiler::emitAlloc(Instr instr, const AST::Node& at)
+{
+    if(at.region_)
+        instr.x_ |= REGION;
+
+    return emit(instr, at);
+}
+
+size_t Compiler::emitJump(Op op, Reg cond, const AST::Node& at)
+{
+    return emit(Instr(op, cond), at);
+}
+
+size_t Compiler::condJump(AST::Node& cond, bool jumpIf)
+{
+    // Integer comparisons branch directly instead of materializing 0/1 first
+    if(cond.type_ == AST::NodeType::BinOp)
+    {
+        auto& op = static_cast<AST::BinOp&>(cond);
+
+        Op jump = Op::Jmp;
+        switch(op.opType_)
+        {
+            case TokenType::LT: jump = jumpIf ? Op::JmpIfLt : Op::JmpIfGe; break;
+            case TokenType::LE: jump = jumpIf ? Op::JmpIfLe : Op::JmpIfGt; break;
+            case TokenType::GT: jump = jumpIf ? Op::JmpIfGt : Op::JmpIfLe; break;
+            case TokenType::GE: jump = jumpIf ? Op::JmpIfGe : Op::JmpIfLt; break;
+            case TokenType::EQEQ: jump = jumpIf ? Op::JmpIfEq : Op::JmpIfNe; break;
+            case TokenType::NE: jump = jumpIf ? Op::JmpIfNe : Op::JmpIfEq; break;
+
+            default: break;
+        }
+
+        if(jump != Op::Jmp && op.op1_->resolvedType_ == types_.intType())
+        {
+            Reg lhs = expr(*op.op1_);
+            Reg rhs = expr(*op.op2_);
+            return emit(Instr(jump, lhs, rhs), cond);
+        }
+    }
+
+    return emitJump(jumpIf ? Op::JmpIf : Op::JmpIfNot, expr(cond), cond);
+}
+
+void Compiler::patchJump(size_t from, size_t to)
+{
+    // Offsets are relative to the instruction following the jump
+    auto offset = static_cast<std::int32_t>(to) - static_cast<std::int32_t>(from + 1);
+
+    Instr& jump = fn_->code_[from];
+    if(!isShortJump(jump.op_))
+    {
+        jump.setSbx(offset);
+        return;
+    }
+
+    if(offset < std::numeric_limits<std::int16_t>::min() || offset > std::numeric_limits<std::int16_t>::max())
+    {
+        throw std::runtime_error("Loop or branch body in '" + fn_->name_ + "' is too long on line "
+                                 + std::to_string(fn_->lines_[from]));
+    }
+
+    jump.c_ = static_cast<Reg>(static_cast<std::int16_t>(offset));
+}
+
+void Compiler::loadInt(Reg dst, std::int64_t v, const AST::Node& at)
+{
+    if(v >= std::numeric_limits<std::int32_t>::min() && v <= std::numeric_limits<std::int32_t>::max())
+    {
+        auto i = Instr(Op::LoadI, dst);
+        i.setSbx(static_cast<std::int32_t>(v));
+        emit(i, at);
+        return;
+    }
+
+    emit(Instr::wide(Op::LoadK, dst, constant(v)), at);
+}
+
+std::uint32_t Compiler::constant(std::int64_t v)
+{
+    auto& idx = intConsts_[v];
+    if(idx == 0)
+    {
+        module_.constants_.emplace_back(v);
+        idx = static_cast<std::uint32_t>(module_.constants_.size());
+    }
+
+    // Indices are stored off by one, so that 0 means "not yet in the pool"
+    return idx - 1;
+}
+
+std::uint32_t Compiler::constant(const Value& s)
+{
+    auto& idx = strConsts_[std::string(s.asStr())];
+    if(idx == 0)
+    {
+        module_.constants_.push_back(s);
+        idx = static_cast<std::uint32_t>(module_.constants_.size());
+    }
+
+    return idx - 1;
+}
+
+std::runtime_error Compiler::error(const std::string& msg, const AST::Node& at) const
+{
+    return std::runtime_error(msg + " on line " + std::to_string(at.line_));
+}
+
+}
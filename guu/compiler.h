@@ -0,0 +1,120 @@
+#pragma once
+
+#include "ast.h"
+#include "bytecode.h"
+#include "types.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../util/flat_map.h"
+
+namespace Guu
+{
+
+// Lowers a resolved AST to register bytecode. Every variable lives in the
+// register equal to its frame slot; temporaries are allocated above
+// FnDef::frameSize_ and released at the end of each statement.
+//
+// The body of a parallel for is outlined into a function of its own, appended
+// after the ones of the program. Its frame mirrors the enclosing one: the
+// variables visible at the loop are its parameters, followed by the index and
+// the end of the chunk it runs. Tasks are joined when their scope is left.
+class Compiler : public AST::Visitor
+{
+public:
+    using AST::Visitor::visit;
+
+    explicit Compiler(const TypeTable& types) : types_(types)
+    {
+    }
+
+    Bytecode::Module compile(AST::Node& root);
+
+    // Compiles only the functions whose index is set in `fns`. The others keep
+    // their index but no code, nothing compiled may call them.
+    Bytecode::Module compile(AST::Node& root, std::vector<bool> fns);
+
+private:
+    void visit(AST::Root& root) override;
+    void visit(AST::FnDef& fn) override;
+    void visit(AST::Variable& var) override;
+    void visit(AST::Return& ret) override;
+    void visit(AST::If& stmt) override;
+    void visit(AST::While& stmt) override;
+    void visit(AST::ParallelFor& stmt) override;
+    void visit(AST::Assign& stmt) override;
+
+    // Expressions store their result into dst_
+    void visit(AST::BinOp& op) override;
+    void visit(AST::UnaryOp& op) override;
+    void visit(AST::Call& call) override;
+    void visit(AST::Spawn& spawn) override;
+    void visit(AST::VarRef& ref) override;
+    void visit(AST::Index& idx) override;
+    void visit(AST::Const& c) override;
+    void visit(AST::ConstArray& arr) override;
+
+private:
+    void statement(AST::Node& st);
+    void block(AST::NodeVec& stmts);
+    void defaultInit(AST::Variable& var, Bytecode::Reg slot);
+    void declare(AST::Variable& var);
+
+    // Joins the open tasks from `first` on, the last one first
+    void joinTasks(size_t first, const AST::Node& at);
+
+    // Returns the register holding the value of `e`, variables are not copied
+    Bytecode::Reg expr(AST::Node& e);
+    void exprTo(AST::Node& e, Bytecode::Reg dst);
+
+    Bytecode::Reg allocTemps(size_t n, const AST::Node& at);
+
+    size_t emit(Bytecode::Instr instr, const AST::Node& at);
+
+    // Sets REGION if EscapeAnalysis moved the object `at` allocates to a region
+    size_t emitAlloc(Bytecode::Instr instr, const AST::Node& at);
+    size_t emitJump(Bytecode::Op op, Bytecode::Reg cond, const AST::Node& at);
+
+    // Emits a branch taken when `cond` equals `jumpIf`, to be patched later
+    size_t condJump(AST::Node& cond, bool jumpIf);
+    void patchJump(size_t from, size_t to);
+    void loadInt(Bytecode::Reg dst, std::int64_t v, const AST::Node& at);
+
+    std::uint32_t constant(std::int64_t v);
+    std::uint32_t constant(const Value& s);
+
+    std::runtime_error error(const std::string& msg, const AST::Node& at) const;
+
+private:
+    const TypeTable& types_;
+
+    Bytecode::Module module_;
+    Bytecode::Function* fn_ = nullptr;
+
+    // Functions to compile, all of them if empty
+    std::vector<bool> only_;
+
+    util::FlatMap<std::int64_t, std::uint32_t> intConsts_;
+    util::FlatMap<std::string, std::uint32_t> strConsts_;
+
+    // Indices into Function::locals_ of the variables in scope
+    std::vector<size_t> openLocals_;
+
+    // Registers of the task variables in scope
+    std::vector<Bytecode::Reg> openTasks_;
+
+    // Outlined parallel loop bodies, their indices follow the functions of the program
+    std::vector<Bytecode::Function> outlined_;
+    size_t numFns_ = 0;
+
+    // Per slot of the current function: 0 unused, 1 only ints, 2 other types too
+    std::vector<std::uint8_t> slotKinds_;
+
+    size_t firstTemp_ = 0;
+    size_t nextReg_   = 0;
+    Bytecode::Reg dst_ = 0;
+};
+
+}
@@ -0,0 +1,442 @@
+#include "debugger.h"
+#include "vm.h"
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <sstream>
+
+namespace Guu
+{
+
+using namespace Bytecode;
+
+Debugger::Debugger(Module& module, StopHandler onStop) : module_(module), onStop_(std::move(onStop))
+{
+    // A statement starts where the line changes and wherever a jump lands.
+    // Unconditional jumps are skipped: they only lead to another start.
+    for(const auto& fn: module_.functions_)
+    {
+        std::vector<bool> isStart(fn.code_.size());
+        for(size_t pc = 0; pc < fn.code_.size(); ++pc)
+        {
+            if(pc == 0 || fn.lines_[pc] != fn.lines_[pc - 1])
+                isStart[pc] = true;
+
+            const Instr& i = fn.code_[pc];
+            if(i.op_ == Op::Jmp || i.op_ == Op::JmpIf || i.op_ == Op::JmpIfNot || isShortJump(i.op_))
+            {
+                std::int64_t offset = isShortJump(i.op_) ? i.sc() : i.sbx();
+                auto target         = static_cast<size_t>(static_cast<std::int64_t>(pc) + 1 + offset);
+                if(target < fn.code_.size())
+                    isStart[target] = true;
+            }
+        }
+
+        auto& starts = starts_.emplace_back();
+        for(size_t pc = 0; pc < fn.code_.size(); ++pc)
+        {
+            if(isStart[pc] && fn.code_[pc].op_ != Op::Jmp)
+                starts.push_back(pc);
+        }
+    }
+}
+
+Debugger::~Debugger()
+{
+    patches_.forEach([this](std::uint64_t k, const Patch& p) {
+        module_.functions_[k >> 32].code_[k & 0xFFFFFFFF].op_ = p.original_;
+    });
+}
+
+bool Debugger::setBreakpoint(size_t line)
+{
+    bool found = false;
+    for(std::uint32_t fn = 0; fn < starts_.size(); ++fn)
+    {
+        for(size_t pc: starts_[fn])
+        {
+            if(module_.functions_[fn].lines_[pc] == line)
+            {
+                patch(fn, pc, true);
+                found = true;
+            }
+        }
+    }
+
+    if(found && std::find(lines_.begin(), lines_.end(), line) == lines_.end())
+        lines_.push_back(line);
+
+    return found;
+}
+
+bool Debugger::clearBreakpoint(size_t line)
+{
+    auto it = std::find(lines_.begin(), lines_.end(), line);
+    if(it == lines_.end())
+        return false;
+
+    lines_.erase(it);
+    for(std::uint32_t fn = 0; fn < starts_.size(); ++fn)
+    {
+        for(size_t pc: starts_[fn])
+        {
+            if(module_.functions_[fn].lines_[pc] == line)
+                unpatch(fn, pc, true);
+        }
+    }
+
+    return true;
+}
+
+std::vector<Debugger::FrameInfo> Debugger::backtrace() const
+{
+    std::vector<FrameInfo> frames;
+    if(!stack_)
+        return frames;
+
+    // Callers are suspended right after their Call instruction, the frames below
+    // nested entry frames after the ParFor or Join they wait in
+    size_t pc = stopPc_;
+    for(size_t idx = stack_->depth(); idx-- > 0;)
+    {
+        const auto& frame = stack_->frame(idx);
+        frames.push_back(FrameInfo{frame.fn_, pc, frame.fn_->lines_[pc]});
+        pc = frame.returnPc_ - 1;
+    }
+
+    return frames;
+}
+
+std::vector<std::pair<std::string, Value>> Debugger::locals(size_t frame) const
+{
+    std::vector<std::pair<std::string, Value>> vars;
+
+    auto frames = backtrace();
+    if(frame >= frames.size())
+        return vars;
+
+    const Value* regs = stack_->frame(stack_->depth() - 1 - frame).regs_;
+    size_t pc         = frames[frame].pc_;
+    for(const auto& var: frames[frame].fn_->locals_)
+    {
+        if(var.startPc_ <= pc && pc < var.endPc_)
+            vars.emplace_back(var.name_, regs[var.reg_]);
+    }
+
+    return vars;
+}
+
+Instr Debugger::trap(const CallStack& stack, const Function& fn, size_t pc)
+{
+    std::uint32_t fnIdx = indexOf(fn);
+
+    const Patch* p = patches_.find(key(fnIdx, pc));
+    if(!p)
+        throw RuntimeError("Unexpected breakpoint in '" + fn.name_ + "' on line " + std::to_string(fn.lines_[pc]));
+
+    Instr original = fn.code_[pc];
+    original.op_   = p->original_;
+
+    size_t depth = stack.depth();
+    size_t line  = fn.lines_[pc];
+
+    const char* reason = nullptr;
+    if(p->user_)
+    {
+        reason = "breakpoint";
+    }
+    else if(shouldStop(*p, fnIdx, depth, line, pc))
+    {
+        reason = "step";
+    }
+
+    if(!reason)
+        return original;
+
+    clearTemps();
+
+    stack_     = &stack;
+    stopFn_    = fnIdx;
+    stopPc_    = pc;
+    stopLine_  = line;
+    stopDepth_ = depth;
+
+    try
+    {
+        mode_ = onStop_(*this, reason);
+        arm(mode_, fnIdx);
+    } catch(...)
+    {
+        stack_ = nullptr;
+        throw;
+    }
+
+    stack_ = nullptr;
+
+    return original;
+}
+
+std::uint32_t Debugger::indexOf(const Function& fn) const
+{
+    return static_cast<std::uint32_t>(&fn - module_.functions_.data());
+}
+
+void Debugger::patch(std::uint32_t fn, size_t pc, bool user)
+{
+    auto k = key(fn, pc);
+
+    Patch* p = patches_.find(k);
+    if(!p)
+    {
+        Op& op = module_.functions_[fn].code_[pc].op_;
+
+        p            = &patches_[k];
+        p->original_ = op;
+        op           = Op::Break;
+    }
+
+    if(user)
+    {
+        p->user_ = true;
+    }
+    else if(!p->temp_)
+    {
+        p->temp_ = true;
+        temps_.push_back(k);
+    }
+}
+
+void Debugger::unpatch(std::uint32_t fn, size_t pc, bool user)
+{
+    auto k = key(fn, pc);
+
+    Patch* p = patches_.find(k);
+    if(!p)
+        return;
+
+    (user ? p->user_ : p->temp_) = false;
+    if(p->user_ || p->temp_)
+        return;
+
+    module_.functions_[fn].code_[pc].op_ = p->original_;
+    patches_.erase(k);
+}
+
+void Debugger::clearTemps()
+{
+    for(auto k: temps_)
+        unpatch(static_cast<std::uint32_t>(k >> 32), k & 0xFFFFFFFF, false);
+
+    temps_.clear();
+}
+
+bool Debugger::shouldStop(const Patch& p, std::uint32_t fn, size_t depth, size_t line, size_t pc) const
+{
+    if(!p.temp_)
+        return false;
+
+    // A pc at or before the last stop means a loop went around
+    bool moved = fn != stopFn_ || line != stopLine_ || pc <= stopPc_;
+
+    switch(mode_)
+    {
+        case Resume::Continue: return false;
+        case Resume::StepIn: return depth != stopDepth_ || moved;
+        case Resume::StepOver: return depth < stopDepth_ || (depth == stopDepth_ && moved);
+        case Resume::StepOut: return depth < stopDepth_;
+    }
+
+    return false;
+}
+
+void Debugger::arm(Resume mode, std::uint32_t fn)
+{
+    if(mode == Resume::Continue)
+        return;
+
+    if(mode == Resume::StepIn)
+    {
+        for(std::uint32_t f = 0; f < starts_.size(); ++f)
+        {
+            for(size_t pc: starts_[f])
+                patch(f, pc, false);
+        }
+    }
+    else if(mode == Resume::StepOver)
+    {
+        for(size_t pc: starts_[fn])
+            patch(fn, pc, false);
+    }
+
+    // Returning from the frame stops in the caller, right after its Call, or
+    // in the suspended frame below an entry frame once the loop or join is done
+    size_t depth = stack_->depth();
+    if(depth > 1)
+        patch(indexOf(*stack_->frame(depth - 2).fn_), stack_->frame(depth - 1).returnPc_, false);
+}
+
+namespace
+{
+
+// Thrown by the `quit` command to unwind the VM
+struct Quit
+{
+};
+
+bool parseNumber(const std::string& s, size_t& n)
+{
+    auto res = std::from_chars(s.data(), s.data() + s.size(), n);
+    return !s.empty() && res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+}
+
+DebugSession::DebugSession(Module& module, std::istream& in, std::ostream& out)
+    : module_(module)
+    , in_(in)
+    , out_(out)
+    , debugger_(module, [this](Debugger& dbg, const char* reason) {
+        auto frames = dbg.backtrace();
+        out_ << "stopped " << reason << " " << frames[0].fn_->name_ << " " << frames[0].line_ << std::endl;
+        return prompt(true);
+    })
+{
+}
+
+int DebugSession::run(const std::vector<std::string>& args, size_t maxDepth)
+{
+    try
+    {
+        prompt(false);
+
+        VM vm(module_, out_, maxDepth);
+        vm.setDebugger(&debugger_);
+
+        Value result = vm.run(args);
+
+        out_ << "exited ";
+        printValue(out_, result);
+        out_ << std::endl;
+
+        return result.isInt() ? static_cast<int>(result.asInt()) : 0;
+    } catch(const Quit&)
+    {
+        out_ << "ok" << std::endl;
+    } catch(const RuntimeError& e)
+    {
+        out_ << "error " << e.what() << std::endl;
+    }
+
+    return 1;
+}
+
+Debugger::Resume DebugSession::prompt(bool running)
+{
+    std::string line;
+    while(std::getline(in_, line))
+    {
+        std::istringstream ss(line);
+        std::string cmd;
+        std::string arg;
+        ss >> cmd >> arg;
+
+        if(cmd.empty())
+            continue;
+
+        if(cmd == "break" || cmd == "clear")
+        {
+            size_t n = 0;
+            if(!parseNumber(arg, n))
+            {
+                out_ << "error expected a line number" << std::endl;
+            }
+            else if(cmd == "break" ? debugger_.setBreakpoint(n) : debugger_.clearBreakpoint(n))
+            {
+                out_ << "ok" << std::endl;
+            }
+            else
+            {
+                out_ << "error " << (cmd == "break" ? "no code" : "no breakpoint") << " on line " << n << std::endl;
+            }
+        }
+        else if(cmd == "run")
+        {
+            if(!running)
+                return Debugger::Resume::Continue;
+
+            out_ << "error already running" << std::endl;
+        }
+        else if(cmd == "continue" || cmd == "step" || cmd == "next" || cmd == "finish")
+        {
+            if(running)
+            {
+                if(cmd == "continue")
+                    return Debugger::Resume::Continue;
+                if(cmd == "step")
+                    return Debugger::Resume::StepIn;
+                if(cmd == "next")
+                    return Debugger::Resume::StepOver;
+                return Debugger::Resume::StepOut;
+            }
+
+            out_ << "error not running" << std::endl;
+        }
+        else if(cmd == "bt" || cmd == "locals")
+        {
+            if(!running)
+            {
+                out_ << "error not running" << std::endl;
+            }
+            else if(cmd == "bt")
+            {
+                backtrace();
+            }
+            else
+            {
+                locals(arg);
+            }
+        }
+        else if(cmd == "quit")
+        {
+            throw Quit();
+        }
+        else
+        {
+            out_ << "error unknown command '" << cmd << "'" << std::endl;
+        }
+    }
+
+    // The input ended, nobody is left to resume the program
+    throw Quit();
+}
+
+void DebugSession::backtrace()
+{
+    auto frames = debugger_.backtrace();
+    for(size_t k = 0; k < frames.size(); ++k)
+        out_ << "frame #" << k << " " << frames[k].fn_->name_ << " line " << frames[k].line_ << std::endl;
+
+    out_ << "ok" << std::endl;
+}
+
+void DebugSession::locals(const std::string& arg)
+{
+    size_t frame = 0;
+    if(!arg.empty() && (!parseNumber(arg, frame) || frame >= debugger_.backtrace().size()))
+    {
+        out_ << "error no frame " << arg << std::endl;
+        return;
+    }
+
+    for(const auto& [name, value]: debugger_.locals(frame))
+    {
+        out_ << "var " << name << " = ";
+        printValue(out_, value);
+        out_ << std::endl;
+    }
+
+    out_ << "ok" << std::endl;
+}
+
+}
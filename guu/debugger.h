@@ -0,0 +1,144 @@
+#pragma once
+
+#include "bytecode.h"
+#include "call_stack.h"
+#include "value.h"
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../util/flat_map.h"
+
+namespace Guu
+{
+
+// Source-level debugger for the VM. Breakpoints and steps are implemented by
+// overwriting the opcode of the first instruction of a statement with
+// Op::Break and restoring it afterwards, so the VM never checks for a
+// debugger: without patches it runs exactly the same code as without one.
+class Debugger
+{
+public:
+    enum class Resume
+    {
+        Continue,
+        StepIn,
+        StepOver,
+        StepOut,
+    };
+
+    struct FrameInfo
+    {
+        const Bytecode::Function* fn_;
+        size_t pc_;
+        size_t line_;
+    };
+
+    // Called whenever execution stops, `reason` is "breakpoint" or "step".
+    // The returned value tells how to go on.
+    using StopHandler = std::function<Resume(Debugger& dbg, const char* reason)>;
+
+    Debugger(Bytecode::Module& module, StopHandler onStop);
+    ~Debugger();
+
+    Debugger(const Debugger&)            = delete;
+    Debugger& operator=(const Debugger&) = delete;
+
+    // Breaks before every statement starting on `line`. Returns false if there is none.
+    bool setBreakpoint(size_t line);
+    bool clearBreakpoint(size_t line);
+
+    const std::vector<size_t>& breakpoints() const
+    {
+        return lines_;
+    }
+
+    // Valid only inside the stop handler. Frame 0 is the innermost one.
+    std::vector<FrameInfo> backtrace() const;
+    std::vector<std::pair<std::string, Value>> locals(size_t frame) const;
+
+    // Entry point for the VM when it executes Op::Break. Returns the
+    // instruction that was patched over, for the VM to execute in its place.
+    Bytecode::Instr trap(const CallStack& stack, const Bytecode::Function& fn, size_t pc);
+
+private:
+    struct Patch
+    {
+        Bytecode::Op original_;
+        bool user_ = false;
+        bool temp_ = false;
+    };
+
+    static std::uint64_t key(std::uint32_t fn, size_t pc)
+    {
+        return (static_cast<std::uint64_t>(fn) << 32) | pc;
+    }
+
+    std::uint32_t indexOf(const Bytecode::Function& fn) const;
+
+    void patch(std::uint32_t fn, size_t pc, bool user);
+    void unpatch(std::uint32_t fn, size_t pc, bool user);
+    void clearTemps();
+
+    bool shouldStop(const Patch& p, std::uint32_t fn, size_t depth, size_t line, size_t pc) const;
+    void arm(Resume mode, std::uint32_t fn);
+
+private:
+    Bytecode::Module& module_;
+    StopHandler onStop_;
+
+    // First instruction of every statement, per function
+    std::vector<std::vector<size_t>> starts_;
+
+    std::vector<size_t> lines_;
+    util::FlatMap<std::uint64_t, Patch> patches_;
+    std::vector<std::uint64_t> temps_;
+
+    // Where execution last stopped and how it was resumed
+    Resume mode_          = Resume::Continue;
+    std::uint32_t stopFn_ = 0;
+    size_t stopPc_        = 0;
+    size_t stopLine_      = 0;
+    size_t stopDepth_     = 0;
+
+    const CallStack* stack_ = nullptr;
+};
+
+// Drives a Debugger and a VM with a line protocol, one command per line:
+//   break N, clear N       set or remove a breakpoint on source line N
+//   run                    start the program (once, before anything else runs)
+//   continue, step, next,  resume, step in, step over or step out
+//   finish
+//   bt                     backtrace, innermost frame first
+//   locals [N]             variables of frame N (0 by default)
+//   quit                   abort the program
+// Commands are answered with "ok" or "error <message>", bt and locals first
+// list one "frame" or "var" line each. Commands that run the program answer
+// with the next "stopped <reason> <function> <line>" or "exited <result>".
+// Program output is interleaved on the same stream.
+class DebugSession
+{
+public:
+    DebugSession(Bytecode::Module& module, std::istream& in, std::ostream& out);
+
+    // Returns the exit code of the program, or 1 if it failed or was aborted
+    int run(const std::vector<std::string>& args, size_t maxDepth);
+
+private:
+    // Reads commands until one starts or resumes execution
+    Debugger::Resume prompt(bool running);
+
+    void backtrace();
+    void locals(const std::string& arg);
+
+private:
+    Bytecode::Module& module_;
+    std::istream& in_;
+    std::ostream& out_;
+    Debugger debugger_;
+};
+
+}
@@ -0,0 +1,597 @@
+#include "document.h"
+#include "lexer.h"
+#include "parser.h"
+#include "resolver.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <iterator>
+#include <set>
+#include <stdexcept>
+
+namespace Guu
+{
+
+namespace
+{
+
+constexpr size_t npos = std::string::npos;
+
+// An error of a chunk, with the line of the chunk the message names, 1-based
+// like in the message. The document line is only known when it is reported.
+struct ChunkError
+{
+    explicit ChunkError(std::string message) : message_(std::move(message))
+    {
+        // "... in line 3 while ..." from the Parser, "... on line 3" from the Tokenizer and the Resolver
+        for(size_t pos = message_.find("line "); pos != npos; pos = message_.find("line ", pos + 1))
+        {
+            const char* begin = message_.data() + pos + 5;
+            auto res          = std::from_chars(begin, message_.data() + message_.size(), line_);
+            if(res.ec == std::errc())
+            {
+                numberAt_ = pos + 5;
+                digits_   = static_cast<size_t>(res.ptr - begin);
+                return;
+            }
+        }
+        line_ = 1;
+    }
+
+    // With the line number of the document, where `line_` is `line`
+    std::string message(size_t line) const
+    {
+        if(numberAt_ == npos)
+            return message_;
+
+        return message_.substr(0, numberAt_) + std::to_string(line) + message_.substr(numberAt_ + digits_);
+    }
+
+    std::string message_;
+    size_t line_     = 1;
+    size_t numberAt_ = npos;
+    size_t digits_   = 0;
+};
+
+bool startsFunction(std::string_view text)
+{
+    return text.size() > 2 && text[0] == 'f' && text[1] == 'n' && (text[2] == ' ' || text[2] == '\t');
+}
+
+bool isIdChar(char c)
+{
+    return c == '_' || std::isalnum(static_cast<unsigned char>(c));
+}
+
+bool isBlank(std::string_view text)
+{
+    return std::all_of(text.begin(), text.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); });
+}
+
+// Before every line that starts a function
+std::vector<std::string> cut(std::string_view text)
+{
+    std::vector<std::string> pieces;
+
+    size_t begin = 0;
+    for(size_t pos = 0; pos < text.size();)
+    {
+        if(pos > begin && startsFunction(text.substr(pos)))
+        {
+            pieces.emplace_back(text.substr(begin, pos - begin));
+            begin = pos;
+        }
+
+        size_t eol = text.find('\n', pos);
+        pos        = eol == npos ? text.size() : eol + 1;
+    }
+
+    if(begin < text.size())
+        pieces.emplace_back(text.substr(begin));
+
+    return pieces;
+}
+
+// What callers check a call against, names of parameters aside
+std::string signature(const AST::FnDef& fn)
+{
+    auto typeName = [](const AST::Node& node) {
+        auto& t = static_cast<const AST::TypeId&>(node);
+        return t.isArray_ ? t.tname_ + "[" + t.arraySize_ + "]" : t.tname_;
+    };
+
+    std::string s = fn.id_ + "(";
+    for(auto& p: fn.params_)
+    {
+        s += typeName(*static_cast<const AST::Variable&>(*p).typeId_) + ",";
+    }
+    return s + ")" + typeName(*fn.retTypeId_);
+}
+
+std::string_view nameOf(std::string_view signature)
+{
+    return signature.substr(0, signature.find('('));
+}
+
+size_t findWord(std::string_view line, std::string_view word, size_t from)
+{
+    for(size_t pos = line.find(word, from); pos != npos; pos = line.find(word, pos + 1))
+    {
+        size_t end = pos + word.size();
+        if((pos == 0 || !isIdChar(line[pos - 1])) && (end == line.size() || !isIdChar(line[end])))
+            return pos;
+    }
+    return npos;
+}
+
+// Names of the functions called anywhere below a node
+class Calls : public AST::Visitor
+{
+public:
+    using AST::Visitor::visit;
+
+    std::vector<std::string_view> names_;
+
+private:
+    void visit(AST::Call& call) override
+    {
+        names_.push_back(call.id_);
+        AST::Visitor::visit(call);
+    }
+};
+
+// The declaration of the variable `name` used or declared on a line
+class VariableAt : public AST::Visitor
+{
+public:
+    using AST::Visitor::visit;
+
+    VariableAt(std::string_view name, size_t line) : name_(name), line_(line)
+    {
+    }
+
+    const AST::Variable* decl_ = nullptr;
+
+private:
+    void visit(AST::Variable& var) override
+    {
+        if(!decl_ && var.line_ == line_ && var.id_ == name_)
+            decl_ = &var;
+
+        AST::Visitor::visit(var);
+    }
+
+    void visit(AST::VarRef& ref) override
+    {
+        if(!decl_ && ref.line_ == line_ && ref.id_ == name_)
+            decl_ = ref.decl_;
+    }
+
+private:
+    std::string_view name_;
+    size_t line_;
+};
+
+}
+
+struct Document::Chunk
+{
+    // Whole lines, every chunk but the last ends with a line break
+    std::string text_;
+
+    // Offsets of the lines in text_, and the first of them in the document
+    std::vector<size_t> lineStarts_;
+    size_t line_ = 0;
+
+    // Null if the chunk is blank or doesn't parse. The lines in the AST are the chunk's, 1-based.
+    AST::Node::Ptr root_;
+    std::vector<AST::FnDef*> fns_;
+
+    // Per function, what callers see of it and whether it was declared
+    std::vector<std::string> signatures_;
+    std::vector<bool> declared_;
+
+    // Sorted
+    std::vector<std::string_view> calls_;
+
+    std::vector<ChunkError> parseErrors_;
+    std::vector<ChunkError> declErrors_;
+    std::vector<ChunkError> bodyErrors_;
+
+    // The bodies need resolving
+    bool stale_ = true;
+
+    explicit Chunk(std::string text) : text_(std::move(text))
+    {
+        lineStarts_.push_back(0);
+        for(size_t pos = text_.find('\n'); pos != npos && pos + 1 < text_.size(); pos = text_.find('\n', pos + 1))
+        {
+            lineStarts_.push_back(pos + 1);
+        }
+
+        if(isBlank(text_))
+            return;
+
+        try
+        {
+            root_ = Parser(Tokenizer(text_)).buildAST();
+        } catch(const std::exception& e)
+        {
+            parseErrors_.emplace_back(e.what());
+            return;
+        }
+
+        Calls calls;
+        for(auto& c: static_cast<AST::Root&>(*root_).children_)
+        {
+            auto& fn = static_cast<AST::FnDef&>(*c);
+            fns_.push_back(&fn);
+            signatures_.push_back(signature(fn));
+            calls.visit(fn);
+        }
+        declared_.assign(fns_.size(), false);
+
+        calls_ = std::move(calls.names_);
+        std::sort(calls_.begin(), calls_.end());
+        calls_.erase(std::unique(calls_.begin(), calls_.end()), calls_.end());
+    }
+
+    // Without the line break, empty past the end
+    std::string_view line(size_t n) const
+    {
+        if(n >= lineStarts_.size())
+            return {};
+
+        size_t begin = lineStarts_[n];
+        size_t end   = n + 1 < lineStarts_.size() ? lineStarts_[n + 1] - 1 : text_.size();
+        if(end == text_.size() && end > begin && text_.back() == '\n')
+            --end;
+
+        return std::string_view(text_).substr(begin, end - begin);
+    }
+
+    // Of the line of an error, 0-based and within the chunk
+    size_t lineOf(const ChunkError& e) const
+    {
+        return std::min(e.line_ > 0 ? e.line_ - 1 : 0, lineStarts_.size() - 1);
+    }
+};
+
+Document::Document(std::string text)
+{
+    replace(0, 0, text);
+}
+
+Document::~Document() = default;
+
+void Document::edit(TextRange range, std::string_view text)
+{
+    auto before = [](const TextPos& a, const TextPos& b) {
+        return a.line_ < b.line_ || (a.line_ == b.line_ && a.col_ < b.col_);
+    };
+    if(before(range.end_, range.begin_))
+        range.end_ = range.begin_;
+
+    size_t first = chunkAt(range.begin_.line_);
+    size_t last  = chunkAt(range.end_.line_);
+
+    std::string region;
+    for(size_t i = first; i <= last; ++i)
+    {
+        region += chunks_[i]->text_;
+    }
+
+    size_t begin = offsetIn(first, range.begin_);
+    size_t end   = region.size() - chunks_[last]->text_.size() + offsetIn(last, range.end_);
+    region.replace(begin, std::max(begin, end) - begin, text);
+    ++last;
+
+    // Every chunk but the first starts a function and every chunk but the last ends a line, the
+    // neighbours come along where the edit broke that
+    while(!region.empty())
+    {
+        if(first > 0 && !startsFunction(region))
+        {
+            region.insert(0, chunks_[--first]->text_);
+        }
+        else if(last < chunks_.size() && region.back() != '\n')
+        {
+            region += chunks_[last++]->text_;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    replace(first, last, region);
+}
+
+void Document::replace(size_t first, size_t last, const std::string& text)
+{
+    stats_ = EditStats{};
+
+    std::vector<std::unique_ptr<Chunk>> fresh;
+    for(auto& piece: cut(text))
+    {
+        fresh.push_back(std::make_unique<Chunk>(std::move(piece)));
+    }
+
+    if(fresh.empty() && last - first == chunks_.size())
+        fresh.push_back(std::make_unique<Chunk>(""));
+
+    stats_.parsed_ = fresh.size();
+
+    // Functions whose signature came, went or changed, their callers resolve differently now
+    std::vector<std::string> removed;
+    std::vector<std::string> added;
+    for(size_t i = first; i < last; ++i)
+    {
+        removed.insert(removed.end(), chunks_[i]->signatures_.begin(), chunks_[i]->signatures_.end());
+    }
+    for(auto& c: fresh)
+    {
+        added.insert(added.end(), c->signatures_.begin(), c->signatures_.end());
+    }
+    std::sort(removed.begin(), removed.end());
+    std::sort(added.begin(), added.end());
+
+    std::vector<std::string> differ;
+    std::set_symmetric_difference(removed.begin(), removed.end(), added.begin(), added.end(),
+                                  std::back_inserter(differ));
+
+    std::set<std::string, std::less<>> changed;
+    for(auto& sig: differ)
+    {
+        changed.emplace(nameOf(sig));
+    }
+
+    chunks_.erase(chunks_.begin() + static_cast<std::ptrdiff_t>(first), chunks_.begin() + static_cast<std::ptrdiff_t>(last));
+    chunks_.insert(chunks_.begin() + static_cast<std::ptrdiff_t>(first), std::make_move_iterator(fresh.begin()),
+                   std::make_move_iterator(fresh.end()));
+
+    firstLines_.resize(chunks_.size());
+    for(size_t i = std::max<size_t>(first, 1); i < chunks_.size(); ++i)
+    {
+        chunks_[i]->line_ = chunks_[i - 1]->line_ + chunks_[i - 1]->lineStarts_.size();
+        firstLines_[i]    = chunks_[i]->line_;
+    }
+
+    if(!changed.empty())
+    {
+        auto affected = [&](const std::string_view& name) { return changed.find(name) != changed.end(); };
+        for(auto& c: chunks_)
+        {
+            c->stale_ = c->stale_ || std::any_of(c->calls_.begin(), c->calls_.end(), affected)
+                     || std::any_of(c->signatures_.begin(), c->signatures_.end(),
+                                    [&](const std::string& sig) { return affected(nameOf(sig)); });
+        }
+    }
+
+    stats_.chunks_ = chunks_.size();
+    resolve();
+}
+
+void Document::resolve()
+{
+    Resolver resolver(types_);
+    fns_.clear();
+
+    for(auto& c: chunks_)
+    {
+        c->declErrors_.clear();
+        for(size_t i = 0; i < c->fns_.size(); ++i)
+        {
+            auto& fn = *c->fns_[i];
+            try
+            {
+                resolver.declare(fn);
+                c->declared_[i] = true;
+                fns_.insert(fn.id_, Definition{c.get(), &fn});
+            } catch(const std::exception& e)
+            {
+                c->declared_[i] = false;
+                c->declErrors_.emplace_back(e.what());
+            }
+        }
+    }
+
+    for(auto& c: chunks_)
+    {
+        if(!c->stale_)
+            continue;
+
+        c->stale_ = false;
+        c->bodyErrors_.clear();
+        ++stats_.resolved_;
+
+        for(size_t i = 0; i < c->fns_.size(); ++i)
+        {
+            if(!c->declared_[i])
+                continue;
+
+            try
+            {
+                resolver.resolveBody(*c->fns_[i]);
+            } catch(const std::exception& e)
+            {
+                c->bodyErrors_.emplace_back(e.what());
+            }
+        }
+    }
+}
+
+size_t Document::chunkAt(size_t line) const
+{
+    auto it = std::upper_bound(firstLines_.begin(), firstLines_.end(), line);
+    return it == firstLines_.begin() ? 0 : static_cast<size_t>(it - firstLines_.begin()) - 1;
+}
+
+size_t Document::offsetIn(size_t idx, TextPos pos) const
+{
+    const Chunk& c = *chunks_[idx];
+
+    size_t rel = pos.line_ - c.line_;
+    if(rel >= c.lineStarts_.size())
+        return c.text_.size();
+
+    return c.lineStarts_[rel] + std::min(pos.col_, c.line(rel).size());
+}
+
+std::string Document::text() const
+{
+    std::string s;
+    for(auto& c: chunks_)
+    {
+        s += c->text_;
+    }
+    return s;
+}
+
+size_t Document::lines() const
+{
+    const Chunk& c = *chunks_.back();
+    return c.line_ + c.lineStarts_.size() + (!c.text_.empty() && c.text_.back() == '\n');
+}
+
+std::string_view Document::line(size_t n) const
+{
+    const Chunk& c = *chunks_[chunkAt(n)];
+    return c.line(n - c.line_);
+}
+
+std::vector<Document::Diagnostic> Document::diagnostics() const
+{
+    std::vector<Diagnostic> result;
+    for(auto& c: chunks_)
+    {
+        for(auto* errors: {&c->parseErrors_, &c->declErrors_, &c->bodyErrors_})
+        {
+            for(const ChunkError& e: *errors)
+            {
+                result.push_back(Diagnostic{lineRange(*c, c->lineOf(e)), e.message(c->line_ + e.line_)});
+            }
+        }
+    }
+
+    std::stable_sort(result.begin(), result.end(), [](const Diagnostic& a, const Diagnostic& b) {
+        return a.range_.begin_.line_ < b.range_.begin_.line_;
+    });
+    return result;
+}
+
+std::vector<Document::Symbol> Document::symbols() const
+{
+    std::vector<Symbol> result;
+    result.reserve(fns_.size());
+
+    for(auto& c: chunks_)
+    {
+        for(size_t i = 0; i < c->fns_.size(); ++i)
+        {
+            const AST::FnDef& fn = *c->fns_[i];
+
+            // Up to the next function of the chunk, blank lines after it aside
+            size_t begin = fn.line_ - 1;
+            size_t end   = (i + 1 < c->fns_.size() ? c->fns_[i + 1]->line_ - 1 : c->lineStarts_.size()) - 1;
+            while(end > begin && isBlank(c->line(end)))
+            {
+                --end;
+            }
+
+            Symbol sym;
+            sym.name_      = fn.id_;
+            sym.selection_ = wordRange(*c, begin, fn.id_, 2);
+            sym.range_     = TextRange{{c->line_ + begin, 0}, {c->line_ + end, c->line(end).size()}};
+
+            std::string_view header = c->line(begin);
+            size_t from             = std::min(sym.selection_.end_.col_, header.size());
+            header                  = header.substr(from, header.rfind('{') - from);
+            while(!header.empty() && std::isspace(static_cast<unsigned char>(header.back())))
+            {
+                header.remove_suffix(1);
+            }
+            sym.detail_ = header;
+
+            result.push_back(std::move(sym));
+        }
+    }
+    return result;
+}
+
+std::optional<TextRange> Document::definition(TextPos pos) const
+{
+    std::string_view text = line(pos.line_);
+
+    size_t begin = std::min(pos.col_, text.size());
+    size_t end   = begin;
+    while(begin > 0 && isIdChar(text[begin - 1]))
+    {
+        --begin;
+    }
+    while(end < text.size() && isIdChar(text[end]))
+    {
+        ++end;
+    }
+
+    if(begin == end || std::isdigit(static_cast<unsigned char>(text[begin])))
+        return std::nullopt;
+
+    std::string_view word = text.substr(begin, end - begin);
+
+    size_t next = text.find_first_not_of(" \t", end);
+    bool call   = next != npos && text[next] == '(';
+
+    // A variable of the function around the line, as the Resolver saw it
+    const Chunk& c = *chunks_[chunkAt(pos.line_)];
+    if(!call && c.root_)
+    {
+        size_t line    = pos.line_ - c.line_ + 1;
+        AST::FnDef* fn = nullptr;
+        for(auto* f: c.fns_)
+        {
+            if(f->line_ <= line)
+                fn = f;
+        }
+
+        if(fn)
+        {
+            VariableAt at(word, line);
+            at.visit(*fn);
+            if(at.decl_)
+            {
+                // Parameters are on the line of `fn`, after its name
+                size_t declLine = at.decl_->line_ - 1;
+                size_t from     = at.decl_->line_ == fn->line_ ? c.line(declLine).find('(') : 0;
+                return wordRange(c, declLine, word, from == npos ? 0 : from);
+            }
+        }
+    }
+
+    if(auto* def = fns_.find(word))
+        return wordRange(*def->chunk_, def->fn_->line_ - 1, word, 2);
+
+    return std::nullopt;
+}
+
+TextRange Document::lineRange(const Chunk& chunk, size_t line)
+{
+    std::string_view text = chunk.line(line);
+    size_t indent         = std::min(text.find_first_not_of(" \t"), text.size());
+
+    line += chunk.line_;
+    return TextRange{{line, indent}, {line, text.size()}};
+}
+
+TextRange Document::wordRange(const Chunk& chunk, size_t line, std::string_view word, size_t from)
+{
+    size_t pos = findWord(chunk.line(line), word, from);
+    if(pos == npos)
+        return lineRange(chunk, line);
+
+    line += chunk.line_;
+    return TextRange{{line, pos}, {line, pos + word.size()}};
+}
+
+}
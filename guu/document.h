@@ -0,0 +1,139 @@
+#pragma once
+
+#include "ast.h"
+#include "types.h"
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../util/flat_map.h"
+
+namespace Guu
+{
+
+// In a Document, both 0-based. Columns count bytes.
+struct TextPos
+{
+    size_t line_ = 0;
+    size_t col_  = 0;
+};
+
+struct TextRange
+{
+    TextPos begin_;
+    TextPos end_;
+};
+
+// A source file kept parsed and resolved across edits, for the language
+// server. The text is cut into chunks before every line that starts with
+// `fn`, and every chunk is lexed and parsed on its own, so an edit only parses
+// the chunks it touches again. A chunk that doesn't parse is reported on its
+// own while the rest stays resolved, since the cuts don't depend on the code
+// in between.
+//
+// After an edit every signature is declared again, which is cheap, but only
+// the bodies of new chunks and of chunks that call or define a function whose
+// signature changed are resolved again.
+class Document
+{
+public:
+    struct Diagnostic
+    {
+        TextRange range_;
+        std::string message_;
+    };
+
+    struct Symbol
+    {
+        std::string name_;
+
+        // The signature as written, like `(n: int) -> int`
+        std::string detail_;
+
+        // From `fn` to the last line of the function, and the name
+        TextRange range_;
+        TextRange selection_;
+    };
+
+    // What the last edit, or the initial parse, did
+    struct EditStats
+    {
+        size_t chunks_   = 0;
+        size_t parsed_   = 0;
+        size_t resolved_ = 0;
+    };
+
+    explicit Document(std::string text);
+    ~Document();
+
+    Document(const Document&)            = delete;
+    Document& operator=(const Document&) = delete;
+
+    // Replaces `range` by `text`. Positions past the end of a line or of the text are clamped.
+    void edit(TextRange range, std::string_view text);
+
+    std::string text() const;
+
+    size_t lines() const;
+
+    // Without the line break, empty past the end
+    std::string_view line(size_t n) const;
+
+    // Ordered by line
+    std::vector<Diagnostic> diagnostics() const;
+
+    std::vector<Symbol> symbols() const;
+
+    // Where the function or variable named at `pos` is declared
+    std::optional<TextRange> definition(TextPos pos) const;
+
+    const EditStats& lastEdit() const
+    {
+        return stats_;
+    }
+
+private:
+    struct Chunk;
+
+    struct Definition
+    {
+        const Chunk* chunk_   = nullptr;
+        const AST::FnDef* fn_ = nullptr;
+    };
+
+    // Index of the chunk with `line`
+    size_t chunkAt(size_t line) const;
+
+    // Of `pos` in the text of chunk `idx`
+    size_t offsetIn(size_t idx, TextPos pos) const;
+
+    // Puts the chunks cut from `text` in place of the chunks [first, last)
+    void replace(size_t first, size_t last, const std::string& text);
+
+    // Declares every function and resolves the bodies of the chunks marked stale
+    void resolve();
+
+    // Of line `line` of `chunk` without its indentation, and of `word` on it at or after column `from`
+    static TextRange lineRange(const Chunk& chunk, size_t line);
+    static TextRange wordRange(const Chunk& chunk, size_t line, std::string_view word, size_t from);
+
+private:
+    TypeTable types_;
+
+    // Never empty, an empty text has one empty chunk
+    std::vector<std::unique_ptr<Chunk>> chunks_;
+
+    // The first line of every chunk, searched without touching the chunks
+    std::vector<size_t> firstLines_;
+
+    // Every function declared, by name
+    util::FlatMap<std::string_view, Definition> fns_;
+
+    EditStats stats_;
+};
+
+}
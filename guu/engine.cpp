@@ -0,0 +1,42 @@
+#include "engine.h"
+#include "compiler.h"
+#include "escape.h"
+#include "lexer.h"
+#include "parser.h"
+#include "resolver.h"
+#include "tail_calls.h"
+#include "types.h"
+
+#include <utility>
+
+namespace Guu
+{
+
+Program::Program(std::string source, int optLevel)
+{
+    TypeTable types;
+
+    auto ast = Parser(Tokenizer(std::move(source))).buildAST();
+    Resolver(types).resolve(*ast);
+
+    if(optLevel > 0)
+        Optimizer(types, optLevel).run(*ast);
+
+    EscapeAnalysis(types).run(*ast);
+    TailCalls().run(*ast);
+    module_ = Compiler(types).compile(*ast);
+
+    // Folded concatenations are ropes, flattened now so that contexts only ever read them
+    for(const Value& c: module_.constants_)
+    {
+        if(c.isStr())
+            c.asStr();
+    }
+}
+
+Context::Context(std::shared_ptr<const Program> program, std::ostream& out, size_t maxDepth)
+    : program_(std::move(program)), vm_(program_->module(), out, maxDepth)
+{
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "bytecode.h"
+#include "call_stack.h"
+#include "optimizer.h"
+#include "value.h"
+#include "vm.h"
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Guu
+{
+
+// Entry point for embedding Guu. A Program is compiled once and never changes
+// afterwards, so any number of threads may share one. Each Context runs it on
+// a VM with a call stack and heap of its own:
+//
+//     auto program = std::make_shared<const Program>(source);
+//     // on every thread
+//     Context context(program, out);
+//     Value result = context.run(args);
+//
+// Contexts share no objects and take no locks, a Context itself is used by
+// one thread at a time. Values returned by a Context belong to it and must not
+// be handed to another thread while it runs.
+class Program
+{
+public:
+    // Throws std::runtime_error on syntax and type errors
+    explicit Program(std::string source, int optLevel = Optimizer::MAX_LEVEL);
+
+    const Bytecode::Module& module() const
+    {
+        return module_;
+    }
+
+private:
+    Bytecode::Module module_;
+};
+
+class Context
+{
+public:
+    Context(std::shared_ptr<const Program> program, std::ostream& out,
+            size_t maxDepth = CallStack::DEFAULT_MAX_DEPTH);
+
+    Context(const Context&)            = delete;
+    Context& operator=(const Context&) = delete;
+
+    // Calls `main`, passing `args` if it takes them. Throws RuntimeError if
+    // the program fails, after which the Context can run again.
+    Value run(const std::vector<std::string>& args)
+    {
+        return vm_.run(args);
+    }
+
+    // Worker threads for the parallel loops and tasks of this Context, see VM::setThreads()
+    void setThreads(size_t threads)
+    {
+        vm_.setThreads(threads);
+    }
+
+    const Program& program() const
+    {
+        return *program_;
+    }
+
+private:
+    // Outlives the VM reading its module
+    std::shared_ptr<const Program> program_;
+    VM vm_;
+};
+
+}
@@ -0,0 +1,311 @@
+#include "escape.h"
+
+#include <cassert>
+
+namespace Guu
+{
+
+size_t EscapeAnalysis::run(AST::Node& root)
+{
+    moved_ = 0;
+    visit(root);
+    return moved_;
+}
+
+void EscapeAnalysis::visit(AST::FnDef& fn)
+{
+    flows_.assign(fn.frameSize_, Flow());
+    scopes_.assign(1, Scope{NONE, &fn});
+    sites_.clear();
+
+    fn.region_ = false;
+    scope_     = 0;
+
+    for(auto& p: fn.params_)
+    {
+        declare(static_cast<AST::Variable&>(*p));
+    }
+
+    visitAll(fn.statements_);
+    solve();
+
+    scope_ = NONE;
+}
+
+void EscapeAnalysis::visit(AST::Variable& var)
+{
+    if(var.init_)
+    {
+        size_t v = value(*var.init_);
+        declare(var);
+        flow(v, var.slot_);
+        return;
+    }
+
+    declare(var);
+    if(types_.isArray(var.resolvedType_))
+        flow(site(var), var.slot_);
+}
+
+void EscapeAnalysis::visit(AST::Return& ret)
+{
+    escape(value(*ret.value_));
+}
+
+void EscapeAnalysis::visit(AST::If& stmt)
+{
+    value(*stmt.cond_);
+    visitAll(stmt.then_);
+    visitAll(stmt.else_);
+}
+
+void EscapeAnalysis::visit(AST::While& stmt)
+{
+    size_t outer = scope_;
+
+    scope_ = NONE;
+    value(*stmt.cond_);
+
+    stmt.region_ = false;
+    scopes_.push_back(Scope{outer, &stmt});
+    scope_ = scopes_.size() - 1;
+
+    visitAll(stmt.body_);
+
+    scope_ = outer;
+}
+
+void EscapeAnalysis::visit(AST::ParallelFor& stmt)
+{
+    value(*stmt.from_);
+    value(*stmt.to_);
+
+    size_t outer = scope_;
+
+    stmt.region_ = false;
+    scopes_.push_back(Scope{outer, &stmt});
+    scope_ = scopes_.size() - 1;
+
+    declare(static_cast<AST::Variable&>(*stmt.var_));
+    visitAll(stmt.body_);
+
+    scope_ = outer;
+}
+
+void EscapeAnalysis::visit(AST::Assign& stmt)
+{
+    size_t v = value(*stmt.value_);
+
+    if(stmt.target_->type_ == AST::NodeType::VarRef)
+    {
+        flow(v, static_cast<AST::VarRef&>(*stmt.target_).slot_);
+        return;
+    }
+
+    escape(v);
+
+    auto& idx = static_cast<AST::Index&>(*stmt.target_);
+    value(*idx.array_);
+    value(*idx.index_);
+}
+
+void EscapeAnalysis::visit(AST::BinOp& op)
+{
+    size_t lhs = value(*op.op1_);
+    size_t rhs = value(*op.op2_);
+
+    // A rope keeps both halves
+    if(op.resolvedType_ == types_.strType())
+    {
+        size_t s = site(op);
+        flow(lhs, s);
+        flow(rhs, s);
+        value_ = s;
+        return;
+    }
+
+    value_ = types_.isArray(op.resolvedType_) ? site(op) : NONE;
+}
+
+void EscapeAnalysis::visit(AST::UnaryOp& op)
+{
+    value(*op.op_);
+    value_ = types_.isArray(op.resolvedType_) ? site(op) : NONE;
+}
+
+void EscapeAnalysis::visit(AST::Call& call)
+{
+    if(call.builtin_ == Builtin::None)
+    {
+        for(auto& a: call.args_)
+        {
+            escape(value(*a));
+        }
+
+        value_ = NONE;
+        return;
+    }
+
+    // Builtins keep no reference to their arguments
+    for(auto& a: call.args_)
+    {
+        value(*a);
+    }
+
+    bool allocates = call.builtin_ == Builtin::Filter || call.builtin_ == Builtin::Copy;
+    value_         = allocates ? site(call) : NONE;
+}
+
+void EscapeAnalysis::visit(AST::VarRef& ref)
+{
+    value_ = ref.slot_;
+}
+
+void EscapeAnalysis::visit(AST::Index& idx)
+{
+    // Elements were stored into an array, so they escaped already
+    value(*idx.array_);
+    value(*idx.index_);
+    value_ = NONE;
+}
+
+void EscapeAnalysis::visit(AST::Const&)
+{
+    value_ = NONE;
+}
+
+void EscapeAnalysis::visit(AST::ConstArray& arr)
+{
+    for(auto& e: arr.elements_)
+    {
+        escape(value(*e));
+    }
+
+    value_ = site(arr);
+}
+
+size_t EscapeAnalysis::value(AST::Node& expr)
+{
+    value_ = NONE;
+    visit(expr);
+    return value_;
+}
+
+size_t EscapeAnalysis::site(AST::Node& n)
+{
+    n.region_ = false;
+
+    Flow f;
+    f.scope_ = scope_;
+    f.site_  = &n;
+    flows_.push_back(std::move(f));
+
+    sites_.push_back(flows_.size() - 1);
+    return flows_.size() - 1;
+}
+
+void EscapeAnalysis::flow(size_t from, size_t to)
+{
+    if(from != NONE)
+        flows_[from].to_.push_back(to);
+}
+
+void EscapeAnalysis::escape(size_t node)
+{
+    if(node != NONE)
+        flows_[node].escapes_ = true;
+}
+
+void EscapeAnalysis::declare(AST::Variable& var)
+{
+    // Slots are shared by variables of sibling scopes, the slot lives as long as all of them
+    auto& f  = flows_[var.slot_];
+    f.scope_ = f.scope_ == NONE ? scope_ : common(f.scope_, scope_);
+}
+
+void EscapeAnalysis::solve()
+{
+    for(size_t s: sites_)
+    {
+        flows_[s].eligible_ = flows_[s].scope_ != NONE;
+    }
+
+    // A site that stops qualifying disqualifies the ones flowing into it
+    for(bool changed = true; changed;)
+    {
+        changed = false;
+        for(size_t s: sites_)
+        {
+            if(flows_[s].eligible_ && !qualifies(s))
+            {
+                flows_[s].eligible_ = false;
+                changed             = true;
+            }
+        }
+    }
+
+    for(size_t s: sites_)
+    {
+        const Flow& f = flows_[s];
+        if(!f.eligible_)
+            continue;
+
+        f.site_->region_                  = true;
+        scopes_[f.scope_].owner_->region_ = true;
+        ++moved_;
+    }
+}
+
+bool EscapeAnalysis::qualifies(size_t site) const
+{
+    size_t scope = flows_[site].scope_;
+
+    std::vector<bool> seen(flows_.size());
+    std::vector<size_t> pending{site};
+    seen[site] = true;
+
+    while(!pending.empty())
+    {
+        const Flow& f = flows_[pending.back()];
+        pending.pop_back();
+
+        if(f.escapes_ || (f.site_ && !f.eligible_) || !within(f.scope_, scope))
+            return false;
+
+        for(size_t to: f.to_)
+        {
+            if(!seen[to])
+            {
+                seen[to] = true;
+                pending.push_back(to);
+            }
+        }
+    }
+
+    return true;
+}
+
+bool EscapeAnalysis::within(size_t scope, size_t ancestor) const
+{
+    for(; scope != NONE; scope = scopes_[scope].parent_)
+    {
+        if(scope == ancestor)
+            return true;
+    }
+
+    return false;
+}
+
+size_t EscapeAnalysis::common(size_t a, size_t b) const
+{
+    for(; a != NONE; a = scopes_[a].parent_)
+    {
+        if(within(b, a))
+            return a;
+    }
+
+    assert(false && "Scopes share the function body");
+    return 0;
+}
+
+}
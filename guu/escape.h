@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ast.h"
+#include "types.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace Guu
+{
+
+// Finds the strings and arrays that never outlive the call or loop iteration
+// allocating them and sets Node::region_ on their allocation sites, so the VM
+// puts them in a Heap region instead of on the global heap.
+//
+// Flow-insensitive and per function. Values flow into variables through
+// initialization and assignment, and into concatenations, whose ropes keep
+// their halves. A value escapes when it is returned, passed to a function or
+// stored into an array. A site qualifies if nothing it flows into escapes and
+// every variable it reaches is declared in the region it runs in: the body of
+// its innermost loop, or the function outside of loops. Each iteration of a
+// parallel for gets a region of its own, on the worker running it. Loop
+// conditions run many times per region, so their sites stay on the heap.
+class EscapeAnalysis : public AST::Visitor
+{
+    static constexpr size_t NONE = static_cast<size_t>(-1);
+
+    // A variable (by slot) or an allocation site
+    struct Flow
+    {
+        std::vector<size_t> to_;
+        size_t scope_    = NONE;
+        AST::Node* site_ = nullptr;
+        bool escapes_    = false;
+        bool eligible_   = true;
+    };
+
+    // The function body or a loop body
+    struct Scope
+    {
+        size_t parent_;
+        AST::Node* owner_;
+    };
+
+public:
+    using AST::Visitor::visit;
+
+    explicit EscapeAnalysis(const TypeTable& types) : types_(types)
+    {
+    }
+
+    // Returns the number of sites moved to regions
+    size_t run(AST::Node& root);
+
+private:
+    void visit(AST::FnDef& fn) override;
+    void visit(AST::Variable& var) override;
+    void visit(AST::Return& ret) override;
+    void visit(AST::If& stmt) override;
+    void visit(AST::While& stmt) override;
+    void visit(AST::ParallelFor& stmt) override;
+    void visit(AST::Assign& stmt) override;
+
+    // Expressions leave the flow node of their value in value_
+    void visit(AST::BinOp& op) override;
+    void visit(AST::UnaryOp& op) override;
+    void visit(AST::Call& call) override;
+    void visit(AST::VarRef& ref) override;
+    void visit(AST::Index& idx) override;
+    void visit(AST::Const& c) override;
+    void visit(AST::ConstArray& arr) override;
+
+private:
+    size_t value(AST::Node& expr);
+    size_t site(AST::Node& n);
+    void flow(size_t from, size_t to);
+    void escape(size_t node);
+    void declare(AST::Variable& var);
+
+    // Marks the qualifying sites of the current function
+    void solve();
+    bool qualifies(size_t site) const;
+    bool within(size_t scope, size_t ancestor) const;
+    size_t common(size_t a, size_t b) const;
+
+private:
+    const TypeTable& types_;
+
+    std::vector<Flow> flows_;
+    std::vector<Scope> scopes_;
+    std::vector<size_t> sites_;
+
+    size_t scope_ = NONE;
+    size_t value_ = NONE;
+    size_t moved_ = 0;
+};
+
+}
@@ -0,0 +1,73 @@
+#include "heap.h"
+#include "value.h"
+
+#include <algorithm>
+
+namespace Guu
+{
+
+Heap::~Heap()
+{
+    leave(0);
+}
+
+void Heap::leave(size_t depth)
+{
+    while(marks_.size() > depth)
+    {
+        const Mark& mark = marks_.back();
+
+        // Newest first: a rope node refers to older halves, never the other way round
+        while(objects_ != mark.objects_)
+        {
+            Link* link = objects_;
+            objects_   = link->prev_;
+            finalize(reinterpret_cast<Object*>(link + 1));
+        }
+
+        chunk_ = mark.chunk_;
+        used_  = mark.used_;
+        marks_.pop_back();
+    }
+}
+
+void* Heap::allocateObject(size_t size)
+{
+    static_assert(sizeof(Link) % alignof(Object) == 0, "Objects must be aligned after their link");
+
+    GUU_STATS_COUNT(regionObjects_);
+
+    auto* link  = static_cast<Link*>(allocate(sizeof(Link) + size, alignof(Link)));
+    link->prev_ = objects_;
+    objects_    = link;
+    return link + 1;
+}
+
+void Heap::nextChunk(size_t size)
+{
+    size_t next = chunks_.empty() ? 0 : chunk_ + 1;
+
+    // Chunks above the top are unused, so one too small for `size` is simply replaced
+    if(next == chunks_.size() || chunks_[next].size_ < size)
+    {
+        size_t grown = next ? std::min(chunks_[next - 1].size_ * 2, MAX_CHUNK) : MIN_CHUNK;
+        size_t bytes = std::max(grown, size);
+
+        Chunk chunk{std::unique_ptr<std::byte[], FreeChunk>(
+                        static_cast<std::byte*>(::operator new(bytes, std::align_val_t(CHUNK_ALIGN)))),
+                    bytes};
+
+        if(next == chunks_.size())
+        {
+            chunks_.push_back(std::move(chunk));
+        }
+        else
+        {
+            chunks_[next] = std::move(chunk);
+        }
+    }
+
+    chunk_ = next;
+}
+
+}
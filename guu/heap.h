@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "stats.h"
+
+#include "../util/aligned_allocator.h"
+
+namespace Guu
+{
+
+struct Object;
+
+// Region heap of the VM for objects that EscapeAnalysis proved never to outlive
+// the call or loop iteration allocating them. Regions nest like the frames and
+// loops they belong to, so all of them share one stack of chunks: entering a
+// region remembers the top, leaving it finalizes the objects allocated since
+// in reverse order and pops their memory at once. Chunks stay around for the
+// next region, so a warmed-up program allocates no memory for them at all.
+//
+// Region objects are reference counted like any other, but reaching zero does
+// not free them. Nothing outside the region may refer to them when it is left.
+class Heap
+{
+public:
+    Heap() = default;
+    ~Heap();
+
+    Heap(const Heap&)            = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    // Number of open regions
+    size_t depth() const
+    {
+        return marks_.size();
+    }
+
+    void enter()
+    {
+        marks_.push_back(Mark{chunk_, used_, objects_});
+    }
+
+    // Leaves regions until `depth` are open
+    void leave(size_t depth);
+
+    // Memory in the innermost region, `align` is at most CHUNK_ALIGN
+    void* allocate(size_t size, size_t align)
+    {
+        assert(!marks_.empty() && align <= CHUNK_ALIGN && (align & (align - 1)) == 0);
+        GUU_STATS_ADD(regionBytes_, size);
+
+        size_t offset = (used_ + align - 1) & ~(align - 1);
+        if(chunk_ >= chunks_.size() || offset + size > chunks_[chunk_].size_)
+        {
+            nextChunk(size);
+            offset = 0;
+        }
+
+        used_ = offset + size;
+        return chunks_[chunk_].data_.get() + offset;
+    }
+
+    // Memory for an Object of `size` bytes, finalized when the region is left
+    void* allocateObject(size_t size);
+
+private:
+    static constexpr size_t CHUNK_ALIGN = 64;
+    static constexpr size_t MIN_CHUNK   = size_t(64) << 10;
+    static constexpr size_t MAX_CHUNK   = size_t(16) << 20;
+
+    struct FreeChunk
+    {
+        void operator()(std::byte* p) const noexcept
+        {
+            ::operator delete(p, std::align_val_t(CHUNK_ALIGN));
+        }
+    };
+
+    struct Chunk
+    {
+        std::unique_ptr<std::byte[], FreeChunk> data_;
+        size_t size_;
+    };
+
+    // Precedes every object, objects_ is the most recent one
+    struct Link
+    {
+        Link* prev_;
+    };
+
+    struct Mark
+    {
+        size_t chunk_;
+        size_t used_;
+        Link* objects_;
+    };
+
+    void nextChunk(size_t size);
+
+private:
+    std::vector<Chunk> chunks_;
+    size_t chunk_  = 0;
+    size_t used_   = 0;
+    Link* objects_ = nullptr;
+
+    std::vector<Mark> marks_;
+};
+
+// Allocator of the elements of arrays. With a Heap the storage comes from its
+// innermost region and is never given back on its own, otherwise from the
+// global heap, starting on an `Align` byte boundary either way. The default
+// does not look at T, which may still be incomplete where the vector is declared.
+template <typename T, size_t Align = alignof(std::max_align_t)>
+class RegionAllocator
+{
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = RegionAllocator<U, Align>;
+    };
+
+    RegionAllocator(Heap* region = nullptr) noexcept : region_(region)
+    {
+    }
+
+    template <typename U>
+    RegionAllocator(const RegionAllocator<U, Align>& o) noexcept : region_(o.region())
+    {
+    }
+
+    Heap* region() const
+    {
+        return region_;
+    }
+
+    T* allocate(size_t n)
+    {
+        if(region_)
+            return static_cast<T*>(region_->allocate(n * sizeof(T), Align));
+
+        return util::AlignedAllocator<T, Align>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        if(!region_)
+            util::AlignedAllocator<T, Align>().deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const RegionAllocator<U, Align>& o) const noexcept
+    {
+        return region_ == o.region();
+    }
+
+    template <typename U>
+    bool operator!=(const RegionAllocator<U, Align>& o) const noexcept
+    {
+        return region_ != o.region();
+    }
+
+private:
+    Heap* region_;
+};
+
+}
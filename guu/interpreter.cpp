@@ -1,280 +1,415 @@
-// #include "interpreter.h"
-
-// #include <cassert>
-// #include <set>
-// #include <iostream>
-
-// namespace Guu
-// {
-
-// Interpreter::Interpreter(std::unique_ptr<AST::Node> program)
-//     : prg_(std::move(program))
-// {
-//     compile();
-//     jumpTo("main");
-// }
-
-// void Interpreter::interpret()
-// {
-//     while (!isEnd())
-//     {
-//         execute(*currentInstruction_);
-//     }
-// }
-
-// void Interpreter::execute(Interpreter::Instruction i)
-// {
-//     switch (i->type_)
-//     {
-//         case AST::NodeType::BinOp:
-//             return execute(static_cast<const AST::BinOp&>(*i));
-
-//   case AST::NodeType::UnaryOp:
-//       return execute(static_cast<const AST::UnaryOp&>(*i));
-
-//   default:
-//       throw std::runtime_error("Unknown instruction executed");
-// }
-// }
-
-// void Interpreter::execute(const AST::BinOp& op)
-// {
-//     switch (op.token_.type_)
-//     {
-//         case TT::SET:
-//         {
-//             auto&& id = dynamic_cast<AST::Param&>(*op.op1_);
-//             assert(id.token_.type_ == TT::ID);
-
-//   auto&& val = dynamic_cast<AST::Param&>(*op.op2_);
-//   assert((std::set{TT::NUM, TT::ID}.count(val.token_.type_)));
-
-//   setVariable(
-//       id.value_,
-//       val.token_.type_ == TokenType::NUM ? val.value_ : getVariable(val.value_)
-//   );
-
-//   moveNext();
-// } break;
-
-//   default:
-//       throw std::runtime_error("Unknown instuction executed");
-// }
-// }
-
-// void Interpreter::execute(const AST::UnaryOp& op)
-// {
-//     auto&& par = dynamic_cast<AST::Param&>(*op.op_);
-
-//   switch (op.token_.type_)
-//   {
-//       case TT::PRINT:
-//       {
-//           assert((std::set{TT::NUM, TT::ID}.count(par.token_.type_)));
-//           auto&& val = par.token_.type_ == TT::NUM ? par.value_ : getVariable(par.value_);
-//           std::cout << val << std::endl;
-//           moveNext();
-//       } break;
-
-//   case TT::CALL:
-//   {
-//       assert(par.token_.type_ == TT::ID);
-//       jumpTo(par.value_);
-//   } break;
-
-//   default:
-//       throw std::runtime_error("Unknown instuction executed");
-// }
-// }
-
-// void Interpreter::compile()
-// {
-//     visit(*prg_);
-
-//   currProc_ = "";
-//   currentInstruction_ = {};
-// }
-
-// void Interpreter::visit(const AST::FnDef& proc)
-// {
-//     if (hasProc(proc.name_))
-//     {
-//         throw std::runtime_error("Double definition of '" + proc.name_ + "'");
-//     }
-
-//   defineProc(proc.name_);
-//   currProc_ = proc.name_;
-// }
-
-// void Interpreter::visit(const AST::BinOp& binOp)
-// {
-//     switch (binOp.token_.type_)
-//     {
-//         case TT::SET:
-//         {
-//             addInstruction( &binOp );
-//         } break;
-
-//   default:
-//       throw std::runtime_error("Unknown BinOp");
-// }
-// }
-
-// void Interpreter::visit(const AST::UnaryOp& op)
-// {
-//     switch (op.token_.type_)
-//     {
-//         case TT::PRINT:
-//         case TT::CALL:
-//         {
-//             addInstruction( &op );
-//         } break;
-
-//   default:
-//       throw std::runtime_error("Unknown UnaryOp");
-// }
-// }
-
-// void Interpreter::defineProc(const Interpreter::Address& address)
-// {
-//     text_[address] = {};
-// }
-
-// bool Interpreter::hasProc(const Interpreter::Address& address)
-// {
-//     return text_.find(address) != text_.end();
-// }
-
-// void Interpreter::addInstruction(Interpreter::Instruction i)
-// {
-//     findProc(currProc_).emplace_back( std::move(i) );
-// }
-
-// std::vector<Interpreter::Instruction>& Interpreter::findProc(const Interpreter::Address& address)
-// {
-//     try
-//     {
-//         return text_.at(address);
-//     }
-//     catch(const std::out_of_range&)
-//     {
-//         throw std::runtime_error("Unknown sub '" + address + "'");
-//     }
-// }
-
-// void Interpreter::setVariable(const Interpreter::Address& address, const std::string& value)
-// {
-//     globalMemory_[address] = value;
-// }
-
-// std::string Interpreter::getVariable(const Interpreter::Address& address)
-// {
-//     try
-//     {
-//         return globalMemory_.at(address);
-//     }
-//     catch(const std::out_of_range&)
-//     {
-//         throw std::runtime_error("Unknown variable '" + address + "'");
-//     }
-// }
-
-// void Interpreter::moveNext()
-// {
-//     if (isEnd())
-//     {
-//         return;
-//     }
-
-//   currentInstruction_++;
-//   while (findProc(currProc_).cend() == currentInstruction_)
-//   {
-//       std::tie(currProc_, currentInstruction_) = stack_.top();
-//       stack_.pop();
-//   }
-// }
-
-// void Interpreter::jumpTo(const Interpreter::Address& address)
-// {
-//     if (stack_.size())
-//     {
-//         stack_.push( {currProc_, currentInstruction_ + 1} );
-//         currentInstruction_ = findProc(address).cbegin();
-//         currProc_ = address;
-
-//   if (stack_.size() > 1024)
-//   {
-//       throw std::runtime_error("!!! STACK OVERFLOW !!!");
-//   }
-// }
-// else
-// {
-//   if (address != "main")
-//   {
-//       throw std::runtime_error("PLEASE START FROM MAIN");
-//   }
-//   currentInstruction_ = findProc("main").cbegin();
-//   currProc_ = address;
-//   stack_.push( {currProc_, currentInstruction_ } );
-// }
-// }
-
-// bool Interpreter::isEnd() const
-// {
-//     return stack_.size() == 0;
-// }
-
-// void Interpreter::bt() const
-// {
-//     if (isEnd())
-//     {
-//         return;
-//     }
-
-//   auto backTrace = stack_;
-//   auto sub = currProc_;
-
-//   std::cout << "#0  " << sub << " at " << (*currentInstruction_)->line_ << std::endl;
-
-//   int num = 1;
-//   while (backTrace.size() != 1)
-//   {
-//       auto [sub, i] = backTrace.top();
-//       backTrace.pop();
-//       std::cout << "#" << (num++) << "  " << sub << " at " << (*(i-1))->line_ << std::endl;
-//   }
-// }
-
-// void Interpreter::stepOver()
-// {
-//     if (isEnd())
-//     {
-//         return;
-//     }
-
-//   auto ss = stack_.size();
-//   do
-//   {
-//       execute(*currentInstruction_);
-//   } while (stack_.size() > ss);
-// }
-
-// void Interpreter::stepInto()
-// {
-//     if (isEnd())
-//     {
-//         return;
-//     }
-
-//   execute(*currentInstruction_);
-// }
-
-// void Interpreter::printVars() const
-// {
-//     for(auto&& [k, v] : globalMemory_)
-//     {
-//         std::cout << k << " = " << v << std::endl;
-//     }
-// }
-
-// }
+#include "interpreter.h"
+#include "arith.h"
+#include "array_ops.h"
+#include "tiering.h"
+
+#include <cassert>
+#include <iostream>
+#include <utility>
+
+namespace Guu
+{
+
+Interpreter::Interpreter(AST::Node& program, const TypeTable& types, std::ostream& out) : types_(types), out_(out)
+{
+    assert(program.type_ == AST::NodeType::Root);
+
+    for(auto& c: static_cast<AST::Root&>(program).children_)
+    {
+        auto& fn = static_cast<const AST::FnDef&>(*c);
+        if(fns_.size() <= fn.index_)
+            fns_.resize(fn.index_ + 1);
+
+        fns_[fn.index_] = &fn;
+    }
+}
+
+Value Interpreter::run(const std::vector<std::string>& args)
+{
+    for(const auto* fn: fns_)
+    {
+        if(fn->id_ != "main")
+            continue;
+
+        std::vector<Value> params;
+        if(!fn->params_.empty())
+        {
+            auto argv = makeArray(ElemKind::Str);
+            argv->strs_.assign(args.begin(), args.end());
+            params.emplace_back(std::move(argv));
+        }
+
+        return call(*fn, std::move(params));
+    }
+
+    throw RuntimeError("Function 'main' is not defined");
+}
+
+Value Interpreter::call(const AST::FnDef& fn, std::vector<Value> args)
+{
+    auto* savedFrame = frame_;
+    auto* savedFn    = currFn_;
+    ++depth_;
+
+    // Tail calls run here one after the other, without going deeper
+    Value result;
+    for(const AST::FnDef* callee = &fn; callee;)
+    {
+        if(tiering_ && tiering_->enter(callee->index_))
+        {
+            result = tiering_->call(callee->index_, std::move(args));
+            break;
+        }
+
+        std::vector<Value> frame(callee->frameSize_);
+        std::move(args.begin(), args.end(), frame.begin());
+
+        frame_  = &frame;
+        currFn_ = callee;
+        execBlock(const_cast<AST::FnDef&>(*callee).statements_);
+
+        // Falling off the end returns the zero value of the return type
+        if(!tailCall_)
+            result = returning_ ? std::move(result_) : defaultValue(types_, callee->resolvedType_);
+
+        returning_ = false;
+        callee     = std::exchange(tailCall_, nullptr);
+        args       = std::move(tailArgs_);
+    }
+
+    --depth_;
+    frame_  = savedFrame;
+    currFn_ = savedFn;
+
+    return result;
+}
+
+void Interpreter::execBlock(AST::NodeVec& block)
+{
+    for(auto& st: block)
+    {
+        visit(*st);
+        if(returning_)
+            break;
+    }
+
+    if(currFn_->spawns_)
+        joinTasks(block);
+}
+
+const Value& Interpreter::join(Task& task, const AST::Node& at)
+{
+    if(task.claim())
+    {
+        if(depth_ >= MAX_CALL_DEPTH)
+            throw error("Stack overflow", at);
+
+        task.finish(call(*fns_[task.fn_], std::move(task.args_)));
+    }
+
+    return task.result();
+}
+
+void Interpreter::joinTasks(AST::NodeVec& block)
+{
+    // A return leaves its value behind while the tasks run
+    bool returning = std::exchange(returning_, false);
+    Value result   = std::move(result_);
+
+    for(auto it = block.rbegin(); it != block.rend(); ++it)
+    {
+        auto& st = **it;
+        if(st.type_ != AST::NodeType::Variable || !types_.isTask(st.resolvedType_))
+            continue;
+
+        // Not declared if the block was left before
+        Value& slot = (*frame_)[static_cast<AST::Variable&>(st).slot_];
+        if(slot.isTask())
+        {
+            join(slot.asTask(), st);
+            slot = Value();
+        }
+    }
+
+    returning_ = returning;
+    result_    = std::move(result);
+}
+
+Value Interpreter::eval(AST::Node& expr)
+{
+    visit(expr);
+    return std::move(result_);
+}
+
+std::int64_t Interpreter::evalInt(AST::Node& expr)
+{
+    visit(expr);
+    return result_.asInt();
+}
+
+void Interpreter::visit(AST::Variable& var)
+{
+    Value v;
+    if(var.init_)
+    {
+        v = eval(*var.init_);
+    }
+    else
+    {
+        auto& typeId = static_cast<AST::TypeId&>(*var.typeId_);
+        if(typeId.sizeSlot_ != static_cast<std::uint32_t>(-1))
+        {
+            try
+            {
+                v = newArray((*frame_)[typeId.sizeSlot_].asInt(), elemKind(types_, var.resolvedType_));
+            } catch(const RuntimeError& e)
+            {
+                throw error(e.what(), var);
+            }
+        }
+        else
+        {
+            v = defaultValue(types_, var.resolvedType_);
+        }
+    }
+
+    (*frame_)[var.slot_] = std::move(v);
+}
+
+void Interpreter::visit(AST::Return& ret)
+{
+    if(ret.value_->type_ == AST::NodeType::Call && static_cast<AST::Call&>(*ret.value_).tail_)
+    {
+        auto& call = static_cast<AST::Call&>(*ret.value_);
+
+        std::vector<Value> args;
+        args.reserve(call.args_.size());
+        for(auto& a: call.args_)
+        {
+            args.push_back(eval(*a));
+        }
+
+        tailCall_ = fns_[call.fnIndex_];
+        tailArgs_ = std::move(args);
+    }
+    else
+    {
+        visit(*ret.value_);
+    }
+
+    returning_ = true;
+}
+
+void Interpreter::visit(AST::If& stmt)
+{
+    if(evalInt(*stmt.cond_))
+    {
+        execBlock(stmt.then_);
+    }
+    else
+    {
+        execBlock(stmt.else_);
+    }
+}
+
+void Interpreter::visit(AST::While& stmt)
+{
+    while(!returning_ && evalInt(*stmt.cond_))
+    {
+        if(tiering_)
+            tiering_->loop(currFn_->index_);
+
+        execBlock(stmt.body_);
+    }
+}
+
+void Interpreter::visit(AST::ParallelFor& stmt)
+{
+    auto from = evalInt(*stmt.from_);
+    auto to   = evalInt(*stmt.to_);
+    auto slot = static_cast<AST::Variable&>(*stmt.var_).slot_;
+
+    for(auto i = from; i < to; ++i)
+    {
+        if(tiering_)
+            tiering_->loop(currFn_->index_);
+
+        (*frame_)[slot] = i;
+        execBlock(stmt.body_);
+    }
+}
+
+void Interpreter::visit(AST::Spawn& spawn)
+{
+    auto& call = static_cast<AST::Call&>(*spawn.call_);
+
+    std::vector<Value> args;
+    args.reserve(call.args_.size());
+    for(auto& a: call.args_)
+    {
+        args.push_back(eval(*a));
+    }
+
+    result_ = TaskRef(new Task(call.fnIndex_, std::move(args)));
+}
+
+void Interpreter::visit(AST::Assign& stmt)
+{
+    Value v = eval(*stmt.value_);
+
+    if(stmt.target_->type_ == AST::NodeType::VarRef)
+    {
+        (*frame_)[static_cast<AST::VarRef&>(*stmt.target_).slot_] = std::move(v);
+    }
+    else
+    {
+        size_t i = element(static_cast<AST::Index&>(*stmt.target_));
+        held_->set(i, v);
+    }
+}
+
+void Interpreter::visit(AST::BinOp& op)
+{
+    Value lhs = eval(*op.op1_);
+    Value rhs = eval(*op.op2_);
+
+    if(lhs.isArray() || rhs.isArray())
+    {
+        try
+        {
+            result_ = ArrayOps::apply(op.opType_, lhs, rhs);
+        } catch(const RuntimeError& e)
+        {
+            throw error(e.what(), op);
+        }
+        return;
+    }
+
+    if(lhs.isStr())
+    {
+        if(op.opType_ == TokenType::PLUS)
+        {
+            result_ = concat(lhs, rhs);
+            return;
+        }
+
+        bool equal = lhs.strEquals(rhs);
+        result_    = Arith::fromBool(op.opType_ == TokenType::EQEQ ? equal : !equal);
+        return;
+    }
+
+    auto v = Arith::apply(op.opType_, lhs.asInt(), rhs.asInt());
+    if(!v)
+        throw error("Division by zero", op);
+
+    result_ = *v;
+}
+
+void Interpreter::visit(AST::UnaryOp& op)
+{
+    Value v = eval(*op.op_);
+    result_ = v.isArray() ? ArrayOps::neg(v) : Value(Arith::neg(v.asInt()));
+}
+
+void Interpreter::visit(AST::Call& call)
+{
+    // The task reports its own errors
+    if(call.builtin_ == Builtin::Join)
+    {
+        Value task = eval(*call.args_[0]);
+        result_    = join(task.asTask(), call);
+        return;
+    }
+
+    if(call.builtin_ != Builtin::None)
+    {
+        Value args[MAX_BUILTIN_ARGS];
+        for(size_t i = 0; i < call.args_.size(); ++i)
+        {
+            args[i] = eval(*call.args_[i]);
+        }
+
+        try
+        {
+            result_ = callBuiltin(call.builtin_, args, out_);
+        } catch(const RuntimeError& e)
+        {
+            throw error(e.what(), call);
+        }
+        return;
+    }
+
+    if(depth_ >= MAX_CALL_DEPTH)
+        throw error("Stack overflow", call);
+
+    std::vector<Value> args;
+    args.reserve(call.args_.size());
+    for(auto& a: call.args_)
+    {
+        args.push_back(eval(*a));
+    }
+
+    result_ = this->call(*fns_[call.fnIndex_], std::move(args));
+}
+
+void Interpreter::visit(AST::VarRef& ref)
+{
+    result_ = (*frame_)[ref.slot_];
+}
+
+void Interpreter::visit(AST::Index& idx)
+{
+    size_t i = element(idx);
+    result_  = held_->get(i);
+}
+
+void Interpreter::visit(AST::Const& c)
+{
+    if(c.isNum())
+    {
+        result_ = c.num_;
+    }
+    else
+    {
+        result_ = c.value_;
+    }
+}
+
+void Interpreter::visit(AST::ConstArray& arr)
+{
+    std::vector<Value> elements;
+    elements.reserve(arr.elements_.size());
+    for(auto& e: arr.elements_)
+    {
+        elements.push_back(eval(*e));
+    }
+
+    auto result = makeArray(elemKind(types_, arr.resolvedType_));
+    result->assign(elements.data(), elements.data() + elements.size());
+    result_ = std::move(result);
+}
+
+size_t Interpreter::element(AST::Index& idx)
+{
+    ArrayRef arr = eval(*idx.array_).arrayRef();
+    auto i       = evalInt(*idx.index_);
+
+    // Keeps an array returned by a call alive until the element is used
+    held_ = arr;
+
+    if(i < 0 || static_cast<size_t>(i) >= arr->size())
+    {
+        throw error("Index " + std::to_string(i) + " is out of bounds of array of size " + std::to_string(arr->size()),
+                    idx);
+    }
+
+    return static_cast<size_t>(i);
+}
+
+RuntimeError Interpreter::error(const std::string& msg, const AST::Node& at) const
+{
+    std::string where = currFn_ ? " in '" + currFn_->id_ + "'" : "";
+    return RuntimeError(msg + where + " on line " + std::to_string(at.line_));
+}
+
+}
@@ -1,65 +1,94 @@
-// #pragma once
-
-// #include "ast.h"
-
-// #include <unordered_map>
-// #include <stack>
-// #include <vector>
-// #include <string>
-
-// namespace Guu
-// {
-// class Interpreter : public AST::Visitor
-// {
-//     using TT          = TokenType;
-//     using Address     = std::string;
-//     using Instruction = const AST::Node*;
-//     using AST::Visitor::visit;
-
-// public:
-//     explicit Interpreter(std::unique_ptr<AST::Node> program);
-
-//   void interpret();
-
-//   void stepInto();
-//   void stepOver();
-//   void bt() const;
-//   void printVars() const;
-
-// private:
-//     void compile();
-
-//   void visit(const AST::FnDef& proc) override;
-//   void visit(const AST::BinOp& binOp) override;
-//   void visit(const AST::UnaryOp& op) override;
-
-// private:
-//     void execute(Instruction i);
-//     void execute(const AST::BinOp& op);
-//     void execute(const AST::UnaryOp& op);
-
-// private:
-//     bool isEnd() const;
-
-//   void defineProc(const Address& address);
-//   bool hasProc(const Address& address);
-//   std::vector<Instruction>& findProc(const Address& address);
-//   void addInstruction(Instruction i);
-
-//   void setVariable(const Address& address, const std::string& value);
-//   std::string getVariable(const Address& address);
-
-//   void moveNext();
-//   void jumpTo(const Address& address);
-
-// private:
-//     std::unordered_map<Address, std::vector<Instruction>> text_;
-//     using InstIter = decltype(decltype(text_)::value_type::second)::const_iterator;
-//     InstIter currentInstruction_{};
-
-//   std::unique_ptr<AST::Node> prg_;
-//   std::string currProc_;
-//   std::unordered_map<Address, std::string> globalMemory_{};
-//   std::stack< std::pair<std::string, InstIter> > stack_{};
-// };
-// }
+#pragma once
+
+#include "ast.h"
+#include "value.h"
+
+#include <iosfwd>
+#include <vector>
+
+namespace Guu
+{
+
+class Tiering;
+
+// Reference tree-walking interpreter over a resolved AST. Slow, but simple
+// enough to serve as the baseline the bytecode VM is checked against.
+// Runs parallel loops in order and spawned calls when they are joined. Tail
+// calls marked by TailCalls reuse the native frame of their caller.
+//
+// As the first tier of tiered execution it reports calls and loop iterations
+// to a Tiering, and leaves functions it compiled to the VM.
+class Interpreter : public AST::Visitor
+{
+public:
+    static constexpr size_t MAX_CALL_DEPTH = 1024;
+
+    using AST::Visitor::visit;
+
+    Interpreter(AST::Node& program, const TypeTable& types, std::ostream& out);
+
+    // Calls `main`, passing `args` if it takes them
+    Value run(const std::vector<std::string>& args);
+
+    Value call(const AST::FnDef& fn, std::vector<Value> args);
+
+    // Runs hot functions on the VM, see Tiering. The AST must be the one the
+    // Tiering was built for.
+    void setTiering(Tiering* tiering)
+    {
+        tiering_ = tiering;
+    }
+
+private:
+    void visit(AST::Variable& var) override;
+    void visit(AST::Return& ret) override;
+    void visit(AST::If& stmt) override;
+    void visit(AST::While& stmt) override;
+    void visit(AST::ParallelFor& stmt) override;
+    void visit(AST::Spawn& spawn) override;
+    void visit(AST::Assign& stmt) override;
+
+    void visit(AST::BinOp& op) override;
+    void visit(AST::UnaryOp& op) override;
+    void visit(AST::Call& call) override;
+    void visit(AST::VarRef& ref) override;
+    void visit(AST::Index& idx) override;
+    void visit(AST::Const& c) override;
+    void visit(AST::ConstArray& arr) override;
+
+private:
+    Value eval(AST::Node& expr);
+    std::int64_t evalInt(AST::Node& expr);
+    void execBlock(AST::NodeVec& block);
+
+    // Runs the task unless it ran already and returns its result
+    const Value& join(Task& task, const AST::Node& at);
+
+    // Joins the tasks declared in `block` when it is left, the last one first
+    void joinTasks(AST::NodeVec& block);
+
+    // Evaluates and bounds-checks `array[index]`, leaves the array in held_ and returns the index
+    size_t element(AST::Index& idx);
+
+    RuntimeError error(const std::string& msg, const AST::Node& at) const;
+
+private:
+    const TypeTable& types_;
+    std::ostream& out_;
+    std::vector<const AST::FnDef*> fns_;
+    Tiering* tiering_ = nullptr;
+
+    std::vector<Value>* frame_ = nullptr;
+    const AST::FnDef* currFn_  = nullptr;
+    size_t depth_              = 0;
+
+    Value result_;
+    ArrayRef held_;
+    bool returning_ = false;
+
+    // Set by a return of a tail call, run by call() once the caller is left
+    const AST::FnDef* tailCall_ = nullptr;
+    std::vector<Value> tailArgs_;
+};
+
+}
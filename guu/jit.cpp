@@ -0,0 +1,835 @@
+#include "jit.h"
+
+#ifdef GUU_ENABLE_JIT
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <limits>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace Guu
+{
+
+using namespace Bytecode;
+
+namespace
+{
+
+enum X64 : std::uint8_t
+{
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+};
+
+// Condition codes of jcc and setcc
+enum Cond : std::uint8_t
+{
+    E  = 0x4,
+    NE = 0x5,
+    L  = 0xC,
+    GE = 0xD,
+    LE = 0xE,
+    G  = 0xF,
+};
+
+// Cached variables live in the callee-saved registers left after RBX (VM
+// registers) and RBP (entry address)
+constexpr X64 CACHE_REGS[] = {R12, R13, R14, R15};
+
+// Emits the few instructions the templates need. Memory operands are always
+// [RBX + disp32], the VM register file.
+class Assembler
+{
+public:
+    size_t size() const
+    {
+        return code_.size();
+    }
+
+    const std::vector<std::uint8_t>& code() const
+    {
+        return code_;
+    }
+
+    // mov dst, [rbx + disp]
+    void load(X64 dst, std::int32_t disp)
+    {
+        rexW(dst, RBX);
+        byte(0x8B);
+        mem(dst, disp);
+    }
+
+    // mov [rbx + disp], src
+    void store(std::int32_t disp, X64 src)
+    {
+        rexW(src, RBX);
+        byte(0x89);
+        mem(src, disp);
+    }
+
+    // lea dst, [rbx + disp]
+    void lea(X64 dst, std::int32_t disp)
+    {
+        rexW(dst, RBX);
+        byte(0x8D);
+        mem(dst, disp);
+    }
+
+    void mov(X64 dst, X64 src)
+    {
+        if(dst != src)
+            aluRR(0x89, dst, src);
+    }
+
+    void movImm(X64 dst, std::int64_t imm)
+    {
+        if(imm >= std::numeric_limits<std::int32_t>::min() && imm <= std::numeric_limits<std::int32_t>::max())
+        {
+            rexW(RAX, dst);
+            byte(0xC7);
+            byte(0xC0 | (dst & 7));
+            imm32(static_cast<std::int32_t>(imm));
+            return;
+        }
+
+        rexW(RAX, dst);
+        byte(0xB8 | (dst & 7));
+        for(int i = 0; i < 8; ++i)
+            byte(static_cast<std::uint8_t>(static_cast<std::uint64_t>(imm) >> (8 * i)));
+    }
+
+    void add(X64 dst, X64 src)
+    {
+        aluRR(0x01, dst, src);
+    }
+
+    void sub(X64 dst, X64 src)
+    {
+        aluRR(0x29, dst, src);
+    }
+
+    void cmp(X64 a, X64 b)
+    {
+        aluRR(0x39, a, b);
+    }
+
+    void test(X64 a, X64 b)
+    {
+        aluRR(0x85, a, b);
+    }
+
+    void imul(X64 dst, X64 src)
+    {
+        rexW(dst, src);
+        byte(0x0F);
+        byte(0xAF);
+        byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+    }
+
+    // add dst, imm / cmp dst, imm with a sign-extended 32-bit immediate
+    void addImm(X64 dst, std::int32_t imm)
+    {
+        aluImm(0, dst, imm);
+    }
+
+    void cmpImm(X64 dst, std::int32_t imm)
+    {
+        aluImm(7, dst, imm);
+    }
+
+    void neg(X64 r)
+    {
+        unary(3, r);
+    }
+
+    // rdx:rax = sign extension of rax, then rax = quotient and rdx = remainder
+    void idiv(X64 r)
+    {
+        byte(0x48);
+        byte(0x99);
+        unary(7, r);
+    }
+
+    // eax = cc ? 1 : 0
+    void setcc(Cond cc)
+    {
+        byte(0x0F);
+        byte(0x90 | cc);
+        byte(0xC0);
+        byte(0x0F);
+        byte(0xB6);
+        byte(0xC0);
+    }
+
+    // test al, al
+    void testAl()
+    {
+        byte(0x84);
+        byte(0xC0);
+    }
+
+    // cmp byte [rbx + disp], imm
+    void cmpByte(std::int32_t disp, std::uint8_t imm)
+    {
+        byte(0x80);
+        mem(static_cast<X64>(7), disp);
+        byte(imm);
+    }
+
+    // Jumps return the position of their rel32 for patch()
+    size_t jcc(Cond cc)
+    {
+        byte(0x0F);
+        byte(0x80 | cc);
+        return rel32();
+    }
+
+    size_t jmp()
+    {
+        byte(0xE9);
+        return rel32();
+    }
+
+    void jmp(X64 r)
+    {
+        if(r >= R8)
+            byte(0x41);
+        byte(0xFF);
+        byte(0xE0 | (r & 7));
+    }
+
+    void patch(size_t at, size_t target)
+    {
+        auto rel = static_cast<std::int32_t>(static_cast<std::int64_t>(target) - static_cast<std::int64_t>(at + 4));
+        std::memcpy(&code_[at], &rel, 4);
+    }
+
+    template <typename Fn>
+    void call(Fn* fn)
+    {
+        movImm(RAX, static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(fn)));
+        byte(0xFF);
+        byte(0xD0);
+    }
+
+    void push(X64 r)
+    {
+        if(r >= R8)
+            byte(0x41);
+        byte(0x50 | (r & 7));
+    }
+
+    void pop(X64 r)
+    {
+        if(r >= R8)
+            byte(0x41);
+        byte(0x58 | (r & 7));
+    }
+
+    // sub rsp, imm8 / add rsp, imm8
+    void reserve(std::uint8_t bytes)
+    {
+        byte(0x48);
+        byte(0x83);
+        byte(0xEC);
+        byte(bytes);
+    }
+
+    void unreserve(std::uint8_t bytes)
+    {
+        byte(0x48);
+        byte(0x83);
+        byte(0xC4);
+        byte(bytes);
+    }
+
+    void ret()
+    {
+        byte(0xC3);
+    }
+
+private:
+    void byte(std::uint8_t b)
+    {
+        code_.push_back(b);
+    }
+
+    void imm32(std::int32_t v)
+    {
+        for(int i = 0; i < 4; ++i)
+            byte(static_cast<std::uint8_t>(static_cast<std::uint32_t>(v) >> (8 * i)));
+    }
+
+    size_t rel32()
+    {
+        size_t at = code_.size();
+        imm32(0);
+        return at;
+    }
+
+    // REX.W with the high bits of the ModRM reg and rm fields
+    void rexW(X64 reg, X64 rm)
+    {
+        byte(0x48 | ((reg >> 3) << 2) | (rm >> 3));
+    }
+
+    void mem(X64 reg, std::int32_t disp)
+    {
+        byte(0x80 | ((reg & 7) << 3) | RBX);
+        imm32(disp);
+    }
+
+    // op r/m64, r64 in register form
+    void aluRR(std::uint8_t op, X64 dst, X64 src)
+    {
+        rexW(src, dst);
+        byte(op);
+        byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+    }
+
+    void aluImm(std::uint8_t ext, X64 dst, std::int32_t imm)
+    {
+        rexW(RAX, dst);
+        byte(0x81);
+        byte(0xC0 | (ext << 3) | (dst & 7));
+        imm32(imm);
+    }
+
+    void unary(std::uint8_t ext, X64 r)
+    {
+        rexW(RAX, r);
+        byte(0xF7);
+        byte(0xC0 | (ext << 3) | (r & 7));
+    }
+
+private:
+    std::vector<std::uint8_t> code_;
+};
+
+// Helpers called from native code, which must not throw: failures return
+// false and the VM repeats the instruction to raise the error
+void clearValue(Value* v)
+{
+    *v = Value();
+}
+
+bool getIndex(Value* regs, std::uint32_t a, std::uint32_t b, std::uint32_t c)
+{
+    const auto& arr = regs[b].asArray();
+    auto idx        = regs[c].asInt();
+    if(idx < 0 || static_cast<size_t>(idx) >= arr.size())
+        return false;
+
+    // Copy first: the destination may hold the last reference to the array
+    Value v = arr.get(static_cast<size_t>(idx));
+    regs[a] = std::move(v);
+    return true;
+}
+
+bool setIndex(Value* regs, std::uint32_t a, std::uint32_t b, std::uint32_t c)
+{
+    auto& arr = regs[a].asArray();
+    auto idx  = regs[b].asInt();
+    if(idx < 0 || static_cast<size_t>(idx) >= arr.size())
+        return false;
+
+    arr.set(static_cast<size_t>(idx), regs[c]);
+    return true;
+}
+
+std::int32_t payload(Reg r)
+{
+    return static_cast<std::int32_t>(r) * static_cast<std::int32_t>(sizeof(Value));
+}
+
+std::int32_t tag(Reg r)
+{
+    return payload(r) + 8;
+}
+
+bool isSupported(const Module& module, const Instr& i)
+{
+    switch(i.op_)
+    {
+        case Op::LoadK: return module.constants_[i.bx()].isInt();
+        case Op::LoadI:
+        case Op::Move:
+        case Op::Add:
+        case Op::Sub:
+        case Op::Mul:
+        case Op::Div:
+        case Op::Mod:
+        case Op::Neg:
+        case Op::Lt:
+        case Op::Le:
+        case Op::Gt:
+        case Op::Ge:
+        case Op::Eq:
+        case Op::Ne:
+        case Op::Jmp:
+        case Op::JmpIf:
+        case Op::JmpIfNot:
+        case Op::GetIndex:
+        case Op::SetIndex:
+        case Op::AddI:
+        case Op::JmpIfLt:
+        case Op::JmpIfLe:
+        case Op::JmpIfGt:
+        case Op::JmpIfGe:
+        case Op::JmpIfEq:
+        case Op::JmpIfNe: return true;
+
+        default: return false;
+    }
+}
+
+// Compiles one function, see Jit for the scheme
+class CodeGen
+{
+public:
+    CodeGen(const Module& module, const Function& fn) : module_(module), fn_(fn)
+    {
+        chooseCached();
+    }
+
+    // Emits the code, entry offsets are relative to its start
+    std::vector<size_t> generate();
+
+    const std::vector<std::uint8_t>& code() const
+    {
+        return as_.code();
+    }
+
+private:
+    void chooseCached();
+
+    void prologue();
+
+    // Writes the cached registers back and returns, emitted last
+    void exitPath();
+    void instruction(size_t pc, const Instr& i);
+
+    // Register holding the int in VM register r: its cache register or `scratch` loaded from memory
+    X64 load(Reg r, X64 scratch)
+    {
+        if(auto c = cached(r); c != RSP)
+            return c;
+
+        as_.load(scratch, payload(r));
+        return scratch;
+    }
+
+    void store(Reg r, X64 src)
+    {
+        if(auto c = cached(r); c != RSP)
+        {
+            as_.mov(c, src);
+            return;
+        }
+
+        as_.store(payload(r), src);
+    }
+
+    // Leaves to the VM at `pc` unless VM register r holds an int. Cached ones always do.
+    void requireInt(Reg r, size_t pc)
+    {
+        if(cached(r) != RSP)
+            return;
+
+        as_.cmpByte(tag(r), static_cast<std::uint8_t>(Value::Tag::Int));
+        exitIf(NE, pc);
+    }
+
+    void exitIf(Cond cc, size_t pc)
+    {
+        exits_.emplace_back(as_.jcc(cc), pc);
+    }
+
+    void exitAt(size_t pc)
+    {
+        as_.movImm(RAX, static_cast<std::int64_t>(pc));
+        exitJumps_.push_back(as_.jmp());
+    }
+
+    void flush(Reg r)
+    {
+        if(auto c = cached(r); c != RSP)
+            as_.store(payload(r), c);
+    }
+
+    void reload(Reg r)
+    {
+        if(auto c = cached(r); c != RSP)
+            as_.load(c, payload(r));
+    }
+
+    // RSP stands for "not cached"
+    X64 cached(Reg r) const
+    {
+        for(const auto& [reg, x]: cache_)
+        {
+            if(reg == r)
+                return x;
+        }
+
+        return RSP;
+    }
+
+private:
+    const Module& module_;
+    const Function& fn_;
+    Assembler as_;
+
+    std::vector<std::pair<Reg, X64>> cache_;
+
+    // Jumps to patch: rel32 position and target pc
+    std::vector<std::pair<size_t, size_t>> jumps_;
+    std::vector<std::pair<size_t, size_t>> exits_;
+    std::vector<size_t> exitJumps_;
+};
+
+void CodeGen::chooseCached()
+{
+    std::vector<size_t> uses(fn_.numRegs_);
+    for(const auto& i: fn_.code_)
+    {
+        for(Reg r: {i.a_, i.b_, i.c_})
+        {
+            if(r < uses.size())
+                ++uses[r];
+        }
+    }
+
+    std::vector<Reg> candidates = fn_.intRegs_;
+    std::stable_sort(candidates.begin(), candidates.end(), [&uses](Reg a, Reg b) { return uses[a] > uses[b]; });
+
+    for(size_t k = 0; k < candidates.size() && k < std::size(CACHE_REGS); ++k)
+        cache_.emplace_back(candidates[k], CACHE_REGS[k]);
+}
+
+std::vector<size_t> CodeGen::generate()
+{
+    prologue();
+
+    std::vector<size_t> labels(fn_.code_.size());
+    for(size_t pc = 0; pc < fn_.code_.size(); ++pc)
+    {
+        labels[pc] = as_.size();
+        instruction(pc, fn_.code_[pc]);
+    }
+
+    for(const auto& [at, target]: jumps_)
+        as_.patch(at, labels[target]);
+
+    // Conditional exits share one stub per pc
+    std::vector<size_t> stubs(fn_.code_.size(), 0);
+    for(const auto& [at, pc]: exits_)
+    {
+        if(!stubs[pc])
+        {
+            stubs[pc] = as_.size();
+            exitAt(pc);
+        }
+        as_.patch(at, stubs[pc]);
+    }
+
+    exitPath();
+
+    return labels;
+}
+
+void CodeGen::prologue()
+{
+    // Six pushes and the return address leave the stack 16-byte aligned after reserving 8
+    for(X64 r: {RBP, RBX, R12, R13, R14, R15})
+        as_.push(r);
+    as_.reserve(8);
+
+    as_.mov(RBX, RDI);
+    as_.mov(RBP, RSI);
+
+    // Registers only ever holding int variables may still hold a stale value
+    // of an earlier frame, which is dead and released before caching
+    for(const auto& [r, x]: cache_)
+    {
+        as_.cmpByte(tag(r), static_cast<std::uint8_t>(Value::Tag::Int));
+        size_t isInt = as_.jcc(E);
+        as_.lea(RDI, payload(r));
+        as_.call(&clearValue);
+        as_.patch(isInt, as_.size());
+
+        as_.load(x, payload(r));
+    }
+
+    as_.jmp(RBP);
+}
+
+void CodeGen::exitPath()
+{
+    // Every exit jumps here with the pc in RAX
+    size_t exit = as_.size();
+    for(size_t at: exitJumps_)
+        as_.patch(at, exit);
+
+    for(const auto& [r, x]: cache_)
+        as_.store(payload(r), x);
+
+    as_.unreserve(8);
+    for(X64 r: {R15, R14, R13, R12, RBX, RBP})
+        as_.pop(r);
+    as_.ret();
+}
+
+void CodeGen::instruction(size_t pc, const Instr& i)
+{
+    if(!isSupported(module_, i))
+    {
+        exitAt(pc);
+        return;
+    }
+
+    auto jumpTo = [&](std::int64_t offset) {
+        return static_cast<size_t>(static_cast<std::int64_t>(pc) + 1 + offset);
+    };
+
+    switch(i.op_)
+    {
+        case Op::LoadI:
+        case Op::LoadK: {
+            std::int64_t v = i.op_ == Op::LoadI ? i.sbx() : module_.constants_[i.bx()].asInt();
+            requireInt(i.a_, pc);
+            as_.movImm(RAX, v);
+            store(i.a_, RAX);
+            break;
+        }
+
+        case Op::Move: {
+            requireInt(i.b_, pc);
+            requireInt(i.a_, pc);
+            store(i.a_, load(i.b_, RAX));
+            break;
+        }
+
+        case Op::Add:
+        case Op::Sub:
+        case Op::Mul: {
+            requireInt(i.a_, pc);
+            as_.mov(RAX, load(i.b_, RAX));
+            X64 c = load(i.c_, RCX);
+            if(i.op_ == Op::Add)
+            {
+                as_.add(RAX, c);
+            }
+            else if(i.op_ == Op::Sub)
+            {
+                as_.sub(RAX, c);
+            }
+            else
+            {
+                as_.imul(RAX, c);
+            }
+            store(i.a_, RAX);
+            break;
+        }
+
+        case Op::Div:
+        case Op::Mod: {
+            // Zero divisors raise the error and -1 wraps, both in the VM
+            requireInt(i.a_, pc);
+            as_.mov(RAX, load(i.b_, RAX));
+            as_.mov(RCX, load(i.c_, RCX));
+            as_.test(RCX, RCX);
+            exitIf(E, pc);
+            as_.cmpImm(RCX, -1);
+            exitIf(E, pc);
+            as_.idiv(RCX);
+            store(i.a_, i.op_ == Op::Div ? RAX : RDX);
+            break;
+        }
+
+        case Op::Neg: {
+            requireInt(i.a_, pc);
+            as_.mov(RAX, load(i.b_, RAX));
+            as_.neg(RAX);
+            store(i.a_, RAX);
+            break;
+        }
+
+        case Op::AddI: {
+            requireInt(i.a_, pc);
+            as_.mov(RAX, load(i.b_, RAX));
+            as_.addImm(RAX, i.sc());
+            store(i.a_, RAX);
+            break;
+        }
+
+        case Op::Lt:
+        case Op::Le:
+        case Op::Gt:
+        case Op::Ge:
+        case Op::Eq:
+        case Op::Ne: {
+            // Strings compare in the VM
+            static constexpr Cond conds[] = {L, LE, G, GE, E, NE};
+
+            requireInt(i.b_, pc);
+            requireInt(i.a_, pc);
+            X64 b = load(i.b_, RAX);
+            X64 c = load(i.c_, RCX);
+            as_.cmp(b, c);
+            as_.setcc(conds[static_cast<size_t>(i.op_) - static_cast<size_t>(Op::Lt)]);
+            store(i.a_, RAX);
+            break;
+        }
+
+        case Op::Jmp: jumps_.emplace_back(as_.jmp(), jumpTo(i.sbx())); break;
+
+        case Op::JmpIf:
+        case Op::JmpIfNot: {
+            X64 a = load(i.a_, RAX);
+            as_.test(a, a);
+            jumps_.emplace_back(as_.jcc(i.op_ == Op::JmpIf ? NE : E), jumpTo(i.sbx()));
+            break;
+        }
+
+        case Op::JmpIfLt:
+        case Op::JmpIfLe:
+        case Op::JmpIfGt:
+        case Op::JmpIfGe:
+        case Op::JmpIfEq:
+        case Op::JmpIfNe: {
+            static constexpr Cond conds[] = {L, LE, G, GE, E, NE};
+
+            X64 a = load(i.a_, RAX);
+            X64 b = load(i.b_, RCX);
+            as_.cmp(a, b);
+            jumps_.emplace_back(as_.jcc(conds[static_cast<size_t>(i.op_) - static_cast<size_t>(Op::JmpIfLt)]),
+                                jumpTo(i.sc()));
+            break;
+        }
+
+        case Op::GetIndex:
+        case Op::SetIndex: {
+            // The helpers read the VM registers, cached operands are written back first
+            bool get = i.op_ == Op::GetIndex;
+            if(get)
+            {
+                flush(i.c_);
+            }
+            else
+            {
+                flush(i.b_);
+                flush(i.c_);
+            }
+
+            as_.mov(RDI, RBX);
+            as_.movImm(RSI, i.a_);
+            as_.movImm(RDX, i.b_);
+            as_.movImm(RCX, i.c_);
+            if(get)
+            {
+                as_.call(&getIndex);
+            }
+            else
+            {
+                as_.call(&setIndex);
+            }
+            as_.testAl();
+            exitIf(E, pc);
+
+            if(get)
+                reload(i.a_);
+            break;
+        }
+
+        default: exitAt(pc); break;
+    }
+}
+
+}
+
+Jit::Jit(const Module& module) : module_(module), functions_(module.functions_.size())
+{
+    // Native code reads ints straight out of the Value representation
+    static_assert(sizeof(Value) == 16 && offsetof(Value, tag_) == 8, "Unexpected Value layout");
+    static_assert(static_cast<int>(Value::Tag::Int) == 0, "Unexpected Value layout");
+}
+
+Jit::~Jit()
+{
+    for(const auto& [addr, len]: regions_)
+        munmap(addr, len);
+}
+
+const Jit::Code* Jit::compile(std::uint32_t fnIdx)
+{
+    auto& state       = functions_[fnIdx];
+    const Function& f = module_.functions_[fnIdx];
+
+    // Not worth it when most instructions would leave again right away
+    auto supported = std::count_if(f.code_.begin(), f.code_.end(),
+                                   [this](const Instr& i) { return isSupported(module_, i); });
+    if(static_cast<size_t>(supported) * 2 < f.code_.size())
+    {
+        state.countdown_ = std::numeric_limits<std::uint32_t>::max();
+        return nullptr;
+    }
+
+    CodeGen gen(module_, f);
+    auto labels = gen.generate();
+
+    // Written while writable, executed once read-only
+    auto page  = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t len = (gen.code().size() + page - 1) / page * page;
+    void* mem  = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+    {
+        state.countdown_ = std::numeric_limits<std::uint32_t>::max();
+        return nullptr;
+    }
+
+    // Hosts that forbid executable mappings leave the function interpreted
+    std::memcpy(mem, gen.code().data(), gen.code().size());
+    if(mprotect(mem, len, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(mem, len);
+        state.countdown_ = std::numeric_limits<std::uint32_t>::max();
+        return nullptr;
+    }
+    regions_.emplace_back(mem, len);
+
+    auto* base  = static_cast<const std::uint8_t*>(mem);
+    state.code_ = std::make_unique<Code>();
+
+    state.code_->run_ = reinterpret_cast<Native>(mem);
+    state.code_->entries_.resize(f.code_.size());
+    for(size_t pc = 0; pc < f.code_.size(); ++pc)
+    {
+        if(isSupported(module_, f.code_[pc]))
+            state.code_->entries_[pc] = base + labels[pc];
+    }
+
+    return state.code_.get();
+}
+
+}
+
+#endif
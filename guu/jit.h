@@ -0,0 +1,87 @@
+#pragma once
+
+// Baseline JIT for the VM, compiled only with GUU_ENABLE_JIT (x86-64 with
+// POSIX mmap). Without it --jit is rejected and the VM never asks for code.
+
+#ifdef GUU_ENABLE_JIT
+
+#include "bytecode.h"
+#include "value.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace Guu
+{
+
+// Translates the bytecode of hot functions into x86-64 code, one fixed
+// template per opcode. Int variables listed in Function::intRegs_ that are
+// used the most are cached in callee-saved machine registers; everything else
+// stays in the VM registers, so at every exit the frame is exactly what the
+// VM expects.
+//
+// Calls, returns, builtins, array creation and every operation on a string
+// leave native code: it returns the pc of that instruction, the VM executes it
+// and re-enters native code at the next one. Failing operations (division by
+// zero, out of bounds) leave the same way, so the VM raises all runtime errors.
+class Jit
+{
+public:
+    // Instructions of a function the VM interprets before compiling it
+    static constexpr std::uint32_t HOT_INSTRUCTIONS = 1000;
+
+    // Runs from `entry` until an instruction left to the VM and returns its pc
+    using Native = std::uint32_t (*)(Value* regs, const void* entry);
+
+    struct Code
+    {
+        Native run_;
+
+        // Native address of every instruction, nullptr where the VM has to run it
+        std::vector<const void*> entries_;
+    };
+
+    explicit Jit(const Bytecode::Module& module);
+    ~Jit();
+
+    Jit(const Jit&)            = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Counts an interpreted instruction of function `fn`, returns its code once it got hot
+    const Code* warm(std::uint32_t fn)
+    {
+        auto& state = functions_[fn];
+        if(--state.countdown_ != 0)
+            return nullptr;
+
+        return compile(fn);
+    }
+
+    const Code* code(std::uint32_t fn) const
+    {
+        return functions_[fn].code_.get();
+    }
+
+private:
+    struct FunctionState
+    {
+        std::uint32_t countdown_ = HOT_INSTRUCTIONS;
+        std::unique_ptr<Code> code_;
+    };
+
+    // Returns nullptr if too little of the function would run natively
+    const Code* compile(std::uint32_t fn);
+
+private:
+    const Bytecode::Module& module_;
+    std::vector<FunctionState> functions_;
+
+    // Executable mappings, address and length
+    std::vector<std::pair<void*, size_t>> regions_;
+};
+
+}
+
+#endif
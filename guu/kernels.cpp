@@ -0,0 +1,411 @@
+#include "kernels.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// The vector helpers below are always inlined into a function compiled for
+// their instruction set, so the ABI of a standalone call never matters
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GUU_INLINE inline __attribute__((always_inline))
+#else
+#define GUU_INLINE inline
+#endif
+
+namespace Guu::Kernels
+{
+
+namespace
+{
+
+using Int = std::int64_t;
+
+// Every kernel is written once over `Bytes` wide lanes with the GCC/Clang
+// vector extensions; 8 bytes is plain scalar code. The same source becomes
+// SSE2 or AVX2 code depending on the target of the entry point it is inlined
+// into, see Sse2 and Avx2 below.
+template <size_t Bytes>
+struct Lanes
+{
+#if defined(GUU_ENABLE_SIMD)
+    typedef Int S __attribute__((vector_size(Bytes)));
+    typedef std::uint64_t U __attribute__((vector_size(Bytes)));
+#endif
+};
+
+template <>
+struct Lanes<sizeof(Int)>
+{
+    using S = Int;
+    using U = std::uint64_t;
+};
+
+template <typename To, typename From>
+GUU_INLINE To bitCast(const From& v)
+{
+    static_assert(sizeof(To) == sizeof(From));
+
+    To result;
+    std::memcpy(&result, &v, sizeof(To));
+    return result;
+}
+
+template <typename V>
+GUU_INLINE V load(const Int* p)
+{
+    V v;
+    std::memcpy(&v, p, sizeof(V));
+    return v;
+}
+
+template <typename V>
+GUU_INLINE void store(Int* p, const V& v)
+{
+    std::memcpy(p, &v, sizeof(V));
+}
+
+// Wrapping arithmetic goes through unsigned lanes, comparisons through signed
+// ones. A comparison of vectors is -1 or 0 per lane, `& 1` turns both that
+// and a scalar bool into 1 or 0.
+#define GUU_KERNEL_OP(name, expr)                                          \
+    struct name                                                            \
+    {                                                                      \
+        template <size_t Bytes>                                            \
+        static GUU_INLINE typename Lanes<Bytes>::S apply(                  \
+            const typename Lanes<Bytes>::S& a, const typename Lanes<Bytes>::S& b) \
+        {                                                                  \
+            using S = typename Lanes<Bytes>::S;                            \
+            using U = typename Lanes<Bytes>::U;                            \
+            (void)sizeof(U);                                               \
+            return expr;                                                   \
+        }                                                                  \
+    };
+
+GUU_KERNEL_OP(AddOp, bitCast<S>(bitCast<U>(a) + bitCast<U>(b)))
+GUU_KERNEL_OP(SubOp, bitCast<S>(bitCast<U>(a) - bitCast<U>(b)))
+GUU_KERNEL_OP(RSubOp, bitCast<S>(bitCast<U>(b) - bitCast<U>(a)))
+GUU_KERNEL_OP(MulOp, bitCast<S>(bitCast<U>(a) * bitCast<U>(b)))
+GUU_KERNEL_OP(LtOp, S((a < b) & 1))
+GUU_KERNEL_OP(LeOp, S((a <= b) & 1))
+GUU_KERNEL_OP(GtOp, S((a > b) & 1))
+GUU_KERNEL_OP(GeOp, S((a >= b) & 1))
+GUU_KERNEL_OP(EqOp, S((a == b) & 1))
+GUU_KERNEL_OP(NeOp, S((a != b) & 1))
+
+#undef GUU_KERNEL_OP
+
+template <size_t Bytes>
+constexpr size_t LANES = Bytes / sizeof(Int);
+
+template <size_t Bytes>
+GUU_INLINE typename Lanes<Bytes>::S broadcast(Int v)
+{
+    typename Lanes<Bytes>::S result;
+    for(size_t k = 0; k < LANES<Bytes>; ++k)
+        std::memcpy(reinterpret_cast<Int*>(&result) + k, &v, sizeof(Int));
+
+    return result;
+}
+
+template <size_t Bytes, typename Op>
+GUU_INLINE void binaryKernel(Int* dst, const Int* a, const Int* b, size_t n)
+{
+    using S = typename Lanes<Bytes>::S;
+
+    size_t i = 0;
+    for(; i + LANES<Bytes> <= n; i += LANES<Bytes>)
+        store(dst + i, Op::template apply<Bytes>(load<S>(a + i), load<S>(b + i)));
+
+    for(; i < n; ++i)
+        dst[i] = Op::template apply<sizeof(Int)>(a[i], b[i]);
+}
+
+template <size_t Bytes, typename Op>
+GUU_INLINE void binaryScalarKernel(Int* dst, const Int* a, Int b, size_t n)
+{
+    using S = typename Lanes<Bytes>::S;
+
+    S vb     = broadcast<Bytes>(b);
+    size_t i = 0;
+    for(; i + LANES<Bytes> <= n; i += LANES<Bytes>)
+        store(dst + i, Op::template apply<Bytes>(load<S>(a + i), vb));
+
+    for(; i < n; ++i)
+        dst[i] = Op::template apply<sizeof(Int)>(a[i], b);
+}
+
+template <size_t Bytes>
+GUU_INLINE Int sumKernel(const Int* a, size_t n)
+{
+    using S = typename Lanes<Bytes>::S;
+
+    S acc    = broadcast<Bytes>(0);
+    size_t i = 0;
+    for(; i + LANES<Bytes> <= n; i += LANES<Bytes>)
+        acc = AddOp::apply<Bytes>(acc, load<S>(a + i));
+
+    Int lanes[LANES<Bytes>];
+    store(lanes, acc);
+
+    Int result = 0;
+    for(Int v: lanes)
+        result = AddOp::apply<sizeof(Int)>(result, v);
+
+    for(; i < n; ++i)
+        result = AddOp::apply<sizeof(Int)>(result, a[i]);
+
+    return result;
+}
+
+// `Less` picks the minimum, otherwise the maximum
+template <size_t Bytes, bool Less>
+GUU_INLINE Int extremeKernel(const Int* a, size_t n)
+{
+    using S = typename Lanes<Bytes>::S;
+
+    size_t i   = 0;
+    Int result = a[0];
+    if(n >= LANES<Bytes>)
+    {
+        S acc = load<S>(a);
+        for(i = LANES<Bytes>; i + LANES<Bytes> <= n; i += LANES<Bytes>)
+        {
+            S v = load<S>(a + i);
+            if constexpr(Bytes == sizeof(Int))
+            {
+                acc = (Less ? v < acc : v > acc) ? v : acc;
+            }
+            else
+            {
+                // All ones where v wins
+                S take = Less ? v < acc : v > acc;
+                acc    = (v & take) | (acc & ~take);
+            }
+        }
+
+        Int lanes[LANES<Bytes>];
+        store(lanes, acc);
+
+        result = lanes[0];
+        for(Int v: lanes)
+            result = (Less ? v < result : v > result) ? v : result;
+    }
+
+    for(; i < n; ++i)
+        result = (Less ? a[i] < result : a[i] > result) ? a[i] : result;
+
+    return result;
+}
+
+template <size_t Bytes>
+GUU_INLINE Int findKernel(const Int* a, size_t n, Int v)
+{
+    using S = typename Lanes<Bytes>::S;
+
+    S vv     = broadcast<Bytes>(v);
+    size_t i = 0;
+    for(; i + LANES<Bytes> <= n; i += LANES<Bytes>)
+    {
+        // Only a block with a match is searched element by element
+        Int lanes[LANES<Bytes>];
+        store(lanes, EqOp::apply<Bytes>(load<S>(a + i), vv));
+
+        Int any = 0;
+        for(Int m: lanes)
+            any |= m;
+
+        if(any)
+            break;
+    }
+
+    for(; i < n; ++i)
+    {
+        if(a[i] == v)
+            return static_cast<Int>(i);
+    }
+
+    return -1;
+}
+
+constexpr size_t OP_COUNT = static_cast<size_t>(Op::Ne) + 1;
+
+// Function table of one instruction set
+struct Table
+{
+    using Binary       = void (*)(Int*, const Int*, const Int*, size_t);
+    using BinaryScalar = void (*)(Int*, const Int*, Int, size_t);
+
+    const char* isa_;
+    Binary binary_[OP_COUNT];
+    BinaryScalar binaryScalar_[OP_COUNT];
+    Int (*sum_)(const Int*, size_t);
+    Int (*min_)(const Int*, size_t);
+    Int (*max_)(const Int*, size_t);
+    Int (*find_)(const Int*, size_t, Int);
+};
+
+// Entry points of an instruction set. The kernels above are forced inline,
+// so they are compiled with the target attribute of the function they end up in.
+#define GUU_KERNEL_ENTRIES(ATTR, BYTES)                                    \
+    template <typename Op>                                                 \
+    ATTR static void binary(Int* dst, const Int* a, const Int* b, size_t n) \
+    {                                                                      \
+        binaryKernel<BYTES, Op>(dst, a, b, n);                          \
+    }                                                                      \
+                                                                           \
+    template <typename Op>                                                 \
+    ATTR static void binaryScalar(Int* dst, const Int* a, Int b, size_t n) \
+    {                                                                      \
+        binaryScalarKernel<BYTES, Op>(dst, a, b, n);                    \
+    }                                                                      \
+                                                                           \
+    ATTR static Int sum(const Int* a, size_t n)                            \
+    {                                                                      \
+        return sumKernel<BYTES>(a, n);                                  \
+    }                                                                      \
+                                                                           \
+    ATTR static Int min(const Int* a, size_t n)                            \
+    {                                                                      \
+        return extremeKernel<BYTES, true>(a, n);                                 \
+    }                                                                      \
+                                                                           \
+    ATTR static Int max(const Int* a, size_t n)                            \
+    {                                                                      \
+        return extremeKernel<BYTES, false>(a, n);                                \
+    }                                                                      \
+                                                                           \
+    ATTR static Int find(const Int* a, size_t n, Int v)                    \
+    {                                                                      \
+        return findKernel<BYTES>(a, n, v);                              \
+    }
+
+struct Scalar
+{
+    GUU_KERNEL_ENTRIES(, sizeof(Int))
+};
+
+#if defined(GUU_ENABLE_SIMD)
+// SSE2 is part of every x86-64 CPU, so it needs no target attribute
+struct Sse2
+{
+    GUU_KERNEL_ENTRIES(, 16)
+};
+
+struct Avx2
+{
+    GUU_KERNEL_ENTRIES(__attribute__((target("avx2"))), 32)
+};
+#endif
+
+#undef GUU_KERNEL_ENTRIES
+
+template <typename Isa>
+Table tableFor(const char* name)
+{
+    // In the order of Kernels::Op
+    return Table{name,
+                 {&Isa::template binary<AddOp>,
+                  &Isa::template binary<SubOp>,
+                  &Isa::template binary<RSubOp>,
+                  &Isa::template binary<MulOp>,
+                  &Isa::template binary<LtOp>,
+                  &Isa::template binary<LeOp>,
+                  &Isa::template binary<GtOp>,
+                  &Isa::template binary<GeOp>,
+                  &Isa::template binary<EqOp>,
+                  &Isa::template binary<NeOp>},
+                 {&Isa::template binaryScalar<AddOp>,
+                  &Isa::template binaryScalar<SubOp>,
+                  &Isa::template binaryScalar<RSubOp>,
+                  &Isa::template binaryScalar<MulOp>,
+                  &Isa::template binaryScalar<LtOp>,
+                  &Isa::template binaryScalar<LeOp>,
+                  &Isa::template binaryScalar<GtOp>,
+                  &Isa::template binaryScalar<GeOp>,
+                  &Isa::template binaryScalar<EqOp>,
+                  &Isa::template binaryScalar<NeOp>},
+                 &Isa::sum,
+                 &Isa::min,
+                 &Isa::max,
+                 &Isa::find};
+}
+
+Table select()
+{
+    const char* requested = std::getenv("GUU_ISA");
+    auto is               = [requested](const char* isa) { return requested && std::strcmp(requested, isa) == 0; };
+
+#if defined(GUU_ENABLE_SIMD)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && (!requested || is("avx2")))
+        return tableFor<Avx2>("avx2");
+
+    if(!is("scalar"))
+        return tableFor<Sse2>("sse2");
+#else
+    (void)is;
+#endif
+
+    return tableFor<Scalar>("scalar");
+}
+
+const Table& table()
+{
+    static const Table t = select();
+    return t;
+}
+
+}
+
+const char* isa()
+{
+    return table().isa_;
+}
+
+void apply(Op op, std::int64_t* dst, const std::int64_t* a, const std::int64_t* b, size_t n)
+{
+    table().binary_[static_cast<size_t>(op)](dst, a, b, n);
+}
+
+void apply(Op op, std::int64_t* dst, const std::int64_t* a, std::int64_t b, size_t n)
+{
+    table().binaryScalar_[static_cast<size_t>(op)](dst, a, b, n);
+}
+
+std::int64_t sum(const std::int64_t* a, size_t n)
+{
+    return table().sum_(a, n);
+}
+
+std::int64_t min(const std::int64_t* a, size_t n)
+{
+    return table().min_(a, n);
+}
+
+std::int64_t max(const std::int64_t* a, size_t n)
+{
+    return table().max_(a, n);
+}
+
+std::int64_t find(const std::int64_t* a, size_t n, std::int64_t v)
+{
+    return table().find_(a, n, v);
+}
+
+size_t filter(std::int64_t* dst, const std::int64_t* a, const std::int64_t* mask, size_t n)
+{
+    // Branchless: every element is written, only kept ones advance the output
+    size_t count = 0;
+    for(size_t i = 0; i < n; ++i)
+    {
+        dst[count] = a[i];
+        count += mask[i] != 0;
+    }
+
+    return count;
+}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace Guu::Kernels
+{
+
+// Int arrays are contiguous and start on a cache line
+constexpr size_t ALIGNMENT = 64;
+
+// Elementwise operations with a vector kernel, comparisons yield 1 or 0.
+// RSub is b - a, so a scalar can stand on either side of a subtraction.
+enum class Op : std::uint8_t
+{
+    Add,
+    Sub,
+    RSub,
+    Mul,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    Eq,
+    Ne,
+};
+
+// Instruction set the kernels run on: "avx2", "sse2" or "scalar". Picked from
+// the CPU on first use; the GUU_ISA environment variable can ask for a lower one.
+const char* isa();
+
+// dst[i] = a[i] op b[i], dst may be a or b
+void apply(Op op, std::int64_t* dst, const std::int64_t* a, const std::int64_t* b, size_t n);
+
+// dst[i] = a[i] op b
+void apply(Op op, std::int64_t* dst, const std::int64_t* a, std::int64_t b, size_t n);
+
+// Wraps around like Guu addition
+std::int64_t sum(const std::int64_t* a, size_t n);
+
+// n must not be 0
+std::int64_t min(const std::int64_t* a, size_t n);
+std::int64_t max(const std::int64_t* a, size_t n);
+
+// Index of the first element equal to v, or -1
+std::int64_t find(const std::int64_t* a, size_t n, std::int64_t v);
+
+// Copies a[i] where mask[i] != 0 to the front of dst, which has room for n, returns the number copied
+size_t filter(std::int64_t* dst, const std::int64_t* a, const std::int64_t* mask, size_t n);
+
+inline void copy(std::int64_t* dst, const std::int64_t* a, size_t n)
+{
+    // memcpy already uses the widest moves of the CPU
+    if(n)
+        std::memcpy(dst, a, n * sizeof(std::int64_t));
+}
+
+}
@@ -0,0 +1,426 @@
+#include "language_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <iomanip>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+
+namespace Guu
+{
+
+namespace
+{
+
+// JSON-RPC error codes
+constexpr int PARSE_ERROR      = -32700;
+constexpr int INVALID_REQUEST  = -32600;
+constexpr int METHOD_NOT_FOUND = -32601;
+constexpr int INVALID_PARAMS   = -32602;
+
+// SymbolKind.Function, DiagnosticSeverity.Error, TextDocumentSyncKind.Incremental
+constexpr int FUNCTION_SYMBOL = 12;
+constexpr int ERROR_SEVERITY  = 1;
+constexpr int INCREMENTAL     = 2;
+
+// About what a DocumentSymbol takes in JSON
+constexpr size_t SYMBOL_BYTES = 256;
+
+// Far above any source file, but not a Content-Length to allocate blindly
+constexpr size_t MAX_MESSAGE_BYTES = 64 << 20;
+
+using Clock = std::chrono::steady_clock;
+
+// Bytes of the UTF-8 sequence starting with `lead`, 1 for a stray continuation byte
+size_t sequenceLength(char lead)
+{
+    auto c = static_cast<unsigned char>(lead);
+    return c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+}
+
+// Characters beyond the 16 bits of the Basic Multilingual Plane take two UTF-16 units, the 4 byte sequences
+size_t utf16ToBytes(std::string_view line, size_t units)
+{
+    size_t pos = 0;
+    while(pos < line.size() && units > 0)
+    {
+        size_t len = sequenceLength(line[pos]);
+        units -= std::min<size_t>(units, len == 4 ? 2 : 1);
+        pos += len;
+    }
+    return std::min(pos, line.size()) + units;
+}
+
+size_t bytesToUtf16(std::string_view line, size_t bytes)
+{
+    size_t units = 0;
+    for(size_t pos = 0; pos < bytes && pos < line.size(); pos += sequenceLength(line[pos]))
+    {
+        units += sequenceLength(line[pos]) == 4 ? 2 : 1;
+    }
+    return units;
+}
+
+size_t toSize(const util::Json& v)
+{
+    return static_cast<size_t>(std::max<std::int64_t>(v.asInt(), 0));
+}
+
+}
+
+LanguageServer::LanguageServer(std::istream& in, std::ostream& out) : in_(in), out_(out)
+{
+}
+
+LanguageServer::~LanguageServer() = default;
+
+int LanguageServer::run()
+{
+    std::string body;
+    while(!exit_ && read(body))
+    {
+        auto start = Clock::now();
+
+        util::Json msg;
+        try
+        {
+            msg = util::Json::parse(body);
+        } catch(const std::exception& e)
+        {
+            respondError(util::Json(), PARSE_ERROR, e.what());
+            continue;
+        }
+
+        handle(msg);
+
+        if(log_)
+        {
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            *log_ << std::fixed << std::setprecision(3) << ms << " ms  " << msg["method"].asString() << std::endl;
+        }
+    }
+
+    return shutdown_ ? 0 : 1;
+}
+
+bool LanguageServer::read(std::string& body)
+{
+    for(;;)
+    {
+        // Headers up to an empty line, of which only Content-Length matters
+        size_t length = 0;
+        bool known    = false;
+
+        std::string header;
+        while(std::getline(in_, header))
+        {
+            if(!header.empty() && header.back() == '\r')
+                header.pop_back();
+
+            if(header.empty())
+            {
+                if(known)
+                    break;
+                continue;
+            }
+
+            static const std::string CONTENT_LENGTH = "Content-Length:";
+            if(header.compare(0, CONTENT_LENGTH.size(), CONTENT_LENGTH) == 0)
+            {
+                size_t begin = header.find_first_not_of(' ', CONTENT_LENGTH.size());
+                if(begin == std::string::npos)
+                    continue;
+
+                auto res = std::from_chars(header.data() + begin, header.data() + header.size(), length);
+                if(res.ec == std::errc::result_out_of_range)
+                    length = std::numeric_limits<size_t>::max();
+
+                known = res.ec == std::errc() || res.ec == std::errc::result_out_of_range;
+            }
+        }
+
+        if(!known || !in_)
+            return false;
+
+        if(length <= MAX_MESSAGE_BYTES)
+        {
+            body.resize(length);
+            in_.read(body.data(), static_cast<std::streamsize>(length));
+            return static_cast<size_t>(in_.gcount()) == length;
+        }
+
+        // Skipped, so the next message is read from where it starts
+        auto skip = std::min<size_t>(length, std::numeric_limits<std::streamsize>::max());
+        in_.ignore(static_cast<std::streamsize>(skip));
+        respondError(util::Json(), INVALID_REQUEST,
+                     "A message of " + std::to_string(length) + " bytes is above the limit of "
+                         + std::to_string(MAX_MESSAGE_BYTES));
+    }
+}
+
+void LanguageServer::send(const util::JsonWriter& msg)
+{
+    const std::string& body = msg.str();
+    out_ << "Content-Length: " << body.size() << "\r\n\r\n" << body;
+    out_.flush();
+}
+
+void LanguageServer::handle(const util::Json& msg)
+{
+    const std::string& method = msg["method"].asString();
+    const util::Json& id      = msg["id"];
+    const util::Json& params  = msg["params"];
+
+    // Responses to requests of the server, which sends none
+    if(method.empty())
+        return;
+
+    bool request = msg.has("id");
+    if(shutdown_ && method != "exit")
+    {
+        if(request)
+            respondError(id, INVALID_REQUEST, "The server is shutting down");
+        return;
+    }
+
+    try
+    {
+        if(method == "initialize")
+        {
+            initialize(id, params);
+        }
+        else if(method == "shutdown")
+        {
+            shutdown_ = true;
+            send(response(id).null().endObject());
+        }
+        else if(method == "exit")
+        {
+            exit_ = true;
+        }
+        else if(method == "textDocument/didOpen")
+        {
+            didOpen(params);
+        }
+        else if(method == "textDocument/didChange")
+        {
+            didChange(params);
+        }
+        else if(method == "textDocument/didClose")
+        {
+            didClose(params);
+        }
+        else if(method == "textDocument/documentSymbol")
+        {
+            documentSymbol(id, params);
+        }
+        else if(method == "textDocument/definition")
+        {
+            definition(id, params);
+        }
+        else if(request)
+        {
+            respondError(id, METHOD_NOT_FOUND, "Unknown method '" + method + "'");
+        }
+    } catch(const std::exception& e)
+    {
+        // Notifications have nobody to tell
+        if(request)
+            respondError(id, INVALID_PARAMS, e.what());
+        else if(log_)
+            *log_ << "ERROR: " << method << ": " << e.what() << std::endl;
+    }
+}
+
+util::JsonWriter LanguageServer::response(const util::Json& id)
+{
+    util::JsonWriter w;
+    w.beginObject().field("jsonrpc", "2.0").field("id", id).key("result");
+    return w;
+}
+
+void LanguageServer::respondError(const util::Json& id, int code, const std::string& message)
+{
+    util::JsonWriter w;
+    w.beginObject().field("jsonrpc", "2.0").field("id", id).key("error").beginObject();
+    w.field("code", code).field("message", message).endObject().endObject();
+    send(w);
+}
+
+void LanguageServer::initialize(const util::Json& id, const util::Json& params)
+{
+    for(const auto& encoding: params["capabilities"]["general"]["positionEncodings"].elements())
+    {
+        utf8_ = utf8_ || encoding.asString() == "utf-8";
+    }
+
+    auto w = response(id);
+    w.beginObject().key("capabilities").beginObject();
+    w.field("positionEncoding", utf8_ ? "utf-8" : "utf-16");
+    w.key("textDocumentSync").beginObject().field("openClose", true).field("change", INCREMENTAL).endObject();
+    w.field("documentSymbolProvider", true).field("definitionProvider", true);
+    w.endObject();
+    w.key("serverInfo").beginObject().field("name", "Guu").endObject();
+    w.endObject();
+
+    send(w.endObject());
+}
+
+void LanguageServer::didOpen(const util::Json& params)
+{
+    const auto& doc = params["textDocument"];
+    const auto& uri = doc["uri"].asString();
+
+    auto& slot = docs_[uri];
+    slot       = std::make_unique<Document>(doc["text"].asString());
+    publishDiagnostics(uri, *slot);
+}
+
+void LanguageServer::didChange(const util::Json& params)
+{
+    const auto& uri = params["textDocument"]["uri"].asString();
+
+    auto& doc = document(params);
+    for(const auto& change: params["contentChanges"].elements())
+    {
+        if(change.has("range"))
+        {
+            const auto& range = change["range"];
+            TextRange r{toDocument(*doc, range["start"]), toDocument(*doc, range["end"])};
+            doc->edit(r, change["text"].asString());
+
+            if(log_)
+            {
+                const auto& stats = doc->lastEdit();
+                *log_ << "  parsed " << stats.parsed_ << " of " << stats.chunks_ << " chunks, resolved "
+                      << stats.resolved_ << std::endl;
+            }
+        }
+        else
+        {
+            doc = std::make_unique<Document>(change["text"].asString());
+        }
+    }
+
+    publishDiagnostics(uri, *doc);
+}
+
+void LanguageServer::didClose(const util::Json& params)
+{
+    const auto& uri = params["textDocument"]["uri"].asString();
+    docs_.erase(uri);
+
+    // Whatever was reported goes away with the file
+    util::JsonWriter w;
+    w.beginObject().field("jsonrpc", "2.0").field("method", "textDocument/publishDiagnostics");
+    w.key("params").beginObject().field("uri", uri).key("diagnostics").beginArray().endArray().endObject();
+    send(w.endObject());
+}
+
+void LanguageServer::documentSymbol(const util::Json& id, const util::Json& params)
+{
+    const Document& doc = *document(params);
+    auto symbols        = doc.symbols();
+
+    auto w = response(id);
+    w.reserve(symbols.size() * SYMBOL_BYTES);
+    w.beginArray();
+    for(const auto& sym: symbols)
+    {
+        w.beginObject().field("name", sym.name_).field("detail", sym.detail_).field("kind", FUNCTION_SYMBOL);
+        w.key("range");
+        writeRange(w, doc, sym.range_);
+        w.key("selectionRange");
+        writeRange(w, doc, sym.selection_);
+        w.endObject();
+    }
+    w.endArray();
+
+    send(w.endObject());
+}
+
+void LanguageServer::definition(const util::Json& id, const util::Json& params)
+{
+    const Document& doc = *document(params);
+    auto range          = doc.definition(toDocument(doc, params["position"]));
+
+    auto w = response(id);
+    if(range)
+    {
+        w.beginObject().field("uri", params["textDocument"]["uri"]).key("range");
+        writeRange(w, doc, *range);
+        w.endObject();
+    }
+    else
+    {
+        w.null();
+    }
+
+    send(w.endObject());
+}
+
+void LanguageServer::publishDiagnostics(const std::string& uri, const Document& doc)
+{
+    util::JsonWriter w;
+    w.beginObject().field("jsonrpc", "2.0").field("method", "textDocument/publishDiagnostics");
+    w.key("params").beginObject().field("uri", uri).key("diagnostics").beginArray();
+    for(const auto& d: doc.diagnostics())
+    {
+        w.beginObject().key("range");
+        writeRange(w, doc, d.range_);
+        w.field("severity", ERROR_SEVERITY).field("source", "guu").field("message", d.message_).endObject();
+    }
+    w.endArray().endObject();
+
+    send(w.endObject());
+}
+
+std::unique_ptr<Document>& LanguageServer::document(const util::Json& params)
+{
+    const auto& uri = params["textDocument"]["uri"].asString();
+
+    auto it = docs_.find(uri);
+    if(it == docs_.end())
+        throw std::runtime_error("Document '" + uri + "' is not open");
+
+    return it->second;
+}
+
+TextPos LanguageServer::toDocument(const Document& doc, const util::Json& pos) const
+{
+    size_t line = toSize(pos["line"]);
+    size_t col  = toSize(pos["character"]);
+    return TextPos{line, utf8_ ? col : utf16ToBytes(doc.line(line), col)};
+}
+
+void LanguageServer::writeRange(util::JsonWriter& w, const Document& doc, const TextRange& range) const
+{
+    // Both ends are mostly on one line, and the start of a line needs no conversion
+    std::string_view line;
+    size_t lineNo = static_cast<size_t>(-1);
+
+    auto position = [&](const TextPos& pos) {
+        size_t col = pos.col_;
+        if(!utf8_ && col > 0)
+        {
+            if(lineNo != pos.line_)
+            {
+                line   = doc.line(pos.line_);
+                lineNo = pos.line_;
+            }
+            col = bytesToUtf16(line, col);
+        }
+        w.beginObject().field("line", pos.line_).field("character", col).endObject();
+    };
+
+    w.beginObject().key("start");
+    position(range.begin_);
+    w.key("end");
+    position(range.end_);
+    w.endObject();
+}
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "document.h"
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "../util/json.h"
+
+namespace Guu
+{
+
+// Language Server Protocol on a pair of streams, stdin and stdout for
+// `Guu lsp`. Every open file is a Document, so a change applies to the parsed
+// and resolved state the last one left rather than starting over; see
+// Document for what an edit parses and resolves again.
+//
+// Serves diagnostics, which are published after every change, the functions
+// of a file and the definitions of functions and variables. Changes may come
+// as ranges or as whole texts. Positions are in UTF-16 code units unless the
+// client offers UTF-8 at initialize.
+class LanguageServer
+{
+public:
+    LanguageServer(std::istream& in, std::ostream& out);
+    ~LanguageServer();
+
+    LanguageServer(const LanguageServer&)            = delete;
+    LanguageServer& operator=(const LanguageServer&) = delete;
+
+    // Every message with the time it took
+    void setLog(std::ostream* log)
+    {
+        log_ = log;
+    }
+
+    // Until `exit` or the end of the input, returns the exit code: 0 if `shutdown` came first
+    int run();
+
+private:
+    // The body of the next message, false at the end of the input. Messages
+    // above MAX_MESSAGE_BYTES are answered with an error and skipped.
+    bool read(std::string& body);
+    void send(const util::JsonWriter& msg);
+
+    void handle(const util::Json& msg);
+
+    // A response to `id` with its result to be written next, and closed by endObject()
+    static util::JsonWriter response(const util::Json& id);
+    void respondError(const util::Json& id, int code, const std::string& message);
+
+    void initialize(const util::Json& id, const util::Json& params);
+    void didOpen(const util::Json& params);
+    void didChange(const util::Json& params);
+    void didClose(const util::Json& params);
+    void documentSymbol(const util::Json& id, const util::Json& params);
+    void definition(const util::Json& id, const util::Json& params);
+
+    void publishDiagnostics(const std::string& uri, const Document& doc);
+
+    // Of the `textDocument` of a request, which must be open
+    std::unique_ptr<Document>& document(const util::Json& params);
+
+    // Between the client's positions and the byte columns of a Document
+    TextPos toDocument(const Document& doc, const util::Json& pos) const;
+    void writeRange(util::JsonWriter& w, const Document& doc, const TextRange& range) const;
+
+private:
+    std::istream& in_;
+    std::ostream& out_;
+    std::ostream* log_ = nullptr;
+
+    std::unordered_map<std::string, std::unique_ptr<Document>> docs_;
+
+    bool utf8_     = false;
+    bool shutdown_ = false;
+    bool exit_     = false;
+};
+
+}
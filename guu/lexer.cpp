@@ -1,9 +1,11 @@
 #include "lexer.h"
+#include "stats.h"
 
 #include <stdexcept>
 #include <algorithm>
 #include <map>
 #include <cassert>
+#include <cctype>
 
 namespace Guu
 {
@@ -12,21 +14,36 @@ Tokenizer::Tokenizer(std::string text) : text_(std::move(text))
 {
     currentChar_ = std::cbegin(text_);
     currLine_    = 1;
-    while(*currentChar_ == '\n' && !isEnd())
+    while(!isEnd() && *currentChar_ == '\n')
     {
         currentChar_++;
         currLine_++;
     }
 }
 
+Tokenizer::Tokenizer(Tokenizer&& other) noexcept : currLine_(other.currLine_)
+{
+    auto offset  = other.currentChar_ - std::cbegin(other.text_);
+    text_        = std::move(other.text_);
+    currentChar_ = std::cbegin(text_) + offset;
+}
+
 Token Tokenizer::getNext()
 {
+    GUU_STATS_COUNT(tokens_);
+
     if(isEnd())
         return Token(TT::END);
 
-    if(std::isspace(*currentChar_) && *currentChar_ != '\n')
+    // <cctype> takes the bytes as unsigned char
+    auto c = static_cast<unsigned char>(*currentChar_);
+
+    if(std::isspace(c) && c != '\n')
         return Token(TT::SPACE, step());
 
+    if(auto token = twoCharToken(); token)
+        return *token;
+
     if(auto token = singleCharToken(); token)
     {
         if(token->type_ == TT::EOL)
@@ -38,17 +55,42 @@ Token Tokenizer::getNext()
     if(*currentChar_ == '"' || *currentChar_ == '\'')
         return Token(TT::STRING_LITERAL, getStringLiteral());
 
-    if(std::isdigit(*currentChar_))
+    if(std::isdigit(c))
         return Token{TT::NUM, getInteger()};
 
-    if(std::isalpha(*currentChar_))
+    if(std::isalpha(c))
     {
         std::string tv = getId();
         return Token{TT::ID, tv};
     }
 
-    throw std::runtime_error("Unexpected symbol '" + std::to_string(*currentChar_) + "' on line "
-                             + std::to_string(currLine_));
+    throw std::runtime_error("Unexpected symbol '" + std::to_string(c) + "' on line " + std::to_string(currLine_));
+}
+
+std::optional<Token> Tokenizer::twoCharToken()
+{
+    if(std::distance(currentChar_, std::cend(text_)) < 2)
+        return std::nullopt;
+
+    TT tt;
+    switch(*currentChar_)
+    {
+        case '=': tt = TT::EQEQ; break;
+        case '!': tt = TT::NE; break;
+        case '<': tt = TT::LE; break;
+        case '>': tt = TT::GE; break;
+        case '.': tt = TT::DOTDOT; break;
+
+        default: return std::nullopt;
+    }
+
+    if(*(currentChar_ + 1) != (tt == TT::DOTDOT ? '.' : '='))
+        return std::nullopt;
+
+    std::string value{currentChar_, currentChar_ + 2};
+    currentChar_ += 2;
+
+    return Token(tt, std::move(value));
 }
 
 std::optional<Token> Tokenizer::singleCharToken()
@@ -65,7 +107,12 @@ std::optional<Token> Tokenizer::singleCharToken()
         { '(',   TT::O_PAREN},
         { ')',   TT::C_PAREN},
         { '-',     TT::MINUS},
+        { '+',      TT::PLUS},
+        { '*',      TT::STAR},
+        { '/',     TT::SLASH},
+        { '%',   TT::PERCENT},
         { '>',        TT::GT},
+        { '<',        TT::LT},
         { '=',        TT::EQ},
     };
 
@@ -81,19 +128,42 @@ std::optional<Token> Tokenizer::singleCharToken()
 std::string Tokenizer::getStringLiteral()
 {
     char quot = step();
-    auto beg  = currentChar_;
 
     assert(quot == '"' || quot == '\'');
 
+    // Escapes are decoded here once, so the value of the token is the string itself
+    std::string result;
     while(!isEnd())
     {
-        if(*currentChar_ == quot && *(currentChar_ - 1) != '\\')
+        char c = step();
+        if(c == quot)
+            return result;
+
+        if(c == '\n')
+            ++currLine_;
+
+        if(c != '\\')
         {
-            step();
-            return std::string{beg, currentChar_ - 1};
+            result += c;
+            continue;
         }
 
-        step();
+        if(isEnd())
+            break;
+
+        switch(char e = step())
+        {
+            case 'n': result += '\n'; break;
+            case 't': result += '\t'; break;
+            case 'r': result += '\r'; break;
+            case '\\':
+            case '"':
+            case '\'': result += e; break;
+
+            default:
+                throw std::runtime_error("Unknown escape sequence '\\" + std::string(1, e) + "' on line "
+                                         + std::to_string(currLine_));
+        }
     }
 
     throw std::runtime_error("String literal is not closed on line " + std::to_string(currLine_));
@@ -102,7 +172,7 @@ std::string Tokenizer::getStringLiteral()
 std::string Tokenizer::getInteger()
 {
     auto begin   = currentChar_;
-    auto end     = std::find_if_not(currentChar_, std::cend(text_), ::isdigit);
+    auto end     = std::find_if_not(currentChar_, std::cend(text_), [](unsigned char c) { return std::isdigit(c); });
     currentChar_ = end;
 
     return std::string{begin, end};
@@ -110,7 +180,7 @@ std::string Tokenizer::getInteger()
 
 std::string Tokenizer::getId()
 {
-    auto pred    = [](char c) { return c == '_' || ::isalnum(c); };
+    auto pred    = [](unsigned char c) { return c == '_' || std::isalnum(c); };
     auto begin   = currentChar_;
     auto end     = std::find_if_not(currentChar_, std::cend(text_), pred);
     currentChar_ = end;
@@ -2,9 +2,9 @@
 
 #include "token.h"
 
-#include <stack>
 #include <string>
 #include <optional>
+#include <tuple>
 
 namespace Guu
 {
@@ -13,13 +13,15 @@ class Tokenizer
 {
     using TT       = TokenType;
     using Iterator = std::string::const_iterator;
-    using State    = Iterator;
+    using State    = std::pair<Iterator, size_t>;
 
 public:
     explicit Tokenizer(std::string text);
 
     Tokenizer(const Tokenizer&) = delete;
-    Tokenizer(Tokenizer&&)      = default;
+
+    // currentChar_ points into text_, which may keep short texts inline
+    Tokenizer(Tokenizer&& other) noexcept;
 
     Token getNext();
 
@@ -35,15 +37,16 @@ public:
 
     State getState()
     {
-        return currentChar_;
+        return {currentChar_, currLine_};
     }
 
     void restoreState(State st)
     {
-        currentChar_ = st;
+        std::tie(currentChar_, currLine_) = st;
     }
 
 private:
+    std::optional<Token> twoCharToken();
     std::optional<Token> singleCharToken();
     std::string getInteger();
     std::string getId();
@@ -58,7 +61,6 @@ private:
     std::string text_;
     Iterator currentChar_;
     size_t currLine_;
-    std::stack<Iterator> states_;
 };
 
 }
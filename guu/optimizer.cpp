@@ -0,0 +1,620 @@
+#include "optimizer.h"
+#include "arith.h"
+#include "resolver.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+#include <unordered_map>
+
+namespace Guu
+{
+
+namespace
+{
+
+class NodeCounter : public AST::Visitor
+{
+public:
+    using AST::Visitor::visit;
+
+    size_t count_ = 0;
+
+private:
+    // clang-format off
+    #define COUNT_VISIT(node, _) void visit(AST::node& n) override { ++count_; AST::Visitor::visit(n); }
+    GUU_NODE_TYPE_VALUES(COUNT_VISIT)
+    #undef COUNT_VISIT
+    // clang-format on
+};
+
+// Expressions that may fail or have side effects at runtime can't be dropped
+class PurityChecker : public AST::Visitor
+{
+public:
+    using AST::Visitor::visit;
+
+    explicit PurityChecker(const TypeTable& types) : types_(types)
+    {
+    }
+
+    bool isPure(AST::Node& n)
+    {
+        pure_ = true;
+        visit(n);
+        return pure_;
+    }
+
+private:
+    void visit(AST::Call&) override
+    {
+        pure_ = false;
+    }
+
+    // Out of bounds access fails at runtime
+    void visit(AST::Index&) override
+    {
+        pure_ = false;
+    }
+
+    void visit(AST::BinOp& op) override
+    {
+        // Operators of arrays fail on arrays of different sizes
+        if(types_.isArray(op.resolvedType_))
+            pure_ = false;
+
+        if(op.opType_ == TokenType::SLASH || op.opType_ == TokenType::PERCENT)
+        {
+            auto* divisor = op.op2_->type_ == AST::NodeType::Const ? static_cast<AST::Const*>(op.op2_.get()) : nullptr;
+            if(!divisor || divisor->num_ == 0)
+                pure_ = false;
+        }
+
+        AST::Visitor::visit(op);
+    }
+
+private:
+    const TypeTable& types_;
+    bool pure_ = true;
+};
+
+// Visits expressions through their owning pointers, so a pass can replace any of them
+class Rewriter : public AST::Visitor
+{
+public:
+    using AST::Visitor::visit;
+
+    size_t rewrite(AST::Root& root)
+    {
+        changes_ = 0;
+        visit(root);
+        return changes_;
+    }
+
+protected:
+    // Called after the children of `node` were rewritten, returns a replacement or nullptr
+    virtual AST::Node::Ptr replace(AST::Node& node) = 0;
+
+    void rewrite(AST::Node::Ptr& node)
+    {
+        visit(*node);
+        if(auto r = replace(*node))
+        {
+            node = std::move(r);
+            ++changes_;
+        }
+    }
+
+    void rewriteAll(AST::NodeVec& nodes)
+    {
+        for(auto& n: nodes)
+        {
+            rewrite(n);
+        }
+    }
+
+    void visit(AST::FnDef& fn) override
+    {
+        rewriteAll(fn.statements_);
+    }
+
+    void visit(AST::Variable& var) override
+    {
+        if(var.init_)
+        {
+            rewrite(var.init_);
+        }
+    }
+
+    void visit(AST::BinOp& op) override
+    {
+        rewrite(op.op1_);
+        rewrite(op.op2_);
+    }
+
+    void visit(AST::UnaryOp& op) override
+    {
+        rewrite(op.op_);
+    }
+
+    void visit(AST::Call& call) override
+    {
+        rewriteAll(call.args_);
+    }
+
+    void visit(AST::Return& ret) override
+    {
+        rewrite(ret.value_);
+    }
+
+    void visit(AST::ConstArray& arr) override
+    {
+        rewriteAll(arr.elements_);
+    }
+
+    void visit(AST::If& stmt) override
+    {
+        rewrite(stmt.cond_);
+        rewriteAll(stmt.then_);
+        rewriteAll(stmt.else_);
+    }
+
+    void visit(AST::While& stmt) override
+    {
+        rewrite(stmt.cond_);
+        rewriteAll(stmt.body_);
+    }
+
+    void visit(AST::ParallelFor& stmt) override
+    {
+        rewrite(stmt.from_);
+        rewrite(stmt.to_);
+        visit(*stmt.var_);
+        rewriteAll(stmt.body_);
+    }
+
+    // The call itself stays, only its arguments are rewritten
+    void visit(AST::Spawn& spawn) override
+    {
+        visit(*spawn.call_);
+    }
+
+    void visit(AST::Assign& stmt) override
+    {
+        // The target is written, not read, so it's never replaced itself
+        if(stmt.target_->type_ == AST::NodeType::Index)
+        {
+            visit(*stmt.target_);
+        }
+
+        rewrite(stmt.value_);
+    }
+
+    void visit(AST::Index& idx) override
+    {
+        rewrite(idx.array_);
+        rewrite(idx.index_);
+    }
+
+    AST::Node::Ptr makeConst(std::int64_t num, const AST::Node& origin, TypeHandle type)
+    {
+        auto result           = std::make_unique<AST::Const>(num);
+        result->line_         = origin.line_;
+        result->resolvedType_ = type;
+        return result;
+    }
+
+    AST::Node::Ptr copyConst(const AST::Const& c, const AST::Node& origin)
+    {
+        auto result = c.isNum() ? std::make_unique<AST::Const>(c.num_) : std::make_unique<AST::Const>(c.str_, c.value_);
+        result->line_         = origin.line_;
+        result->resolvedType_ = c.resolvedType_;
+        return result;
+    }
+
+private:
+    size_t changes_ = 0;
+};
+
+const AST::Const* asNumConst(const AST::Node& n)
+{
+    if(n.type_ != AST::NodeType::Const)
+        return nullptr;
+
+    auto& c = static_cast<const AST::Const&>(n);
+    return c.isNum() ? &c : nullptr;
+}
+
+// Evaluates operators on constants and drops arithmetic identities like `x + 0` or `x * 1`
+class ConstantFolding : public OptimizerPass, private Rewriter
+{
+public:
+    using OptimizerPass::OptimizerPass;
+
+    const char* name() const override
+    {
+        return "const-fold";
+    }
+
+    size_t run(AST::Root& root) override
+    {
+        return rewrite(root);
+    }
+
+private:
+    AST::Node::Ptr replace(AST::Node& node) override
+    {
+        switch(node.type_)
+        {
+            case AST::NodeType::BinOp: return fold(static_cast<AST::BinOp&>(node));
+            case AST::NodeType::UnaryOp: return fold(static_cast<AST::UnaryOp&>(node));
+
+            default: return nullptr;
+        }
+    }
+
+    AST::Node::Ptr fold(AST::BinOp& op)
+    {
+        auto* lhs = asNumConst(*op.op1_);
+        auto* rhs = asNumConst(*op.op2_);
+
+        if(lhs && rhs)
+        {
+            // Division by zero is left for the runtime to report
+            if(auto v = Arith::apply(op.opType_, lhs->num_, rhs->num_))
+                return makeConst(*v, op, op.resolvedType_);
+
+            return nullptr;
+        }
+
+        // `a + 0` of an array is a new array, not `a` itself
+        if(op.resolvedType_ != types_.intType())
+            return nullptr;
+
+        auto isNum = [](const AST::Const* c, std::int64_t v) { return c && c->num_ == v; };
+
+        switch(op.opType_)
+        {
+            case TokenType::PLUS:
+                if(isNum(lhs, 0))
+                    return std::move(op.op2_);
+                [[fallthrough]];
+            case TokenType::MINUS:
+                if(isNum(rhs, 0))
+                    return std::move(op.op1_);
+                break;
+
+            case TokenType::STAR:
+                if(isNum(lhs, 1))
+                    return std::move(op.op2_);
+                [[fallthrough]];
+            case TokenType::SLASH:
+                if(isNum(rhs, 1))
+                    return std::move(op.op1_);
+                break;
+
+            default: break;
+        }
+
+        return nullptr;
+    }
+
+    AST::Node::Ptr fold(AST::UnaryOp& op)
+    {
+        assert(op.opType_ == TokenType::MINUS);
+
+        if(auto* c = asNumConst(*op.op_))
+            return makeConst(Arith::neg(c->num_), op, op.resolvedType_);
+
+        // --x, unless x is an array
+        if(op.op_->type_ == AST::NodeType::UnaryOp && op.resolvedType_ == types_.intType())
+        {
+            auto& inner = static_cast<AST::UnaryOp&>(*op.op_);
+            if(inner.opType_ == TokenType::MINUS)
+                return std::move(inner.op_);
+        }
+
+        return nullptr;
+    }
+};
+
+// Replaces references to variables initialized with a scalar constant and never
+// assigned afterwards by that constant.
+class ConstantPropagation : public OptimizerPass, private Rewriter
+{
+public:
+    using OptimizerPass::OptimizerPass;
+
+    const char* name() const override
+    {
+        return "const-prop";
+    }
+
+    size_t run(AST::Root& root) override
+    {
+        return rewrite(root);
+    }
+
+private:
+    void visit(AST::FnDef& fn) override
+    {
+        known_.assign(fn.frameSize_, nullptr);
+        Rewriter::visit(fn);
+    }
+
+    void visit(AST::Variable& var) override
+    {
+        Rewriter::visit(var);
+
+        // Slots are reused by sibling scopes, so a later declaration always overrides
+        const AST::Node* init = var.init_.get();
+        bool isConst          = !var.assigned_ && init && init->type_ == AST::NodeType::Const;
+        known_[var.slot_]     = isConst ? static_cast<const AST::Const*>(init) : nullptr;
+    }
+
+    AST::Node::Ptr replace(AST::Node& node) override
+    {
+        if(node.type_ != AST::NodeType::VarRef)
+            return nullptr;
+
+        auto& ref = static_cast<AST::VarRef&>(node);
+        if(const AST::Const* c = known_[ref.slot_])
+            return copyConst(*c, ref);
+
+        return nullptr;
+    }
+
+private:
+    std::vector<const AST::Const*> known_;
+};
+
+// Removes local variables that are never referenced and whose initializer has no side effects
+class DeadVariableElimination : public OptimizerPass, private AST::Visitor
+{
+public:
+    using OptimizerPass::OptimizerPass;
+    using AST::Visitor::visit;
+
+    const char* name() const override
+    {
+        return "dead-vars";
+    }
+
+    size_t run(AST::Root& root) override
+    {
+        removed_ = 0;
+        visit(root);
+        return removed_;
+    }
+
+private:
+    void visit(AST::FnDef& fn) override
+    {
+        // Removing a variable may leave the ones used by its initializer dead too
+        size_t removedBefore;
+        do
+        {
+            removedBefore = removed_;
+
+            owner_.assign(fn.frameSize_, nullptr);
+            uses_.clear();
+            AST::Visitor::visit(fn);
+
+            sweep(fn.statements_);
+        } while(removed_ != removedBefore);
+    }
+
+    void sweep(AST::NodeVec& block)
+    {
+        auto isDead = [this](const AST::Node::Ptr& st) {
+            if(st->type_ != AST::NodeType::Variable)
+                return false;
+
+            auto& var = static_cast<AST::Variable&>(*st);
+            return uses_[&var] == 0 && (!var.init_ || purity_.isPure(*var.init_));
+        };
+
+        auto it = std::remove_if(block.begin(), block.end(), isDead);
+        removed_ += static_cast<size_t>(std::distance(it, block.end()));
+        block.erase(it, block.end());
+
+        for(auto& st: block)
+        {
+            if(st->type_ == AST::NodeType::If)
+            {
+                sweep(static_cast<AST::If&>(*st).then_);
+                sweep(static_cast<AST::If&>(*st).else_);
+            }
+            else if(st->type_ == AST::NodeType::While)
+            {
+                sweep(static_cast<AST::While&>(*st).body_);
+            }
+            else if(st->type_ == AST::NodeType::ParallelFor)
+            {
+                sweep(static_cast<AST::ParallelFor&>(*st).body_);
+            }
+        }
+    }
+
+    void visit(AST::Variable& var) override
+    {
+        AST::Visitor::visit(var);
+        owner_[var.slot_] = &var;
+
+        // `int[n] a;` reads n
+        auto& typeId = static_cast<AST::TypeId&>(*var.typeId_);
+        if(!var.init_ && typeId.sizeSlot_ != static_cast<std::uint32_t>(-1))
+            ++uses_[owner_[typeId.sizeSlot_]];
+    }
+
+    void visit(AST::VarRef& ref) override
+    {
+        ++uses_[owner_[ref.slot_]];
+    }
+
+private:
+    PurityChecker purity_{types_};
+    std::vector<const AST::Variable*> owner_;
+    std::unordered_map<const AST::Variable*, size_t> uses_;
+    size_t removed_ = 0;
+};
+
+// Removes the functions that can't be reached through calls starting from `main`
+class UnreachableFunctionElimination : public OptimizerPass, private AST::Visitor
+{
+public:
+    using OptimizerPass::OptimizerPass;
+    using AST::Visitor::visit;
+
+    const char* name() const override
+    {
+        return "dead-fns";
+    }
+
+    size_t run(AST::Root& root) override
+    {
+        auto& fns = root.children_;
+
+        auto main = std::find_if(fns.begin(), fns.end(), [](auto& fn) {
+            return static_cast<AST::FnDef&>(*fn).id_ == "main";
+        });
+
+        // A library of functions without an entry point has nothing to start from
+        if(main == fns.end())
+            return 0;
+
+        reachable_.assign(fns.size(), false);
+        worklist_.clear();
+
+        markReachable(static_cast<AST::FnDef&>(**main).index_);
+        while(!worklist_.empty())
+        {
+            auto idx = worklist_.back();
+            worklist_.pop_back();
+            visit(*fns[idx]);
+        }
+
+        auto isDead = [this](const AST::Node::Ptr& fn) { return !reachable_[static_cast<AST::FnDef&>(*fn).index_]; };
+
+        auto it       = std::remove_if(fns.begin(), fns.end(), isDead);
+        size_t result = static_cast<size_t>(std::distance(it, fns.end()));
+        fns.erase(it, fns.end());
+
+        return result;
+    }
+
+private:
+    void visit(AST::Call& call) override
+    {
+        markReachable(call.fnIndex_);
+        AST::Visitor::visit(call);
+    }
+
+    void markReachable(std::uint32_t idx)
+    {
+        if(!reachable_[idx])
+        {
+            reachable_[idx] = true;
+            worklist_.push_back(idx);
+        }
+    }
+
+private:
+    std::vector<bool> reachable_;
+    std::vector<std::uint32_t> worklist_;
+};
+
+enum PassIdx : size_t
+{
+    FOLD,
+    PROP,
+    DEAD_VARS,
+    DEAD_FNS,
+};
+
+}
+
+size_t countNodes(AST::Node& root)
+{
+    NodeCounter counter;
+    counter.visit(root);
+    return counter.count_;
+}
+
+Optimizer::Optimizer(TypeTable& types, int level) : types_(types), level_(level)
+{
+    passes_.push_back(std::make_unique<ConstantFolding>(types_));
+    passes_.push_back(std::make_unique<ConstantPropagation>(types_));
+    passes_.push_back(std::make_unique<DeadVariableElimination>(types_));
+    passes_.push_back(std::make_unique<UnreachableFunctionElimination>(types_));
+
+    for(auto& p: passes_)
+    {
+        stats_.push_back(PassStats{p->name()});
+    }
+}
+
+Optimizer::~Optimizer() = default;
+
+void Optimizer::run(AST::Node& root)
+{
+    if(level_ <= 0)
+        return;
+
+    assert(root.type_ == AST::NodeType::Root);
+    auto& r = static_cast<AST::Root&>(root);
+
+    size_t changes = 0;
+
+    // Propagation exposes new folding opportunities and vice versa
+    for(size_t round = 0; round < MAX_ROUNDS; ++round)
+    {
+        size_t roundChanges = runPass(FOLD, r) + runPass(PROP, r);
+        if(roundChanges == 0)
+            break;
+
+        changes += roundChanges;
+    }
+
+    changes += runPass(DEAD_VARS, r);
+    changes += runPass(DEAD_FNS, r);
+
+    // Renumber slots and function indices after removals
+    if(changes)
+    {
+        GUU_STATS_PHASE("re-resolve");
+        Resolver(types_).resolve(root);
+    }
+}
+
+size_t Optimizer::runPass(size_t idx, AST::Root& root)
+{
+    GUU_STATS_PHASE(passes_[idx]->name());
+
+    auto nodesBefore = static_cast<std::int64_t>(countNodes(root));
+    size_t changes   = passes_[idx]->run(root);
+    auto nodesAfter  = static_cast<std::int64_t>(countNodes(root));
+
+    auto& st = stats_[idx];
+    st.runs_ += 1;
+    st.changes_ += changes;
+    st.nodesRemoved_ += nodesBefore - nodesAfter;
+
+    return changes;
+}
+
+void Optimizer::printStats(std::ostream& os) const
+{
+    os << std::left << std::setw(12) << "Pass" << std::right << std::setw(8) << "Runs" << std::setw(10) << "Changes"
+       << std::setw(16) << "Nodes removed" << std::endl;
+
+    for(const auto& st: stats_)
+    {
+        os << std::left << std::setw(12) << st.name_ << std::right << std::setw(8) << st.runs_ << std::setw(10)
+           << st.changes_ << std::setw(16) << st.nodesRemoved_ << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ast.h"
+#include "types.h"
+
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+namespace Guu
+{
+
+struct PassStats
+{
+    const char* name_;
+    size_t runs_    = 0;
+    size_t changes_ = 0;
+
+    // Net number of AST nodes the pass removed from the tree
+    std::int64_t nodesRemoved_ = 0;
+};
+
+class OptimizerPass
+{
+public:
+    explicit OptimizerPass(TypeTable& types) : types_(types)
+    {
+    }
+
+    virtual ~OptimizerPass() = default;
+
+    virtual const char* name() const = 0;
+
+    // Returns the number of rewrites done
+    virtual size_t run(AST::Root& root) = 0;
+
+protected:
+    TypeTable& types_;
+};
+
+// Runs on a resolved AST and leaves it resolved again. -O0 does nothing, -O1 runs
+// constant folding and propagation to a fixed point, then removes dead variables
+// and the functions not reachable from `main`.
+class Optimizer
+{
+    static constexpr size_t MAX_ROUNDS = 8;
+
+public:
+    static constexpr int MAX_LEVEL = 1;
+
+    Optimizer(TypeTable& types, int level);
+    ~Optimizer();
+
+    void run(AST::Node& root);
+
+    const std::vector<PassStats>& stats() const
+    {
+        return stats_;
+    }
+
+    void printStats(std::ostream& os) const;
+
+private:
+    size_t runPass(size_t idx, AST::Root& root);
+
+private:
+    TypeTable& types_;
+    int level_;
+    std::vector<std::unique_ptr<OptimizerPass>> passes_;
+    std::vector<PassStats> stats_;
+};
+
+size_t countNodes(AST::Node& root);
+
+}
@@ -1,25 +1,46 @@
 #include "parser.h"
+#include "stats.h"
 
 #include <iostream>
 #include <sstream>
 #include <cassert>
+#include <charconv>
 
 #define UNEXPECTED_VAL(expected) unexpectedValue(expected, __PRETTY_FUNCTION__)
 
 namespace Guu
 {
 
+namespace
+{
+
+// Not a reason to try another production, every one would nest as deep
+class NestingError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+}
+
 AST::Node::Ptr Parser::tryParse(AST::Node::Ptr (Parser::*memFn)())
 {
     auto state      = tokenizer_.getState();
     auto savedToken = currToken_;
+    auto savedLine  = tokenLine_;
     try
     {
         return (this->*memFn)();
+    } catch(const NestingError&)
+    {
+        throw;
     } catch(...)
     {
+        GUU_STATS_COUNT(backtracks_);
+
         tokenizer_.restoreState(state);
         currToken_ = savedToken;
+        tokenLine_ = savedLine;
         return nullptr;
     }
 }
@@ -30,23 +51,20 @@ AST::Node::Ptr Parser::program()
     auto result = construct<AST::Root>();
 
     eatEmptyLines();
-    result->children_.push_back(fn());
-
-    // while(!tokenizer_.isEnd())
-    // {
-    //     eatAll(TokenType::NEWLINE);
-    //     result->children_.push_back(statement());
-    // }
-
-    eatEmptyLines();
+    do
+    {
+        result->children_.push_back(fn());
+        eatEmptyLines();
+    } while(currToken_.type_ != TT::END);
 
-    assert(currToken_.type_ == TT::END);
     return result;
 }
 
 // fn ::= "fn" SPACE spaces fn_name fn_args fn_ret o_brace fn_content c_brace
 AST::Node::Ptr Parser::fn()
 {
+    auto line = tokenLine_;
+
     // "fn"
     std::string fnStr = eatVal(TT::ID);
     if(fnStr != "fn")
@@ -75,14 +93,11 @@ AST::Node::Ptr Parser::fn()
     eat(TT::GT);
     auto retTypeId = type_id();
 
-    // o_brace fn_content c_brace
-    eatWithSpaces(TT::O_BRACE);
-
-    eatEmptyLines();
-
-    eatWithSpaces(TT::C_BRACE);
+    auto result   = construct<AST::FnDef>(id, std::move(retTypeId), std::move(fnArgs));
+    result->line_ = line;
 
-    auto result = construct<AST::FnDef>(id, std::move(retTypeId), std::move(fnArgs));
+    // o_brace fn_content c_brace
+    result->statements_ = block();
 
     return result;
 }
@@ -102,6 +117,444 @@ AST::Node::Ptr Parser::fn_arg()
     return construct<AST::Variable>(id, type_id());
 }
 
+// block ::= o_brace statement* c_brace
+AST::NodeVec Parser::block()
+{
+    Nesting nesting(*this);
+    eatWithSpaces(TT::O_BRACE);
+
+    AST::NodeVec result;
+
+    eatEmptyLines();
+    while(currToken_.type_ != TT::C_BRACE)
+    {
+        result.push_back(statement());
+        eatEmptyLines();
+    }
+
+    eat(TT::C_BRACE);
+
+    return result;
+}
+
+// statement ::= eol | var_decl | return_stmt | if_stmt | while_stmt | parallel_for | assign | call_stmt
+AST::Node::Ptr Parser::statement()
+{
+    if(isKeyword("return"))
+        return return_stmt();
+
+    if(isKeyword("if"))
+        return if_stmt();
+
+    if(isKeyword("while"))
+        return while_stmt();
+
+    if(isKeyword("parallel"))
+        return parallel_for();
+
+    AST::Node::Ptr result;
+    if(result = tryParse(&Parser::var_decl); result)
+    {
+    }
+    else if(result = tryParse(&Parser::assign); result)
+    {
+    }
+    else if(result = tryParse(&Parser::call_stmt); result)
+    {
+    }
+
+    if(!result)
+    {
+        throw unexpectedToken("statement");
+    }
+
+    return result;
+}
+
+// var_decl ::= type_id id (eq expr)? semicolon eol
+AST::Node::Ptr Parser::var_decl()
+{
+    auto line   = tokenLine_;
+    auto typeId = type_id();
+
+    std::string id = eatValueWithSpaces(TT::ID, EatSpaces::Both);
+
+    AST::Node::Ptr init;
+    if(currToken_.type_ == TT::EQ)
+    {
+        eat(TT::EQ);
+        init = expr();
+    }
+
+    auto result   = construct<AST::Variable>(id, std::move(typeId), std::move(init));
+    result->line_ = line;
+
+    eatWithSpaces(TT::SEMICOLON, TT::EOL);
+
+    return result;
+}
+
+// return_stmt ::= "return" SPACE expr semicolon eol
+AST::Node::Ptr Parser::return_stmt()
+{
+    auto line = tokenLine_;
+    eatKeyword("return");
+    eat(TT::SPACE);
+
+    auto result   = construct<AST::Return>(expr());
+    result->line_ = line;
+
+    eatWithSpaces(TT::SEMICOLON, TT::EOL);
+
+    return result;
+}
+
+// if_stmt ::= "if" SPACE expr block (spaces "else" (spaces if_stmt | block eol) | eol)
+AST::Node::Ptr Parser::if_stmt()
+{
+    // Also the depth of an else if chain
+    Nesting nesting(*this);
+
+    auto line = tokenLine_;
+    eatKeyword("if");
+    eat(TT::SPACE);
+
+    auto cond = expr();
+    auto then = block();
+
+    AST::NodeVec otherwise;
+
+    eatAll(TT::SPACE);
+    if(isKeyword("else"))
+    {
+        eatKeyword("else");
+        eatAll(TT::SPACE);
+
+        if(isKeyword("if"))
+        {
+            otherwise.push_back(if_stmt());
+        }
+        else
+        {
+            otherwise = block();
+            eatWithSpaces(TT::EOL);
+        }
+    }
+    else
+    {
+        eatWithSpaces(TT::EOL);
+    }
+
+    auto result   = construct<AST::If>(std::move(cond), std::move(then), std::move(otherwise));
+    result->line_ = line;
+    return result;
+}
+
+// while_stmt ::= "while" SPACE expr block eol
+AST::Node::Ptr Parser::while_stmt()
+{
+    auto line = tokenLine_;
+    eatKeyword("while");
+    eat(TT::SPACE);
+
+    auto cond = expr();
+    auto body = block();
+
+    eatWithSpaces(TT::EOL);
+
+    auto result   = construct<AST::While>(std::move(cond), std::move(body));
+    result->line_ = line;
+    return result;
+}
+
+// parallel_for ::= "parallel" SPACE spaces "for" SPACE id SPACE spaces "in" SPACE expr spaces DOTDOT expr block eol
+AST::Node::Ptr Parser::parallel_for()
+{
+    auto line = tokenLine_;
+    eatKeyword("parallel");
+    eat(TT::SPACE);
+    eatAll(TT::SPACE);
+    eatKeyword("for");
+    eat(TT::SPACE);
+
+    auto var   = construct<AST::Variable>(eatValueWithSpaces(TT::ID, EatSpaces::Both), construct<AST::TypeId>("int"));
+    var->line_ = line;
+
+    eatKeyword("in");
+    eat(TT::SPACE);
+
+    auto from = expr();
+    eatWithSpaces(TT::DOTDOT);
+    auto to   = expr();
+    auto body = block();
+
+    eatWithSpaces(TT::EOL);
+
+    auto result   = construct<AST::ParallelFor>(std::move(var), std::move(from), std::move(to), std::move(body));
+    result->line_ = line;
+    return result;
+}
+
+// assign ::= id index? eq expr semicolon eol
+AST::Node::Ptr Parser::assign()
+{
+    auto line = tokenLine_;
+
+    AST::Node::Ptr target = construct<AST::VarRef>(eatVal(TT::ID));
+    if(currToken_.type_ == TT::O_BRACK)
+        target = index(std::move(target));
+
+    eatWithSpaces(TT::EQ);
+
+    auto result   = construct<AST::Assign>(std::move(target), expr());
+    result->line_ = line;
+
+    eatWithSpaces(TT::SEMICOLON, TT::EOL);
+
+    return result;
+}
+
+// call_stmt ::= id call semicolon eol
+AST::Node::Ptr Parser::call_stmt()
+{
+    auto result = call(eatVal(TT::ID));
+
+    eatWithSpaces(TT::SEMICOLON, TT::EOL);
+
+    return result;
+}
+
+// expr ::= sum (spaces (LT | GT | LE | GE | EQEQ | NE) sum)?
+AST::Node::Ptr Parser::expr()
+{
+    Nesting nesting(*this);
+    auto result = sum();
+
+    switch(currToken_.type_)
+    {
+        case TT::LT:
+        case TT::GT:
+        case TT::LE:
+        case TT::GE:
+        case TT::EQEQ:
+        case TT::NE: {
+            auto op = currToken_.type_;
+            eat(op);
+            result = construct<AST::BinOp>(op, std::move(result), sum());
+        }
+        break;
+
+        default: break;
+    }
+
+    return result;
+}
+
+// sum ::= term (spaces (PLUS | MINUS) term)*
+AST::Node::Ptr Parser::sum()
+{
+    Nesting nesting(*this, 0);
+    auto result = term();
+
+    eatAll(TT::SPACE);
+    while(currToken_.type_ == TT::PLUS || currToken_.type_ == TT::MINUS)
+    {
+        nesting.deeper();
+
+        auto op = currToken_.type_;
+        eat(op);
+        result = construct<AST::BinOp>(op, std::move(result), term());
+        eatAll(TT::SPACE);
+    }
+
+    return result;
+}
+
+// term ::= unary (spaces (STAR | SLASH | PERCENT) unary)*
+AST::Node::Ptr Parser::term()
+{
+    Nesting nesting(*this, 0);
+    auto result = unary();
+
+    eatAll(TT::SPACE);
+    while(currToken_.type_ == TT::STAR || currToken_.type_ == TT::SLASH || currToken_.type_ == TT::PERCENT)
+    {
+        nesting.deeper();
+
+        auto op = currToken_.type_;
+        eat(op);
+        result = construct<AST::BinOp>(op, std::move(result), unary());
+        eatAll(TT::SPACE);
+    }
+
+    return result;
+}
+
+// unary ::= spaces MINUS unary | primary
+AST::Node::Ptr Parser::unary()
+{
+    eatAll(TT::SPACE);
+
+    if(currToken_.type_ == TT::MINUS)
+    {
+        Nesting nesting(*this);
+
+        eat(TT::MINUS);
+        return construct<AST::UnaryOp>(TT::MINUS, unary());
+    }
+
+    return primary();
+}
+
+// primary ::= const_decl | spawn | id call | id index* | o_paren expr c_paren
+AST::Node::Ptr Parser::primary()
+{
+    eatAll(TT::SPACE);
+
+    switch(currToken_.type_)
+    {
+        case TT::ID: {
+            if(isKeyword("spawn"))
+                return spawn();
+
+            auto line      = tokenLine_;
+            std::string id = eatVal(TT::ID);
+            if(currToken_.type_ == TT::O_PAREN)
+                return call(std::move(id));
+
+            AST::Node::Ptr result = construct<AST::VarRef>(std::move(id));
+            result->line_         = line;
+
+            Nesting nesting(*this, 0);
+            while(currToken_.type_ == TT::O_BRACK)
+            {
+                nesting.deeper();
+                result = index(std::move(result));
+            }
+
+            return result;
+        }
+
+        case TT::O_PAREN: {
+            eat(TT::O_PAREN);
+            auto result = expr();
+            eatWithSpaces(TT::C_PAREN);
+            return result;
+        }
+
+        default: return const_decl();
+    }
+}
+
+// call ::= o_paren (expr (comma expr)*)? c_paren
+AST::Node::Ptr Parser::call(std::string id)
+{
+    auto line = tokenLine_;
+    eat(TT::O_PAREN);
+
+    AST::NodeVec args;
+
+    eatAll(TT::SPACE);
+    if(currToken_.type_ != TT::C_PAREN)
+    {
+        args.push_back(expr());
+        while(currToken_.type_ == TT::COMMA)
+        {
+            eat(TT::COMMA);
+            args.push_back(expr());
+        }
+    }
+
+    eatWithSpaces(TT::C_PAREN);
+
+    auto result   = construct<AST::Call>(std::move(id), std::move(args));
+    result->line_ = line;
+    return result;
+}
+
+// spawn ::= "spawn" SPACE id call
+AST::Node::Ptr Parser::spawn()
+{
+    auto line = tokenLine_;
+    eatKeyword("spawn");
+    eat(TT::SPACE);
+
+    auto result   = construct<AST::Spawn>(call(eatValueWithSpaces(TT::ID)));
+    result->line_ = line;
+    return result;
+}
+
+// const_decl ::= spaces const_num | const_str | const_array
+AST::Node::Ptr Parser::const_decl()
+{
+    eatAll(TT::SPACE);
+
+    switch(currToken_.type_)
+    {
+        case TT::NUM: return construct<AST::Const>(toInt(eatVal(TT::NUM)));
+        case TT::STRING_LITERAL: {
+            std::string str = eatVal(TT::STRING_LITERAL);
+
+            // Equal literals share one string, evaluating one never allocates
+            Value& interned = strings_[str];
+            if(!interned.isStr())
+                interned = Value(str);
+
+            return construct<AST::Const>(std::move(str), interned);
+        }
+        case TT::O_BRACK: return const_array();
+
+        default: throw unexpectedToken("const_decl");
+    }
+}
+
+// const_array ::= o_brack const_decl (comma const_decl)* comma? c_brack
+AST::Node::Ptr Parser::const_array()
+{
+    Nesting nesting(*this);
+
+    auto line = tokenLine_;
+    eat(TT::O_BRACK);
+
+    AST::NodeVec elements;
+
+    eatEmptyLines();
+    elements.push_back(const_decl());
+    eatEmptyLines();
+
+    while(currToken_.type_ == TT::COMMA)
+    {
+        eat(TT::COMMA);
+        eatEmptyLines();
+
+        if(currToken_.type_ == TT::C_BRACK)
+            break;
+
+        elements.push_back(const_decl());
+        eatEmptyLines();
+    }
+
+    eat(TT::C_BRACK);
+
+    auto result   = construct<AST::ConstArray>(std::move(elements));
+    result->line_ = line;
+    return result;
+}
+
+// index ::= O_BRACK expr c_brack
+AST::Node::Ptr Parser::index(AST::Node::Ptr array)
+{
+    auto line = tokenLine_;
+    eat(TT::O_BRACK);
+
+    auto result = construct<AST::Index>(std::move(array), expr());
+
+    eatWithSpaces(TT::C_BRACK);
+
+    result->line_ = line;
+    return result;
+}
+
 // type_id ::= id (o_brack (int|id) c_brack)?
 AST::Node::Ptr Parser::type_id()
 {
@@ -156,6 +609,7 @@ void Parser::eat(TokenType tt)
 {
     if(tt == currToken_.type_)
     {
+        tokenLine_ = tokenizer_.currentLine();
         currToken_ = tokenizer_.getNext();
     }
     else
@@ -169,6 +623,7 @@ std::string Parser::eatVal(TokenType tt)
     if(tt == currToken_.type_)
     {
         std::string result = currToken_.value_;
+        tokenLine_         = tokenizer_.currentLine();
         currToken_         = tokenizer_.getNext();
         return result;
     }
@@ -205,6 +660,20 @@ std::string Parser::eatValueWithSpaces(TokenType tt, EatSpaces policy)
 
         default: break;
     }
+
+    assert(!"Unknown EatSpaces policy");
+    return {};
+}
+
+std::int64_t Parser::toInt(const std::string& num)
+{
+    std::int64_t result = 0;
+
+    auto [end, ec] = std::from_chars(num.data(), num.data() + num.size(), result);
+    if(ec != std::errc() || end != num.data() + num.size())
+        throw UNEXPECTED_VAL("integer in range of int");
+
+    return result;
 }
 
 void Parser::eatWithSpaces(TokenType tt, EatSpaces policy)
@@ -240,6 +709,14 @@ void Parser::eatAll(TokenType tt)
         eat(tt);
 }
 
+void Parser::eatKeyword(const char* kw)
+{
+    if(!isKeyword(kw))
+        throw UNEXPECTED_VAL(kw);
+
+    eat(TT::ID);
+}
+
 void Parser::eatEmptyLines()
 {
     eatAll(TT::SPACE);
@@ -281,6 +758,12 @@ std::runtime_error Parser::unexpectedToken(ValidationSource source)
     return std::runtime_error(ss.str());
 }
 
+void Parser::tooDeep()
+{
+    throw NestingError("Nesting deeper than " + std::to_string(MAX_NESTING) + " levels in line "
+                       + std::to_string(tokenizer_.currentLine()));
+}
+
 std::runtime_error Parser::unexpectedToken(TokenType expected, ValidationSource source)
 {
     std::ostringstream ss;
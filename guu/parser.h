@@ -6,6 +6,8 @@
 #include <iosfwd>
 #include <stdexcept>
 
+#include "../util/flat_map.h"
+
 namespace Guu
 {
 using ValidationSource = const char*;
@@ -22,7 +24,10 @@ class Parser
     };
 
 public:
-    Parser(Tokenizer t) : tokenizer_(std::move(t)), currToken_(tokenizer_.getNext())
+    // Deepest the AST may nest, every pass over it recurses
+    static constexpr size_t MAX_NESTING = 1000;
+
+    Parser(Tokenizer t) : tokenizer_(std::move(t)), tokenLine_(tokenizer_.currentLine()), currToken_(tokenizer_.getNext())
     {
     }
 
@@ -35,14 +40,67 @@ private:
     AST::Node::Ptr program();
     AST::Node::Ptr fn();
     AST::Node::Ptr fn_arg();
+    AST::NodeVec block();
     AST::Node::Ptr statement();
+    AST::Node::Ptr var_decl();
+    AST::Node::Ptr return_stmt();
+    AST::Node::Ptr if_stmt();
+    AST::Node::Ptr while_stmt();
+    AST::Node::Ptr parallel_for();
+    AST::Node::Ptr assign();
+    AST::Node::Ptr call_stmt();
+    AST::Node::Ptr expr();
+    AST::Node::Ptr sum();
+    AST::Node::Ptr term();
+    AST::Node::Ptr unary();
+    AST::Node::Ptr primary();
+    AST::Node::Ptr call(std::string id);
+    AST::Node::Ptr spawn();
+    AST::Node::Ptr index(AST::Node::Ptr array);
+    AST::Node::Ptr const_decl();
+    AST::Node::Ptr const_array();
     AST::Node::Ptr type_id();
 
 private:
+    // Counts the levels a production adds to the AST, at most MAX_NESTING
+    class Nesting
+    {
+    public:
+        explicit Nesting(Parser& parser, size_t levels = 1) : parser_(parser)
+        {
+            while(levels_ < levels)
+                deeper();
+        }
+
+        ~Nesting()
+        {
+            parser_.nesting_ -= levels_;
+        }
+
+        Nesting(const Nesting&)            = delete;
+        Nesting& operator=(const Nesting&) = delete;
+
+        // One more level, left-associative operators nest their left operand
+        void deeper()
+        {
+            if(parser_.nesting_ == MAX_NESTING)
+                parser_.tooDeep();
+
+            ++parser_.nesting_;
+            ++levels_;
+        }
+
+    private:
+        Parser& parser_;
+        size_t levels_ = 0;
+    };
+
     template <typename Node, typename... Args>
     auto construct(Args... args)
     {
-        return std::make_unique<Node>(std::forward<Args>(args)...);
+        auto node   = std::make_unique<Node>(std::forward<Args>(args)...);
+        node->line_ = tokenLine_;
+        return node;
     }
 
     AST::Node::Ptr tryParse(AST::Node::Ptr (Parser::*memFn)());
@@ -61,6 +119,12 @@ private:
         eatWithSpaces(rest...);
     }
 
+    bool isKeyword(const char* kw) const
+    {
+        return currToken_.type_ == TT::ID && currToken_.value_ == kw;
+    }
+
+    void eatKeyword(const char* kw);
     void eatEmptyLines();
     void eat(TokenType tt);
     void eatAll(TokenType tt);
@@ -69,15 +133,23 @@ private:
     std::string eatVal(TokenType tt);
     std::string eatValueWithSpaces(TokenType tt, EatSpaces policy = EatSpaces::Left);
 
+    std::int64_t toInt(const std::string& num);
+
     void checkTokenType(TokenType tt, ValidationSource source);
     void checkTokenValue(std::string value, ValidationSource source);
 
     std::runtime_error unexpectedValue(std::string expected, ValidationSource source);
     std::runtime_error unexpectedToken(ValidationSource source);
     std::runtime_error unexpectedToken(TokenType expected, ValidationSource source);
+    [[noreturn]] void tooDeep();
 
 private:
     Tokenizer tokenizer_;
+    size_t tokenLine_;
     Token currToken_;
+    size_t nesting_ = 0;
+
+    // Pool of string literals by their decoded text
+    util::FlatMap<std::string, Value> strings_;
 };
 }
\ No newline at end of file
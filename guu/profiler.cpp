@@ -0,0 +1,217 @@
+#include "profiler.h"
+#include "value.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+namespace Guu
+{
+
+using namespace Bytecode;
+
+namespace
+{
+
+constexpr size_t RING_WORDS = 1 << 16;
+constexpr std::uint32_t TRUNCATED = static_cast<std::uint32_t>(-1);
+
+#if defined(__unix__) || defined(__APPLE__)
+// Flag of the running Profiler, std::atomic<bool> is lock-free and safe to store from a handler
+std::atomic<std::atomic<bool>*> activeFlag{nullptr};
+struct sigaction previousAction;
+
+void onTimer(int)
+{
+    if(auto* flag = activeFlag.load(std::memory_order_relaxed))
+        flag->store(true, std::memory_order_relaxed);
+}
+#endif
+
+}
+
+Profiler::Profiler(const Module& module, unsigned intervalUs)
+    : module_(module)
+    , intervalUs_(std::max(intervalUs, 1u))
+    , ring_(RING_WORDS)
+    , self_(module.functions_.size())
+    , total_(module.functions_.size())
+{
+    scratch_.reserve(1 + 2 * (MAX_FRAMES + 1));
+}
+
+Profiler::~Profiler()
+{
+    stop();
+}
+
+void Profiler::start()
+{
+    if(running_)
+        return;
+
+#if defined(__unix__) || defined(__APPLE__)
+    std::atomic<bool>* expected = nullptr;
+    if(!activeFlag.compare_exchange_strong(expected, &pending_))
+        throw RuntimeError("Another profiler is already running");
+
+    struct sigaction action = {};
+    action.sa_handler       = onTimer;
+    action.sa_flags         = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &previousAction);
+
+    itimerval timer      = {};
+    timer.it_interval    = {static_cast<time_t>(intervalUs_ / 1000000), static_cast<suseconds_t>(intervalUs_ % 1000000)};
+    timer.it_value       = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+
+    running_ = true;
+}
+
+void Profiler::stop()
+{
+    if(!running_)
+        return;
+
+#if defined(__unix__) || defined(__APPLE__)
+    itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &previousAction, nullptr);
+
+    activeFlag.store(nullptr);
+#endif
+
+    running_ = false;
+}
+
+void Profiler::sample(const CallStack& stack, size_t pc)
+{
+    pending_.store(false, std::memory_order_relaxed);
+    countdown_ = SAMPLE_INSTRUCTIONS;
+
+    size_t depth = stack.depth();
+    size_t first = depth > MAX_FRAMES ? depth - MAX_FRAMES : 0;
+
+    scratch_.clear();
+    scratch_.push_back(0);
+    if(first > 0)
+    {
+        scratch_.push_back(TRUNCATED);
+        scratch_.push_back(0);
+    }
+
+    // Callers are suspended right after their Call instruction, the frames below
+    // nested entry frames after the ParFor or Join they wait in
+    for(size_t idx = first; idx < depth; ++idx)
+    {
+        const auto& frame = stack.frame(idx);
+        size_t at         = idx + 1 < depth ? stack.frame(idx + 1).returnPc_ - 1 : pc;
+
+        scratch_.push_back(static_cast<std::uint32_t>(frame.fn_ - module_.functions_.data()));
+        scratch_.push_back(static_cast<std::uint32_t>(frame.fn_->lines_[at]));
+    }
+
+    scratch_[0] = static_cast<std::uint32_t>((scratch_.size() - 1) / 2);
+
+    if(!ring_.push(scratch_.data(), scratch_.size()))
+    {
+        drain();
+        ring_.push(scratch_.data(), scratch_.size());
+    }
+}
+
+void Profiler::drain()
+{
+    std::vector<bool> seen(module_.functions_.size());
+
+    std::uint32_t frames = 0;
+    while(ring_.pop(frames))
+    {
+        std::string key;
+        std::fill(seen.begin(), seen.end(), false);
+
+        std::uint32_t fn   = 0;
+        std::uint32_t line = 0;
+        for(std::uint32_t k = 0; k < frames; ++k)
+        {
+            ring_.pop(fn);
+            ring_.pop(line);
+
+            if(!key.empty())
+                key += ';';
+
+            if(fn == TRUNCATED)
+            {
+                key += "...";
+                continue;
+            }
+
+            key += module_.functions_[fn].name_ + ":" + std::to_string(line);
+            if(!seen[fn])
+            {
+                seen[fn] = true;
+                ++total_[fn];
+            }
+        }
+
+        if(fn != TRUNCATED)
+            ++self_[fn];
+
+        ++stacks_[key];
+        ++samples_;
+    }
+}
+
+std::uint64_t Profiler::samples()
+{
+    drain();
+    return samples_;
+}
+
+void Profiler::printCollapsed(std::ostream& os)
+{
+    drain();
+
+    for(const auto& [stack, count]: stacks_)
+        os << stack << " " << count << "\n";
+}
+
+void Profiler::printTable(std::ostream& os)
+{
+    drain();
+
+    std::vector<size_t> order(module_.functions_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return self_[a] != self_[b] ? self_[a] > self_[b] : total_[a] > total_[b];
+    });
+
+    auto percent = [this](std::uint64_t n) { return samples_ ? 100.0 * static_cast<double>(n) / samples_ : 0.0; };
+
+    os << samples_ << " samples" << std::endl;
+    os << std::setw(8) << "self %" << std::setw(10) << "self" << std::setw(9) << "total %" << std::setw(10)
+       << "total"
+       << "  function" << std::endl;
+
+    os << std::fixed << std::setprecision(1);
+    for(size_t fn: order)
+    {
+        if(total_[fn] == 0)
+            continue;
+
+        os << std::setw(7) << percent(self_[fn]) << "%" << std::setw(10) << self_[fn] << std::setw(8)
+           << percent(total_[fn]) << "%" << std::setw(10) << total_[fn] << "  " << module_.functions_[fn].name_
+           << std::endl;
+    }
+    os << std::defaultfloat;
+}
+
+}
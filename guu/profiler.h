@@ -0,0 +1,87 @@
+#pragma once
+
+#include "bytecode.h"
+#include "call_stack.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../util/ring_buffer.h"
+
+namespace Guu
+{
+
+// Sampling profiler for the VM. A CPU-time timer (SIGPROF) raises a flag, the
+// VM sees it before its next instruction and records the Guu call stack, as
+// function index and source line per frame, into a lock-free ring buffer.
+// Samples are aggregated when the buffer fills up and when a report is printed.
+//
+// Only a VM given a Profiler runs the checking variant of its dispatch loop,
+// so without one there is no overhead at all. Where SIGPROF is not available
+// a sample is taken every SAMPLE_INSTRUCTIONS instructions instead.
+class Profiler
+{
+public:
+    static constexpr unsigned DEFAULT_INTERVAL_US = 1000;
+    static constexpr unsigned SAMPLE_INSTRUCTIONS = 10007;
+
+    // Deeper stacks keep their innermost frames below a "..." root
+    static constexpr size_t MAX_FRAMES = 128;
+
+    explicit Profiler(const Bytecode::Module& module, unsigned intervalUs = DEFAULT_INTERVAL_US);
+    ~Profiler();
+
+    Profiler(const Profiler&)            = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // Only one Profiler can be started at a time
+    void start();
+    void stop();
+
+    // Checked by the VM before every instruction
+    bool due()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        return pending_.load(std::memory_order_relaxed);
+#else
+        return --countdown_ == 0;
+#endif
+    }
+
+    // Records the stack of the VM about to execute instruction `pc` of the running frame
+    void sample(const CallStack& stack, size_t pc);
+
+    std::uint64_t samples();
+
+    // One line per distinct stack, "main:12;fact:5 42", as read by flamegraph.pl
+    void printCollapsed(std::ostream& os);
+
+    // Samples per function: self where it was running, total where it was on the stack
+    void printTable(std::ostream& os);
+
+private:
+    void drain();
+
+private:
+    const Bytecode::Module& module_;
+    unsigned intervalUs_;
+    bool running_ = false;
+
+    std::atomic<bool> pending_{false};
+    unsigned countdown_ = SAMPLE_INSTRUCTIONS;
+
+    // Samples are a frame count followed by (function, line) pairs, outermost first
+    util::RingBuffer<std::uint32_t> ring_;
+    std::vector<std::uint32_t> scratch_;
+
+    std::uint64_t samples_ = 0;
+    std::map<std::string, std::uint64_t> stacks_;
+    std::vector<std::uint64_t> self_;
+    std::vector<std::uint64_t> total_;
+};
+
+}
@@ -0,0 +1,643 @@
+#include "resolver.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <charconv>
+#include <sstream>
+
+namespace Guu
+{
+
+void Resolver::resolve(AST::Node& root)
+{
+    clear();
+    visit(root);
+}
+
+void Resolver::clear()
+{
+    fns_.clear();
+    fnIndex_.clear();
+}
+
+void Resolver::declare(AST::FnDef& fn)
+{
+    declareFunction(fn);
+}
+
+void Resolver::resolveBody(AST::FnDef& fn)
+{
+    // Whatever the last failed body left open
+    names_.clear();
+    symbols_.clear();
+    scopes_.clear();
+    parallelVar_ = NO_SYMBOL;
+
+    visit(fn);
+}
+
+const AST::FnDef* Resolver::findFunction(std::string_view name) const
+{
+    auto* idx = fnIndex_.find(name);
+    return idx ? fns_[*idx] : nullptr;
+}
+
+void Resolver::visit(AST::Root& root)
+{
+    // Signatures first, so functions may be referenced before their definition
+    for(auto& c: root.children_)
+    {
+        assert(c->type_ == AST::NodeType::FnDef);
+        declareFunction(static_cast<AST::FnDef&>(*c));
+    }
+
+    for(auto& c: root.children_)
+    {
+        visit(*c);
+    }
+}
+
+void Resolver::declareFunction(AST::FnDef& fn)
+{
+    if(findBuiltin(fn.id_) != Builtin::None)
+        throw error("Function '" + fn.id_ + "' redefines a builtin", fn.line_);
+
+    if(fnIndex_.contains(fn.id_))
+        throw error("Double definition of '" + fn.id_ + "'", fn.line_);
+
+    fn.resolvedType_ = resolveType(*fn.retTypeId_);
+
+    for(auto& p: fn.params_)
+    {
+        auto& param         = static_cast<AST::Variable&>(*p);
+        param.resolvedType_ = resolveType(*param.typeId_);
+    }
+
+    // The entry point receives the command line, if it asks for it
+    if(fn.id_ == "main")
+    {
+        auto argsType = types_.arrayOf(types_.strType());
+        if(fn.params_.size() > 1 || (fn.params_.size() == 1 && fn.params_[0]->resolvedType_ != argsType))
+            throw error("Function 'main' must take no parameters or a single 'str[N]'", fn.line_);
+    }
+
+    // Only once the signature checked out
+    fn.index_ = static_cast<std::uint32_t>(fns_.size());
+    fnIndex_.insert(fn.id_, fn.index_);
+    fns_.push_back(&fn);
+}
+
+void Resolver::visit(AST::FnDef& fn)
+{
+    currFn_       = &fn;
+    nextSlot_     = 0;
+    fn.frameSize_ = 0;
+    fn.spawns_    = false;
+
+    enterScope();
+
+    for(auto& p: fn.params_)
+    {
+        auto& param     = static_cast<AST::Variable&>(*p);
+        param.assigned_ = false;
+        param.slot_     = declare(param);
+    }
+
+    for(auto& st: fn.statements_)
+    {
+        visit(*st);
+    }
+
+    leaveScope();
+
+    currFn_ = nullptr;
+}
+
+void Resolver::visit(AST::Variable& var)
+{
+    var.assigned_ = false;
+
+    // The type of a task follows from the function it spawns
+    auto& typeId = static_cast<AST::TypeId&>(*var.typeId_);
+    if(typeId.tname_ == "task" && !typeId.isArray_)
+    {
+        if(!var.init_ || var.init_->type_ != AST::NodeType::Spawn)
+            throw error("Task '" + var.id_ + "' must be initialized with a spawn", var.line_);
+
+        var.resolvedType_    = resolveSpawn(static_cast<AST::Spawn&>(*var.init_));
+        typeId.resolvedType_ = var.resolvedType_;
+        var.slot_            = declare(var);
+        currFn_->spawns_     = true;
+        return;
+    }
+
+    var.resolvedType_ = resolveType(*var.typeId_);
+
+    // The initializer is resolved before the name is visible: `int x = x;` is an error
+    if(var.init_)
+    {
+        visit(*var.init_);
+        checkAssignable(var.resolvedType_, *var.init_, "variable '" + var.id_ + "'");
+    }
+    else if(types_.isArray(var.resolvedType_) && types_.get(var.resolvedType_).size_ == Type::DYNAMIC_SIZE)
+    {
+        // `int[n] a;` allocates an array of a size only known at runtime
+        const Symbol* sym = lookup(typeId.arraySize_);
+        if(!sym || sym->type_ != types_.intType())
+        {
+            throw error("Size of array '" + var.id_ + "' must be a number or an int variable, got '"
+                            + typeId.arraySize_ + "'",
+                        var.line_);
+        }
+
+        typeId.sizeSlot_ = sym->slot_;
+    }
+
+    var.slot_ = declare(var);
+}
+
+void Resolver::visit(AST::VarRef& ref)
+{
+    const Symbol* sym = lookup(ref.id_);
+    if(!sym)
+        throw error("Unknown variable '" + ref.id_ + "'", ref.line_);
+
+    ref.slot_         = sym->slot_;
+    ref.resolvedType_ = sym->type_;
+    ref.decl_         = sym->decl_;
+}
+
+void Resolver::visit(AST::BinOp& op)
+{
+    visit(*op.op1_);
+    visit(*op.op2_);
+
+    auto intType = types_.intType();
+    auto lhs     = op.op1_->resolvedType_;
+    auto rhs     = op.op2_->resolvedType_;
+
+    bool isEquality = op.opType_ == TokenType::EQEQ || op.opType_ == TokenType::NE;
+    bool valid      = lhs == intType && rhs == intType;
+    if(isEquality && lhs == types_.strType() && rhs == types_.strType())
+        valid = true;
+
+    // `+` of strings concatenates
+    TypeHandle result = intType;
+    if(op.opType_ == TokenType::PLUS && lhs == types_.strType() && rhs == types_.strType())
+    {
+        valid  = true;
+        result = lhs;
+    }
+
+    // Operators of int arrays apply elementwise, an int on either side stands for
+    // an array of it. Arrays of known sizes must agree, others are checked at runtime.
+    if((isIntArray(lhs) || isIntArray(rhs)) && (isIntArray(lhs) || lhs == intType)
+       && (isIntArray(rhs) || rhs == intType))
+    {
+        std::int64_t size = Type::DYNAMIC_SIZE;
+        valid             = true;
+        for(auto t: {lhs, rhs})
+        {
+            if(t == intType || types_.get(t).size_ == Type::DYNAMIC_SIZE)
+                continue;
+
+            valid = valid && (size == Type::DYNAMIC_SIZE || size == types_.get(t).size_);
+            size  = types_.get(t).size_;
+        }
+
+        result = types_.arrayOf(intType, size);
+    }
+
+    if(!valid)
+    {
+        std::ostringstream ss;
+        ss << "Operator " << op.opType_ << " is not defined for '" << types_.name(op.op1_->resolvedType_) << "' and '"
+           << types_.name(op.op2_->resolvedType_) << "'";
+        throw error(ss.str(), op.line_);
+    }
+
+    op.resolvedType_ = result;
+}
+
+void Resolver::visit(AST::UnaryOp& op)
+{
+    visit(*op.op_);
+
+    if(op.op_->resolvedType_ != types_.intType() && !isIntArray(op.op_->resolvedType_))
+    {
+        std::ostringstream ss;
+        ss << "Operator " << op.opType_ << " is not defined for '" << types_.name(op.op_->resolvedType_) << "'";
+        throw error(ss.str(), op.line_);
+    }
+
+    op.resolvedType_ = op.op_->resolvedType_;
+}
+
+void Resolver::visit(AST::Call& call)
+{
+    call.builtin_ = findBuiltin(call.id_);
+    if(call.builtin_ != Builtin::None)
+    {
+        resolveBuiltin(call);
+        return;
+    }
+
+    auto* idx = fnIndex_.find(call.id_);
+    if(!idx)
+        throw error("Unknown function '" + call.id_ + "'", call.line_);
+
+    const AST::FnDef& fn = *fns_[*idx];
+    if(call.args_.size() != fn.params_.size())
+    {
+        throw error("Function '" + fn.id_ + "' expects " + std::to_string(fn.params_.size()) + " arguments, "
+                        + std::to_string(call.args_.size()) + " given",
+                    call.line_);
+    }
+
+    for(size_t i = 0; i < call.args_.size(); ++i)
+    {
+        const auto& param = static_cast<const AST::Variable&>(*fn.params_[i]);
+
+        visit(*call.args_[i]);
+        checkAssignable(param.resolvedType_, *call.args_[i], "parameter '" + param.id_ + "'");
+    }
+
+    call.fnIndex_      = *idx;
+    call.resolvedType_ = fn.resolvedType_;
+}
+
+void Resolver::visit(AST::Return& ret)
+{
+    if(parallelVar_ != NO_SYMBOL)
+        throw error("Cannot return from the body of a parallel for", ret.line_);
+
+    visit(*ret.value_);
+    checkAssignable(currFn_->resolvedType_, *ret.value_, "return value of '" + currFn_->id_ + "'");
+}
+
+void Resolver::resolveBuiltin(AST::Call& call)
+{
+    size_t arity = builtinArity(call.builtin_);
+    if(call.args_.size() != arity)
+    {
+        throw error("Builtin '" + call.id_ + "' expects " + std::to_string(arity)
+                        + (arity == 1 ? " argument, " : " arguments, ") + std::to_string(call.args_.size()) + " given",
+                    call.line_);
+    }
+
+    for(auto& arg: call.args_)
+    {
+        visit(*arg);
+    }
+
+    call.resolvedType_ = types_.intType();
+
+    // The image holds the frame of main and nothing else
+    if(call.builtin_ == Builtin::Checkpoint)
+    {
+        if(currFn_->id_ != "main" || parallelVar_ != NO_SYMBOL)
+            throw error("Builtin 'checkpoint' can only be called from main, outside of parallel loops", call.line_);
+        return;
+    }
+
+    auto& arg = *call.args_[0];
+
+    auto expectIntArray = [&](AST::Node& a) {
+        if(!isIntArray(a.resolvedType_))
+            throw error("Builtin '" + call.id_ + "' expects an int array, got '" + types_.name(a.resolvedType_) + "'",
+                        a.line_);
+    };
+
+    if(types_.isTask(arg.resolvedType_) != (call.builtin_ == Builtin::Join))
+    {
+        if(call.builtin_ == Builtin::Join)
+            throw error("Builtin 'join' expects a task, got '" + types_.name(arg.resolvedType_) + "'", arg.line_);
+
+        throw error("Builtin '" + call.id_ + "' does not take a task", arg.line_);
+    }
+
+    switch(call.builtin_)
+    {
+        case Builtin::Print: break;
+
+        case Builtin::Join: call.resolvedType_ = types_.get(arg.resolvedType_).elem_; break;
+
+        case Builtin::Len:
+            if(arg.resolvedType_ != types_.strType() && !types_.isArray(arg.resolvedType_))
+                throw error("Builtin 'len' expects a str or an array, got '" + types_.name(arg.resolvedType_) + "'",
+                            arg.line_);
+            break;
+
+        case Builtin::Sum:
+        case Builtin::Min:
+        case Builtin::Max: expectIntArray(arg); break;
+
+        case Builtin::Find:
+            expectIntArray(arg);
+            checkInt(*call.args_[1], "value to find");
+            break;
+
+        case Builtin::Filter: {
+            expectIntArray(arg);
+            expectIntArray(*call.args_[1]);
+
+            auto size = types_.get(arg.resolvedType_).size_;
+            auto mask = types_.get(call.args_[1]->resolvedType_).size_;
+            if(size != Type::DYNAMIC_SIZE && mask != Type::DYNAMIC_SIZE && size != mask)
+                throw error("Builtin 'filter' expects a mask of the size of the array, got '"
+                                + types_.name(call.args_[1]->resolvedType_) + "'",
+                            call.args_[1]->line_);
+
+            // The size of the result is only known at runtime
+            call.resolvedType_ = types_.arrayOf(types_.intType());
+            break;
+        }
+
+        case Builtin::Copy:
+            if(!types_.isArray(arg.resolvedType_))
+                throw error("Builtin 'copy' expects an array, got '" + types_.name(arg.resolvedType_) + "'", arg.line_);
+
+            call.resolvedType_ = arg.resolvedType_;
+            break;
+
+        case Builtin::Checkpoint:
+        case Builtin::None: assert(false); break;
+    }
+}
+
+bool Resolver::isIntArray(TypeHandle type) const
+{
+    return types_.isArray(type) && types_.get(type).elem_ == types_.intType();
+}
+
+void Resolver::visit(AST::If& stmt)
+{
+    visit(*stmt.cond_);
+    checkInt(*stmt.cond_, "condition");
+
+    resolveBlock(stmt.then_);
+    resolveBlock(stmt.else_);
+}
+
+void Resolver::visit(AST::While& stmt)
+{
+    visit(*stmt.cond_);
+    checkInt(*stmt.cond_, "condition");
+
+    stmt.bodySlot_ = nextSlot_;
+    resolveBlock(stmt.body_);
+}
+
+void Resolver::visit(AST::ParallelFor& stmt)
+{
+    visit(*stmt.from_);
+    checkInt(*stmt.from_, "range start");
+    visit(*stmt.to_);
+    checkInt(*stmt.to_, "range end");
+
+    enterScope();
+
+    visit(*stmt.var_);
+
+    // The end of the range is kept in the slot after the index
+    ++nextSlot_;
+    currFn_->frameSize_ = std::max(currFn_->frameSize_, nextSlot_);
+    stmt.bodySlot_      = nextSlot_;
+
+    SymbolIdx saved = parallelVar_;
+    parallelVar_    = static_cast<SymbolIdx>(symbols_.size() - 1);
+
+    for(auto& st: stmt.body_)
+    {
+        visit(*st);
+    }
+
+    parallelVar_ = saved;
+    leaveScope();
+}
+
+void Resolver::visit(AST::Spawn& spawn)
+{
+    throw error("spawn must initialize a task variable", spawn.line_);
+}
+
+TypeHandle Resolver::resolveSpawn(AST::Spawn& spawn)
+{
+    auto& call = static_cast<AST::Call&>(*spawn.call_);
+    if(findBuiltin(call.id_) != Builtin::None)
+        throw error("Cannot spawn builtin '" + call.id_ + "'", spawn.line_);
+
+    visit(call);
+
+    spawn.resolvedType_ = types_.taskOf(call.resolvedType_);
+    return spawn.resolvedType_;
+}
+
+void Resolver::visit(AST::Assign& stmt)
+{
+    visit(*stmt.value_);
+
+    if(stmt.target_->type_ == AST::NodeType::VarRef)
+    {
+        auto& ref         = static_cast<AST::VarRef&>(*stmt.target_);
+        const Symbol* sym = lookup(ref.id_);
+        if(!sym)
+            throw error("Unknown variable '" + ref.id_ + "'", ref.line_);
+
+        if(types_.isTask(sym->type_))
+            throw error("Cannot assign task '" + ref.id_ + "'", ref.line_);
+
+        if(parallelVar_ != NO_SYMBOL && static_cast<SymbolIdx>(sym - symbols_.data()) <= parallelVar_)
+            throw error("Cannot assign '" + ref.id_ + "' in the body of a parallel for", ref.line_);
+
+        sym->decl_->assigned_ = true;
+        visit(ref);
+
+        checkAssignable(ref.resolvedType_, *stmt.value_, "variable '" + ref.id_ + "'");
+    }
+    else
+    {
+        visit(*stmt.target_);
+        checkAssignable(stmt.target_->resolvedType_, *stmt.value_, "array element");
+    }
+}
+
+void Resolver::visit(AST::Index& idx)
+{
+    visit(*idx.array_);
+    visit(*idx.index_);
+
+    if(!types_.isArray(idx.array_->resolvedType_))
+        throw error("Value of type '" + types_.name(idx.array_->resolvedType_) + "' is not an array", idx.line_);
+
+    checkInt(*idx.index_, "array index");
+
+    idx.resolvedType_ = types_.get(idx.array_->resolvedType_).elem_;
+}
+
+void Resolver::resolveBlock(AST::NodeVec& block)
+{
+    enterScope();
+
+    for(auto& st: block)
+    {
+        visit(*st);
+    }
+
+    leaveScope();
+}
+
+void Resolver::visit(AST::Const& c)
+{
+    c.resolvedType_ = c.isNum() ? types_.intType() : types_.strType();
+}
+
+void Resolver::visit(AST::ConstArray& arr)
+{
+    assert(!arr.elements_.empty());
+
+    TypeHandle elem = INVALID_TYPE;
+    for(auto& e: arr.elements_)
+    {
+        visit(*e);
+
+        if(types_.isTask(e->resolvedType_))
+            throw error("Array elements cannot be tasks", e->line_);
+
+        if(elem == INVALID_TYPE)
+        {
+            elem = e->resolvedType_;
+        }
+        else if(e->resolvedType_ != elem)
+        {
+            throw error("Array elements have different types: '" + types_.name(elem) + "' and '"
+                            + types_.name(e->resolvedType_) + "'",
+                        e->line_);
+        }
+    }
+
+    arr.resolvedType_ = types_.arrayOf(elem, static_cast<std::int64_t>(arr.elements_.size()));
+}
+
+TypeHandle Resolver::resolveType(AST::Node& node)
+{
+    assert(node.type_ == AST::NodeType::TypeId);
+    auto& typeId = static_cast<AST::TypeId&>(node);
+
+    TypeHandle result = INVALID_TYPE;
+    if(typeId.tname_ == "int")
+    {
+        result = types_.intType();
+    }
+    else if(typeId.tname_ == "str")
+    {
+        result = types_.strType();
+    }
+    else
+    {
+        throw error("Unknown type '" + typeId.tname_ + "'", typeId.line_);
+    }
+
+    if(typeId.isArray_)
+    {
+        const auto& size = typeId.arraySize_;
+        if(std::all_of(size.begin(), size.end(), ::isdigit))
+        {
+            std::int64_t n = 0;
+            if(std::from_chars(size.data(), size.data() + size.size(), n).ec != std::errc())
+                throw error("Array size '" + size + "' is too big", typeId.line_);
+
+            result = types_.arrayOf(result, n);
+        }
+        else
+        {
+            result = types_.arrayOf(result);
+        }
+    }
+
+    typeId.resolvedType_ = result;
+    return result;
+}
+
+void Resolver::checkAssignable(TypeHandle to, AST::Node& value, const std::string& what)
+{
+    if(!types_.isAssignable(to, value.resolvedType_))
+    {
+        throw error("Cannot assign value of type '" + types_.name(value.resolvedType_) + "' to " + what
+                        + " of type '" + types_.name(to) + "'",
+                    value.line_);
+    }
+}
+
+void Resolver::checkInt(AST::Node& value, const std::string& what)
+{
+    if(value.resolvedType_ != types_.intType())
+        throw error("Expected int " + what + ", got '" + types_.name(value.resolvedType_) + "'", value.line_);
+}
+
+void Resolver::enterScope()
+{
+    scopes_.push_back(symbols_.size());
+}
+
+void Resolver::leaveScope()
+{
+    assert(!scopes_.empty());
+
+    size_t begin = scopes_.back();
+    scopes_.pop_back();
+
+    while(symbols_.size() > begin)
+    {
+        const Symbol& sym = symbols_.back();
+        if(sym.shadowed_ == NO_SYMBOL)
+        {
+            names_.erase(sym.name_);
+        }
+        else
+        {
+            names_[sym.name_] = sym.shadowed_;
+        }
+
+        nextSlot_ = sym.slot_;
+        symbols_.pop_back();
+    }
+}
+
+AST::Slot Resolver::declare(AST::Variable& var)
+{
+    auto depth = static_cast<std::uint32_t>(scopes_.size());
+
+    std::string_view name = var.id_;
+
+    SymbolIdx shadowed = NO_SYMBOL;
+    if(auto* idx = names_.find(name))
+    {
+        if(symbols_[*idx].depth_ == depth)
+            throw error("Redefinition of '" + var.id_ + "'", var.line_);
+
+        shadowed = *idx;
+    }
+
+    AST::Slot slot = nextSlot_++;
+    currFn_->frameSize_ = std::max(currFn_->frameSize_, nextSlot_);
+
+    names_[name] = static_cast<SymbolIdx>(symbols_.size());
+    symbols_.push_back(Symbol{name, var.resolvedType_, slot, depth, shadowed, &var});
+
+    return slot;
+}
+
+const Resolver::Symbol* Resolver::lookup(std::string_view name) const
+{
+    auto* idx = names_.find(name);
+    return idx ? &symbols_[*idx] : nullptr;
+}
+
+std::runtime_error Resolver::error(const std::string& msg, size_t line) const
+{
+    return std::runtime_error(msg + " on line " + std::to_string(line));
+}
+
+}
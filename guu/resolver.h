@@ -0,0 +1,118 @@
+#pragma once
+
+#include "ast.h"
+#include "types.h"
+
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "../util/flat_map.h"
+
+namespace Guu
+{
+
+// Checks names and types and annotates the AST in place:
+//  - every FnDef gets its index and the number of frame slots it needs;
+//  - every Variable and VarRef gets a resolved type handle and a frame slot;
+//  - every expression gets its resolved type, every Call the callee index
+//    or the builtin it refers to.
+// Every block opens a new scope.
+// `task` variables only hold the result of a spawn and can't be assigned, the
+// body of a parallel for can't assign the variables visible at its start.
+// Params occupy slots [0, params_.size()), locals follow. Slots of a closed
+// scope are reused by the next one, so frameSize_ is the maximum live count.
+class Resolver : public AST::Visitor
+{
+    using SymbolIdx = std::uint32_t;
+
+    static constexpr SymbolIdx NO_SYMBOL = static_cast<SymbolIdx>(-1);
+
+    struct Symbol
+    {
+        std::string_view name_;
+        TypeHandle type_;
+        AST::Slot slot_;
+        std::uint32_t depth_;
+        SymbolIdx shadowed_;
+        AST::Variable* decl_;
+    };
+
+public:
+    using AST::Visitor::visit;
+
+    explicit Resolver(TypeTable& types) : types_(types)
+    {
+    }
+
+    void resolve(AST::Node& root);
+
+    // For callers that keep every function apart and resolve them one at a
+    // time, like Document: declare() every signature, then resolveBody() the
+    // functions to check. A signature that fails to declare leaves no trace,
+    // a body that fails leaves the Resolver ready for the next one.
+    void clear();
+    void declare(AST::FnDef& fn);
+    void resolveBody(AST::FnDef& fn);
+
+    const std::vector<AST::FnDef*>& functions() const
+    {
+        return fns_;
+    }
+
+    const AST::FnDef* findFunction(std::string_view name) const;
+
+private:
+    void visit(AST::Root& root) override;
+    void visit(AST::FnDef& fn) override;
+    void visit(AST::Variable& var) override;
+    void visit(AST::VarRef& ref) override;
+    void visit(AST::BinOp& op) override;
+    void visit(AST::UnaryOp& op) override;
+    void visit(AST::Call& call) override;
+    void visit(AST::Return& ret) override;
+    void visit(AST::If& stmt) override;
+    void visit(AST::While& stmt) override;
+    void visit(AST::ParallelFor& stmt) override;
+    void visit(AST::Spawn& spawn) override;
+    void visit(AST::Assign& stmt) override;
+    void visit(AST::Index& idx) override;
+    void visit(AST::Const& c) override;
+    void visit(AST::ConstArray& arr) override;
+
+private:
+    void declareFunction(AST::FnDef& fn);
+    void resolveBuiltin(AST::Call& call);
+    void resolveBlock(AST::NodeVec& block);
+    TypeHandle resolveSpawn(AST::Spawn& spawn);
+    TypeHandle resolveType(AST::Node& typeId);
+    void checkAssignable(TypeHandle to, AST::Node& value, const std::string& what);
+    void checkInt(AST::Node& value, const std::string& what);
+    bool isIntArray(TypeHandle type) const;
+
+    void enterScope();
+    void leaveScope();
+    AST::Slot declare(AST::Variable& var);
+    const Symbol* lookup(std::string_view name) const;
+
+    std::runtime_error error(const std::string& msg, size_t line) const;
+
+private:
+    TypeTable& types_;
+
+    std::vector<AST::FnDef*> fns_;
+    util::FlatMap<std::string_view, std::uint32_t> fnIndex_;
+
+    // Innermost visible symbol per name; shadowed ones are chained through Symbol::shadowed_
+    util::FlatMap<std::string_view, SymbolIdx> names_;
+    std::vector<Symbol> symbols_;
+    std::vector<size_t> scopes_;
+
+    AST::Slot nextSlot_ = 0;
+    AST::FnDef* currFn_ = nullptr;
+
+    // Index of the variable of the innermost parallel for, symbols up to it are read-only
+    SymbolIdx parallelVar_ = NO_SYMBOL;
+};
+
+}
@@ -0,0 +1,164 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace Guu
+{
+
+thread_local size_t Scheduler::worker_ = 0;
+
+namespace
+{
+
+// Picks the first victim to steal from, so thieves spread over the queues
+size_t randomIndex(size_t n)
+{
+    thread_local std::uint32_t state =
+        static_cast<std::uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state % n;
+}
+
+}
+
+Scheduler::Scheduler(size_t threads) : queues_(std::max<size_t>(threads, 1))
+{
+    worker_ = 0;
+
+    threads_.reserve(queues_.size() - 1);
+    for(size_t i = 1; i < queues_.size(); ++i)
+    {
+        threads_.emplace_back([this, i] { loop(i); });
+    }
+}
+
+Scheduler::~Scheduler()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_.store(true);
+    }
+    wake_.notify_all();
+
+    for(auto& t: threads_)
+    {
+        t.join();
+    }
+
+    // Jobs nobody waited for, e.g. after an error
+    for(auto& q: queues_)
+    {
+        for(Job* job: q.jobs_)
+        {
+            delete job;
+        }
+    }
+}
+
+void Scheduler::push(Job* job)
+{
+    {
+        Queue& q = queues_[worker()];
+        std::lock_guard lock(q.mutex_);
+        q.jobs_.push_back(job);
+    }
+
+    // Pairs with the sleepers_ increment in loop(): either the sleeper finds the job or we wake it
+    epoch_.fetch_add(1);
+    if(sleepers_.load() > 0)
+    {
+        std::lock_guard lock(mutex_);
+        wake_.notify_one();
+    }
+}
+
+void Scheduler::loop(size_t self)
+{
+    worker_ = self;
+
+    size_t idle = 0;
+    while(!stop_.load(std::memory_order_relaxed))
+    {
+        if(Job* job = take(self))
+        {
+            execute(job, self);
+            idle = 0;
+            continue;
+        }
+
+        if(++idle <= SPINS)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        size_t epoch = epoch_.load();
+        sleepers_.fetch_add(1);
+
+        // A push between the first look and the increment is seen here
+        if(Job* job = take(self))
+        {
+            sleepers_.fetch_sub(1);
+            execute(job, self);
+            idle = 0;
+            continue;
+        }
+
+        std::unique_lock lock(mutex_);
+        wake_.wait(lock, [&] { return stop_.load() || epoch_.load() != epoch; });
+        sleepers_.fetch_sub(1);
+        idle = 0;
+    }
+}
+
+Scheduler::Job* Scheduler::take(size_t self)
+{
+    {
+        Queue& own = queues_[self];
+        std::lock_guard lock(own.mutex_);
+        if(!own.jobs_.empty())
+        {
+            Job* job = own.jobs_.back();
+            own.jobs_.pop_back();
+            return job;
+        }
+    }
+
+    size_t n = queues_.size();
+    if(n == 1)
+        return nullptr;
+
+    size_t start = randomIndex(n);
+    for(size_t k = 0; k < n; ++k)
+    {
+        size_t victim = (start + k) % n;
+        if(victim == self)
+            continue;
+
+        Queue& q = queues_[victim];
+        std::lock_guard lock(q.mutex_);
+        if(!q.jobs_.empty())
+        {
+            Job* job = q.jobs_.front();
+            q.jobs_.pop_front();
+            return job;
+        }
+    }
+
+    return nullptr;
+}
+
+void Scheduler::execute(Job* job, size_t self)
+{
+    std::unique_ptr<Job> owned(job);
+    owned->run(self);
+}
+
+}
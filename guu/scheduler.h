@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Guu
+{
+
+// Work-stealing thread pool behind parallel loops and tasks. Worker 0 is the
+// thread that created the scheduler, the others are started here. Each worker
+// has a deque of jobs: it pushes and pops its own at the back, so nested work
+// runs depth first, while idle workers steal the oldest, typically largest,
+// jobs from the front of another one. Workers that found nothing for a while
+// sleep until the next push.
+//
+// A thread waiting for some of the work it pushed runs jobs meanwhile instead
+// of blocking, so nested parallelism never needs more threads.
+class Scheduler
+{
+public:
+    struct Job
+    {
+        virtual ~Job() = default;
+
+        // `worker` is the index of the running thread
+        virtual void run(size_t worker) = 0;
+    };
+
+    explicit Scheduler(size_t threads);
+    ~Scheduler();
+
+    Scheduler(const Scheduler&)            = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    size_t size() const
+    {
+        return queues_.size();
+    }
+
+    // Index of the calling worker
+    static size_t worker()
+    {
+        return worker_;
+    }
+
+    // Queues `job` on the calling worker, the scheduler deletes it after it ran
+    void push(Job* job);
+
+    // Runs jobs until done() returns true
+    template <typename Done>
+    void wait(Done done)
+    {
+        size_t self = worker();
+        for(size_t idle = 0; !done();)
+        {
+            if(Job* job = take(self))
+            {
+                execute(job, self);
+                idle = 0;
+            }
+            else if(++idle > SPINS)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    static constexpr size_t SPINS = 64;
+
+    struct alignas(64) Queue
+    {
+        std::mutex mutex_;
+        std::deque<Job*> jobs_;
+    };
+
+    void loop(size_t self);
+
+    // Pops a job of `self` or steals one, nullptr if there is none
+    Job* take(size_t self);
+    void execute(Job* job, size_t self);
+
+private:
+    static thread_local size_t worker_;
+
+    // Never resized, the mutexes stay in place
+    std::vector<Queue> queues_;
+    std::vector<std::thread> threads_;
+
+    // Sleepers wait for the epoch to change, every push changes it
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> epoch_{0};
+    std::atomic<size_t> sleepers_{0};
+    std::atomic<bool> stop_{false};
+};
+
+}
@@ -0,0 +1,642 @@
+#include "snapshot.h"
+#include "arith.h"
+#include "builtins.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+#include "../util/mapped_file.h"
+
+namespace Guu
+{
+
+using namespace Bytecode;
+
+namespace
+{
+
+// Bumped whenever the layout or the bytecode changes
+constexpr std::uint32_t VERSION     = 3;
+constexpr std::array<char, 8> MAGIC = {'G', 'U', 'U', 'I', 'M', 'A', 'G', 'E'};
+constexpr std::uint32_t ORDER_MARK  = 0x01020304;
+
+// Values and constants start with one of these
+enum class Tag : std::uint8_t
+{
+    Int,
+    Str,
+    Array,
+};
+
+// The layout, all in native byte order:
+//
+//   header    magic, byte order, version
+//   module    functions, constants, main
+//   state     0, or 1 and pc, regions, objects, registers
+//   checksum  FNV-1a of everything before it
+//
+// Strings are deduplicated by content, arrays by identity. Every object is
+// written before the first one referring to it, so refer to them by index.
+//
+// Loading checks every index, but a damaged image can still be well formed,
+// a constant of another type say, and the VM trusts the types of registers.
+// The checksum turns such damage into a corrupt image too.
+std::uint64_t checksum(std::string_view bytes)
+{
+    std::uint64_t h = 14695981039346656037ull;
+    for(unsigned char c: bytes)
+    {
+        h = (h ^ c) * 1099511628211ull;
+    }
+    return h;
+}
+
+class Writer
+{
+public:
+    template <typename T>
+    void put(T v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        buf_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void put(std::string_view s)
+    {
+        put<std::uint64_t>(s.size());
+        buf_.append(s);
+    }
+
+    // A vector of trivially copyable elements
+    template <typename Vec>
+    void putAll(const Vec& v)
+    {
+        put<std::uint64_t>(v.size());
+        buf_.append(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(v[0]));
+    }
+
+    void append(const Writer& o)
+    {
+        buf_ += o.buf_;
+    }
+
+    const std::string& str() const
+    {
+        return buf_;
+    }
+
+private:
+    std::string buf_;
+};
+
+class ObjectWriter
+{
+public:
+    void value(Writer& out, const Value& v)
+    {
+        if(v.isInt())
+        {
+            out.put(Tag::Int);
+            out.put(v.asInt());
+        }
+        else if(v.isStr())
+        {
+            out.put(Tag::Str);
+            out.put(string(v.asStr()));
+        }
+        else if(v.isArray())
+        {
+            out.put(Tag::Array);
+            out.put(array(v.asArray()));
+        }
+        else
+        {
+            throw RuntimeError("Cannot save a task in an image");
+        }
+    }
+
+    std::uint32_t count() const
+    {
+        return count_;
+    }
+
+    const Writer& objects() const
+    {
+        return objects_;
+    }
+
+private:
+    std::uint32_t string(std::string_view s)
+    {
+        auto [it, added] = strings_.try_emplace(std::string(s), count_);
+        if(added)
+        {
+            objects_.put(Tag::Str);
+            objects_.put(s);
+            ++count_;
+        }
+        return it->second;
+    }
+
+    std::uint32_t array(const Array& a)
+    {
+        if(auto it = arrays_.find(&a); it != arrays_.end())
+            return it->second;
+
+        // Elements first, they may be objects themselves
+        Writer elems;
+        if(a.elemKind_ == ElemKind::Int)
+        {
+            elems.putAll(a.ints_);
+        }
+        else
+        {
+            elems.put<std::uint64_t>(a.strs_.size());
+            for(const Value& v: a.strs_)
+            {
+                value(elems, v);
+            }
+        }
+
+        objects_.put(Tag::Array);
+        objects_.put(a.elemKind_);
+        objects_.append(elems);
+
+        arrays_.emplace(&a, count_);
+        return count_++;
+    }
+
+private:
+    Writer objects_;
+    std::uint32_t count_ = 0;
+
+    std::unordered_map<std::string, std::uint32_t> strings_;
+    std::unordered_map<const Array*, std::uint32_t> arrays_;
+};
+
+// Bounds-checked reads, anything out of place is a corrupt image
+class Reader
+{
+public:
+    Reader(const char* data, size_t size, const std::string& path) : p_(data), end_(data + size), path_(path)
+    {
+    }
+
+    template <typename T>
+    T get()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        T v;
+        std::memcpy(&v, take(sizeof(T)), sizeof(T));
+        return v;
+    }
+
+    std::string getString()
+    {
+        auto size = get<std::uint64_t>();
+        return std::string(take(size), size);
+    }
+
+    template <typename Vec>
+    void getAll(Vec& v)
+    {
+        using T   = typename Vec::value_type;
+        auto size = get<std::uint64_t>();
+        if(size > static_cast<size_t>(end_ - p_) / sizeof(T))
+            corrupt();
+
+        v.resize(size);
+        std::memcpy(v.data(), take(size * sizeof(T)), size * sizeof(T));
+    }
+
+    bool atEnd() const
+    {
+        return p_ == end_;
+    }
+
+    [[noreturn]] void corrupt() const
+    {
+        throw std::runtime_error("'" + path_ + "' is not an image of this version of Guu");
+    }
+
+private:
+    const char* take(size_t n)
+    {
+        if(n > static_cast<size_t>(end_ - p_))
+            corrupt();
+
+        const char* p = p_;
+        p_ += n;
+        return p;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+    const std::string& path_;
+};
+
+void writeModule(Writer& out, const Module& module)
+{
+    out.put<std::uint32_t>(static_cast<std::uint32_t>(module.functions_.size()));
+    for(const Function& fn: module.functions_)
+    {
+        out.put(std::string_view(fn.name_));
+        out.put(fn.numParams_);
+        out.put(fn.numRegs_);
+        out.put<std::uint64_t>(fn.code_.size());
+        for(const Instr& i: fn.code_)
+        {
+            out.put(i.op_);
+            out.put(i.x_);
+            out.put(i.a_);
+            out.put(i.b_);
+            out.put(i.c_);
+        }
+
+        out.putAll(fn.lines_);
+
+        out.put<std::uint32_t>(static_cast<std::uint32_t>(fn.locals_.size()));
+        for(const LocalVar& local: fn.locals_)
+        {
+            out.put(std::string_view(local.name_));
+            out.put(local.reg_);
+            out.put(local.startPc_);
+            out.put(local.endPc_);
+        }
+
+        out.putAll(fn.intRegs_);
+    }
+
+    // Ints and strings only, no objects to share
+    out.put<std::uint32_t>(static_cast<std::uint32_t>(module.constants_.size()));
+    for(const Value& c: module.constants_)
+    {
+        if(c.isInt())
+        {
+            out.put(Tag::Int);
+            out.put(c.asInt());
+        }
+        else
+        {
+            out.put(Tag::Str);
+            out.put(c.asStr());
+        }
+    }
+
+    out.put(module.main_);
+}
+
+// clang-format off
+constexpr size_t NUM_BUILTINS = 0
+    #define COUNT(_0, _1, _2, _3) + 1
+    GUU_BUILTIN_VALUES(COUNT)
+    #undef COUNT
+    ;
+// clang-format on
+
+// Whether every instruction of `fn` stays within its registers, its code, the
+// constants and the functions of `module`, so that the VM may run it unchecked
+bool operandsValid(const Module& module, const Function& fn)
+{
+    auto regs = [&fn](size_t first, size_t count = 1) { return first + count <= fn.numRegs_; };
+
+    // Jumps are relative to the next instruction
+    auto target = [&fn](size_t pc, std::int64_t offset) {
+        std::int64_t to = static_cast<std::int64_t>(pc) + 1 + offset;
+        return to >= 0 && static_cast<size_t>(to) < fn.code_.size();
+    };
+
+    auto callee = [&module](const Instr& i) {
+        return i.bx() < module.functions_.size() ? &module.functions_[i.bx()] : nullptr;
+    };
+
+    for(size_t pc = 0; pc < fn.code_.size(); ++pc)
+    {
+        const Instr& i = fn.code_[pc];
+
+        // Only ArrayOp has an operator in x, any allocating op may have REGION
+        if(i.op_ != Op::ArrayOp && (i.x_ & ~REGION) != 0)
+            return false;
+
+        bool valid = false;
+        switch(i.op_)
+        {
+            case Op::LoadK: valid = regs(i.a_) && i.bx() < module.constants_.size(); break;
+            case Op::LoadI: valid = regs(i.a_); break;
+
+            case Op::Move:
+            case Op::Neg:
+            case Op::ArrayNeg:
+            case Op::AddI: valid = regs(i.a_) && regs(i.b_); break;
+
+            case Op::Add:
+            case Op::Sub:
+            case Op::Mul:
+            case Op::Div:
+            case Op::Mod:
+            case Op::Lt:
+            case Op::Le:
+            case Op::Gt:
+            case Op::Ge:
+            case Op::Eq:
+            case Op::Ne:
+            case Op::GetIndex:
+            case Op::SetIndex:
+            case Op::Concat: valid = regs(i.a_) && regs(i.b_) && regs(i.c_); break;
+
+            case Op::ArrayOp: {
+                auto op = static_cast<TokenType>(i.x_ & ~REGION);
+                valid   = regs(i.a_) && regs(i.b_) && regs(i.c_) && Arith::apply(op, 1, 1).has_value();
+                break;
+            }
+
+            case Op::Jmp: valid = target(pc, i.sbx()); break;
+
+            case Op::JmpIf:
+            case Op::JmpIfNot: valid = regs(i.a_) && target(pc, i.sbx()); break;
+
+            case Op::JmpIfLt:
+            case Op::JmpIfLe:
+            case Op::JmpIfGt:
+            case Op::JmpIfGe:
+            case Op::JmpIfEq:
+            case Op::JmpIfNe: valid = regs(i.a_) && regs(i.b_) && target(pc, i.sc()); break;
+
+            case Op::NewArray:
+                valid = regs(i.a_) && regs(i.b_)
+                     && (static_cast<ElemKind>(i.c_) == ElemKind::Int || static_cast<ElemKind>(i.c_) == ElemKind::Str);
+                break;
+
+            // Array literals are never empty
+            case Op::MakeArray: valid = regs(i.a_) && i.c_ > 0 && regs(i.b_, i.c_); break;
+
+            // The arguments start at R[a], and the result of Spawn goes there too
+            case Op::Call:
+            case Op::TailCall:
+            case Op::Spawn: {
+                const Function* f = callee(i);
+                valid             = f && regs(i.a_, std::max<size_t>(f->numParams_, 1));
+                break;
+            }
+
+            // The body takes the variables R[0..a) and the bounds of a chunk
+            case Op::ParFor: {
+                const Function* f = callee(i);
+                valid             = f && regs(i.a_, 2) && f->numParams_ == i.a_ + 2u;
+                break;
+            }
+
+            case Op::CallBuiltin:
+                valid = regs(i.a_) && i.b_ > 0 && i.b_ <= NUM_BUILTINS
+                     && regs(i.c_, builtinArity(static_cast<Builtin>(i.b_)));
+                break;
+
+            case Op::Ret: valid = regs(i.a_); break;
+
+            case Op::EnterRegion: valid = true; break;
+            case Op::LeaveRegion: valid = i.a_ <= fn.numRegs_; break;
+
+            case Op::Join: valid = regs(i.a_) && regs(i.b_); break;
+
+            // Only a Debugger patches it in, images hold the original op
+            case Op::Break: valid = false; break;
+        }
+
+        if(!valid)
+            return false;
+    }
+
+    return true;
+}
+
+Module readModule(Reader& in)
+{
+    Module module;
+
+    auto numFns = in.get<std::uint32_t>();
+    for(std::uint32_t f = 0; f < numFns; ++f)
+    {
+        Function fn;
+        fn.name_      = in.getString();
+        fn.numParams_ = in.get<std::uint32_t>();
+        fn.numRegs_   = in.get<std::uint32_t>();
+        auto numInstrs = in.get<std::uint64_t>();
+        for(std::uint64_t k = 0; k < numInstrs; ++k)
+        {
+            auto op = in.get<Op>();
+            auto x  = in.get<std::uint8_t>();
+            auto a  = in.get<Reg>();
+            auto b  = in.get<Reg>();
+            Instr i(op, a, b, in.get<Reg>());
+            i.x_ = x;
+
+            fn.code_.push_back(i);
+        }
+
+        in.getAll(fn.lines_);
+
+        auto numLocals = in.get<std::uint32_t>();
+        for(std::uint32_t l = 0; l < numLocals; ++l)
+        {
+            LocalVar local;
+            local.name_    = in.getString();
+            local.reg_     = in.get<Reg>();
+            local.startPc_ = in.get<std::uint32_t>();
+            local.endPc_   = in.get<std::uint32_t>();
+            fn.locals_.push_back(std::move(local));
+        }
+
+        in.getAll(fn.intRegs_);
+
+        // Registers are allocated below MAX_REGS and every function ends in a return
+        if(fn.numRegs_ > MAX_REGS || fn.numParams_ > fn.numRegs_ || fn.code_.empty()
+           || fn.code_.back().op_ != Op::Ret || fn.lines_.size() != fn.code_.size())
+            in.corrupt();
+
+        for(const LocalVar& local: fn.locals_)
+        {
+            if(local.reg_ >= fn.numRegs_ || local.startPc_ > local.endPc_ || local.endPc_ > fn.code_.size())
+                in.corrupt();
+        }
+        for(Reg r: fn.intRegs_)
+        {
+            if(r >= fn.numRegs_)
+                in.corrupt();
+        }
+
+        module.functions_.push_back(std::move(fn));
+    }
+
+    auto numConsts = in.get<std::uint32_t>();
+    for(std::uint32_t k = 0; k < numConsts; ++k)
+    {
+        switch(in.get<Tag>())
+        {
+            case Tag::Int: module.constants_.emplace_back(in.get<std::int64_t>()); break;
+            case Tag::Str: module.constants_.emplace_back(in.getString()); break;
+            default: in.corrupt();
+        }
+    }
+
+    module.main_ = in.get<std::uint32_t>();
+    if(module.main_ != Module::NO_MAIN && module.main_ >= module.functions_.size())
+        in.corrupt();
+
+    for(const Function& fn: module.functions_)
+    {
+        if(!operandsValid(module, fn))
+            in.corrupt();
+    }
+
+    return module;
+}
+
+// Objects are read before anything refers to them
+Value readValue(Reader& in, const std::vector<Value>& objects)
+{
+    auto tag = in.get<Tag>();
+    if(tag == Tag::Int)
+        return in.get<std::int64_t>();
+
+    auto idx = in.get<std::uint32_t>();
+    if(tag > Tag::Array || idx >= objects.size() || (tag == Tag::Str) != objects[idx].isStr())
+        in.corrupt();
+
+    return objects[idx];
+}
+
+}
+
+void saveImage(const std::string& path, const Module& module, const Checkpoint* checkpoint)
+{
+    Writer out;
+    out.put(MAGIC);
+    out.put(ORDER_MARK);
+    out.put(VERSION);
+    writeModule(out, module);
+
+    out.put<std::uint8_t>(checkpoint != nullptr);
+    if(checkpoint)
+    {
+        // The registers collect the objects, which go first
+        ObjectWriter objects;
+        Writer regs;
+        regs.put<std::uint32_t>(static_cast<std::uint32_t>(checkpoint->regs_.size()));
+        for(const Value& v: checkpoint->regs_)
+        {
+            objects.value(regs, v);
+        }
+
+        out.put<std::uint64_t>(checkpoint->pc_);
+        out.put(checkpoint->regions_);
+        out.put(objects.count());
+        out.append(objects.objects());
+        out.append(regs);
+    }
+
+    out.put(checksum(out.str()));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file)
+        throw std::runtime_error("Cannot open '" + path + "'");
+
+    file.write(out.str().data(), static_cast<std::streamsize>(out.str().size()));
+    if(!file.flush())
+        throw std::runtime_error("Cannot write '" + path + "'");
+}
+
+Image loadImage(const std::string& path)
+{
+    util::MappedFile file(path);
+
+    // The checksum is read like the rest, the image is checked without it
+    size_t size = file.size() < sizeof(std::uint64_t) ? 0 : file.size() - sizeof(std::uint64_t);
+    Reader sum(file.data() + size, file.size() - size, path);
+    if(sum.get<std::uint64_t>() != checksum(std::string_view(file.data(), size)))
+        sum.corrupt();
+
+    Reader in(file.data(), size, path);
+    if(in.get<std::array<char, 8>>() != MAGIC || in.get<std::uint32_t>() != ORDER_MARK
+       || in.get<std::uint32_t>() != VERSION)
+        in.corrupt();
+
+    Image image;
+    image.module_    = readModule(in);
+    image.resumable_ = in.get<std::uint8_t>() != 0;
+
+    if(image.resumable_)
+    {
+        if(image.module_.main_ == Module::NO_MAIN)
+            in.corrupt();
+
+        Checkpoint& cp = image.checkpoint_;
+        cp.pc_         = in.get<std::uint64_t>();
+        cp.regions_    = in.get<std::uint32_t>();
+
+        std::vector<Value> objects;
+        auto numObjects = in.get<std::uint32_t>();
+        objects.reserve(numObjects);
+        for(std::uint32_t k = 0; k < numObjects; ++k)
+        {
+            switch(in.get<Tag>())
+            {
+                case Tag::Str: objects.emplace_back(in.getString()); break;
+
+                case Tag::Array: {
+                    auto kind = in.get<ElemKind>();
+                    if(kind != ElemKind::Int && kind != ElemKind::Str)
+                        in.corrupt();
+
+                    ArrayRef arr = makeArray(kind);
+                    if(kind == ElemKind::Int)
+                    {
+                        in.getAll(arr->ints_);
+                    }
+                    else
+                    {
+                        auto size = in.get<std::uint64_t>();
+                        for(std::uint64_t e = 0; e < size; ++e)
+                        {
+                            arr->strs_.push_back(readValue(in, objects));
+                        }
+                    }
+                    objects.emplace_back(std::move(arr));
+                    break;
+                }
+
+                default: in.corrupt();
+            }
+        }
+
+        const Function& main = image.module_.functions_[image.module_.main_];
+
+        // Each region open at the checkpoint was entered by an op of main
+        auto enters = std::count_if(main.code_.begin(), main.code_.end(),
+                                    [](const Instr& i) { return i.op_ == Op::EnterRegion; });
+
+        auto numRegs = in.get<std::uint32_t>();
+        if(numRegs != main.numRegs_ || cp.pc_ >= main.code_.size() || cp.regions_ > static_cast<size_t>(enters))
+            in.corrupt();
+
+        cp.regs_.reserve(numRegs);
+        for(std::uint32_t r = 0; r < numRegs; ++r)
+        {
+            cp.regs_.push_back(readValue(in, objects));
+        }
+    }
+
+    if(!in.atEnd())
+        in.corrupt();
+
+    return image;
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "bytecode.h"
+#include "value.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Guu
+{
+
+// The frame of `main` at a checkpoint() of the VM: everything a later run
+// needs to go on from there. Objects the frame refers to are copied, regions
+// open at the checkpoint are reopened empty.
+struct Checkpoint
+{
+    size_t pc_              = 0;
+    std::uint32_t regions_ = 0;
+    std::vector<Value> regs_;
+};
+
+// A compiled Module, and the state of main if the program reached a
+// checkpoint, as written by saveImage()
+struct Image
+{
+    Bytecode::Module module_;
+    bool resumable_ = false;
+    Checkpoint checkpoint_;
+};
+
+// Writes `module` and, unless null, `checkpoint` to `path`. The image holds
+// offsets instead of pointers, so it loads at any address, but it is only
+// readable by the same version of Guu on a machine of the same byte order.
+// Throws RuntimeError for tasks, which cannot be saved.
+void saveImage(const std::string& path, const Bytecode::Module& module, const Checkpoint* checkpoint);
+
+// Maps the image at `path` and rebuilds it. Throws std::runtime_error if the
+// file is not an image of this version.
+Image loadImage(const std::string& path);
+
+}
@@ -0,0 +1,281 @@
+#include "stats.h"
+
+#ifdef GUU_ENABLE_STATS
+
+#include "ast.h"
+
+#include <iomanip>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace Guu::Stats
+{
+
+namespace
+{
+
+// clang-format off
+const char* const NODE_TYPE_NAMES[] = {
+    #define NODE_TYPE_NAME(x, _) #x,
+    GUU_NODE_TYPE_VALUES(NODE_TYPE_NAME)
+    #undef NODE_TYPE_NAME
+};
+// clang-format on
+
+constexpr size_t NODE_TYPES = std::size(NODE_TYPE_NAMES);
+
+static_assert(NODE_TYPES <= MAX_NODE_TYPES, "Increase Stats::MAX_NODE_TYPES");
+
+double toMs(std::clock_t ticks)
+{
+    return 1000.0 * static_cast<double>(ticks) / CLOCKS_PER_SEC;
+}
+
+std::string jsonEscape(const std::string& s)
+{
+    std::string result;
+    for(char c: s)
+    {
+        if(c == '"' || c == '\\')
+            result += '\\';
+
+        result += c;
+    }
+
+    return result;
+}
+
+}
+
+std::uint64_t Snapshot::totalNodes() const
+{
+    std::uint64_t result = 0;
+    for(size_t i = 0; i < NODE_TYPES; ++i)
+    {
+        result += nodes_[i];
+    }
+
+    return result;
+}
+
+Snapshot Snapshot::operator-(const Snapshot& o) const
+{
+    Snapshot result;
+    result.tokens_         = tokens_ - o.tokens_;
+    result.backtracks_     = backtracks_ - o.backtracks_;
+    result.allocations_    = allocations_ - o.allocations_;
+    result.bytesAllocated_ = bytesAllocated_ - o.bytesAllocated_;
+    result.objects_        = objects_ - o.objects_;
+    result.regionObjects_  = regionObjects_ - o.regionObjects_;
+    result.regionBytes_    = regionBytes_ - o.regionBytes_;
+    for(size_t i = 0; i < NODE_TYPES; ++i)
+    {
+        result.nodes_[i] = nodes_[i] - o.nodes_[i];
+    }
+
+    return result;
+}
+
+Snapshot& Snapshot::operator+=(const Snapshot& o)
+{
+    tokens_ += o.tokens_;
+    backtracks_ += o.backtracks_;
+    allocations_ += o.allocations_;
+    bytesAllocated_ += o.bytesAllocated_;
+    objects_ += o.objects_;
+    regionObjects_ += o.regionObjects_;
+    regionBytes_ += o.regionBytes_;
+    for(size_t i = 0; i < NODE_TYPES; ++i)
+    {
+        nodes_[i] += o.nodes_[i];
+    }
+
+    return *this;
+}
+
+Snapshot Counters::snapshot() const
+{
+    auto load = [](const Counter& c) { return c.load(std::memory_order_relaxed); };
+
+    Snapshot result;
+    result.tokens_         = load(tokens_);
+    result.backtracks_     = load(backtracks_);
+    result.allocations_    = load(allocations_);
+    result.bytesAllocated_ = load(bytesAllocated_);
+    result.objects_        = load(objects_);
+    result.regionObjects_  = load(regionObjects_);
+    result.regionBytes_    = load(regionBytes_);
+    for(size_t i = 0; i < NODE_TYPES; ++i)
+    {
+        result.nodes_[i] = load(nodes_[i]);
+    }
+
+    return result;
+}
+
+Registry& Registry::instance()
+{
+    static Registry registry;
+    return registry;
+}
+
+size_t Registry::beginPhase(const char* name)
+{
+    size_t idx = NO_PARENT;
+    for(size_t i = 0; i < phases_.size(); ++i)
+    {
+        if(phases_[i].parent_ == current_ && phases_[i].name_ == name)
+        {
+            idx = i;
+            break;
+        }
+    }
+
+    if(idx == NO_PARENT)
+    {
+        size_t depth = current_ == NO_PARENT ? 0 : phases_[current_].depth_ + 1;
+
+        idx = phases_.size();
+
+        PhaseRecord record;
+        record.name_   = name;
+        record.parent_ = current_;
+        record.depth_  = depth;
+        phases_.push_back(std::move(record));
+    }
+
+    current_ = idx;
+    return idx;
+}
+
+void Registry::endPhase(size_t idx, double wallMs, double cpuMs, const Snapshot& delta)
+{
+    auto& ph = phases_[idx];
+    ph.calls_ += 1;
+    ph.wallMs_ += wallMs;
+    ph.cpuMs_ += cpuMs;
+    ph.delta_ += delta;
+
+    current_ = ph.parent_;
+}
+
+void Registry::printText(std::ostream& os) const
+{
+    auto flags = os.flags();
+
+    os << std::left << std::setw(24) << "Phase" << std::right << std::setw(7) << "Calls" << std::setw(11) << "Wall ms"
+       << std::setw(11) << "CPU ms" << std::setw(10) << "Tokens" << std::setw(9) << "Nodes" << std::setw(11)
+       << "Backtracks" << std::setw(9) << "Allocs" << std::setw(12) << "Bytes" << std::endl;
+
+    os << std::fixed << std::setprecision(3);
+    for(const auto& ph: phases_)
+    {
+        os << std::left << std::setw(24) << (std::string(ph.depth_ * 2, ' ') + ph.name_) << std::right << std::setw(7)
+           << ph.calls_ << std::setw(11) << ph.wallMs_ << std::setw(11) << ph.cpuMs_ << std::setw(10)
+           << ph.delta_.tokens_ << std::setw(9) << ph.delta_.totalNodes() << std::setw(11) << ph.delta_.backtracks_
+           << std::setw(9) << ph.delta_.allocations_ << std::setw(12) << ph.delta_.bytesAllocated_ << std::endl;
+    }
+
+    Snapshot total = counters().snapshot();
+
+    os << std::endl << "AST nodes allocated:" << std::endl;
+    for(size_t i = 0; i < NODE_TYPES; ++i)
+    {
+        if(total.nodes_[i])
+        {
+            os << "  " << std::left << std::setw(12) << NODE_TYPE_NAMES[i] << std::right << std::setw(10)
+               << total.nodes_[i] << std::endl;
+        }
+    }
+
+    os << std::endl;
+    os << "Tokens produced:  " << total.tokens_ << std::endl;
+    os << "Parser backtracks: " << total.backtracks_ << std::endl;
+    os << "Allocations:      " << total.allocations_ << " (" << total.bytesAllocated_ << " bytes)" << std::endl;
+    os << "Runtime objects:  " << total.objects_ << " (" << total.regionObjects_ << " in regions, "
+       << total.regionBytes_ << " region bytes)" << std::endl;
+    os << "Peak RSS:         " << peakRssKb() << " KiB" << std::endl;
+
+    os.flags(flags);
+}
+
+void Registry::printJson(std::ostream& os) const
+{
+    auto flags = os.flags();
+    os << std::fixed << std::setprecision(3);
+
+    auto printCounters = [&os](const Snapshot& s) {
+        os << "\"tokens\": " << s.tokens_ << ", \"nodes\": " << s.totalNodes() << ", \"backtracks\": " << s.backtracks_
+           << ", \"allocations\": " << s.allocations_ << ", \"bytes_allocated\": " << s.bytesAllocated_
+           << ", \"objects\": " << s.objects_ << ", \"region_objects\": " << s.regionObjects_
+           << ", \"region_bytes\": " << s.regionBytes_;
+    };
+
+    os << "{" << std::endl << "  \"phases\": [";
+    for(size_t i = 0; i < phases_.size(); ++i)
+    {
+        const auto& ph = phases_[i];
+        os << (i ? "," : "") << std::endl
+           << "    {\"name\": \"" << jsonEscape(ph.name_) << "\", \"parent\": "
+           << (ph.parent_ == NO_PARENT ? std::string("null") : std::to_string(ph.parent_))
+           << ", \"calls\": " << ph.calls_ << ", \"wall_ms\": " << ph.wallMs_ << ", \"cpu_ms\": " << ph.cpuMs_ << ", ";
+        printCounters(ph.delta_);
+        os << "}";
+    }
+    os << std::endl << "  ]," << std::endl;
+
+    Snapshot total = counters().snapshot();
+
+    os << "  \"totals\": {";
+    printCounters(total);
+    os << "}," << std::endl;
+
+    os << "  \"nodes_by_type\": {";
+    for(size_t i = 0; i < NODE_TYPES; ++i)
+    {
+        os << (i ? ", " : "") << "\"" << NODE_TYPE_NAMES[i] << "\": " << total.nodes_[i];
+    }
+    os << "}," << std::endl;
+
+    os << "  \"peak_rss_kb\": " << peakRssKb() << std::endl << "}" << std::endl;
+
+    os.flags(flags);
+}
+
+ScopedPhase::ScopedPhase(const char* name)
+    : idx_(Registry::instance().beginPhase(name)), start_(counters().snapshot()), wallStart_(Clock::now()),
+      cpuStart_(std::clock())
+{
+}
+
+ScopedPhase::~ScopedPhase()
+{
+    double wallMs = std::chrono::duration<double, std::milli>(Clock::now() - wallStart_).count();
+    double cpuMs  = toMs(std::clock() - cpuStart_);
+
+    Registry::instance().endPhase(idx_, wallMs, cpuMs, counters().snapshot() - start_);
+}
+
+std::uint64_t peakRssKb()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+#if defined(__APPLE__)
+    return static_cast<std::uint64_t>(usage.ru_maxrss) / 1024;
+#else
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+#endif
+#else
+    return 0;
+#endif
+}
+
+}
+
+#endif
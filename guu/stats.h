@@ -0,0 +1,151 @@
+#pragma once
+
+// Built-in instrumentation for --stats. Everything here is compiled out unless
+// GUU_ENABLE_STATS is defined: the GUU_STATS_* macros expand to nothing and
+// no counters, timers or allocation hooks exist in the binary.
+
+#ifdef GUU_ENABLE_STATS
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace Guu::AST
+{
+enum class NodeType;
+}
+
+namespace Guu::Stats
+{
+
+// Must match the length of GUU_NODE_TYPE_VALUES, checked in stats.cpp
+constexpr size_t MAX_NODE_TYPES = 32;
+
+struct Snapshot
+{
+    std::uint64_t tokens_         = 0;
+    std::uint64_t backtracks_     = 0;
+    std::uint64_t allocations_    = 0;
+    std::uint64_t bytesAllocated_ = 0;
+    std::uint64_t objects_        = 0;
+    std::uint64_t regionObjects_  = 0;
+    std::uint64_t regionBytes_    = 0;
+    std::uint64_t nodes_[MAX_NODE_TYPES]{};
+
+    std::uint64_t totalNodes() const;
+
+    Snapshot operator-(const Snapshot& o) const;
+    Snapshot& operator+=(const Snapshot& o);
+};
+
+struct Counters
+{
+    using Counter = std::atomic<std::uint64_t>;
+
+    Counter tokens_{0};
+    Counter backtracks_{0};
+    // Only counted in executables that link guu_alloc_hooks, see guu/alloc_hooks.cpp
+    Counter allocations_{0};
+    Counter bytesAllocated_{0};
+
+    // Strings and arrays of the runtime, the region ones are also counted in objects_
+    Counter objects_{0};
+    Counter regionObjects_{0};
+    Counter regionBytes_{0};
+
+    Counter nodes_[MAX_NODE_TYPES]{};
+
+    Snapshot snapshot() const;
+};
+
+// Constant-initialized, so it is usable from the allocation hooks before main()
+inline Counters& counters()
+{
+    static Counters c;
+    return c;
+}
+
+inline void count(Counters::Counter& c, std::uint64_t n = 1)
+{
+    c.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void countNode(AST::NodeType nt)
+{
+    count(counters().nodes_[static_cast<size_t>(nt)]);
+}
+
+struct PhaseRecord
+{
+    std::string name_;
+    size_t parent_;
+    size_t depth_;
+    size_t calls_  = 0;
+    double wallMs_ = 0;
+    double cpuMs_  = 0;
+    Snapshot delta_;
+};
+
+// Phases nest: a phase started while another one runs becomes its child.
+// Repeated phases with the same name under the same parent are accumulated.
+class Registry
+{
+public:
+    static constexpr size_t NO_PARENT = static_cast<size_t>(-1);
+
+    static Registry& instance();
+
+    size_t beginPhase(const char* name);
+    void endPhase(size_t idx, double wallMs, double cpuMs, const Snapshot& delta);
+
+    void printText(std::ostream& os) const;
+    void printJson(std::ostream& os) const;
+
+private:
+    std::vector<PhaseRecord> phases_;
+    size_t current_ = NO_PARENT;
+};
+
+class ScopedPhase
+{
+    using Clock = std::chrono::steady_clock;
+
+public:
+    explicit ScopedPhase(const char* name);
+    ~ScopedPhase();
+
+    ScopedPhase(const ScopedPhase&)            = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+private:
+    size_t idx_;
+    Snapshot start_;
+    Clock::time_point wallStart_;
+    std::clock_t cpuStart_;
+};
+
+// Peak resident set size of the process, 0 if the platform can't tell
+std::uint64_t peakRssKb();
+
+}
+
+#define GUU_STATS_CONCAT_IMPL(a, b) a##b
+#define GUU_STATS_CONCAT(a, b)      GUU_STATS_CONCAT_IMPL(a, b)
+
+#define GUU_STATS_COUNT(counter)  ::Guu::Stats::count(::Guu::Stats::counters().counter)
+#define GUU_STATS_ADD(counter, n) ::Guu::Stats::count(::Guu::Stats::counters().counter, n)
+#define GUU_STATS_COUNT_NODE(nt)  ::Guu::Stats::countNode(nt)
+#define GUU_STATS_PHASE(name)     ::Guu::Stats::ScopedPhase GUU_STATS_CONCAT(guuStatsPhase, __LINE__)(name)
+
+#else
+
+#define GUU_STATS_COUNT(counter)  ((void)0)
+#define GUU_STATS_ADD(counter, n) ((void)0)
+#define GUU_STATS_COUNT_NODE(nt)  ((void)0)
+#define GUU_STATS_PHASE(name)     ((void)0)
+
+#endif
@@ -0,0 +1,50 @@
+#include "tail_calls.h"
+
+namespace Guu
+{
+
+size_t TailCalls::run(AST::Node& root)
+{
+    marked_ = 0;
+    visit(root);
+    return marked_;
+}
+
+void TailCalls::visit(AST::FnDef& fn)
+{
+    allowed_ = !fn.spawns_;
+    AST::Visitor::visit(fn);
+    allowed_ = false;
+}
+
+void TailCalls::visit(AST::Return& ret)
+{
+    visit(*ret.value_);
+
+    if(allowed_ && ret.value_->type_ == AST::NodeType::Call)
+    {
+        auto& call = static_cast<AST::Call&>(*ret.value_);
+        if(call.builtin_ == Builtin::None)
+        {
+            call.tail_ = true;
+            ++marked_;
+        }
+    }
+}
+
+void TailCalls::visit(AST::ParallelFor& stmt)
+{
+    bool allowed = allowed_;
+    allowed_     = false;
+    AST::Visitor::visit(stmt);
+    allowed_ = allowed;
+}
+
+void TailCalls::visit(AST::Call& call)
+{
+    // Left over from a previous run on a tree rewritten since
+    call.tail_ = false;
+    AST::Visitor::visit(call);
+}
+
+}
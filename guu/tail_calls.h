@@ -0,0 +1,37 @@
+#pragma once
+
+#include "ast.h"
+
+#include <cstddef>
+
+namespace Guu
+{
+
+// Sets Call::tail_ on the calls in tail position, `return f(...)` for a
+// function f of the program. The VM and the Interpreter run those in place
+// of the caller, so tail recursion takes constant stack space and is not
+// limited by the call depth.
+//
+// Functions declaring tasks have no tail calls, their tasks are joined after
+// the returned value is computed. Neither do the bodies of parallel loops,
+// which the VM runs as functions of their own.
+class TailCalls : public AST::Visitor
+{
+public:
+    using AST::Visitor::visit;
+
+    // Returns the number of tail calls, on the whole program or a single FnDef
+    size_t run(AST::Node& root);
+
+private:
+    void visit(AST::FnDef& fn) override;
+    void visit(AST::Return& ret) override;
+    void visit(AST::ParallelFor& stmt) override;
+    void visit(AST::Call& call) override;
+
+private:
+    bool allowed_  = false;
+    size_t marked_ = 0;
+};
+
+}
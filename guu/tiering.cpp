@@ -0,0 +1,204 @@
+#include "tiering.h"
+#include "compiler.h"
+#include "escape.h"
+#include "lexer.h"
+#include "parser.h"
+#include "resolver.h"
+#include "stats.h"
+#include "tail_calls.h"
+#include "vm.h"
+
+#include <cassert>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+
+namespace Guu
+{
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Collects the functions a function calls or spawns
+class Callees : public AST::Visitor
+{
+public:
+    using AST::Visitor::visit;
+
+    std::vector<std::uint32_t> fns_;
+
+private:
+    void visit(AST::Call& call) override
+    {
+        if(call.builtin_ == Builtin::None)
+            fns_.push_back(call.fnIndex_);
+
+        AST::Visitor::visit(call);
+    }
+};
+
+}
+
+Tiering::Tiering(const AST::Node& program, std::string source, std::ostream& out, TierPolicy policy, size_t maxDepth)
+    : policy_(policy), source_(std::move(source)), out_(out), maxDepth_(maxDepth)
+{
+    assert(program.type_ == AST::NodeType::Root);
+
+    for(auto& c: static_cast<const AST::Root&>(program).children_)
+    {
+        auto& fn = static_cast<const AST::FnDef&>(*c);
+        if(names_.size() <= fn.index_)
+            names_.resize(fn.index_ + 1);
+
+        names_[fn.index_] = fn.id_;
+    }
+
+    counters_.resize(names_.size());
+}
+
+Tiering::~Tiering() = default;
+
+void Tiering::setThreads(size_t threads)
+{
+    threads_ = threads;
+    if(vm_)
+        vm_->setThreads(threads);
+}
+
+Value Tiering::call(std::uint32_t fn, std::vector<Value> args)
+{
+    ++counters_[fn].vmCalls_;
+    return vm_->call(optimizedIndex_[fn], std::move(args));
+}
+
+void Tiering::buildOptimized()
+{
+    GUU_STATS_PHASE("tier front end");
+    auto start = Clock::now();
+
+    // Only needed once
+    optimized_ = Parser(Tokenizer(std::move(source_))).buildAST();
+    Resolver(types_).resolve(*optimized_);
+
+    if(policy_.optLevel_ > 0)
+        Optimizer(types_, policy_.optLevel_).run(*optimized_);
+
+    // The Optimizer renumbers functions and drops the unreachable ones
+    std::unordered_map<std::string, std::uint32_t> byName;
+    for(auto& c: static_cast<AST::Root&>(*optimized_).children_)
+    {
+        auto& fn = static_cast<AST::FnDef&>(*c);
+        if(optimizedFns_.size() <= fn.index_)
+            optimizedFns_.resize(fn.index_ + 1);
+
+        optimizedFns_[fn.index_] = &fn;
+        byName.emplace(fn.id_, fn.index_);
+    }
+    compiled_.assign(optimizedFns_.size(), false);
+
+    optimizedIndex_.assign(names_.size(), AST_TIER);
+    for(size_t i = 0; i < names_.size(); ++i)
+    {
+        if(auto it = byName.find(names_[i]); it != byName.end())
+        {
+            optimizedIndex_[i] = it->second;
+        }
+        else
+        {
+            counters_[i].pinned_ = true;
+        }
+    }
+
+    frontEndMs_ = msSince(start);
+}
+
+void Tiering::tierUp(std::uint32_t fn)
+{
+    if(!optimized_)
+        buildOptimized();
+
+    if(counters_[fn].pinned_)
+        return;
+
+    GUU_STATS_PHASE("tier-up");
+    auto start = Clock::now();
+
+    // Compiled code never leaves the VM, so everything `fn` reaches comes along
+    EscapeAnalysis escape(types_);
+    std::vector<std::uint32_t> work{optimizedIndex_[fn]};
+    while(!work.empty())
+    {
+        auto idx = work.back();
+        work.pop_back();
+        if(compiled_[idx])
+            continue;
+
+        compiled_[idx] = true;
+        escape.run(*optimizedFns_[idx]);
+        TailCalls().run(*optimizedFns_[idx]);
+
+        Callees callees;
+        callees.visit(*optimizedFns_[idx]);
+        work.insert(work.end(), callees.fns_.begin(), callees.fns_.end());
+    }
+
+    // Nothing runs on the old VM while the Interpreter is here
+    vm_.reset();
+    module_ = std::make_unique<Bytecode::Module>(Compiler(types_).compile(*optimized_, compiled_));
+    vm_     = std::make_unique<VM>(*module_, out_, maxDepth_);
+    vm_->setThreads(threads_);
+
+    ++tierUps_;
+    counters_[fn].hot_ = true;
+    for(size_t i = 0; i < counters_.size(); ++i)
+    {
+        auto& c = counters_[i];
+        if(c.tierUp_ == AST_TIER && !c.pinned_ && compiled_[optimizedIndex_[i]])
+            c.tierUp_ = tierUps_;
+    }
+
+    compileMs_ += msSince(start);
+}
+
+void Tiering::printStats(std::ostream& os) const
+{
+    size_t compiled = 0;
+    for(const auto& c: counters_)
+    {
+        compiled += c.tierUp_ != AST_TIER;
+    }
+
+    os << std::fixed << std::setprecision(2);
+    os << tierUps_ << " tier-ups compiled " << compiled << " of " << counters_.size() << " functions, front end "
+       << frontEndMs_ << " ms, compiling " << compileMs_ << " ms" << std::endl;
+    os << std::defaultfloat;
+
+    os << std::setw(12) << "calls" << std::setw(12) << "loops" << std::setw(12) << "vm calls" << std::setw(9)
+       << "tier-up"
+       << "  function" << std::endl;
+
+    for(size_t i = 0; i < counters_.size(); ++i)
+    {
+        const auto& c = counters_[i];
+
+        std::string tier = c.pinned_ ? "pinned" : c.tierUp_ == AST_TIER ? "-" : std::to_string(c.tierUp_);
+        os << std::setw(12) << c.calls_ << std::setw(12) << c.loops_ << std::setw(12) << c.vmCalls_ << std::setw(9)
+           << tier << "  " << names_[i];
+
+        // Compiled along with a hot caller
+        if(c.tierUp_ != AST_TIER && !c.hot_)
+            os << " (callee)";
+        os << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "ast.h"
+#include "bytecode.h"
+#include "call_stack.h"
+#include "optimizer.h"
+#include "types.h"
+#include "value.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Guu
+{
+
+class VM;
+
+// When a function run by the Interpreter is compiled, see Tiering
+struct TierPolicy
+{
+    // Calls of a function in the AST tier, 0 never compiles on calls
+    std::uint32_t hotCalls_ = 100;
+
+    // Loop iterations of a function in the AST tier, 0 never compiles on loops
+    std::uint32_t hotLoops_ = 10000;
+
+    int optLevel_ = Optimizer::MAX_LEVEL;
+};
+
+// Tiered execution: every function starts out walked by the Interpreter over
+// the resolved AST, so a program starts after parsing and resolving alone.
+// The Interpreter counts calls and loop iterations per function; one crossing
+// a threshold of the TierPolicy is compiled to bytecode, with the functions it
+// calls, and from its next call on runs on the VM.
+//
+// The VM never calls back into the AST tier, so compiled code only ever calls
+// compiled code. The optimized tier has an AST of its own, built from the
+// source at the first tier-up, since the Optimizer rewrites functions that may
+// be running in the AST tier at that moment. Every tier-up compiles a new
+// Module with all functions compiled so far and starts a VM on it; none runs
+// meanwhile, the VM only runs below calls of the Interpreter.
+class Tiering
+{
+public:
+    // Of the tier-up that compiled a function, if none did
+    static constexpr std::uint32_t AST_TIER = static_cast<std::uint32_t>(-1);
+
+    struct FunctionCounters
+    {
+        // In the AST tier
+        std::uint64_t calls_ = 0;
+        std::uint64_t loops_ = 0;
+
+        // Calls from the AST tier that ran on the VM
+        std::uint64_t vmCalls_ = 0;
+
+        // 1 for the first tier-up, AST_TIER while interpreted
+        std::uint32_t tierUp_ = AST_TIER;
+
+        // Compiled for crossing a threshold itself rather than as a callee
+        bool hot_ = false;
+
+        // Not in the optimized program, so it stays in the AST tier
+        bool pinned_ = false;
+    };
+
+    // `program` is the resolved AST of `source` run by the Interpreter
+    Tiering(const AST::Node& program, std::string source, std::ostream& out, TierPolicy policy = {},
+            size_t maxDepth = CallStack::DEFAULT_MAX_DEPTH);
+    ~Tiering();
+
+    Tiering(const Tiering&)            = delete;
+    Tiering& operator=(const Tiering&) = delete;
+
+    // Parallel loops and tasks of compiled functions, see VM::setThreads()
+    void setThreads(size_t threads);
+
+    // Counts a call of `fn` by the Interpreter, returns whether it runs on the VM
+    bool enter(std::uint32_t fn)
+    {
+        auto& c = counters_[fn];
+        if(c.tierUp_ == AST_TIER && ++c.calls_ == policy_.hotCalls_)
+            tierUp(fn);
+
+        return c.tierUp_ != AST_TIER;
+    }
+
+    // Counts a loop iteration of `fn` by the Interpreter
+    void loop(std::uint32_t fn)
+    {
+        auto& c = counters_[fn];
+        if(c.tierUp_ == AST_TIER && ++c.loops_ == policy_.hotLoops_)
+            tierUp(fn);
+    }
+
+    // Runs `fn`, for which enter() returned true, on the VM
+    Value call(std::uint32_t fn, std::vector<Value> args);
+
+    const std::vector<FunctionCounters>& counters() const
+    {
+        return counters_;
+    }
+
+    void printStats(std::ostream& os) const;
+
+private:
+    // Compiles `fn` and every function it may call
+    void tierUp(std::uint32_t fn);
+
+    // Parses, resolves and optimizes the source for the bytecode tier
+    void buildOptimized();
+
+private:
+    TierPolicy policy_;
+    std::string source_;
+    std::ostream& out_;
+    size_t maxDepth_;
+    size_t threads_ = 1;
+
+    // Of the AST tier, by function index
+    std::vector<std::string> names_;
+    std::vector<FunctionCounters> counters_;
+
+    // The optimized program, and the index of every function of the AST tier in it
+    TypeTable types_;
+    std::unique_ptr<AST::Node> optimized_;
+    std::vector<std::uint32_t> optimizedIndex_;
+
+    // By optimized index
+    std::vector<AST::FnDef*> optimizedFns_;
+    std::vector<bool> compiled_;
+
+    // The VM is destroyed before the module it runs
+    std::unique_ptr<Bytecode::Module> module_;
+    std::unique_ptr<VM> vm_;
+
+    std::uint32_t tierUps_ = 0;
+    double frontEndMs_     = 0;
+    double compileMs_      = 0;
+};
+
+}
@@ -13,8 +13,18 @@ namespace Guu
     _(SEMICOLON, "SEMICOLON ::= ';'")                                  \
     _(COMMA, "COMMA ::= ','")                                          \
     _(MINUS, "MINUS ::= '-'")                                          \
+    _(PLUS, "PLUS ::= '+'")                                            \
+    _(STAR, "STAR ::= '*'")                                            \
+    _(SLASH, "SLASH ::= '/'")                                          \
+    _(PERCENT, "PERCENT ::= '%'")                                      \
     _(EQ, "EQ ::= '='")                                                \
     _(GT, "GT ::= '>'")                                                \
+    _(LT, "LT ::= '<'")                                                \
+    _(GE, "GE ::= '>='")                                               \
+    _(LE, "LE ::= '<='")                                               \
+    _(EQEQ, "EQEQ ::= '=='")                                           \
+    _(NE, "NE ::= '!='")                                               \
+    _(DOTDOT, "DOTDOT ::= '..'")                                       \
     _(O_BRACE, "O_BRACE ::= '{'")                                      \
     _(C_BRACE, "C_BRACE ::= '}'")                                      \
     _(O_BRACK, "O_BRACK ::= '['")                                      \
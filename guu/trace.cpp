@@ -0,0 +1,241 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace Guu
+{
+
+using namespace Bytecode;
+
+namespace
+{
+
+// Bumped whenever the layout changes
+constexpr std::uint32_t VERSION     = 1;
+constexpr std::array<char, 8> MAGIC = {'G', 'U', 'U', 'T', 'R', 'A', 'C', 'E'};
+constexpr std::uint32_t ORDER_MARK  = 0x01020304;
+
+// The layout, all in native byte order:
+//
+//   header     magic, byte order, version
+//   error      the message the run failed with
+//   functions  count, then name and line of every instruction of each
+//   records    events recorded, records kept, the kept ones oldest first
+template <typename T>
+void put(std::string& buf, T v)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void put(std::string& buf, const std::string& s)
+{
+    put<std::uint64_t>(buf, s.size());
+    buf.append(s);
+}
+
+class Reader
+{
+public:
+    Reader(const std::string& data, const std::string& path) : data_(data), path_(path)
+    {
+    }
+
+    template <typename T>
+    T get()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        T v;
+        std::memcpy(&v, take(sizeof(T)), sizeof(T));
+        return v;
+    }
+
+    std::string getString()
+    {
+        auto size = get<std::uint64_t>();
+        return std::string(take(size), size);
+    }
+
+    // Checks that `n` items of `size` bytes can follow before allocating for them
+    void expect(std::uint64_t n, size_t size) const
+    {
+        if(n > (data_.size() - pos_) / size)
+            corrupt();
+    }
+
+    [[noreturn]] void corrupt() const
+    {
+        throw std::runtime_error("'" + path_ + "' is not a trace of this version of Guu");
+    }
+
+private:
+    const char* take(size_t n)
+    {
+        if(n > data_.size() - pos_)
+            corrupt();
+
+        const char* p = data_.data() + pos_;
+        pos_ += n;
+        return p;
+    }
+
+private:
+    const std::string& data_;
+    const std::string& path_;
+    size_t pos_ = 0;
+};
+
+const char* eventName(TraceEvent event)
+{
+    switch(event)
+    {
+        case TraceEvent::Enter: return "enter";
+        case TraceEvent::Return: return "return";
+        case TraceEvent::Call: return "call";
+        case TraceEvent::Statement: return "line";
+    }
+    return "?";
+}
+
+}
+
+Tracer::Tracer(std::string path, bool statements, size_t capacity) : path_(std::move(path)), statements_(statements)
+{
+    size_t size = 1;
+    while(size < capacity)
+    {
+        size <<= 1;
+    }
+
+    records_ = std::make_unique<TraceRecord[]>(size);
+    mask_    = size - 1;
+}
+
+void Tracer::save(const Module& module, const std::string& error) const
+{
+    std::string buf;
+    buf.append(MAGIC.data(), MAGIC.size());
+    put(buf, ORDER_MARK);
+    put(buf, VERSION);
+    put(buf, error);
+
+    put<std::uint32_t>(buf, static_cast<std::uint32_t>(module.functions_.size()));
+    for(const Function& fn: module.functions_)
+    {
+        put(buf, fn.name_);
+        put<std::uint64_t>(buf, fn.lines_.size());
+        for(size_t line: fn.lines_)
+        {
+            put<std::uint32_t>(buf, static_cast<std::uint32_t>(line));
+        }
+    }
+
+    std::uint64_t kept = std::min<std::uint64_t>(next_, mask_ + 1);
+    put(buf, next_);
+    put(buf, kept);
+    for(std::uint64_t n = next_ - kept; n < next_; ++n)
+    {
+        put(buf, records_[n & mask_]);
+    }
+
+    std::ofstream file(path_, std::ios::binary | std::ios::trunc);
+    if(!file)
+        throw std::runtime_error("Cannot open '" + path_ + "'");
+
+    file.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+    if(!file)
+        throw std::runtime_error("Cannot write '" + path_ + "'");
+}
+
+void Tracer::decode(const std::string& path, std::ostream& os)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file)
+        throw std::runtime_error("Cannot open '" + path + "'");
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    Reader in(data, path);
+
+    auto magic = in.get<std::array<char, 8>>();
+    if(magic != MAGIC || in.get<std::uint32_t>() != ORDER_MARK || in.get<std::uint32_t>() != VERSION)
+        in.corrupt();
+
+    std::string error = in.getString();
+
+    struct Fn
+    {
+        std::string name_;
+        std::vector<std::uint32_t> lines_;
+    };
+
+    auto count = in.get<std::uint32_t>();
+    in.expect(count, sizeof(std::uint64_t) * 2);
+
+    std::vector<Fn> fns(count);
+    for(Fn& fn: fns)
+    {
+        fn.name_ = in.getString();
+
+        auto lines = in.get<std::uint64_t>();
+        in.expect(lines, sizeof(std::uint32_t));
+        fn.lines_.resize(lines);
+        for(auto& line: fn.lines_)
+        {
+            line = in.get<std::uint32_t>();
+        }
+    }
+
+    auto events = in.get<std::uint64_t>();
+    auto kept   = in.get<std::uint64_t>();
+    in.expect(kept, sizeof(TraceRecord));
+    if(kept > events)
+        in.corrupt();
+
+    // Function and line of a record, checked since the file may be anything
+    auto where = [&](std::uint32_t fn, std::uint32_t pc) {
+        if(fn >= fns.size())
+            in.corrupt();
+
+        std::string s = fns[fn].name_;
+        if(pc < fns[fn].lines_.size())
+            s += ":" + std::to_string(fns[fn].lines_[pc]);
+        return s;
+    };
+
+    os << events << " events, the last " << kept << " kept" << std::endl;
+    for(std::uint64_t n = events - kept; n < events; ++n)
+    {
+        auto r = in.get<TraceRecord>();
+
+        os << std::setw(10) << n << "  " << std::left << std::setw(7) << eventName(r.event_) << std::right << "  "
+           << where(r.fn_, r.pc_);
+
+        switch(r.event_)
+        {
+            case TraceEvent::Enter: os << " depth " << r.arg_; break;
+            case TraceEvent::Return: os << " depth " << r.arg_; break;
+            case TraceEvent::Call:
+                if(r.arg_ >= fns.size())
+                    in.corrupt();
+                os << " -> " << fns[r.arg_].name_;
+                break;
+            case TraceEvent::Statement: break;
+        }
+        os << std::endl;
+    }
+
+    if(!error.empty())
+        os << "Failed: " << error << std::endl;
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "bytecode.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+namespace Guu
+{
+
+enum class TraceEvent : std::uint8_t
+{
+    // arg_ is the call depth
+    Enter,
+    Return,
+
+    // At the call instruction, arg_ is the callee
+    Call,
+
+    // First instruction of a line, arg_ is the line
+    Statement,
+};
+
+// 16 bytes, fn_ indexes the functions of the Module and pc_ their code
+struct TraceRecord
+{
+    std::uint32_t fn_;
+    std::uint32_t pc_;
+    std::uint32_t arg_;
+    TraceEvent event_;
+};
+
+// Flight recorder of a VM. Events go into a ring that keeps the most recent
+// `capacity` of them: recording one is a store and an increment, with no
+// branch on whether the ring is full. Every VM has its own, so threads never
+// share one.
+//
+// A VM with a Tracer saves it when a run fails. The file holds the raw
+// records together with the names and line tables of the functions, which is
+// all decode() needs to print them.
+class Tracer
+{
+public:
+    static constexpr size_t DEFAULT_CAPACITY = size_t(1) << 16;
+
+    // Saved to `path`, `statements` adds Statement events. `capacity` is
+    // rounded up to a power of two.
+    explicit Tracer(std::string path, bool statements = false, size_t capacity = DEFAULT_CAPACITY);
+
+    Tracer(const Tracer&)            = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    bool statements() const
+    {
+        return statements_;
+    }
+
+    void record(TraceEvent event, std::uint32_t fn, std::uint32_t pc, std::uint32_t arg)
+    {
+        records_[next_++ & mask_] = TraceRecord{fn, pc, arg, event};
+    }
+
+    // Number of events recorded so far, including the ones overwritten
+    std::uint64_t events() const
+    {
+        return next_;
+    }
+
+    // Writes the records, oldest first, and `error` to the path
+    void save(const Bytecode::Module& module, const std::string& error) const;
+
+    // Prints a file written by save(), one event per line
+    static void decode(const std::string& path, std::ostream& os);
+
+private:
+    std::string path_;
+    bool statements_;
+
+    std::unique_ptr<TraceRecord[]> records_;
+    size_t mask_;
+    std::uint64_t next_ = 0;
+};
+
+}
@@ -0,0 +1,643 @@
+#include "transpiler.h"
+
+#include <cassert>
+#include <cstdio>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+
+namespace Guu
+{
+
+namespace
+{
+
+// Fills in Transpiler::loops_ and bounces_ from the calls TailCalls marked
+class TailCallers : public AST::Visitor
+{
+public:
+    using AST::Visitor::visit;
+
+    TailCallers(std::vector<bool>& loops, std::vector<bool>& bounces) : loops_(loops), bounces_(bounces)
+    {
+    }
+
+    void visit(AST::FnDef& fn) override
+    {
+        fn_ = &fn;
+        AST::Visitor::visit(fn);
+    }
+
+    void visit(AST::Call& call) override
+    {
+        if(call.tail_ && call.fnIndex_ == fn_->index_)
+        {
+            loops_[call.fnIndex_] = true;
+        }
+        else if(call.tail_)
+        {
+            bounces_[fn_->index_]   = true;
+            bounces_[call.fnIndex_] = true;
+        }
+
+        AST::Visitor::visit(call);
+    }
+
+private:
+    std::vector<bool>& loops_;
+    std::vector<bool>& bounces_;
+    const AST::FnDef* fn_ = nullptr;
+};
+
+}
+
+void Transpiler::emit(AST::Node& root)
+{
+    indent_ = 0;
+    currFn_ = nullptr;
+    fns_.clear();
+    loops_.clear();
+    bounces_.clear();
+
+    visit(root);
+}
+
+void Transpiler::visit(AST::Root& root)
+{
+    // Indexed like the Resolver did, so calls find their callee by Call::fnIndex_
+    fns_.resize(root.children_.size());
+    for(auto& c: root.children_)
+    {
+        auto& fn        = static_cast<const AST::FnDef&>(*c);
+        fns_[fn.index_] = &fn;
+    }
+
+    const AST::FnDef* main = nullptr;
+    for(const auto* fn: fns_)
+    {
+        if(fn->id_ == "main")
+            main = fn;
+    }
+
+    if(!main)
+        throw std::runtime_error("Function 'main' is not defined");
+
+    loops_.assign(fns_.size(), false);
+    bounces_.assign(fns_.size(), false);
+    TailCallers(loops_, bounces_).visit(root);
+
+    os_ << "// Generated by Guu --emit-cpp, do not edit\n\n";
+    os_ << "#include \"guu_runtime.h\"\n\n";
+    os_ << "#include <tuple>\n\n";
+
+    // Declared up front so functions can call each other in any order. One
+    // only ever tail called is reached through its body alone.
+    os_ << "namespace\n{\n\n";
+    for(const auto* fn: fns_)
+    {
+        os_ << "[[maybe_unused]] ";
+        signature(*fn);
+        os_ << ";\n";
+
+        if(bounces_[fn->index_])
+        {
+            signature(*fn, true);
+            os_ << ";\n";
+        }
+    }
+    os_ << "\n";
+
+    for(auto& c: root.children_)
+    {
+        visit(*c);
+    }
+    os_ << "}\n\n";
+
+    bool takesArgs = !main->params_.empty();
+
+    os_ << (takesArgs ? "int main(int argc, char** argv)\n" : "int main()\n");
+    os_ << "{\n";
+    os_ << "    std::ios::sync_with_stdio(false);\n\n";
+    os_ << "    try\n";
+    os_ << "    {\n";
+    os_ << "        return guu::exitCode(" << fnName(main->id_) << (takesArgs ? "(guu::args(argc, argv))" : "()")
+        << ");\n";
+    os_ << "    } catch(const std::exception& e)\n";
+    os_ << "    {\n";
+    os_ << "        std::cout.flush();\n";
+    os_ << "        std::cerr << \"ERROR: \" << e.what() << std::endl;\n";
+    os_ << "        return 1;\n";
+    os_ << "    }\n";
+    os_ << "}\n";
+}
+
+void Transpiler::visit(AST::FnDef& fn)
+{
+    currFn_ = &fn;
+
+    // Counted once for the body and whatever it tail calls
+    bool bounces = bounces_[fn.index_];
+    if(bounces)
+    {
+        std::string type = cppType(fn.resolvedType_);
+
+        signature(fn);
+        os_ << "\n{\n";
+        os_ << "    guu::Frame frame;\n";
+        os_ << "    return guu::Bounce<" << type << ">::run([&](guu::Bounce<" << type << ">& bounce) { return "
+            << bodyName(fn.id_) << "(";
+        for(const auto& p: fn.params_)
+        {
+            auto& param = static_cast<const AST::Variable&>(*p);
+            os_ << "std::move(" << varName(param.id_, param.slot_) << "), ";
+        }
+        os_ << "bounce); });\n";
+        os_ << "}\n\n";
+    }
+
+    signature(fn, bounces);
+    os_ << "\n{\n";
+
+    indent_ = INDENT_STEP;
+    if(!bounces)
+    {
+        indent();
+        os_ << "guu::Frame frame;\n";
+    }
+
+    if(loops_[fn.index_])
+        os_ << "tail_call:\n";
+
+    for(auto& st: fn.statements_)
+    {
+        statement(*st);
+    }
+
+    // Falling off the end returns the zero value of the return type
+    indent();
+    os_ << "return " << defaultValue(fn.resolvedType_) << ";\n";
+    os_ << "}\n\n";
+
+    indent_ = 0;
+    currFn_ = nullptr;
+}
+
+void Transpiler::visit(AST::Variable& var)
+{
+    // Guu allows unused variables, warnings about them would only break -Werror builds
+    indent();
+    os_ << "[[maybe_unused]] ";
+
+    std::string name = varName(var.id_, var.slot_);
+    if(var.init_)
+    {
+        os_ << cppType(var.resolvedType_) << " " << name << " = ";
+        visit(*var.init_);
+        os_ << ";\n";
+        return;
+    }
+
+    auto& typeId = static_cast<AST::TypeId&>(*var.typeId_);
+    if(typeId.sizeSlot_ != static_cast<std::uint32_t>(-1))
+    {
+        os_ << "auto " << name << " = " << cppType(var.resolvedType_) << "::sized("
+            << varName(typeId.arraySize_, typeId.sizeSlot_) << ", " << location(var) << ");\n";
+        return;
+    }
+
+    os_ << cppType(var.resolvedType_) << " " << name << " = " << defaultValue(var.resolvedType_) << ";\n";
+}
+
+void Transpiler::visit(AST::Return& ret)
+{
+    if(ret.value_->type_ == AST::NodeType::Call && static_cast<AST::Call&>(*ret.value_).tail_)
+    {
+        tailCall(static_cast<AST::Call&>(*ret.value_));
+        return;
+    }
+
+    indent();
+    os_ << "return ";
+    visit(*ret.value_);
+    os_ << ";\n";
+}
+
+void Transpiler::visit(AST::If& stmt)
+{
+    indent();
+    ifChain(stmt);
+}
+
+void Transpiler::ifChain(AST::If& stmt)
+{
+    os_ << "if(";
+    visit(*stmt.cond_);
+    os_ << ")\n";
+    block(stmt.then_);
+
+    if(stmt.else_.empty())
+        return;
+
+    indent();
+    if(stmt.else_.size() == 1 && stmt.else_[0]->type_ == AST::NodeType::If)
+    {
+        os_ << "else ";
+        ifChain(static_cast<AST::If&>(*stmt.else_[0]));
+        return;
+    }
+
+    os_ << "else\n";
+    block(stmt.else_);
+}
+
+void Transpiler::visit(AST::While& stmt)
+{
+    indent();
+    os_ << "while(";
+    visit(*stmt.cond_);
+    os_ << ")\n";
+    block(stmt.body_);
+}
+
+void Transpiler::visit(AST::ParallelFor& stmt)
+{
+    auto& var        = static_cast<AST::Variable&>(*stmt.var_);
+    std::string name = varName(var.id_, var.slot_);
+
+    // The bounds are evaluated once, in order
+    indent();
+    os_ << "for(std::int64_t " << name << " = ";
+    visit(*stmt.from_);
+    os_ << ", " << name << "_end = ";
+    visit(*stmt.to_);
+    os_ << "; " << name << " < " << name << "_end; ++" << name << ")\n";
+    block(stmt.body_);
+}
+
+void Transpiler::visit(AST::Assign& stmt)
+{
+    // C++17 evaluates the right side of `=` first, the same order as the interpreter
+    indent();
+    visit(*stmt.target_);
+    os_ << " = ";
+    visit(*stmt.value_);
+    os_ << ";\n";
+}
+
+void Transpiler::visit(AST::BinOp& op)
+{
+    const char* name = nullptr;
+    bool checked     = false;
+    bool strings     = types_.get(op.op1_->resolvedType_).kind_ == TypeKind::Str;
+
+    switch(op.opType_)
+    {
+        case TokenType::PLUS: name = strings ? "concat" : "add"; break;
+        case TokenType::MINUS: name = "sub"; break;
+        case TokenType::STAR: name = "mul"; break;
+        case TokenType::SLASH:
+            name    = "div";
+            checked = true;
+            break;
+        case TokenType::PERCENT:
+            name    = "mod";
+            checked = true;
+            break;
+        case TokenType::LT: name = "lt"; break;
+        case TokenType::GT: name = "gt"; break;
+        case TokenType::LE: name = "le"; break;
+        case TokenType::GE: name = "ge"; break;
+        case TokenType::EQEQ: name = "eq"; break;
+        case TokenType::NE: name = "ne"; break;
+
+        default: throw std::runtime_error("Unexpected binary operator on line " + std::to_string(op.line_));
+    }
+
+    // Operators of arrays may fail on arrays of different sizes
+    if(types_.isArray(op.resolvedType_))
+    {
+        os_ << "guu::" << name << "(guu::Pair<" << cppType(op.op1_->resolvedType_) << ", "
+            << cppType(op.op2_->resolvedType_) << ">{";
+        visit(*op.op1_);
+        os_ << ", ";
+        visit(*op.op2_);
+        os_ << "}, " << location(op) << ")";
+        return;
+    }
+
+    os_ << "guu::" << name << (strings ? "(guu::Strs{" : "(guu::Ints{");
+    visit(*op.op1_);
+    os_ << ", ";
+    visit(*op.op2_);
+    os_ << "}";
+    if(checked)
+        os_ << ", " << location(op);
+    os_ << ")";
+}
+
+void Transpiler::visit(AST::UnaryOp& op)
+{
+    os_ << "guu::neg(";
+    visit(*op.op_);
+    os_ << ")";
+}
+
+void Transpiler::visit(AST::Call& call)
+{
+    if(call.builtin_ != Builtin::None)
+    {
+        // The runtime names builtins like Guu does, two arguments come as a Pair
+        os_ << "guu::" << call.id_ << "(";
+        if(call.args_.size() > 1)
+        {
+            os_ << "guu::Pair<" << cppType(call.args_[0]->resolvedType_) << ", "
+                << cppType(call.args_[1]->resolvedType_) << ">{";
+        }
+        for(size_t i = 0; i < call.args_.size(); ++i)
+        {
+            if(i)
+                os_ << ", ";
+            visit(*call.args_[i]);
+        }
+        if(call.args_.size() > 1)
+            os_ << "}";
+
+        if(call.builtin_ == Builtin::Min || call.builtin_ == Builtin::Max || call.builtin_ == Builtin::Filter
+           || call.builtin_ == Builtin::Join)
+            os_ << ", " << location(call);
+        os_ << ")";
+        return;
+    }
+
+    const AST::FnDef& callee = *fns_[call.fnIndex_];
+
+    // The depth is checked before the arguments are evaluated, as in the interpreter
+    os_ << "(guu::checkDepth(" << location(call) << "), ";
+
+    if(call.args_.size() < 2)
+    {
+        os_ << fnName(callee.id_) << "(";
+        if(!call.args_.empty())
+            visit(*call.args_[0]);
+        os_ << "))";
+        return;
+    }
+
+    // Arguments of a plain call are evaluated in no particular order, those of a braced tuple left to right
+    os_ << "std::apply(" << fnName(callee.id_) << ", ";
+    arguments(callee, call);
+    os_ << "))";
+}
+
+void Transpiler::tailCall(AST::Call& call)
+{
+    const AST::FnDef& callee = *fns_[call.fnIndex_];
+
+    // The arguments become the parameters, and the body starts over
+    if(&callee == currFn_)
+    {
+        indent();
+        os_ << "{\n";
+        indent_ += INDENT_STEP;
+
+        if(!callee.params_.empty())
+        {
+            indent();
+            os_ << "std::tie(";
+            for(size_t i = 0; i < callee.params_.size(); ++i)
+            {
+                auto& param = static_cast<const AST::Variable&>(*callee.params_[i]);
+                os_ << (i ? ", " : "") << varName(param.id_, param.slot_);
+            }
+            os_ << ") = ";
+            arguments(callee, call);
+            os_ << ";\n";
+        }
+
+        indent();
+        os_ << "goto tail_call;\n";
+
+        indent_ -= INDENT_STEP;
+        indent();
+        os_ << "}\n";
+        return;
+    }
+
+    // The arguments are evaluated now, the callee runs once this function returned to the trampoline
+    indent();
+    os_ << "return bounce.to([args = ";
+    arguments(callee, call);
+    os_ << "](guu::Bounce<" << cppType(currFn_->resolvedType_) << ">& next) mutable { return std::apply("
+        << bodyName(callee.id_) << ", std::tuple_cat(std::move(args), std::tie(next))); });\n";
+}
+
+void Transpiler::arguments(const AST::FnDef& callee, AST::Call& call)
+{
+    os_ << "std::tuple<";
+    for(size_t i = 0; i < callee.params_.size(); ++i)
+    {
+        os_ << (i ? ", " : "") << cppType(callee.params_[i]->resolvedType_);
+    }
+    os_ << ">{";
+    for(size_t i = 0; i < call.args_.size(); ++i)
+    {
+        if(i)
+            os_ << ", ";
+        visit(*call.args_[i]);
+    }
+    os_ << "}";
+}
+
+void Transpiler::visit(AST::Spawn& spawn)
+{
+    auto& call               = static_cast<AST::Call&>(*spawn.call_);
+    const AST::FnDef& callee = *fns_[call.fnIndex_];
+
+    // The arguments are evaluated now, left to right, the call when the task is joined
+    os_ << cppType(spawn.resolvedType_) << "([args = ";
+    arguments(callee, call);
+    os_ << "] { return std::apply(" << fnName(callee.id_) << ", args); }, " << location(spawn) << ")";
+}
+
+void Transpiler::visit(AST::VarRef& ref)
+{
+    os_ << varName(ref.id_, ref.slot_);
+}
+
+void Transpiler::visit(AST::Index& idx)
+{
+    os_ << "(";
+    visit(*idx.array_);
+    os_ << ").at(";
+    visit(*idx.index_);
+    os_ << ", " << location(idx) << ")";
+}
+
+void Transpiler::visit(AST::Const& c)
+{
+    if(!c.isNum())
+    {
+        os_ << "guu::Str(" << quote(c.str_) << ", " << c.str_.size() << ")";
+    }
+    else if(c.num_ == std::numeric_limits<std::int64_t>::min())
+    {
+        // Has no literal, 9223372036854775808 does not fit
+        os_ << "std::numeric_limits<std::int64_t>::min()";
+    }
+    else
+    {
+        os_ << "std::int64_t{" << c.num_ << "}";
+    }
+}
+
+void Transpiler::visit(AST::ConstArray& arr)
+{
+    os_ << cppType(arr.resolvedType_) << "{";
+    for(size_t i = 0; i < arr.elements_.size(); ++i)
+    {
+        if(i)
+            os_ << ", ";
+        visit(*arr.elements_[i]);
+    }
+    os_ << "}";
+}
+
+void Transpiler::signature(const AST::FnDef& fn, bool body)
+{
+    std::string type = cppType(fn.resolvedType_);
+
+    os_ << type << " " << (body ? bodyName(fn.id_) : fnName(fn.id_)) << "(";
+    for(size_t i = 0; i < fn.params_.size(); ++i)
+    {
+        auto& param = static_cast<const AST::Variable&>(*fn.params_[i]);
+        os_ << (i ? ", " : "") << "[[maybe_unused]] " << cppType(param.resolvedType_) << " "
+            << varName(param.id_, param.slot_);
+    }
+    if(body)
+        os_ << (fn.params_.empty() ? "" : ", ") << "[[maybe_unused]] guu::Bounce<" << type << ">& bounce";
+    os_ << ")";
+}
+
+void Transpiler::block(AST::NodeVec& stmts)
+{
+    indent();
+    os_ << "{\n";
+
+    indent_ += INDENT_STEP;
+    for(auto& st: stmts)
+    {
+        statement(*st);
+    }
+    indent_ -= INDENT_STEP;
+
+    indent();
+    os_ << "}\n";
+}
+
+void Transpiler::statement(AST::Node& st)
+{
+    // Calls are the only expressions that stand as statements
+    if(st.type_ == AST::NodeType::Call)
+    {
+        indent();
+        visit(st);
+        os_ << ";\n";
+        return;
+    }
+
+    visit(st);
+}
+
+void Transpiler::indent()
+{
+    os_ << std::string(static_cast<size_t>(indent_), ' ');
+}
+
+std::string Transpiler::cppType(TypeHandle type) const
+{
+    const Type& t = types_.get(type);
+    switch(t.kind_)
+    {
+        case TypeKind::Int: return "std::int64_t";
+        case TypeKind::Str: return "guu::Str";
+        case TypeKind::Array: return "guu::Array<" + cppType(t.elem_) + ">";
+        case TypeKind::Task: return "guu::Task<" + cppType(t.elem_) + ">";
+    }
+
+    return "void";
+}
+
+std::string Transpiler::defaultValue(TypeHandle type) const
+{
+    const Type& t = types_.get(type);
+    switch(t.kind_)
+    {
+        case TypeKind::Int: return "std::int64_t{0}";
+        case TypeKind::Str: return "guu::Str()";
+        case TypeKind::Array:
+            if(t.size_ == Type::DYNAMIC_SIZE)
+                return cppType(type) + "()";
+
+            return cppType(type) + "(std::int64_t{" + std::to_string(t.size_) + "})";
+
+        // Only ever initialized by a spawn
+        case TypeKind::Task: break;
+    }
+
+    return "";
+}
+
+std::string Transpiler::location(const AST::Node& at) const
+{
+    assert(currFn_);
+    return quote(currFn_->id_) + ", " + std::to_string(at.line_);
+}
+
+// Suffixes keep Guu names apart from C++ keywords and from each other
+std::string Transpiler::fnName(const std::string& id)
+{
+    return id + "_fn";
+}
+
+std::string Transpiler::bodyName(const std::string& id)
+{
+    return id + "_body";
+}
+
+// The slot tells apart a variable from the one it shadows, `int x = x + 1;` in a nested block
+std::string Transpiler::varName(const std::string& id, AST::Slot slot)
+{
+    return id + "_" + std::to_string(slot);
+}
+
+std::string Transpiler::quote(const std::string& s)
+{
+    std::string result = "\"";
+    for(char c: s)
+    {
+        switch(c)
+        {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\t': result += "\\t"; break;
+            case '\r': result += "\\r"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20 || c == 0x7f)
+                {
+                    // Always three octal digits, so a following digit is not taken into the escape
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\%03o", static_cast<unsigned char>(c));
+                    result += buf;
+                }
+                else
+                {
+                    result += c;
+                }
+        }
+    }
+
+    return result + "\"";
+}
+
+}
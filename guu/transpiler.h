@@ -0,0 +1,98 @@
+#pragma once
+
+#include "ast.h"
+#include "types.h"
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace Guu
+{
+
+// Writes a resolved AST as one standalone C++17 translation unit for ahead of
+// time compilation. Every FnDef becomes a C++ function over native types: int
+// is std::int64_t, str and arrays come from aot/guu_runtime.h, which the
+// output includes. A generated main() calls the Guu main and exits with its
+// result, or prints "ERROR: ..." and exits with 1 like the interpreter.
+//
+// Operands and arguments keep the interpreter's left to right evaluation
+// order, so a program prints and fails exactly as it does under Guu. Like the
+// interpreter, the output runs parallel loops in order and tasks when joined.
+//
+// Tail calls, see TailCalls, take no stack either: a function calling itself
+// starts over with the new arguments, and functions tail calling one another
+// return to a guu::Bounce trampoline that runs the callee next.
+class Transpiler : public AST::Visitor
+{
+    static constexpr int INDENT_STEP = 4;
+
+public:
+    using AST::Visitor::visit;
+
+    Transpiler(const TypeTable& types, std::ostream& os) : types_(types), os_(os)
+    {
+    }
+
+    void emit(AST::Node& root);
+
+private:
+    void visit(AST::Root& root) override;
+    void visit(AST::FnDef& fn) override;
+    void visit(AST::Variable& var) override;
+    void visit(AST::Return& ret) override;
+    void visit(AST::If& stmt) override;
+    void visit(AST::While& stmt) override;
+    void visit(AST::ParallelFor& stmt) override;
+    void visit(AST::Assign& stmt) override;
+
+    // Expressions are written inline, without indentation or a semicolon
+    void visit(AST::BinOp& op) override;
+    void visit(AST::UnaryOp& op) override;
+    void visit(AST::Call& call) override;
+    void visit(AST::Spawn& spawn) override;
+    void visit(AST::VarRef& ref) override;
+    void visit(AST::Index& idx) override;
+    void visit(AST::Const& c) override;
+    void visit(AST::ConstArray& arr) override;
+
+private:
+    // Of the function itself, or of its body run by a trampoline, see bounces_
+    void signature(const AST::FnDef& fn, bool body = false);
+
+    void tailCall(AST::Call& call);
+
+    // The arguments of `call` as a std::tuple of the parameter types, evaluated left to right
+    void arguments(const AST::FnDef& callee, AST::Call& call);
+
+    // Writes `if(...) {...} else if(...) ...` starting at the current column
+    void ifChain(AST::If& stmt);
+    void block(AST::NodeVec& stmts);
+    void statement(AST::Node& st);
+    void indent();
+
+    std::string cppType(TypeHandle type) const;
+    std::string defaultValue(TypeHandle type) const;
+    std::string location(const AST::Node& at) const;
+
+    static std::string fnName(const std::string& id);
+    static std::string bodyName(const std::string& id);
+    static std::string varName(const std::string& id, AST::Slot slot);
+    static std::string quote(const std::string& s);
+
+private:
+    const TypeTable& types_;
+    std::ostream& os_;
+
+    int indent_ = 0;
+    const AST::FnDef* currFn_ = nullptr;
+    std::vector<const AST::FnDef*> fns_;
+
+    // By function index: those calling themselves in tail position start over
+    // at a label, those in tail calls to or from others are split into a
+    // trampoline and a body
+    std::vector<bool> loops_;
+    std::vector<bool> bounces_;
+};
+
+}
@@ -0,0 +1,60 @@
+#include "types.h"
+
+namespace Guu
+{
+
+TypeTable::TypeTable()
+{
+    int_ = intern(Type{TypeKind::Int, INVALID_TYPE, 0});
+    str_ = intern(Type{TypeKind::Str, INVALID_TYPE, 0});
+}
+
+TypeHandle TypeTable::arrayOf(TypeHandle elem, std::int64_t size)
+{
+    return intern(Type{TypeKind::Array, elem, size});
+}
+
+bool TypeTable::isAssignable(TypeHandle to, TypeHandle from) const
+{
+    if(to == from)
+        return true;
+
+    const Type& t = get(to);
+    const Type& f = get(from);
+
+    // `str[N]` accepts arrays of any length
+    return t.kind_ == TypeKind::Array && f.kind_ == TypeKind::Array && t.size_ == Type::DYNAMIC_SIZE
+        && isAssignable(t.elem_, f.elem_);
+}
+
+std::string TypeTable::name(TypeHandle h) const
+{
+    if(h == INVALID_TYPE)
+        return "<invalid>";
+
+    const Type& t = get(h);
+    switch(t.kind_)
+    {
+        case TypeKind::Int: return "int";
+        case TypeKind::Str: return "str";
+        case TypeKind::Array:
+            return name(t.elem_) + "[" + (t.size_ == Type::DYNAMIC_SIZE ? "N" : std::to_string(t.size_)) + "]";
+        case TypeKind::Task: return "task<" + name(t.elem_) + ">";
+    }
+
+    return "<unknown>";
+}
+
+TypeHandle TypeTable::intern(Type t)
+{
+    Key key{t.kind_, t.elem_, t.size_};
+    if(auto* h = index_.find(key))
+        return *h;
+
+    auto h = static_cast<TypeHandle>(types_.size());
+    types_.push_back(t);
+    index_.insert(key, h);
+    return h;
+}
+
+}
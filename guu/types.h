@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../util/flat_map.h"
+
+namespace Guu
+{
+
+using TypeHandle = std::uint32_t;
+
+constexpr TypeHandle INVALID_TYPE = static_cast<TypeHandle>(-1);
+
+enum class TypeKind : std::uint8_t
+{
+    Int,
+    Str,
+    Array,
+    Task,
+};
+
+struct Type
+{
+    // Size of arrays declared with a symbolic length, e.g. `args: str[N]`
+    static constexpr std::int64_t DYNAMIC_SIZE = -1;
+
+    TypeKind kind_;
+    TypeHandle elem_;
+    std::int64_t size_;
+};
+
+// Interns every distinct type once, so types compare by handle
+class TypeTable
+{
+public:
+    TypeTable();
+
+    TypeHandle intType() const
+    {
+        return int_;
+    }
+
+    TypeHandle strType() const
+    {
+        return str_;
+    }
+
+    TypeHandle arrayOf(TypeHandle elem, std::int64_t size);
+
+    // Array of `elem` whose size is not known until runtime
+    TypeHandle arrayOf(TypeHandle elem)
+    {
+        return arrayOf(elem, Type::DYNAMIC_SIZE);
+    }
+
+    // Pending result of a spawned call returning `result`
+    TypeHandle taskOf(TypeHandle result)
+    {
+        return intern(Type{TypeKind::Task, result, 0});
+    }
+
+    const Type& get(TypeHandle h) const
+    {
+        return types_[h];
+    }
+
+    bool isArray(TypeHandle h) const
+    {
+        return get(h).kind_ == TypeKind::Array;
+    }
+
+    bool isTask(TypeHandle h) const
+    {
+        return get(h).kind_ == TypeKind::Task;
+    }
+
+    // True if a value of type `from` can be stored into a slot of type `to`
+    bool isAssignable(TypeHandle to, TypeHandle from) const;
+
+    std::string name(TypeHandle h) const;
+
+private:
+    TypeHandle intern(Type t);
+
+    struct Key
+    {
+        TypeKind kind_;
+        TypeHandle elem_;
+        std::int64_t size_;
+
+        bool operator==(const Key& o) const
+        {
+            return kind_ == o.kind_ && elem_ == o.elem_ && size_ == o.size_;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const
+        {
+            return (static_cast<size_t>(k.kind_) * 31 + k.elem_) * 1000003u + static_cast<size_t>(k.size_);
+        }
+    };
+
+private:
+    std::vector<Type> types_;
+    util::FlatMap<Key, TypeHandle, KeyHash> index_;
+    TypeHandle int_;
+    TypeHandle str_;
+};
+
+}
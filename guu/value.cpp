@@ -0,0 +1,378 @@
+#include "value.h"
+
+#include <iostream>
+#include <mutex>
+#include <new>
+
+namespace Guu
+{
+
+namespace
+{
+
+// Concatenations shorter than this are copied into a flat string, a rope node
+// and its leaves would take more memory than the characters
+constexpr size_t MIN_ROPE_SIZE = 64;
+
+std::uint64_t fnv1a(std::string_view s)
+{
+    std::uint64_t h = 14695981039346656037ull;
+    for(unsigned char c: s)
+    {
+        h = (h ^ c) * 1099511628211ull;
+    }
+
+    // 0 means "not computed yet"
+    return h ? h : 1;
+}
+
+template <typename T, typename... Args>
+T* create(Heap* region, Args&&... args)
+{
+    if(!region)
+        return new T(std::forward<Args>(args)...);
+
+    T* obj       = new(region->allocateObject(sizeof(T))) T(std::forward<Args>(args)...);
+    obj->region_ = true;
+    return obj;
+}
+
+}
+
+void destroy(Object* obj)
+{
+    // The region frees it when it is left
+    if(obj->region_)
+        return;
+
+    if(obj->kind_ == Object::Kind::Array)
+    {
+        delete static_cast<Array*>(obj);
+        return;
+    }
+
+    if(obj->kind_ == Object::Kind::Task)
+    {
+        delete static_cast<Task*>(obj);
+        return;
+    }
+
+    // A rope built in a loop is as deep as the loop ran, so its nodes are
+    // released from a worklist rather than by recursion
+    std::vector<String*> pending;
+    for(auto* s = static_cast<String*>(obj);;)
+    {
+        for(String* half: {s->left_.load(std::memory_order_relaxed), s->right_})
+        {
+            if(half && half->dropRef())
+                pending.push_back(half);
+        }
+        delete s;
+
+        if(pending.empty())
+            return;
+
+        s = pending.back();
+        pending.pop_back();
+    }
+}
+
+void finalize(Object* obj)
+{
+    assert(obj->region_ && obj->refs() == 0 && "Nothing may refer to a region that is left");
+    assert(obj->kind_ != Object::Kind::Task && "Tasks are never allocated in regions");
+
+    if(obj->kind_ == Object::Kind::Array)
+    {
+        static_cast<Array*>(obj)->~Array();
+        return;
+    }
+
+    auto* s = static_cast<String*>(obj);
+    for(String* half: {s->left_.load(std::memory_order_relaxed), s->right_})
+    {
+        if(half && half->dropRef())
+            destroy(half);
+    }
+    s->~String();
+}
+
+void String::flatten() const
+{
+    // Flattening is rare enough for one lock, which also keeps the halves other
+    // nodes share from being flattened while they are walked. Without threads
+    // sharing objects nobody else can see this rope.
+    static std::mutex mutex;
+    std::unique_lock lock(mutex, std::defer_lock);
+    if(Object::concurrent())
+        lock.lock();
+
+    String* left = left_.load(std::memory_order_relaxed);
+    if(!left)
+        return;
+
+    std::string result;
+    result.reserve(size_);
+
+    // Left to right with an explicit stack for the same reason as destroy()
+    std::vector<const String*> stack{this};
+    while(!stack.empty())
+    {
+        const String* s = stack.back();
+        stack.pop_back();
+
+        if(String* l = s->left_.load(std::memory_order_relaxed))
+        {
+            stack.push_back(s->right_);
+            stack.push_back(l);
+        }
+        else
+        {
+            result += s->flat_;
+        }
+    }
+
+    flat_ = std::move(result);
+
+    // Readers that see no left half see the flat string
+    left_.store(nullptr, std::memory_order_release);
+
+    // The halves are no longer needed by this node
+    for(String* h: {left, std::exchange(right_, nullptr)})
+    {
+        if(h->dropRef())
+            destroy(h);
+    }
+}
+
+std::uint64_t String::hash() const
+{
+    // Threads racing here compute the same value
+    std::uint64_t h = hash_.load(std::memory_order_relaxed);
+    if(!h)
+    {
+        h = fnv1a(view());
+        hash_.store(h, std::memory_order_relaxed);
+    }
+
+    return h;
+}
+
+std::uint64_t Value::strHash() const
+{
+    return tag_ == Tag::SmallStr ? fnv1a(asStr()) : static_cast<String*>(obj_)->hash();
+}
+
+StringRef Value::stringRef(Heap* region) const
+{
+    if(tag_ == Tag::SmallStr)
+        return StringRef(create<String>(region, std::string(asStr())));
+
+    return StringRef(static_cast<String*>(obj_));
+}
+
+Value concat(const Value& a, const Value& b, Heap* region)
+{
+    size_t size = a.strSize() + b.strSize();
+    if(size < MIN_ROPE_SIZE)
+    {
+        std::string result;
+        result.reserve(size);
+        result += a.asStr();
+        result += b.asStr();
+        if(!region || size <= Value::SMALL_STR)
+            return Value(std::move(result));
+
+        return StringRef(create<String>(region, std::move(result)));
+    }
+
+    return StringRef(create<String>(region, a.stringRef(region).release(), b.stringRef(region).release()));
+}
+
+ArrayRef makeArray(ElemKind elemKind, Heap* region)
+{
+    return ArrayRef(create<Array>(region, elemKind, region));
+}
+
+void Array::assign(const Value* first, const Value* last)
+{
+    if(elemKind_ == ElemKind::Str)
+    {
+        strs_.assign(first, last);
+        return;
+    }
+
+    ints_.resize(static_cast<size_t>(last - first));
+    for(size_t i = 0; first != last; ++first, ++i)
+    {
+        ints_[i] = first->asInt();
+    }
+}
+
+Value defaultValue(ElemKind kind)
+{
+    return kind == ElemKind::Int ? Value(std::int64_t{0}) : Value(std::string());
+}
+
+ElemKind elemKind(const TypeTable& types, TypeHandle array)
+{
+    return types.get(types.get(array).elem_).kind_ == TypeKind::Int ? ElemKind::Int : ElemKind::Str;
+}
+
+ArrayRef newArray(std::int64_t size, ElemKind kind, Heap* region)
+{
+    if(size < 0)
+        throw RuntimeError("Negative array size " + std::to_string(size));
+    if(size > MAX_ARRAY_SIZE)
+        throw RuntimeError("Array size " + std::to_string(size) + " is too large");
+
+    auto result = makeArray(kind, region);
+    try
+    {
+        if(kind == ElemKind::Int)
+        {
+            result->ints_.assign(static_cast<size_t>(size), 0);
+        }
+        else
+        {
+            result->strs_.assign(static_cast<size_t>(size), defaultValue(kind));
+        }
+    } catch(const std::bad_alloc&)
+    {
+        throw RuntimeError("Not enough memory for an array of size " + std::to_string(size));
+    }
+    return result;
+}
+
+Value defaultValue(const TypeTable& types, TypeHandle type)
+{
+    const Type& t = types.get(type);
+    switch(t.kind_)
+    {
+        case TypeKind::Int: return std::int64_t{0};
+        case TypeKind::Str: return std::string();
+        case TypeKind::Array: {
+            auto result = makeArray(elemKind(types, type));
+            if(t.size_ == Type::DYNAMIC_SIZE)
+                return result;
+
+            if(result->elemKind_ == ElemKind::Int)
+            {
+                result->ints_.assign(static_cast<size_t>(t.size_), 0);
+            }
+            else
+            {
+                result->strs_.assign(static_cast<size_t>(t.size_), defaultValue(types, t.elem_));
+            }
+            return result;
+        }
+
+        // Only ever initialized by a spawn
+        case TypeKind::Task: break;
+    }
+
+    return std::int64_t{0};
+}
+
+Value callBuiltin(Builtin builtin, const Value* args, std::ostream& out, Heap* region)
+{
+    switch(builtin)
+    {
+        case Builtin::Print:
+            printValue(out, args[0]);
+            out << '\n';
+            return std::int64_t{0};
+
+        case Builtin::Len:
+            if(args[0].isStr())
+                return static_cast<std::int64_t>(args[0].strSize());
+
+            return static_cast<std::int64_t>(args[0].asArray().size());
+
+        case Builtin::Sum: {
+            const auto& a = args[0].asArray();
+            return Kernels::sum(a.ints_.data(), a.size());
+        }
+
+        case Builtin::Min:
+        case Builtin::Max: {
+            const auto& a = args[0].asArray();
+            if(a.size() == 0)
+                throw RuntimeError(std::string(builtin == Builtin::Min ? "min" : "max") + " of an empty array");
+
+            return builtin == Builtin::Min ? Kernels::min(a.ints_.data(), a.size())
+                                           : Kernels::max(a.ints_.data(), a.size());
+        }
+
+        case Builtin::Find: {
+            const auto& a = args[0].asArray();
+            return Kernels::find(a.ints_.data(), a.size(), args[1].asInt());
+        }
+
+        case Builtin::Filter: {
+            const auto& a    = args[0].asArray();
+            const auto& mask = args[1].asArray();
+            if(mask.size() != a.size())
+                throw RuntimeError("Arrays of different sizes " + std::to_string(a.size()) + " and "
+                                   + std::to_string(mask.size()));
+
+            auto result = makeArray(ElemKind::Int, region);
+            result->ints_.resize(a.size());
+            result->ints_.resize(Kernels::filter(result->ints_.data(), a.ints_.data(), mask.ints_.data(), a.size()));
+            return result;
+        }
+
+        case Builtin::Copy: {
+            const auto& a = args[0].asArray();
+
+            auto result = makeArray(a.elemKind_, region);
+            if(a.elemKind_ == ElemKind::Str)
+            {
+                result->strs_ = a.strs_;
+            }
+            else
+            {
+                result->ints_.resize(a.size());
+                Kernels::copy(result->ints_.data(), a.ints_.data(), a.size());
+            }
+            return result;
+        }
+
+        // The engines wait for the task to be done first
+        case Builtin::Join: return args[0].asTask().result();
+
+        // Only the VM saves images
+        case Builtin::Checkpoint: return std::int64_t{0};
+
+        case Builtin::None: break;
+    }
+
+    throw RuntimeError("Unknown builtin");
+}
+
+void printValue(std::ostream& os, const Value& v)
+{
+    switch(v.tag())
+    {
+        case Value::Tag::Int: os << v.asInt(); break;
+        case Value::Tag::SmallStr:
+        case Value::Tag::Str: os << v.asStr(); break;
+        case Value::Tag::Array: {
+            const auto& arr = v.asArray();
+
+            os << "[";
+            for(size_t i = 0; i < arr.size(); ++i)
+            {
+                if(i)
+                    os << ", ";
+
+                printValue(os, arr.get(i));
+            }
+            os << "]";
+            break;
+        }
+        case Value::Tag::Task: os << "<task>"; break;
+    }
+}
+
+}
@@ -0,0 +1,582 @@
+#pragma once
+
+#include "types.h"
+#include "builtins.h"
+#include "heap.h"
+#include "kernels.h"
+#include "stats.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Guu
+{
+
+class Value;
+
+// Element type of an array, also the operand of NewArray
+enum class ElemKind : std::uint8_t
+{
+    Int,
+    Str,
+};
+
+// Heap part of strings, arrays and tasks. Values share objects through an
+// intrusive reference count, so copying a Value never copies the payload.
+//
+// Counting is atomic, but only pays for read-modify-write instructions once
+// worker threads may share objects, see setConcurrent(). VMs on threads of
+// their own share no objects, so they never need it.
+struct Object
+{
+    enum class Kind : std::uint8_t
+    {
+        Str,
+        Array,
+        Task,
+    };
+
+    explicit Object(Kind kind) : kind_(kind)
+    {
+        GUU_STATS_COUNT(objects_);
+    }
+
+    // Must be called before the first thread that shares objects starts
+    static void setConcurrent()
+    {
+        concurrent_.store(true, std::memory_order_relaxed);
+    }
+
+    static bool concurrent()
+    {
+        return concurrent_.load(std::memory_order_relaxed);
+    }
+
+    void addRef()
+    {
+        if(concurrent())
+        {
+            refs_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            refs_.store(refs_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns true if that was the last reference
+    bool dropRef()
+    {
+        if(concurrent())
+            return refs_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+
+        auto refs = refs_.load(std::memory_order_relaxed) - 1;
+        refs_.store(refs, std::memory_order_relaxed);
+        return refs == 0;
+    }
+
+    std::uint32_t refs() const
+    {
+        return refs_.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<std::uint32_t> refs_{0};
+    Kind kind_;
+
+    // Lives in a Heap region, which finalizes it instead of the last reference
+    bool region_ = false;
+
+private:
+    static inline std::atomic<bool> concurrent_{false};
+};
+
+// Strings are immutable, so sharing one is indistinguishable from copying it.
+// Strings of up to 8 bytes live inside a Value instead, see Value::SMALL_STR.
+//
+// A long concatenation is a rope node holding both halves. It is flattened into
+// one buffer when its characters are first read, so building a string in a loop
+// copies it once instead of on every step. Length is known without flattening.
+struct String : Object
+{
+    explicit String(std::string str) : Object(Kind::Str), size_(str.size()), flat_(std::move(str))
+    {
+    }
+
+    // Takes over one reference to each half
+    String(String* left, String* right)
+        : Object(Kind::Str), size_(left->size_ + right->size_), left_(left), right_(right)
+    {
+    }
+
+    std::string_view view() const
+    {
+        if(left_.load(std::memory_order_acquire))
+            flatten();
+
+        return flat_;
+    }
+
+    // Computed on first use and cached
+    std::uint64_t hash() const;
+
+    size_t size_;
+
+private:
+    friend void destroy(Object* obj);
+    friend void finalize(Object* obj);
+
+    // Threads may read the same rope, the first one flattens it under a lock
+    void flatten() const;
+
+    mutable std::atomic<std::uint64_t> hash_{0};
+    mutable std::string flat_;
+
+    // Halves of a rope node, null once flattened
+    mutable std::atomic<String*> left_{nullptr};
+    mutable String* right_ = nullptr;
+};
+
+// Arrays are reference types: assigning one shares the elements. Int arrays
+// keep raw ints in aligned contiguous storage the kernels work on, arrays of
+// strings (or of arrays) hold Values in strs_.
+struct Array : Object
+{
+    using Ints = std::vector<std::int64_t, RegionAllocator<std::int64_t, Kernels::ALIGNMENT>>;
+    using Strs = std::vector<Value, RegionAllocator<Value>>;
+
+    // The elements of an array in a region live in the same region
+    explicit Array(ElemKind elemKind, Heap* region = nullptr)
+        : Object(Kind::Array), elemKind_(elemKind), ints_(region), strs_(region)
+    {
+    }
+
+    size_t size() const
+    {
+        return elemKind_ == ElemKind::Int ? ints_.size() : strs_.size();
+    }
+
+    // `i` must be in bounds, `v` of the element kind
+    inline Value get(size_t i) const;
+    inline void set(size_t i, const Value& v);
+
+    void assign(const Value* first, const Value* last);
+
+    ElemKind elemKind_;
+    Ints ints_;
+    Strs strs_;
+};
+
+void destroy(Object* obj);
+
+// Runs the destructor of a region object without freeing its memory, see Heap
+void finalize(Object* obj);
+
+// Owning pointer to an Object, the typed counterpart of a Value
+template <typename T>
+class Ref
+{
+public:
+    Ref() = default;
+
+    explicit Ref(T* p) : p_(p)
+    {
+        if(p_)
+            p_->addRef();
+    }
+
+    Ref(const Ref& o) : Ref(o.p_)
+    {
+    }
+
+    Ref(Ref&& o) noexcept : p_(std::exchange(o.p_, nullptr))
+    {
+    }
+
+    Ref& operator=(Ref o) noexcept
+    {
+        std::swap(p_, o.p_);
+        return *this;
+    }
+
+    ~Ref()
+    {
+        if(p_ && p_->dropRef())
+            destroy(p_);
+    }
+
+    T* get() const
+    {
+        return p_;
+    }
+
+    T* operator->() const
+    {
+        return p_;
+    }
+
+    T& operator*() const
+    {
+        return *p_;
+    }
+
+    explicit operator bool() const
+    {
+        return p_ != nullptr;
+    }
+
+    // Hands the reference over to the caller
+    T* release()
+    {
+        return std::exchange(p_, nullptr);
+    }
+
+private:
+    T* p_ = nullptr;
+};
+
+using ArrayRef  = Ref<Array>;
+using StringRef = Ref<String>;
+
+// Objects are allocated in `region` if given, on the global heap otherwise
+ArrayRef makeArray(ElemKind elemKind, Heap* region = nullptr);
+
+struct Task;
+using TaskRef = Ref<Task>;
+
+// 16 bytes: a 64-bit payload and a tag. Ints and strings of up to 8 bytes are
+// stored inline and never touch the heap; longer strings, arrays and tasks
+// hold a counted reference to an Object.
+class Value
+{
+public:
+    // The tags from Str on refer to an Object
+    enum class Tag : std::uint8_t
+    {
+        Int,
+        SmallStr,
+        Str,
+        Array,
+        Task,
+    };
+
+    // Strings that fit are always stored inline, so a String object is never
+    // equal to a small string. Small strings are padded with zero bytes, which
+    // is why one containing a zero byte stays on the heap.
+    static constexpr size_t SMALL_STR = 8;
+
+    Value() noexcept : i_(0), tag_(Tag::Int)
+    {
+    }
+
+    Value(std::int64_t i) noexcept : i_(i), tag_(Tag::Int)
+    {
+    }
+
+    Value(std::string s)
+    {
+        if(s.size() <= SMALL_STR && s.find('\0') == std::string::npos)
+        {
+            i_   = 0;
+            tag_ = Tag::SmallStr;
+            std::memcpy(small_, s.data(), s.size());
+            return;
+        }
+
+        obj_ = new String(std::move(s));
+        tag_ = Tag::Str;
+        obj_->addRef();
+    }
+
+    Value(StringRef str) : obj_(str.release()), tag_(Tag::Str)
+    {
+        assert(obj_);
+    }
+
+    Value(ArrayRef arr) : obj_(arr.release()), tag_(Tag::Array)
+    {
+        assert(obj_);
+    }
+
+    inline Value(TaskRef task);
+
+    Value(const Value& o) noexcept : i_(o.i_), tag_(o.tag_)
+    {
+        if(isObject())
+            obj_->addRef();
+    }
+
+    Value(Value&& o) noexcept : i_(o.i_), tag_(o.tag_)
+    {
+        o.tag_ = Tag::Int;
+    }
+
+    Value& operator=(const Value& o) noexcept
+    {
+        if(o.isObject())
+            o.obj_->addRef();
+
+        release();
+        i_   = o.i_;
+        tag_ = o.tag_;
+        return *this;
+    }
+
+    Value& operator=(Value&& o) noexcept
+    {
+        if(this != &o)
+        {
+            release();
+            i_     = o.i_;
+            tag_   = o.tag_;
+            o.tag_ = Tag::Int;
+        }
+        return *this;
+    }
+
+    // Storing an int only touches the heap if the old value was the last reference to an object
+    Value& operator=(std::int64_t i) noexcept
+    {
+        release();
+        i_   = i;
+        tag_ = Tag::Int;
+        return *this;
+    }
+
+    ~Value()
+    {
+        release();
+    }
+
+    Tag tag() const
+    {
+        return tag_;
+    }
+
+    bool isInt() const
+    {
+        return tag_ == Tag::Int;
+    }
+
+    bool isStr() const
+    {
+        return tag_ == Tag::Str || tag_ == Tag::SmallStr;
+    }
+
+    bool isArray() const
+    {
+        return tag_ == Tag::Array;
+    }
+
+    bool isTask() const
+    {
+        return tag_ == Tag::Task;
+    }
+
+    std::int64_t asInt() const
+    {
+        assert(isInt());
+        return i_;
+    }
+
+    // Flattens a rope, valid while the Value holds the same string
+    std::string_view asStr() const
+    {
+        assert(isStr());
+        if(tag_ == Tag::SmallStr)
+            return std::string_view(small_, smallSize());
+
+        return static_cast<String*>(obj_)->view();
+    }
+
+    size_t strSize() const
+    {
+        assert(isStr());
+        return tag_ == Tag::SmallStr ? smallSize() : static_cast<String*>(obj_)->size_;
+    }
+
+    std::uint64_t strHash() const;
+
+    // Both must be strings. Small strings compare as one int, others by length and cached hash first.
+    bool strEquals(const Value& o) const
+    {
+        if(tag_ == Tag::SmallStr || o.tag_ == Tag::SmallStr)
+            return tag_ == o.tag_ && i_ == o.i_;
+
+        auto* a = static_cast<String*>(obj_);
+        auto* b = static_cast<String*>(o.obj_);
+        return a == b || (a->size_ == b->size_ && a->hash() == b->hash() && a->view() == b->view());
+    }
+
+    // The string as a String object, small strings are copied to the heap or to `region`
+    StringRef stringRef(Heap* region = nullptr) const;
+
+    Array& asArray() const
+    {
+        assert(isArray());
+        return *static_cast<Array*>(obj_);
+    }
+
+    ArrayRef arrayRef() const
+    {
+        return ArrayRef(&asArray());
+    }
+
+    inline Task& asTask() const;
+
+private:
+    // Native code reads and writes ints in place
+    friend class Jit;
+
+    bool isObject() const
+    {
+        return tag_ >= Tag::Str;
+    }
+
+    size_t smallSize() const
+    {
+        auto* end = static_cast<const char*>(std::memchr(small_, 0, SMALL_STR));
+        return end ? static_cast<size_t>(end - small_) : SMALL_STR;
+    }
+
+    void release() noexcept
+    {
+        if(isObject() && obj_->dropRef())
+            destroy(obj_);
+    }
+
+private:
+    union
+    {
+        std::int64_t i_;
+        Object* obj_;
+        char small_[SMALL_STR];
+    };
+    Tag tag_;
+};
+
+static_assert(sizeof(Value) == 16, "Value is expected to be a 16-byte tagged union");
+
+Value Array::get(size_t i) const
+{
+    if(elemKind_ == ElemKind::Int)
+        return ints_[i];
+
+    return strs_[i];
+}
+
+void Array::set(size_t i, const Value& v)
+{
+    if(elemKind_ == ElemKind::Int)
+    {
+        ints_[i] = v.asInt();
+    }
+    else
+    {
+        strs_[i] = v;
+    }
+}
+
+class RuntimeError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// A spawned call of the user function fn_. Whoever claims it first runs it and
+// reports the outcome, joining threads wait for done() and then read the result.
+struct Task : Object
+{
+    Task(std::uint32_t fn, std::vector<Value> args) : Object(Kind::Task), fn_(fn), args_(std::move(args))
+    {
+    }
+
+    // True for the one caller that gets to run the call
+    bool claim()
+    {
+        return !claimed_.exchange(true, std::memory_order_acq_rel);
+    }
+
+    bool done() const
+    {
+        return done_.load(std::memory_order_acquire);
+    }
+
+    void finish(Value result)
+    {
+        result_ = std::move(result);
+        done_.store(true, std::memory_order_release);
+    }
+
+    void fail(std::exception_ptr error)
+    {
+        error_ = std::move(error);
+        done_.store(true, std::memory_order_release);
+    }
+
+    // Rethrows the error of a failed call, every time it is joined
+    const Value& result() const
+    {
+        assert(done());
+        if(error_)
+            std::rethrow_exception(error_);
+
+        return result_;
+    }
+
+    std::uint32_t fn_;
+
+    // Moved out by whoever runs the call
+    std::vector<Value> args_;
+
+private:
+    Value result_;
+    std::exception_ptr error_;
+    std::atomic<bool> claimed_{false};
+    std::atomic<bool> done_{false};
+};
+
+Value::Value(TaskRef task) : obj_(task.release()), tag_(Tag::Task)
+{
+    assert(obj_);
+}
+
+Task& Value::asTask() const
+{
+    assert(isTask());
+    return *static_cast<Task*>(obj_);
+}
+
+// Zero value of an element kind used by NewArray and default initialization
+Value defaultValue(ElemKind kind);
+
+// Element kind of an array type
+ElemKind elemKind(const TypeTable& types, TypeHandle array);
+
+// Arrays may hold at most this many elements, 32 GiB of ints
+constexpr std::int64_t MAX_ARRAY_SIZE = std::int64_t{1} << 32;
+
+// `int[n] a;`, throws RuntimeError if n is negative, above MAX_ARRAY_SIZE or
+// more than memory holds
+ArrayRef newArray(std::int64_t size, ElemKind kind, Heap* region = nullptr);
+
+// Default value of a declared type, arrays of symbolic size are empty
+Value defaultValue(const TypeTable& types, TypeHandle type);
+
+void printValue(std::ostream& os, const Value& v);
+
+// `a + b` of two strings. Short results are copied, long ones become a rope node.
+Value concat(const Value& a, const Value& b, Heap* region = nullptr);
+
+// `args` holds builtinArity(builtin) values, arrays it returns are allocated in `region` if given
+Value callBuiltin(Builtin builtin, const Value* args, std::ostream& out, Heap* region = nullptr);
+
+}
@@ -0,0 +1,864 @@
+#include "vm.h"
+#include "arith.h"
+#include "array_ops.h"
+#include "debugger.h"
+#include "jit.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace Guu
+{
+
+using namespace Bytecode;
+
+// Worker VMs are created by their own thread when it first runs a job
+struct VM::Pool
+{
+    Pool(VM& root, size_t threads) : root_(root), vms_(threads), scheduler_(threads)
+    {
+    }
+
+    VM& vm(size_t worker)
+    {
+        if(worker == 0)
+            return root_;
+
+        auto& vm = vms_[worker];
+        if(!vm)
+        {
+            vm        = std::make_unique<VM>(root_.module_, root_.out_, root_.stack_.maxDepth());
+            vm->pool_ = this;
+        }
+        return *vm;
+    }
+
+    VM& root_;
+
+    // Destroyed after the scheduler stopped the threads running them
+    std::vector<std::unique_ptr<VM>> vms_;
+    std::mutex output_;
+    Scheduler scheduler_;
+};
+
+// A running parallel for. Of the chunks that failed, the error of the first
+// one is reported, as if the iterations had run in order.
+struct VM::Loop
+{
+    Loop(Pool& pool, std::uint32_t fnIndex, std::vector<Value> captures, std::uint64_t grain)
+        : pool_(pool), fnIndex_(fnIndex), captures_(std::move(captures)), grain_(grain)
+    {
+    }
+
+    Pool& pool_;
+    std::uint32_t fnIndex_;
+    std::vector<Value> captures_;
+    std::uint64_t grain_;
+
+    // Chunks not done yet, the parent waits for zero
+    std::atomic<size_t> pending_{1};
+
+    std::mutex mutex_;
+    std::atomic<std::int64_t> failedAt_{std::numeric_limits<std::int64_t>::max()};
+    std::exception_ptr error_;
+
+    void fail(std::int64_t lo, std::exception_ptr error)
+    {
+        std::lock_guard lock(mutex_);
+        if(lo < failedAt_.load(std::memory_order_relaxed))
+        {
+            failedAt_.store(lo, std::memory_order_relaxed);
+            error_ = std::move(error);
+        }
+    }
+};
+
+// Splits its range in halves, leaving the upper ones to thieves, down to the grain
+struct VM::LoopJob : Scheduler::Job
+{
+    LoopJob(Loop& loop, std::int64_t lo, std::int64_t hi) : loop_(loop), lo_(lo), hi_(hi)
+    {
+    }
+
+    void run(size_t worker) override
+    {
+        while(size(lo_, hi_) > loop_.grain_)
+        {
+            std::int64_t mid = lo_ + static_cast<std::int64_t>(size(lo_, hi_) / 2);
+            loop_.pending_.fetch_add(1, std::memory_order_relaxed);
+            loop_.pool_.scheduler_.push(new LoopJob(loop_, mid, hi_));
+            hi_ = mid;
+        }
+
+        // Chunks after a failed one would not have run in order either
+        if(lo_ < loop_.failedAt_.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                loop_.pool_.vm(worker).runChunk(loop_, lo_, hi_);
+            } catch(...)
+            {
+                loop_.fail(lo_, std::current_exception());
+            }
+        }
+
+        loop_.pending_.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    // Of a range that may not fit into an int64
+    static std::uint64_t size(std::int64_t lo, std::int64_t hi)
+    {
+        return static_cast<std::uint64_t>(hi) - static_cast<std::uint64_t>(lo);
+    }
+
+    Loop& loop_;
+    std::int64_t lo_;
+    std::int64_t hi_;
+};
+
+struct VM::TaskJob : Scheduler::Job
+{
+    TaskJob(Pool& pool, TaskRef task) : pool_(pool), task_(std::move(task))
+    {
+    }
+
+    // Joining it first runs it in place
+    void run(size_t worker) override
+    {
+        if(task_->claim())
+            pool_.vm(worker).runTask(*task_);
+    }
+
+    Pool& pool_;
+    TaskRef task_;
+};
+
+VM::VM(const Module& module, std::ostream& out, size_t maxDepth) : module_(module), out_(out), stack_(maxDepth)
+{
+    constants_.reserve(module.constants_.size());
+    for(const Value& c: module.constants_)
+    {
+        constants_.push_back(c.isStr() ? Value(std::string(c.asStr())) : c);
+    }
+}
+
+VM::~VM() = default;
+
+void VM::setThreads(size_t threads)
+{
+    threads_ = threads ? threads : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+Value VM::run(const std::vector<std::string>& args)
+{
+    if(module_.main_ == Module::NO_MAIN)
+        throw RuntimeError("Function 'main' is not defined");
+
+    std::vector<Value> params;
+    if(module_.functions_[module_.main_].numParams_ > 0)
+        params.push_back(mainArgs(args));
+
+    Value result = call(module_.main_, std::move(params));
+
+    // A program that never reached a checkpoint is saved as it was compiled
+    if(!snapshot_.empty() && !saved_)
+        saveImage(snapshot_, module_, nullptr);
+
+    return result;
+}
+
+Value VM::resume(Checkpoint checkpoint, const std::vector<std::string>& args)
+{
+    const Function& fn = module_.functions_[module_.main_];
+    size_t depth       = stack_.depth();
+    auto regions       = static_cast<std::uint32_t>(heap_.depth());
+
+    CallStack::Frame* frame = stack_.enter(fn, regions, suspendedPc_);
+    if(!frame)
+        throw error("Stack overflow", fn, 0);
+
+    std::move(checkpoint.regs_.begin(), checkpoint.regs_.end(), frame->regs_);
+    if(fn.numParams_ > 0)
+        frame->regs_[0] = mainArgs(args);
+
+    // Regions open at the checkpoint, their objects came back on the global heap
+    for(std::uint32_t r = 0; r < checkpoint.regions_; ++r)
+    {
+        heap_.enter();
+    }
+
+    return start(frame, checkpoint.pc_, depth, regions);
+}
+
+Value VM::call(std::uint32_t fnIndex, std::vector<Value> args)
+{
+    const Function& fn = module_.functions_[fnIndex];
+    size_t depth       = stack_.depth();
+    auto regions       = static_cast<std::uint32_t>(heap_.depth());
+
+    // Jobs suspend frames of their own, the next one nested here goes on top of the same
+    size_t resumePc = suspendedPc_;
+
+    CallStack::Frame* frame = stack_.enter(fn, regions, resumePc);
+    if(!frame)
+        throw error("Stack overflow", fn, 0);
+
+    std::move(args.begin(), args.end(), frame->regs_);
+
+    Value result;
+    try
+    {
+        result = start(frame, 0, depth, regions);
+    } catch(...)
+    {
+        suspendedPc_ = resumePc;
+        throw;
+    }
+
+    suspendedPc_ = resumePc;
+    return result;
+}
+
+Value VM::start(CallStack::Frame* frame, size_t pc, size_t depth, std::uint32_t regions)
+{
+    try
+    {
+        if(profiler_)
+            return execute<Mode::Profile>(frame, pc);
+
+        if(tracer_)
+            return execute<Mode::Trace>(frame, pc);
+
+#ifdef GUU_ENABLE_JIT
+        if(jit_)
+            return execute<Mode::Jit>(frame, pc);
+#endif
+
+        return execute<Mode::Plain>(frame, pc);
+    } catch(...)
+    {
+        // The frames of a failed run are abandoned with their registers
+        stack_.unwind(depth);
+        heap_.leave(regions);
+
+        // Once, when the error leaves the outermost run
+        if(tracer_ && depth == 0)
+            saveTrace();
+        throw;
+    }
+}
+
+void VM::saveTrace() const
+{
+    std::string msg;
+    try
+    {
+        throw;
+    } catch(const std::exception& e)
+    {
+        msg = e.what();
+    } catch(...)
+    {
+        msg = "Unknown error";
+    }
+
+    // The error of the program matters more than the one of its trace
+    try
+    {
+        tracer_->save(module_, msg);
+    } catch(const std::exception&)
+    {
+    }
+}
+
+template <VM::Mode M>
+Value VM::execute(CallStack::Frame* frame, size_t pc)
+{
+    // State of the running frame, reloaded on every call and return
+    const Function* fn = frame->fn_;
+    Value* regs        = frame->regs_;
+
+    auto R      = [&regs](Reg r) -> Value& { return regs[r]; };
+    auto I      = [&regs](Reg r) { return regs[r].asInt(); };
+    auto region = [this](const Instr& i) { return i.x_ & REGION ? &heap_ : nullptr; };
+    auto cmp    = [&](const Instr& i, auto pred) {
+        // Strings only have == and !=, whose predicates only ask whether they differ
+        if(R(i.b_).isStr())
+        {
+            regs[i.a_] = Arith::fromBool(pred(R(i.b_).strEquals(R(i.c_)) ? 0 : 1, 0));
+        }
+        else
+        {
+            regs[i.a_] = Arith::fromBool(pred(I(i.b_), I(i.c_)));
+        }
+    };
+
+    const Instr* code = fn->code_.data();
+    const Instr* i    = nullptr;
+
+    // The instruction a Debugger patched over, executed in place of Op::Break
+    Instr trapped(Op::Break);
+
+    auto fnIndex = [&fn, this] { return static_cast<std::uint32_t>(fn - module_.functions_.data()); };
+
+#ifdef GUU_ENABLE_JIT
+    // Native code of the running function, once the Jit compiled it
+    const Jit::Code* native = nullptr;
+    if constexpr(M == Mode::Jit)
+        native = jit_->code(fnIndex());
+#endif
+
+    // VM_CASE labels a handler, VM_NEXT fetches the next instruction and jumps to
+    // its handler, VM_DISPATCH jumps to the handler of `i` without a fetch. With
+    // direct threading every handler ends in its own indirect jump, which
+    // predicts far better than the single shared switch jump. VM_TICK takes due
+    // profiler samples or records statements, VM_TRACE records an event and
+    // VM_NATIVE runs native code from pc on, all compile to nothing in other
+    // modes. Native code returns the pc of an instruction it left to the VM,
+    // which is fetched next.
+#define VM_TRACE(event, at, arg)                                                           \
+    do                                                                                     \
+    {                                                                                      \
+        if constexpr(M == Mode::Trace)                                                     \
+            tracer_->record(TraceEvent::event, fnIndex(), static_cast<std::uint32_t>(at),  \
+                            static_cast<std::uint32_t>(arg));                              \
+    } while(false)
+
+#define VM_TICK()                                                                          \
+    do                                                                                     \
+    {                                                                                      \
+        if constexpr(M == Mode::Profile)                                                   \
+        {                                                                                  \
+            if(profiler_->due())                                                           \
+                profiler_->sample(stack_, pc);                                             \
+        }                                                                                  \
+        else if constexpr(M == Mode::Trace)                                                \
+        {                                                                                  \
+            if(tracer_->statements() && (pc == 0 || fn->lines_[pc] != fn->lines_[pc - 1])) \
+                VM_TRACE(Statement, pc, fn->lines_[pc]);                                   \
+        }                                                                                  \
+    } while(false)
+
+#ifdef GUU_ENABLE_JIT
+#define VM_NATIVE()                                              \
+    do                                                           \
+    {                                                            \
+        if constexpr(M == Mode::Jit)                             \
+        {                                                        \
+            if(!native)                                          \
+            {                                                    \
+                native = jit_->warm(fnIndex());                  \
+            }                                                    \
+            else if(const void* entry = native->entries_[pc])    \
+            {                                                    \
+                pc = native->run_(regs, entry);                  \
+            }                                                    \
+        }                                                        \
+    } while(false)
+
+// Calls and returns switch the running function
+#define VM_SWITCH_NATIVE()                                       \
+    do                                                           \
+    {                                                            \
+        if constexpr(M == Mode::Jit)                             \
+            native = jit_->code(fnIndex());                      \
+    } while(false)
+#else
+#define VM_NATIVE() \
+    do              \
+    {               \
+    } while(false)
+#define VM_SWITCH_NATIVE() VM_NATIVE()
+#endif
+
+    VM_TRACE(Enter, pc, stack_.depth());
+
+#ifdef GUU_VM_COMPUTED_GOTO
+    // clang-format off
+    static void* const handlers[] = {
+        #define HANDLER_ADDRESS(x, _) &&op_##x,
+        GUU_OPCODE_VALUES(HANDLER_ADDRESS)
+        #undef HANDLER_ADDRESS
+    };
+    // clang-format on
+
+#define VM_CASE(x) op_##x
+#define VM_DISPATCH() goto *handlers[static_cast<std::uint8_t>(i->op_)]
+#define VM_NEXT()                                                \
+    do                                                           \
+    {                                                            \
+        VM_TICK();                                               \
+        VM_NATIVE();                                             \
+        i = &code[pc++];                                         \
+        VM_DISPATCH();                                           \
+    } while(false)
+
+    VM_NEXT();
+    {
+#else
+#define VM_CASE(x) case Op::x
+#define VM_DISPATCH() goto dispatch
+#define VM_NEXT() continue
+
+    for(;;)
+    {
+        VM_TICK();
+        VM_NATIVE();
+        i = &code[pc++];
+    dispatch:
+        switch(i->op_)
+#endif
+        {
+            VM_CASE(LoadK):
+                regs[i->a_] = constants_[i->bx()];
+                VM_NEXT();
+
+            VM_CASE(LoadI):
+                regs[i->a_] = std::int64_t{i->sbx()};
+                VM_NEXT();
+
+            VM_CASE(Move):
+                regs[i->a_] = R(i->b_);
+                VM_NEXT();
+
+            VM_CASE(Add):
+                regs[i->a_] = Arith::add(I(i->b_), I(i->c_));
+                VM_NEXT();
+
+            VM_CASE(Sub):
+                regs[i->a_] = Arith::sub(I(i->b_), I(i->c_));
+                VM_NEXT();
+
+            VM_CASE(Mul):
+                regs[i->a_] = Arith::mul(I(i->b_), I(i->c_));
+                VM_NEXT();
+
+            VM_CASE(Div): {
+                auto b = I(i->c_);
+                if(b == 0)
+                    throw error("Division by zero", *fn, pc - 1);
+
+                regs[i->a_] = Arith::div(I(i->b_), b);
+
+                VM_NEXT();
+            }
+
+            VM_CASE(Mod): {
+                auto b = I(i->c_);
+                if(b == 0)
+                    throw error("Division by zero", *fn, pc - 1);
+
+                regs[i->a_] = Arith::mod(I(i->b_), b);
+
+                VM_NEXT();
+            }
+
+            VM_CASE(Neg):
+                regs[i->a_] = Arith::neg(I(i->b_));
+                VM_NEXT();
+
+            VM_CASE(Lt):
+                cmp(*i, [](auto a, auto b) { return a < b; });
+                VM_NEXT();
+
+            VM_CASE(Le):
+                cmp(*i, [](auto a, auto b) { return a <= b; });
+                VM_NEXT();
+
+            VM_CASE(Gt):
+                cmp(*i, [](auto a, auto b) { return a > b; });
+                VM_NEXT();
+
+            VM_CASE(Ge):
+                cmp(*i, [](auto a, auto b) { return a >= b; });
+                VM_NEXT();
+
+            VM_CASE(Eq):
+                cmp(*i, [](auto a, auto b) { return a == b; });
+                VM_NEXT();
+
+            VM_CASE(Ne):
+                cmp(*i, [](auto a, auto b) { return a != b; });
+                VM_NEXT();
+
+            VM_CASE(Jmp):
+                pc += i->sbx();
+                VM_NEXT();
+
+            VM_CASE(JmpIf):
+                if(I(i->a_))
+                    pc += i->sbx();
+                VM_NEXT();
+
+            VM_CASE(JmpIfNot):
+                if(!I(i->a_))
+                    pc += i->sbx();
+                VM_NEXT();
+
+            VM_CASE(NewArray):
+                try
+                {
+                    regs[i->a_] = newArray(I(i->b_), static_cast<ElemKind>(i->c_), region(*i));
+                } catch(const RuntimeError& e)
+                {
+                    throw error(e.what(), *fn, pc - 1);
+                }
+                VM_NEXT();
+
+            VM_CASE(MakeArray): {
+                // Array literals are never empty
+                auto arr = makeArray(R(i->b_).isInt() ? ElemKind::Int : ElemKind::Str, region(*i));
+                arr->assign(regs + i->b_, regs + i->b_ + i->c_);
+                regs[i->a_] = std::move(arr);
+
+                VM_NEXT();
+            }
+
+            VM_CASE(GetIndex): {
+                const auto& arr = R(i->b_).asArray();
+                auto idx        = I(i->c_);
+                if(idx < 0 || static_cast<size_t>(idx) >= arr.size())
+                    throw outOfBounds(idx, arr.size(), *fn, pc - 1);
+
+                // Copy first: the destination may hold the last reference to the array
+                Value v     = arr.get(static_cast<size_t>(idx));
+                regs[i->a_] = std::move(v);
+
+                VM_NEXT();
+            }
+
+            VM_CASE(SetIndex): {
+                auto& arr = R(i->a_).asArray();
+                auto idx  = I(i->b_);
+                if(idx < 0 || static_cast<size_t>(idx) >= arr.size())
+                    throw outOfBounds(idx, arr.size(), *fn, pc - 1);
+
+                arr.set(static_cast<size_t>(idx), R(i->c_));
+
+                VM_NEXT();
+            }
+
+            VM_CASE(ArrayOp):
+                try
+                {
+                    auto op     = static_cast<TokenType>(i->x_ & ~REGION);
+                    regs[i->a_] = ArrayOps::apply(op, R(i->b_), R(i->c_), region(*i));
+                } catch(const RuntimeError& e)
+                {
+                    throw error(e.what(), *fn, pc - 1);
+                }
+                VM_NEXT();
+
+            VM_CASE(ArrayNeg):
+                regs[i->a_] = ArrayOps::neg(R(i->b_), region(*i));
+                VM_NEXT();
+
+            VM_CASE(Concat):
+                regs[i->a_] = concat(R(i->b_), R(i->c_), region(*i));
+                VM_NEXT();
+
+            VM_CASE(Call): {
+                // The arguments already sit at the start of the callee's frame
+                const Function& callee = module_.functions_[i->bx()];
+                Value* args            = regs + i->a_;
+                VM_TRACE(Call, pc - 1, i->bx());
+
+                auto* calleeFrame = stack_.push(callee, args, pc, args, static_cast<std::uint32_t>(heap_.depth()));
+                if(!calleeFrame)
+                    throw error("Stack overflow", *fn, pc - 1);
+
+                frame = calleeFrame;
+                fn    = &callee;
+                code  = callee.code_.data();
+                regs  = frame->regs_;
+                pc    = 0;
+                VM_SWITCH_NATIVE();
+                VM_TRACE(Enter, pc, stack_.depth());
+
+                VM_NEXT();
+            }
+
+            VM_CASE(TailCall): {
+                // The callee takes over the frame: the arguments move to its start and
+                // the caller's regions are left as on return, arguments never live there
+                const Function& callee = module_.functions_[i->bx()];
+                VM_TRACE(Call, pc - 1, i->bx());
+
+                if(i->a_ != 0)
+                    std::move(regs + i->a_, regs + i->a_ + callee.numParams_, regs);
+
+                if(heap_.depth() > frame->regions_)
+                {
+                    std::fill(regs + callee.numParams_, regs + fn->numRegs_, Value());
+                    heap_.leave(frame->regions_);
+                }
+
+                frame = stack_.replace(callee);
+                fn    = &callee;
+                code  = callee.code_.data();
+                regs  = frame->regs_;
+                pc    = 0;
+                VM_SWITCH_NATIVE();
+                VM_TRACE(Enter, pc, stack_.depth());
+
+                VM_NEXT();
+            }
+
+            VM_CASE(CallBuiltin):
+                try
+                {
+                    // Workers print whole lines
+                    std::unique_lock<std::mutex> lock;
+                    if(pool_ && static_cast<Builtin>(i->b_) == Builtin::Print)
+                        lock = std::unique_lock(pool_->output_);
+
+                    regs[i->a_] = callBuiltin(static_cast<Builtin>(i->b_), regs + i->c_, out_, region(*i));
+
+                    if(static_cast<Builtin>(i->b_) == Builtin::Checkpoint && !snapshot_.empty() && !saved_)
+                        checkpoint(*frame, pc);
+                } catch(const RuntimeError& e)
+                {
+                    throw error(e.what(), *fn, pc - 1);
+                }
+                VM_NEXT();
+
+            VM_CASE(Ret): {
+                Value result    = std::move(regs[i->a_]);
+                Value* dst      = frame->result_;
+                size_t returnPc = frame->returnPc_;
+                VM_TRACE(Return, pc - 1, stack_.depth());
+
+                // Returned values escape, so they never live in a region
+                if(heap_.depth() > frame->regions_)
+                    leaveRegions(*frame);
+
+                // Entry frames have nowhere to put the result
+                frame = stack_.pop();
+                if(!dst)
+                    return result;
+
+                *dst = std::move(result);
+                fn   = frame->fn_;
+                code = fn->code_.data();
+                regs = frame->regs_;
+                pc   = returnPc;
+                VM_SWITCH_NATIVE();
+
+                VM_NEXT();
+            }
+
+            VM_CASE(EnterRegion):
+                heap_.enter();
+                VM_NEXT();
+
+            VM_CASE(LeaveRegion):
+                std::fill(regs + i->a_, regs + fn->numRegs_, Value());
+                heap_.leave(heap_.depth() - 1);
+                VM_NEXT();
+
+            VM_CASE(ParFor):
+                suspendedPc_ = pc;
+                parallelFor(i->bx(), regs, i->a_);
+                VM_NEXT();
+
+            VM_CASE(Spawn): {
+                const Function& callee = module_.functions_[i->bx()];
+                Value* args            = regs + i->a_;
+
+                TaskRef task(new Task(i->bx(), std::vector<Value>(std::make_move_iterator(args),
+                                                                  std::make_move_iterator(args + callee.numParams_))));
+                if(Pool* p = pool())
+                    p->scheduler_.push(new TaskJob(*p, task));
+
+                regs[i->a_] = std::move(task);
+                VM_NEXT();
+            }
+
+            VM_CASE(Join): {
+                // Copy first: the destination may hold the last reference to the task
+                suspendedPc_ = pc;
+                Value result = join(R(i->b_).asTask());
+                regs[i->a_]  = std::move(result);
+                VM_NEXT();
+            }
+
+            VM_CASE(AddI):
+                regs[i->a_] = Arith::add(I(i->b_), i->sc());
+                VM_NEXT();
+
+            VM_CASE(JmpIfLt):
+                if(I(i->a_) < I(i->b_))
+                    pc += i->sc();
+                VM_NEXT();
+
+            VM_CASE(JmpIfLe):
+                if(I(i->a_) <= I(i->b_))
+                    pc += i->sc();
+                VM_NEXT();
+
+            VM_CASE(JmpIfGt):
+                if(I(i->a_) > I(i->b_))
+                    pc += i->sc();
+                VM_NEXT();
+
+            VM_CASE(JmpIfGe):
+                if(I(i->a_) >= I(i->b_))
+                    pc += i->sc();
+                VM_NEXT();
+
+            VM_CASE(JmpIfEq):
+                if(I(i->a_) == I(i->b_))
+                    pc += i->sc();
+                VM_NEXT();
+
+            VM_CASE(JmpIfNe):
+                if(I(i->a_) != I(i->b_))
+                    pc += i->sc();
+                VM_NEXT();
+
+            VM_CASE(Break):
+                if(!debugger_)
+                    throw error("Unexpected breakpoint", *fn, pc - 1);
+
+                trapped = debugger_->trap(stack_, *fn, pc - 1);
+                i       = &trapped;
+
+                VM_DISPATCH();
+        }
+    }
+
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_NEXT
+#undef VM_TICK
+#undef VM_TRACE
+#undef VM_NATIVE
+#undef VM_SWITCH_NATIVE
+
+    return Value();
+}
+
+void VM::leaveRegions(const CallStack::Frame& frame)
+{
+    std::fill(frame.regs_, frame.regs_ + frame.fn_->numRegs_, Value());
+    heap_.leave(frame.regions_);
+}
+
+Value VM::mainArgs(const std::vector<std::string>& args)
+{
+    auto argv = makeArray(ElemKind::Str);
+    argv->strs_.assign(args.begin(), args.end());
+    return argv;
+}
+
+void VM::checkpoint(const CallStack::Frame& frame, size_t pc)
+{
+    if(stack_.depth() != 1)
+        throw RuntimeError("checkpoint() must be called from main");
+
+    Checkpoint cp;
+    cp.pc_      = pc;
+    cp.regions_ = static_cast<std::uint32_t>(heap_.depth() - frame.regions_);
+    cp.regs_.assign(frame.regs_, frame.regs_ + frame.fn_->numRegs_);
+
+    saveImage(snapshot_, module_, &cp);
+    saved_ = true;
+}
+
+VM::Pool* VM::pool()
+{
+    if(!pool_ && threads_ > 1)
+    {
+        Object::setConcurrent();
+        ownedPool_ = std::make_unique<Pool>(*this, threads_);
+        pool_      = ownedPool_.get();
+    }
+
+    return pool_;
+}
+
+void VM::parallelFor(std::uint32_t fnIndex, const Value* regs, Reg a)
+{
+    std::int64_t lo = regs[a].asInt();
+    std::int64_t hi = regs[a + 1].asInt();
+    if(lo >= hi)
+        return;
+
+    Pool* p = pool();
+    if(!p)
+    {
+        std::vector<Value> args(regs, regs + a);
+        args.emplace_back(lo);
+        args.emplace_back(hi);
+        call(fnIndex, std::move(args));
+        return;
+    }
+
+    // A few chunks per worker leave room for balancing uneven iterations
+    auto grain = std::max<std::uint64_t>(LoopJob::size(lo, hi) / (8 * p->scheduler_.size()), 1);
+    Loop loop(*p, fnIndex, std::vector<Value>(regs, regs + a), grain);
+
+    LoopJob(loop, lo, hi).run(Scheduler::worker());
+    p->scheduler_.wait([&loop] { return loop.pending_.load(std::memory_order_acquire) == 0; });
+
+    if(loop.error_)
+        std::rethrow_exception(loop.error_);
+}
+
+void VM::runChunk(const Loop& loop, std::int64_t lo, std::int64_t hi)
+{
+    std::vector<Value> args;
+    args.reserve(loop.captures_.size() + 2);
+    args.assign(loop.captures_.begin(), loop.captures_.end());
+    args.emplace_back(lo);
+    args.emplace_back(hi);
+
+    call(loop.fnIndex_, std::move(args));
+}
+
+void VM::runTask(Task& task)
+{
+    try
+    {
+        task.finish(call(task.fn_, std::move(task.args_)));
+    } catch(...)
+    {
+        task.fail(std::current_exception());
+    }
+}
+
+const Value& VM::join(Task& task)
+{
+    if(task.claim())
+    {
+        runTask(task);
+    }
+    else if(!task.done())
+    {
+        // Only ever claimed by others with a pool running
+        pool_->scheduler_.wait([&task] { return task.done(); });
+    }
+
+    return task.result();
+}
+
+RuntimeError VM::outOfBounds(std::int64_t idx, size_t size, const Function& fn, size_t pc) const
+{
+    return error("Index " + std::to_string(idx) + " is out of bounds of array of size " + std::to_string(size), fn, pc);
+}
+
+RuntimeError VM::error(const std::string& msg, const Function& fn, size_t pc) const
+{
+    size_t line = pc < fn.lines_.size() ? fn.lines_[pc] : 0;
+    return RuntimeError(msg + " in '" + fn.name_ + "' on line " + std::to_string(line));
+}
+
+}
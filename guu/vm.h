@@ -0,0 +1,164 @@
+#pragma once
+
+#include "bytecode.h"
+#include "call_stack.h"
+#include "heap.h"
+#include "value.h"
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Guu
+{
+
+class Debugger;
+class Jit;
+class Profiler;
+class Tracer;
+struct Checkpoint;
+
+// Executes a compiled Module without recursing on the native stack: calls and
+// returns push and pop CallStack frames, arguments are passed in place. Dispatch is direct-threaded through computed goto
+// when built with GUU_VM_COMPUTED_GOTO, and a portable switch otherwise. With a
+// Jit attached, hot functions run as native code between the instructions the
+// VM has to execute itself. Objects marked REGION go to a Heap region that is
+// left at the end of the loop iteration or call, see EscapeAnalysis.
+//
+// A VM only reads the Module, whose string constants it copies, so VMs on
+// different threads may run the same Module at once, see Context.
+//
+// Parallel loops and spawned tasks run on a Scheduler with a VM of its own per
+// worker thread. A thread waiting for a loop or a task runs other jobs in a
+// frame nested above its own meanwhile, see CallStack::enter().
+class VM
+{
+public:
+    VM(const Bytecode::Module& module, std::ostream& out, size_t maxDepth = CallStack::DEFAULT_MAX_DEPTH);
+    ~VM();
+
+    // Calls `main`, passing `args` if it takes them
+    Value run(const std::vector<std::string>& args);
+
+    Value call(std::uint32_t fnIndex, std::vector<Value> args);
+
+    // Goes on from a checkpoint of main with `args` as its arguments. The
+    // module must be the one of the image the checkpoint came from.
+    Value resume(Checkpoint checkpoint, const std::vector<std::string>& args);
+
+    // Saves an image to `path` at the first checkpoint(), or after main
+    // returned if there was none, see saveImage()
+    void setSnapshot(std::string path)
+    {
+        snapshot_ = std::move(path);
+    }
+
+    // Op::Break traps into `debugger`, which must outlive the run
+    void setDebugger(Debugger* debugger)
+    {
+        debugger_ = debugger;
+    }
+
+    // Samples the running program, see Profiler
+    void setProfiler(Profiler* profiler)
+    {
+        profiler_ = profiler;
+    }
+
+    // Records calls, returns and, if asked to, statements, and saves them when
+    // a run fails, see Tracer. Ignored while profiling.
+    void setTracer(Tracer* tracer)
+    {
+        tracer_ = tracer;
+    }
+
+    // Runs hot functions as native code, see Jit. Ignored while profiling or tracing.
+    void setJit(Jit* jit)
+    {
+        jit_ = jit;
+    }
+
+    // Runs parallel loops and tasks on `threads` threads, 0 for one per core.
+    // With a single one they run in order, tasks when they are joined.
+    void setThreads(size_t threads);
+
+private:
+    struct Pool;
+    struct Loop;
+    struct LoopJob;
+    struct TaskJob;
+
+    // Plain runs nothing but bytecode, only the other variants check for due
+    // samples, trace events or native code between instructions
+    enum class Mode
+    {
+        Plain,
+        Profile,
+        Trace,
+        Jit,
+    };
+
+    // Runs the entered `frame` from `pc`, unwinding to `depth` and `regions` on errors
+    Value start(CallStack::Frame* frame, size_t pc, size_t depth, std::uint32_t regions);
+
+    template <Mode M>
+    Value execute(CallStack::Frame* frame, size_t pc);
+
+    // Saves the trace with the message of the error being handled
+    void saveTrace() const;
+
+    static Value mainArgs(const std::vector<std::string>& args);
+
+    // Saves main, `frame`, to be resumed at `pc`
+    void checkpoint(const CallStack::Frame& frame, size_t pc);
+
+    // Drops the registers of `frame`, which may refer to region objects, and leaves its regions
+    void leaveRegions(const CallStack::Frame& frame);
+
+    // The worker threads, started on first use, or nullptr if running on one thread
+    Pool* pool();
+
+    // Runs the outlined body `fnIndex` for R[a] <= i < R[a + 1], capturing R[0, a)
+    void parallelFor(std::uint32_t fnIndex, const Value* regs, Bytecode::Reg a);
+    void runChunk(const Loop& loop, std::int64_t lo, std::int64_t hi);
+
+    // Runs a task claimed by the caller and reports its outcome to it
+    void runTask(Task& task);
+    const Value& join(Task& task);
+
+    RuntimeError error(const std::string& msg, const Bytecode::Function& fn, size_t pc) const;
+    RuntimeError outOfBounds(std::int64_t idx, size_t size, const Bytecode::Function& fn, size_t pc) const;
+
+private:
+    const Bytecode::Module& module_;
+    std::ostream& out_;
+
+    // Of the module, strings copied so that no other VM refers to them
+    std::vector<Value> constants_;
+
+    // Outlives the registers referring to it
+    Heap heap_;
+    CallStack stack_;
+
+    // Where the running frame goes on once a loop or a join it waits for is
+    // done, for the frames of the jobs run meanwhile
+    size_t suspendedPc_ = 0;
+
+    Debugger* debugger_ = nullptr;
+    Profiler* profiler_ = nullptr;
+    Tracer* tracer_     = nullptr;
+    Jit* jit_           = nullptr;
+
+    std::string snapshot_;
+    bool saved_ = false;
+
+    size_t threads_ = 1;
+    Pool* pool_     = nullptr;
+
+    // Of the VM that started the threads, stops them before anything else is destroyed
+    std::unique_ptr<Pool> ownedPool_;
+};
+
+}
@@ -1,76 +1,1091 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <numeric>
+#include <sstream>
 #include <stdexcept>
+#include <streambuf>
 
 #include "guu/lexer.h"
 #include "guu/parser.h"
+#include "guu/resolver.h"
+#include "guu/optimizer.h"
+#include "guu/escape.h"
+#include "guu/stats.h"
 #include "guu/interpreter.h"
+#include "guu/kernels.h"
+#include "guu/compiler.h"
+#include "guu/vm.h"
+#include "guu/debugger.h"
+#include "guu/jit.h"
+#include "guu/profiler.h"
+#include "guu/transpiler.h"
+#include "guu/snapshot.h"
+#include "guu/tail_calls.h"
+#include "guu/tiering.h"
+#include "guu/trace.h"
+#include "guu/language_server.h"
+
+#include "util/mapped_file.h"
 
 using namespace std::string_literals;
 
 using namespace Guu;
 
-int main()
+enum class StatsFormat
 {
-    const std::string example = R"delim(
-fn main(args: str[N]) -> int {
-    int x = 3;
-    int[3] y = [1,2,3];
-    str dquot_str = "some_text";
-    str squot_str = 'some_text';
-    str[3] strings = ["struct", 'struct', "\"escaped_str\"", '\'escaped_str\''];
+    None,
+    Text,
+    Json,
+};
+
+enum class Engine
+{
+    VM,
+    AST,
+    Tiered,
+};
+
+namespace
+{
+
+std::string readFile(const std::string& path)
+{
+    util::MappedFile file(path);
+    return std::string(file.view());
 }
-)delim";
-    (void)example;
 
-    const std::string program = R"delim(
-fn main(args: str[N], test : int, aa : hello) -> int {
+int exitCode(const Value& result)
+{
+    return result.isInt() ? static_cast<int>(result.asInt()) : 0;
+}
+
+// Runs main, or resumes it at `checkpoint` if given. A `snapshot` path saves an image at its checkpoint(), a
+// `tracer` records the run and is saved if it fails.
+Value runVM(const Bytecode::Module& module, std::ostream& out, size_t maxDepth, bool jit, size_t threads,
+            const std::vector<std::string>& args, const std::string& snapshot = "", Checkpoint* checkpoint = nullptr,
+            Tracer* tracer = nullptr)
+{
+    VM vm(module, out, maxDepth);
+    vm.setThreads(threads);
+    vm.setSnapshot(snapshot);
+    vm.setTracer(tracer);
+
+#ifdef GUU_ENABLE_JIT
+    std::unique_ptr<Jit> compiler;
+    if(jit)
+    {
+        compiler = std::make_unique<Jit>(module);
+        vm.setJit(compiler.get());
+    }
+#else
+    (void)jit;
+#endif
 
+    return checkpoint ? vm.resume(std::move(*checkpoint), args) : vm.run(args);
 }
-)delim";
+
+// Goes on from an image written by --snapshot, skipping everything up to its checkpoint
+Value runImage(const std::string& path, bool dump, size_t maxDepth, bool jit, size_t threads,
+               const std::vector<std::string>& args, Tracer* tracer)
+{
+    Image image;
+    {
+        GUU_STATS_PHASE("restore");
+        image = loadImage(path);
+    }
+
+    if(dump)
+        image.module_.dump(std::cout);
+
+    GUU_STATS_PHASE("execute");
+    return runVM(image.module_, std::cout, maxDepth, jit, threads, args, "",
+                 image.resumable_ ? &image.checkpoint_ : nullptr, tracer);
+}
+
+// Runs the program with the sampling profiler, the table goes to stderr and
+// collapsed stacks for flamegraphs to `stacksPath` if given
+Value runProfiled(const Bytecode::Module& module, size_t maxDepth, const std::vector<std::string>& args,
+                  const std::string& stacksPath)
+{
+    Profiler profiler(module);
+
+    VM vm(module, std::cout, maxDepth);
+    vm.setProfiler(&profiler);
+
+    profiler.start();
+    Value value = vm.run(args);
+    profiler.stop();
+
+    std::cerr << std::endl;
+    profiler.printTable(std::cerr);
+
+    if(!stacksPath.empty())
+    {
+        std::ofstream out(stacksPath);
+        if(!out)
+            throw std::runtime_error("Cannot open '" + stacksPath + "'");
+
+        profiler.printCollapsed(out);
+    }
+
+    return value;
+}
+
+// Starts every function in the AST tier and compiles the hot ones, see Tiering.
+// The counters go to stderr if `stats` is set.
+Value runTiered(AST::Node& ast, const TypeTable& types, std::string source, std::ostream& out, const TierPolicy& policy,
+                size_t maxDepth, size_t threads, const std::vector<std::string>& args, bool stats)
+{
+    Tiering tiering(ast, std::move(source), out, policy, maxDepth);
+    tiering.setThreads(threads);
+
+    Interpreter interpreter(ast, types, out);
+    interpreter.setTiering(&tiering);
+
+    Value value = interpreter.run(args);
+
+    if(stats)
+    {
+        std::cerr << std::endl;
+        tiering.printStats(std::cerr);
+    }
+
+    return value;
+}
+
+// Writes the program as C++ for ahead of time compilation, to stdout if `path` is empty
+void writeCpp(AST::Node& ast, const TypeTable& types, const std::string& path)
+{
+    if(path.empty())
+    {
+        Transpiler(types, std::cout).emit(ast);
+        return;
+    }
+
+    std::ofstream out(path);
+    if(!out)
+        throw std::runtime_error("Cannot open '" + path + "'");
+
+    Transpiler(types, out).emit(ast);
+}
+
+// Runs the program on both engines, checks they agree and reports the times
+int bench(AST::Node& ast, const TypeTable& types, const Bytecode::Module& module, bool jit, size_t threads,
+          const std::vector<std::string>& args)
+{
+    using Clock = std::chrono::steady_clock;
+
+    auto timed = [](auto&& fn) {
+        auto start  = Clock::now();
+        auto result = fn();
+        return std::make_pair(std::move(result), std::chrono::duration<double, std::milli>(Clock::now() - start));
+    };
+
+    std::ostringstream astOut;
+    std::ostringstream vmOut;
+
+    auto [astResult, astTime] = timed([&] { return Interpreter(ast, types, astOut).run(args); });
+    auto [vmResult, vmTime]   = timed([&] { return runVM(module, vmOut, CallStack::DEFAULT_MAX_DEPTH, jit, threads, args); });
+
+    std::ostringstream astValue;
+    std::ostringstream vmValue;
+    printValue(astValue, astResult);
+    printValue(vmValue, vmResult);
+
+    if(astOut.str() != vmOut.str() || astValue.str() != vmValue.str())
+    {
+        std::cerr << "ERROR: engines disagree, ast returned " << astValue.str() << ", vm returned " << vmValue.str()
+                  << std::endl;
+        return 1;
+    }
+
+    std::cout << "ast: " << astTime.count() << " ms" << std::endl;
+    std::cout << "vm:  " << vmTime.count() << " ms" << std::endl;
+    std::cout << "speedup: " << astTime.count() / vmTime.count() << "x" << std::endl;
+    std::cout << "array kernels: " << Kernels::isa() << std::endl;
+    return 0;
+}
+
+// Exit codes of the commands, see runCommand()
+namespace Exit
+{
+constexpr int OK      = 0;
+constexpr int RUNTIME = 1;
+constexpr int USAGE   = 2;
+constexpr int COMPILE = 3;
+constexpr int INPUT   = 4;
+}
+
+enum class Command
+{
+    Run,
+    Parse,
+    Check,
+    Dump,
+    Bench,
+};
+
+struct CommandOptions
+{
+    Command command_;
+    int optLevel_    = Optimizer::MAX_LEVEL;
+    Engine engine_   = Engine::VM;
+    bool jit_        = false;
+    bool time_       = false;
+    size_t threads_  = 0;
+    size_t maxDepth_ = CallStack::DEFAULT_MAX_DEPTH;
+    size_t repeat_   = 1;
+    size_t warmup_   = 0;
+
+    std::vector<std::string> files_;
+    std::vector<std::string> args_;
+};
+
+const char* const USAGE = R"(usage: Guu <command> [options] <file>... [-- <program args>]
+
+commands:
+  run      run main of every file, exits with its result for a single file
+  parse    parse every file
+  check    parse, resolve and compile every file
+  dump     print the AST and the bytecode of every file
+  bench    run every file with its output discarded and print the phase times
+  lsp      serve the Language Server Protocol on stdin and stdout, --log=FILE
+           writes every message with the time it took to FILE
+
+options:
+  -O0, -O1                optimization level, -O1 by default
+  --engine=vm|ast|tiered  what run and bench execute on, vm by default
+  --jit                   compile hot functions of the VM to machine code
+  --threads=N             threads of parallel loops and tasks, 0 for every core
+  --max-depth=N           call depth limit, at most 16777216
+  --repeat=N              take every file through its phases N times, 10 for bench
+  --warmup[=N]            untimed runs before the timed ones, 1 without N and for bench
+  --time                  print the phase times to stderr
+
+exit codes: 0 success, 1 runtime error, 2 usage error, 3 compile error, 4 unreadable input
+)";
+
+template <typename T>
+bool parseNumber(const std::string& s, T& value)
+{
+    auto res = std::from_chars(s.data(), s.data() + s.size(), value);
+    return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+// Swallows everything written to it, so bench measures the program rather than the terminal
+class NullBuffer : public std::streambuf
+{
+public:
+    NullBuffer()
+    {
+        setp(buffer_, buffer_ + sizeof(buffer_));
+    }
+
+private:
+    int overflow(int c) override
+    {
+        setp(buffer_, buffer_ + sizeof(buffer_));
+        return traits_type::not_eof(c);
+    }
+
+private:
+    char buffer_[256];
+};
+
+// Wall time of every phase over the timed iterations of a command, and the
+// exit code of the phase running last, so a failure maps to its code
+class PhaseTimes
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Iterations not timed still run their phases
+    void startIteration(bool timed)
+    {
+        timed_     = timed;
+        iteration_ = 0;
+    }
+
+    void endIteration()
+    {
+        if(timed_)
+            add("total", iteration_);
+    }
+
+    template <typename Fn>
+    void run(const char* phase, int code, Fn&& fn)
+    {
+        code_ = code;
+
+        auto start = Clock::now();
+        fn();
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        iteration_ += ms;
+        if(timed_)
+            add(phase, ms);
+    }
+
+    int failureCode() const
+    {
+        return code_;
+    }
+
+    void print(std::ostream& os) const
+    {
+        os << std::left << std::setw(12) << "phase" << std::right << std::setw(12) << "min ms" << std::setw(12)
+           << "median ms" << std::setw(12) << "mean ms" << std::endl;
+
+        os << std::fixed << std::setprecision(3);
+        for(auto [phase, samples]: phases_)
+        {
+            std::sort(samples.begin(), samples.end());
+
+            size_t n      = samples.size();
+            double median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+            double mean   = std::accumulate(samples.begin(), samples.end(), 0.0) / n;
+
+            os << std::left << std::setw(12) << phase << std::right << std::setw(12) << samples.front()
+               << std::setw(12) << median << std::setw(12) << mean << std::endl;
+        }
+        os << std::defaultfloat;
+    }
+
+private:
+    void add(const std::string& phase, double ms)
+    {
+        auto it = std::find_if(phases_.begin(), phases_.end(), [&](const auto& p) { return p.first == phase; });
+        if(it == phases_.end())
+            it = phases_.insert(phases_.end(), {phase, {}});
+
+        it->second.push_back(ms);
+    }
+
+private:
+    // In the order they first ran
+    std::vector<std::pair<std::string, std::vector<double>>> phases_;
+
+    bool timed_       = true;
+    double iteration_ = 0;
+    int code_         = Exit::OK;
+};
+
+// Takes `path` through the phases of the command, all of them once per
+// warmup and repeat, and returns its exit code
+int runFile(const CommandOptions& opts, const std::string& path)
+{
+    const Command command = opts.command_;
+
+    // check and dump are about the bytecode whatever runs it
+    bool executes = command == Command::Run || command == Command::Bench;
+    bool tiered   = executes && opts.engine_ == Engine::Tiered;
+    bool compiles = !tiered && (!executes || opts.engine_ == Engine::VM);
+
+    NullBuffer discard;
+    std::ostream discardOut(&discard);
+    std::ostream& out = command == Command::Bench ? discardOut : std::cout;
+
+    TierPolicy tierPolicy;
+    tierPolicy.optLevel_ = opts.optLevel_;
+
+    PhaseTimes times;
+    int result = Exit::OK;
 
     try
     {
-        std::cout << "PROGRAM:" << std::endl;
-        std::cout << program << std::endl << std::endl;
+        for(size_t i = 0; i < opts.warmup_ + opts.repeat_; ++i)
+        {
+            times.startIteration(i >= opts.warmup_);
+
+            std::string source;
+            times.run("read", Exit::INPUT, [&] {
+                util::MappedFile file(path);
+                source.assign(file.data(), file.size());
+            });
+
+            std::unique_ptr<AST::Node> ast;
+            times.run("parse", Exit::COMPILE, [&] {
+                // The tiers parse the source once more when they compile
+                ast = Parser(Tokenizer(tiered ? source : std::move(source))).buildAST();
+            });
+
+            if(command == Command::Parse)
+            {
+                times.endIteration();
+                continue;
+            }
+
+            TypeTable types;
+            times.run("resolve", Exit::COMPILE, [&] { Resolver(types).resolve(*ast); });
+
+            if(opts.optLevel_ > 0 && !tiered)
+                times.run("optimize", Exit::COMPILE, [&] { Optimizer(types, opts.optLevel_).run(*ast); });
+
+            times.run("tail calls", Exit::COMPILE, [&] { TailCalls().run(*ast); });
+
+            Bytecode::Module module;
+            if(compiles)
+            {
+                times.run("escape", Exit::COMPILE, [&] { EscapeAnalysis(types).run(*ast); });
+                times.run("compile", Exit::COMPILE, [&] { module = Compiler(types).compile(*ast); });
+            }
+
+            if(command == Command::Dump)
+            {
+                AST::Printer p(std::cout);
+                p.print(*ast);
+
+                std::cout << std::endl;
+                module.dump(std::cout);
+            }
+
+            if(executes)
+            {
+                times.run("execute", Exit::RUNTIME, [&] {
+                    Value value;
+                    if(opts.engine_ == Engine::VM)
+                    {
+                        value = runVM(module, out, opts.maxDepth_, opts.jit_, opts.threads_, opts.args_);
+                    }
+                    else if(tiered)
+                    {
+                        value = runTiered(*ast, types, std::move(source), out, tierPolicy, opts.maxDepth_,
+                                          opts.threads_, opts.args_, false);
+                    }
+                    else
+                    {
+                        value = Interpreter(*ast, types, out).run(opts.args_);
+                    }
+
+                    // Several results would make no exit code, nor tell apart one of 3 from a compile error
+                    if(command == Command::Run && opts.files_.size() == 1)
+                        result = exitCode(value);
+                });
+            }
+
+            times.endIteration();
+        }
+    } catch(const std::runtime_error& e)
+    {
+        std::cerr << "ERROR: " << path << ": " << e.what() << std::endl;
+        return times.failureCode();
+    } catch(const std::exception& e)
+    {
+        // Running out of memory, whatever the phase
+        std::cerr << "ERROR: " << path << ": " << e.what() << std::endl;
+        return Exit::RUNTIME;
+    }
+
+    if(command == Command::Bench || opts.time_)
+    {
+        std::ostream& os = command == Command::Bench ? std::cout : std::cerr;
+
+        os << path << ": " << opts.repeat_ << (opts.repeat_ == 1 ? " run" : " runs");
+        if(opts.warmup_)
+            os << " after " << opts.warmup_ << (opts.warmup_ == 1 ? " warmup" : " warmups");
+        os << std::endl;
+
+        times.print(os);
+    }
+
+    return result;
+}
+
+// `Guu <command> [options] <file>...`, the subcommand interface next to the
+// flags of main(). argv starts after the command.
+int runCommand(Command command, int argc, char** argv)
+{
+    CommandOptions opts;
+    opts.command_ = command;
+
+    // bench defaults to timing enough runs for a median
+    bool repeatSet = false;
+    bool warmupSet = false;
+
+    auto usage = [](const std::string& error) {
+        if(!error.empty())
+            std::cerr << error << std::endl << std::endl;
+
+        std::cerr << USAGE;
+        return Exit::USAGE;
+    };
+
+    for(int i = 0; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--")
+        {
+            opts.args_.assign(argv + i + 1, argv + argc);
+            break;
+        }
+        else if(arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0'
+                && arg[2] - '0' <= Optimizer::MAX_LEVEL)
+        {
+            opts.optLevel_ = arg[2] - '0';
+        }
+        else if(arg == "--engine=vm" || arg == "--engine=ast" || arg == "--engine=tiered")
+        {
+            opts.engine_ = arg == "--engine=vm" ? Engine::VM : arg == "--engine=ast" ? Engine::AST : Engine::Tiered;
+        }
+        else if(arg == "--jit")
+        {
+#ifdef GUU_ENABLE_JIT
+            opts.jit_ = true;
+#else
+            return usage("Guu was built without the JIT (GUU_ENABLE_JIT=OFF or not x86-64)");
+#endif
+        }
+        else if(arg.compare(0, 10, "--threads=") == 0)
+        {
+            if(!parseNumber(arg.substr(10), opts.threads_))
+                return usage("Invalid thread count '" + arg.substr(10) + "'");
+        }
+        else if(arg.compare(0, 12, "--max-depth=") == 0)
+        {
+            if(!parseNumber(arg.substr(12), opts.maxDepth_) || opts.maxDepth_ == 0
+               || opts.maxDepth_ > CallStack::MAX_MAX_DEPTH)
+                return usage("Invalid call depth '" + arg.substr(12) + "'");
+        }
+        else if(arg == "--repeat" || arg.compare(0, 9, "--repeat=") == 0)
+        {
+            std::string value = arg.size() > 8 ? arg.substr(9) : i + 1 < argc ? argv[++i] : "";
+            if(!parseNumber(value, opts.repeat_) || opts.repeat_ == 0)
+                return usage("Invalid repeat count '" + value + "'");
+
+            repeatSet = true;
+        }
+        else if(arg == "--warmup" || arg.compare(0, 9, "--warmup=") == 0)
+        {
+            opts.warmup_ = 1;
+            if(arg.size() > 8 && !parseNumber(arg.substr(9), opts.warmup_))
+                return usage("Invalid warmup count '" + arg.substr(9) + "'");
+
+            warmupSet = true;
+        }
+        else if(arg == "--time")
+        {
+            opts.time_ = true;
+        }
+        else if(!arg.empty() && arg[0] != '-')
+        {
+            opts.files_.push_back(arg);
+        }
+        else
+        {
+            return usage("Unknown option '" + arg + "'");
+        }
+    }
+
+    if(opts.files_.empty())
+        return usage("No input files");
+
+    if(opts.jit_ && opts.engine_ != Engine::VM)
+        return usage("--jit needs --engine=vm");
+
+    if(command == Command::Bench)
+    {
+        opts.repeat_ = repeatSet ? opts.repeat_ : 10;
+        opts.warmup_ = warmupSet ? opts.warmup_ : 1;
+    }
+
+    // Every file is processed, the first failure decides the exit code
+    int result = Exit::OK;
+    for(const auto& path: opts.files_)
+    {
+        int code = runFile(opts, path);
+        if(result == Exit::OK)
+            result = code;
+    }
+
+    return result;
+}
+
+// `Guu lsp [--log=FILE]`, see LanguageServer
+int runLanguageServer(int argc, char** argv)
+{
+    std::ofstream log;
+    for(int i = 0; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg.compare(0, 6, "--log=") != 0)
+        {
+            std::cerr << "Unknown option '" << arg << "'" << std::endl << std::endl << USAGE;
+            return Exit::USAGE;
+        }
+
+        log.open(arg.substr(6));
+        if(!log)
+        {
+            std::cerr << "ERROR: Cannot open '" << arg.substr(6) << "'" << std::endl;
+            return Exit::INPUT;
+        }
+    }
+
+    std::ios::sync_with_stdio(false);
+
+    LanguageServer server(std::cin, std::cout);
+    if(log.is_open())
+        server.setLog(&log);
+
+    return server.run();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    // Subcommands, everything else is the flag interface below
+    if(argc > 1)
+    {
+        static const std::pair<const char*, Command> commands[] = {
+            {"run", Command::Run},   {"parse", Command::Parse}, {"check", Command::Check},
+            {"dump", Command::Dump}, {"bench", Command::Bench},
+        };
+
+        for(auto [name, command]: commands)
+        {
+            if(std::strcmp(argv[1], name) == 0)
+                return runCommand(command, argc - 2, argv + 2);
+        }
+
+        if(std::strcmp(argv[1], "lsp") == 0)
+            return runLanguageServer(argc - 2, argv + 2);
+    }
 
-        std::cout << "Parsing...";
+    int optLevel            = Optimizer::MAX_LEVEL;
+    StatsFormat statsFormat = StatsFormat::None;
+    Engine engine           = Engine::VM;
+    bool dump               = false;
+    bool benchmark          = false;
+    bool debug              = false;
+    bool profile            = false;
+    bool jit                = false;
+    bool emitCpp            = false;
+    bool restore            = false;
+    bool traceStatements    = false;
+    bool tierStats          = false;
+    size_t maxDepth         = CallStack::DEFAULT_MAX_DEPTH;
+    size_t threads          = 0;
+    TierPolicy tierPolicy;
 
-        std::unique_ptr<AST::Node> ast;
+    std::string path;
+    std::string profilePath;
+    std::string cppPath;
+    std::string snapshotPath;
+    std::string tracePath;
+    std::string decodePath;
+    std::vector<std::string> programArgs;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(!path.empty())
+        {
+            // Everything after the script belongs to the script
+            programArgs.push_back(arg);
+        }
+        else if(arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0'
+                && arg[2] - '0' <= Optimizer::MAX_LEVEL)
+        {
+            optLevel = arg[2] - '0';
+        }
+        else if(arg == "--stats" || arg == "--stats=text" || arg == "--stats=json")
+        {
+#ifdef GUU_ENABLE_STATS
+            statsFormat = arg == "--stats=json" ? StatsFormat::Json : StatsFormat::Text;
+#else
+            std::cerr << "Guu was built without statistics support (GUU_ENABLE_STATS=OFF)" << std::endl;
+            return 1;
+#endif
+        }
+        else if(arg == "--engine=vm" || arg == "--engine=ast" || arg == "--engine=tiered")
+        {
+            engine = arg == "--engine=vm" ? Engine::VM : arg == "--engine=ast" ? Engine::AST : Engine::Tiered;
+        }
+        else if(arg.compare(0, 13, "--tier-calls=") == 0 || arg.compare(0, 13, "--tier-loops=") == 0)
+        {
+            // 0 never compiles for that reason
+            auto& threshold = arg[7] == 'c' ? tierPolicy.hotCalls_ : tierPolicy.hotLoops_;
+            auto value      = arg.substr(13);
+            auto res        = std::from_chars(value.data(), value.data() + value.size(), threshold);
+            if(res.ec != std::errc() || res.ptr != value.data() + value.size())
+            {
+                std::cerr << "Invalid tier-up threshold '" << value << "'" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--tier-stats")
+        {
+            tierStats = true;
+        }
+        else if(arg.compare(0, 12, "--max-depth=") == 0)
+        {
+            auto value = arg.substr(12);
+            auto res   = std::from_chars(value.data(), value.data() + value.size(), maxDepth);
+            if(res.ec != std::errc() || res.ptr != value.data() + value.size() || maxDepth == 0
+               || maxDepth > CallStack::MAX_MAX_DEPTH)
+            {
+                std::cerr << "Invalid call depth '" << value << "'" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg.compare(0, 10, "--threads=") == 0)
+        {
+            // 0 uses every core
+            auto value = arg.substr(10);
+            auto res   = std::from_chars(value.data(), value.data() + value.size(), threads);
+            if(res.ec != std::errc() || res.ptr != value.data() + value.size())
+            {
+                std::cerr << "Invalid thread count '" << value << "'" << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--dump")
+        {
+            dump = true;
+        }
+        else if(arg == "--bench")
+        {
+            benchmark = true;
+        }
+        else if(arg == "--jit")
+        {
+#ifdef GUU_ENABLE_JIT
+            jit = true;
+#else
+            std::cerr << "Guu was built without the JIT (GUU_ENABLE_JIT=OFF or not x86-64)" << std::endl;
+            return 1;
+#endif
+        }
+        else if(arg == "--debug")
+        {
+            debug = true;
+        }
+        else if(arg == "--profile" || arg.compare(0, 10, "--profile=") == 0)
+        {
+            profile     = true;
+            profilePath = arg.size() > 10 ? arg.substr(10) : "";
+        }
+        else if(arg == "--emit-cpp" || arg.compare(0, 11, "--emit-cpp=") == 0)
+        {
+            emitCpp = true;
+            cppPath = arg.size() > 11 ? arg.substr(11) : "";
+        }
+        else if(arg.compare(0, 11, "--snapshot=") == 0 && arg.size() > 11)
+        {
+            snapshotPath = arg.substr(11);
+        }
+        else if(arg == "--restore")
+        {
+            // The script is an image
+            restore = true;
+        }
+        else if(arg.compare(0, 8, "--trace=") == 0 && arg.size() > 8)
+        {
+            tracePath = arg.substr(8);
+        }
+        else if(arg == "--trace-statements")
+        {
+            traceStatements = true;
+        }
+        else if(arg.compare(0, 15, "--decode-trace=") == 0 && arg.size() > 15)
+        {
+            decodePath = arg.substr(15);
+        }
+        else if(!arg.empty() && arg[0] != '-')
+        {
+            path = arg;
+        }
+        else
+        {
+            std::cerr << "Unknown option '" << arg << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    if(!decodePath.empty())
+    {
         try
         {
-            auto p = Parser(Tokenizer(program));
-            ast    = p.buildAST();
-        } catch(...)
+            Tracer::decode(decodePath, std::cout);
+            return 0;
+        } catch(const std::runtime_error& e)
         {
-            std::cout << "FAIL" << std::endl;
-            throw;
+            std::cerr << "ERROR: " << e.what() << std::endl;
+            return 1;
+        } catch(const std::exception& e)
+        {
+            std::cerr << "ERROR: " << e.what() << std::endl;
+            return 1;
         }
-        std::cout << "OK" << std::endl;
+    }
+
+    if(traceStatements && tracePath.empty())
+    {
+        std::cerr << "--trace-statements needs --trace=<file>" << std::endl;
+        return 1;
+    }
+
+    if(!tracePath.empty() && engine == Engine::AST)
+    {
+        std::cerr << "Only the VM traces, not --engine=ast" << std::endl;
+        return 1;
+    }
+
+    // Saved by the VM if the run fails
+    std::unique_ptr<Tracer> tracer;
+    if(!tracePath.empty())
+        tracer = std::make_unique<Tracer>(tracePath, traceStatements);
+
+    if(restore && path.empty())
+    {
+        std::cerr << "--restore needs an image written by --snapshot" << std::endl;
+        return 1;
+    }
 
-        AST::Printer p(std::cout);
+    if(engine == Engine::Tiered
+       && (restore || benchmark || debug || profile || jit || emitCpp || !snapshotPath.empty() || !tracePath.empty()))
+    {
+        std::cerr << "--engine=tiered only runs programs, without --restore, --bench, --debug, --profile, --jit, "
+                     "--emit-cpp, --snapshot or --trace"
+                  << std::endl;
+        return 1;
+    }
 
-        p.print(*ast);
+    // The profiler, the tracer and the Debugger run the VM without native code
+    if(jit && (engine == Engine::AST || debug || profile || !tracePath.empty()))
+    {
+        std::cerr << "--jit only runs on the VM, without --engine=ast, --debug, --profile or --trace" << std::endl;
+        return 1;
+    }
 
-        // std::cout << std::endl;
-        // std::cout << "Running..." << std::endl;
-        // Interpreter interpreter(std::move(ast));
-        // interpreter.stepInto();
-        // interpreter.stepInto();
-        // interpreter.printVars();
-        // interpreter.bt();
+    if(tierStats && engine != Engine::Tiered)
+    {
+        std::cerr << "--tier-stats needs --engine=tiered" << std::endl;
+        return 1;
+    }
 
-        // std::cout << std::endl;
+    if(!snapshotPath.empty() && engine == Engine::AST)
+    {
+        std::cerr << "Only the VM saves images, not --engine=ast" << std::endl;
+        return 1;
+    }
 
-        // interpreter.stepOver();
-        // interpreter.printVars();
-        // interpreter.bt();
+    const std::string demo = R"delim(
+fn square(x: int) -> int {
+    return x * x;
+}
+
+fn unused(s: str) -> int {
+    return 0;
+}
+
+fn main(args: str[N]) -> int {
+    int x = 3;
+    int[3] y = [1,2,3];
+    str dquot_str = "some_text";
+    str[4] strings = ["struct", 'struct', "\"escaped_str\"", '\'escaped_str\''];
+    int z = x * (2 + 4) - 1;
+    str[N] argsCopy = args;
+    return square(z + 0) / -(-x);
+}
+)delim";
 
-        // interpreter.interpret();
+    // Without a script the built-in demo runs verbosely
+    bool verbose = path.empty();
+    int result   = 0;
+
+    try
+    {
+        if(restore)
+        {
+            result = exitCode(runImage(path, dump, maxDepth, jit, threads, programArgs, tracer.get()));
+        }
+        else
+        {
+            const std::string program = verbose ? demo : readFile(path);
+
+            if(verbose)
+            {
+                std::cout << "PROGRAM:" << std::endl;
+                std::cout << program << std::endl << std::endl;
+            }
+
+            // The parser pulls tokens lazily, so lexing alone is only measured on request
+            if(statsFormat != StatsFormat::None)
+            {
+                GUU_STATS_PHASE("lex");
+
+                Tokenizer t(program);
+                while(t.getNext().type_ != TokenType::END)
+                {
+                }
+            }
+
+            auto step = [verbose](const char* name, auto&& fn) {
+                if(verbose)
+                    std::cout << name << "...";
+
+                try
+                {
+                    fn();
+                } catch(...)
+                {
+                    if(verbose)
+                        std::cout << "FAIL" << std::endl;
+                    throw;
+                }
+
+                if(verbose)
+                    std::cout << "OK" << std::endl;
+            };
+
+            std::unique_ptr<AST::Node> ast;
+            step("Parsing", [&] {
+                GUU_STATS_PHASE("parse");
+
+                auto p = Parser(Tokenizer(program));
+                ast    = p.buildAST();
+            });
+
+            TypeTable types;
+            step("Resolving", [&] {
+                GUU_STATS_PHASE("resolve");
+
+                Resolver(types).resolve(*ast);
+            });
+
+            // The tiers build what they need themselves
+            bool tiered = engine == Engine::Tiered;
+            tierPolicy.optLevel_ = optLevel;
+
+            if(optLevel > 0 && !tiered)
+            {
+                Optimizer optimizer(types, optLevel);
+                step(("Optimizing (-O" + std::to_string(optLevel) + ")").c_str(), [&] {
+                    GUU_STATS_PHASE("optimize");
+                    optimizer.run(*ast);
+                });
+
+                if(verbose)
+                    optimizer.printStats(std::cout);
+            }
+
+            // Both the interpreter and the VM run them in place of the caller
+            step("Tail calls", [&] {
+                GUU_STATS_PHASE("tail calls");
+
+                TailCalls().run(*ast);
+            });
+
+            // Also at -O0: regions are how the VM manages memory, not an optimization
+            Bytecode::Module module;
+            if(!tiered)
+            {
+                step("Escape analysis", [&] {
+                    GUU_STATS_PHASE("escape");
+
+                    EscapeAnalysis(types).run(*ast);
+                });
+
+                step("Compiling", [&] {
+                    GUU_STATS_PHASE("compile");
+
+                    module = Compiler(types).compile(*ast);
+                });
+            }
+
+            if(verbose || dump)
+            {
+                GUU_STATS_PHASE("print");
+
+                AST::Printer p(std::cout);
+                p.print(*ast);
+
+                std::cout << std::endl;
+                module.dump(std::cout);
+            }
+
+            if(emitCpp)
+            {
+                GUU_STATS_PHASE("emit");
+
+                writeCpp(*ast, types, cppPath);
+            }
+            else if(benchmark)
+            {
+                result = bench(*ast, types, module, jit, threads, programArgs);
+            }
+            else if(debug)
+            {
+                // Debugger commands come from stdin, see DebugSession
+                result = DebugSession(module, std::cin, std::cout).run(programArgs, maxDepth);
+            }
+            else
+            {
+                Value value;
+                {
+                    GUU_STATS_PHASE("execute");
+
+                    if(engine == Engine::VM && profile)
+                    {
+                        value = runProfiled(module, maxDepth, programArgs, profilePath);
+                    }
+                    else if(engine == Engine::VM)
+                    {
+                        value = runVM(module, std::cout, maxDepth, jit, threads, programArgs, snapshotPath, nullptr,
+                                      tracer.get());
+                    }
+                    else if(engine == Engine::Tiered)
+                    {
+                        value = runTiered(*ast, types, program, std::cout, tierPolicy, maxDepth, threads, programArgs,
+                                          tierStats);
+                    }
+                    else
+                    {
+                        value = Interpreter(*ast, types, std::cout).run(programArgs);
+                    }
+                }
+
+                if(verbose)
+                {
+                    std::cout << "Result: ";
+                    printValue(std::cout, value);
+                    std::cout << std::endl;
+                }
+                else
+                {
+                    result = exitCode(value);
+                }
+            }
+        }
     } catch(const std::runtime_error& e)
     {
         std::cerr << "ERROR: " << e.what() << std::endl;
+        result = 1;
+    } catch(const std::exception& e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        result = 1;
     }
 
-    return 0;
+#ifdef GUU_ENABLE_STATS
+    if(statsFormat == StatsFormat::Text)
+    {
+        std::cerr << std::endl;
+        Stats::Registry::instance().printText(std::cerr);
+    }
+    else if(statsFormat == StatsFormat::Json)
+    {
+        Stats::Registry::instance().printJson(std::cerr);
+    }
+#endif
+
+    return result;
 }
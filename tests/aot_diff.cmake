@@ -0,0 +1,19 @@
+# Differential test of an ahead of time compiled program: runs SCRIPT on the
+# AST interpreter and BIN, built from it by guu_add_executable, and fails
+# unless both print the same, report the same error and exit with the same
+# code. Invoked by CTest with -P.
+#
+#   -DGUU=<Guu> -DBIN=<executable> -DSCRIPT=<script.guu> [-DARGS=<program arguments>]
+
+separate_arguments(ARGS)
+
+execute_process(COMMAND ${GUU} --engine=ast ${SCRIPT} ${ARGS}
+                OUTPUT_VARIABLE expectedOut ERROR_VARIABLE expectedErr RESULT_VARIABLE expectedRc)
+execute_process(COMMAND ${BIN} ${ARGS}
+                OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+
+if(NOT out STREQUAL expectedOut OR NOT err STREQUAL expectedErr OR NOT rc STREQUAL expectedRc)
+    message(FATAL_ERROR "${BIN} disagrees with the interpreter on ${SCRIPT}\n"
+                        "interpreter (exit ${expectedRc}):\n${expectedOut}${expectedErr}\n"
+                        "native (exit ${rc}):\n${out}${err}")
+endif()
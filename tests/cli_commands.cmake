@@ -0,0 +1,92 @@
+# Runs the subcommands of Guu on SCRIPT, which prints fib(27) and returns 0, on a script with a
+# syntax error and on a missing file, and a language server session, and fails
+# unless every one exits with its code and prints what it should. Invoked by
+# CTest with -P.
+#
+#   -DGUU=<Guu> -DSCRIPT=<script.guu> -DDIR=<scratch directory>
+
+file(MAKE_DIRECTORY ${DIR})
+set(bad ${DIR}/bad.guu)
+file(WRITE ${bad} "fn main() -> int {\n    return 1 +;\n}\n")
+set(empty ${DIR}/empty.guu)
+file(WRITE ${empty} "")
+set(newline ${DIR}/newline.guu)
+file(WRITE ${newline} "\n")
+set(short ${DIR}/short.guu)
+file(WRITE ${short} "fn m(\n")
+set(huge ${DIR}/huge.guu)
+file(WRITE ${huge} "fn main() -> int {\n    int n = 9000000000000000000;\n    int[n] a;\n    return len(a);\n}\n")
+set(three ${DIR}/three.guu)
+file(WRITE ${three} "fn main() -> int {\n    print(7);\n    return 3;\n}\n")
+
+# Exit code, then a regex stdout and stderr together must match
+function(expect code regex)
+    execute_process(COMMAND ${GUU} ${ARGN} OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+    if(NOT rc EQUAL ${code} OR NOT "${out}${err}" MATCHES "${regex}")
+        string(REPLACE ";" " " cmd "${ARGN}")
+        message(FATAL_ERROR "'Guu ${cmd}' exited with ${rc} rather than ${code}, or lacks '${regex}':\n${out}${err}")
+    endif()
+endfunction()
+
+expect(0 "^$" parse ${SCRIPT})
+expect(0 "^$" check -O0 ${SCRIPT})
+expect(0 "FnDef id = 'main'.*fn main" dump ${SCRIPT})
+expect(0 "^196418\n$" run ${SCRIPT})
+expect(0 "^196418\n$" run --engine=ast ${SCRIPT})
+
+# Timings on stderr for every phase up to execute, and the median of bench
+expect(0 "3 runs after 2 warmups\nphase.*\nread .*\nparse .*\nresolve .*execute .*\ntotal "
+       run --time --repeat 3 --warmup=2 ${SCRIPT})
+expect(0 "${SCRIPT}: 10 runs after 1 warmup\n.*median ms.*\nexecute .*\ntotal " bench ${SCRIPT})
+
+expect(3 "ERROR: .*bad.guu: Unexpected token in line 2" check ${bad})
+expect(4 "ERROR: .*missing.guu: Cannot open" parse ${DIR}/missing.guu)
+expect(4 "ERROR: .*: Cannot read '${DIR}'" parse ${DIR})
+
+# Texts short enough to be kept inline by std::string report what the Parser found
+expect(3 "ERROR: .*empty.guu: Unexpected token in line 1 .*Actual = END" parse ${empty})
+expect(3 "ERROR: .*newline.guu: Unexpected token in line 2 .*Actual = END" parse ${newline})
+expect(3 "ERROR: .*short.guu: Unexpected token in line 2 .*Actual = EOL" parse ${short})
+
+expect(1 "ERROR: .*huge.guu: Array size 9000000000000000000 is too large in 'main' on line 3" run ${huge})
+expect(1 "ERROR: .*huge.guu: Array size 9000000000000000000 is too large in 'main' on line 3" run --engine=ast ${huge})
+
+# Only a single file exits with the result of its main
+expect(3 "^7\n$" run ${three})
+expect(0 "^7\n196418\n$" run ${three} ${SCRIPT})
+
+# Every file is processed, the first failure decides
+expect(3 "bad.guu.*missing.guu" parse ${bad} ${DIR}/missing.guu ${SCRIPT})
+
+expect(2 "usage: Guu <command>" run)
+expect(2 "Unknown option '--nope'" run --nope ${SCRIPT})
+expect(2 "Invalid repeat count '0'" bench --repeat=0 ${SCRIPT})
+expect(2 "Invalid call depth '100000000000000'" run --max-depth=100000000000000 ${SCRIPT})
+
+# A language server session on stdin, which publishes the syntax error of bad.guu
+function(lsp_message var json)
+    string(LENGTH "${json}" length)
+    set(${var} "${${var}}Content-Length: ${length}\r\n\r\n${json}" PARENT_SCOPE)
+endfunction()
+
+set(session "")
+lsp_message(session [[{"jsonrpc":"2.0","id":1,"method":"initialize","params":{"capabilities":{}}}]])
+lsp_message(session [[{"jsonrpc":"2.0","method":"textDocument/didOpen","params":{"textDocument":
+                      {"uri":"file:///bad.guu","text":"fn main() -> int {\n    return 1 +;\n}\n"}}}]])
+lsp_message(session [[{"jsonrpc":"2.0","id":2,"method":"shutdown"}]])
+lsp_message(session [[{"jsonrpc":"2.0","method":"exit"}]])
+file(WRITE ${DIR}/lsp.in "${session}")
+
+execute_process(COMMAND ${GUU} lsp INPUT_FILE ${DIR}/lsp.in OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0 OR NOT out MATCHES "\"definitionProvider\":true.*\"line\":1,.*Unexpected token in line 2.*\"id\":2,\"result\":null")
+    message(FATAL_ERROR "'Guu lsp' exited with ${rc} rather than 0, or answered wrong:\n${out}${err}")
+endif()
+
+expect(2 "Unknown option '--nope'" lsp --nope)
+
+# A Content-Length no message could have is refused rather than allocated
+file(WRITE ${DIR}/lsp_huge.in "Content-Length: 99999999999999999\r\n\r\n{}")
+execute_process(COMMAND ${GUU} lsp INPUT_FILE ${DIR}/lsp_huge.in OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+if(NOT rc EQUAL 1 OR NOT out MATCHES "\"code\":-32600,\"message\":\"A message of 99999999999999999 bytes")
+    message(FATAL_ERROR "'Guu lsp' exited with ${rc} rather than 1, or answered wrong:\n${out}${err}")
+endif()
@@ -0,0 +1,24 @@
+# Differential test: generates COUNT programs with GEN and runs each through
+# `GUU --bench FLAGS`, which fails unless the AST interpreter and the VM
+# agree on the output and the result. Invoked by CTest with -P.
+#
+#   -DGUU=<Guu> -DGEN=<gen_program> -DDIR=<scratch dir> -DCOUNT=<n> [-DFLAGS=<options>]
+
+file(MAKE_DIRECTORY ${DIR})
+separate_arguments(FLAGS)
+
+foreach(seed RANGE 1 ${COUNT})
+    set(program ${DIR}/program_${seed}.guu)
+    execute_process(COMMAND ${GEN} ${seed} OUTPUT_FILE ${program} RESULT_VARIABLE rc)
+    if(NOT rc EQUAL 0)
+        message(FATAL_ERROR "Generating ${program} failed")
+    endif()
+
+    foreach(opt -O0 -O1)
+        execute_process(COMMAND ${GUU} --bench ${FLAGS} ${opt} ${program}
+                        OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+        if(NOT rc EQUAL 0)
+            message(FATAL_ERROR "${program} ${opt} ${FLAGS}:\n${out}${err}")
+        endif()
+    endforeach()
+endforeach()
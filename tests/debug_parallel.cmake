@@ -0,0 +1,24 @@
+# Debugs SCRIPT, tests/parallel_calls.guu, stopping in the body of the
+# parallel loop and in the joined task, and fails unless the backtraces end in
+# main on the line waiting for them and `finish` stops right after the loop.
+# Invoked by CTest with -P.
+#
+#   -DGUU=<Guu> -DSCRIPT=<script.guu> -DDIR=<scratch directory>
+
+file(MAKE_DIRECTORY ${DIR})
+file(WRITE ${DIR}/debug.in "break 15\nrun\nbt\nclear 15\nfinish\nbreak 5\ncontinue\nbt\nclear 5\ncontinue\n")
+
+execute_process(COMMAND ${GUU} --debug ${SCRIPT} INPUT_FILE ${DIR}/debug.in
+                OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "Debugging ${SCRIPT} failed (exit ${rc}):\n${out}${err}")
+endif()
+
+foreach(expected "stopped breakpoint main 15\nframe #0 main line 15\nframe #1 main line 14\n"
+                 "stopped step main 17\n"
+                 "stopped breakpoint work 5\nframe #0 work line 5\nframe #1 main line 18\n"
+                 "exited 0\n")
+    if(NOT out MATCHES "${expected}")
+        message(FATAL_ERROR "The session lacks '${expected}':\n${out}${err}")
+    endif()
+endforeach()
@@ -0,0 +1,142 @@
+// Compiles one Program and runs it in many Contexts on as many threads at
+// once, each with arguments of its own. Fails unless every run prints and
+// returns what a run on its own does, errors included.
+//
+// Usage: embed_contexts
+
+#include "../guu/engine.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+const char* const SOURCE = R"(fn describe(words: str[N], k: int) -> str {
+    str s = "";
+    int i = 0;
+    while i < len(words) {
+        s = s + words[i] + "-" + "constant-string-shared-by-every-context";
+        i = i + 1;
+    }
+    if k % 7 == 6 {
+        int[2] a = [1, 2];
+        return words[a[k]];
+    }
+    return s;
+}
+
+fn main(args: str[N]) -> int {
+    int total = 0;
+    int round = 0;
+    while round < 20 {
+        str d = describe(args, round + len(args));
+        total = total + len(d);
+        round = round + 1;
+    }
+    print(total);
+    print(args);
+    return total % 100;
+}
+)";
+
+constexpr int THREADS = 8;
+constexpr int RUNS    = 50;
+
+struct Outcome
+{
+    std::string out_;
+    std::string error_;
+    std::string result_;
+
+    bool operator==(const Outcome& o) const
+    {
+        return out_ == o.out_ && error_ == o.error_ && result_ == o.result_;
+    }
+};
+
+std::vector<std::string> argsFor(int n)
+{
+    std::vector<std::string> args;
+    for(int i = 0; i < n % 5 + 1; ++i)
+    {
+        args.push_back("arg" + std::to_string(n) + "_" + std::to_string(i));
+    }
+    return args;
+}
+
+Outcome run(Guu::Context& context, std::ostringstream& out, int n)
+{
+    out.str("");
+
+    Outcome outcome;
+    try
+    {
+        std::ostringstream result;
+        Guu::printValue(result, context.run(argsFor(n)));
+        outcome.result_ = result.str();
+    } catch(const std::runtime_error& e)
+    {
+        outcome.error_ = e.what();
+    }
+
+    outcome.out_ = out.str();
+    return outcome;
+}
+
+}
+
+int main()
+{
+    auto program = std::make_shared<const Guu::Program>(SOURCE);
+
+    std::vector<Outcome> expected;
+    for(int n = 0; n < RUNS; ++n)
+    {
+        std::ostringstream out;
+        Guu::Context context(program, out);
+        expected.push_back(run(context, out, n));
+    }
+
+    std::vector<int> failures(THREADS);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < THREADS; ++t)
+    {
+        threads.emplace_back([&, t] {
+            // One Context reused for every run and a fresh one per run
+            std::ostringstream out;
+            Guu::Context reused(program, out);
+
+            for(int k = 0; k < RUNS; ++k)
+            {
+                int n = (k + t * 7) % RUNS;
+
+                std::ostringstream freshOut;
+                Guu::Context fresh(program, freshOut);
+
+                if(!(run(reused, out, n) == expected[n]) || !(run(fresh, freshOut, n) == expected[n]))
+                    ++failures[t];
+            }
+        });
+    }
+
+    int failed = 0;
+    for(int t = 0; t < THREADS; ++t)
+    {
+        threads[t].join();
+        failed += failures[t];
+    }
+
+    if(failed)
+    {
+        std::cerr << failed << " runs disagree with a run on its own" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,341 @@
+// Writes a random, always terminating and error-free Guu program for a seed
+// to stdout. Used by the corpus tests to compare the engines on code nobody
+// wrote by hand: int arithmetic with wrap-around, division by -1, arrays,
+// strings, nested loops and calls.
+//
+// Usage: gen_program SEED
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// splitmix64, identical on every platform unlike the <random> distributions
+class Rng
+{
+public:
+    explicit Rng(std::uint64_t seed) : state_(seed)
+    {
+    }
+
+    std::uint64_t next()
+    {
+        std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+        z               = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z               = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // In [lo, hi]
+    int range(int lo, int hi)
+    {
+        return lo + static_cast<int>(next() % static_cast<std::uint64_t>(hi - lo + 1));
+    }
+
+    bool chance(int percent)
+    {
+        return range(1, 100) <= percent;
+    }
+
+private:
+    std::uint64_t state_;
+};
+
+struct ArrayVar
+{
+    std::string name_;
+    int size_;
+};
+
+struct Scope
+{
+    std::vector<std::string> ints_;
+    std::vector<std::string> counters_;
+    std::vector<ArrayVar> arrays_;
+    std::vector<std::string> strs_;
+};
+
+struct Fn
+{
+    std::string name_;
+    int params_;
+};
+
+class Generator
+{
+public:
+    explicit Generator(std::uint64_t seed) : rng_(seed)
+    {
+    }
+
+    std::string program()
+    {
+        int count = rng_.range(1, 4);
+        for(int k = 0; k < count; ++k)
+            function("f" + std::to_string(k), rng_.range(1, 3), false);
+
+        function("main", 0, true);
+        return out_.str();
+    }
+
+private:
+    void function(const std::string& name, int params, bool isMain)
+    {
+        Scope scope;
+        nextVar_ = 0;
+
+        out_ << "fn " << name << "(";
+        for(int p = 0; p < params; ++p)
+        {
+            std::string param = "p" + std::to_string(p);
+            out_ << (p ? ", " : "") << param << ": int";
+            scope.ints_.push_back(param);
+        }
+        out_ << ") -> int {\n";
+
+        isMain_ = isMain;
+        if(isMain)
+        {
+            // A hot loop calling everything, so every function gets compiled by the JIT
+            out_ << "    int acc = 0;\n";
+            out_ << "    int round = 0;\n";
+            out_ << "    while round < " << rng_.range(20, 60) << " {\n";
+            scope.ints_.push_back("acc");
+            scope.counters_.push_back("round");
+
+            for(const auto& fn: fns_)
+            {
+                out_ << "        acc = acc + " << call(fn, scope, 0) << ";\n";
+            }
+            block(scope, 2, 1, rng_.range(2, 5));
+
+            out_ << "        round = round + 1;\n";
+            out_ << "    }\n";
+            out_ << "    print(acc);\n";
+            block(scope, 1, 0, rng_.range(1, 4));
+            out_ << "    return acc % 100;\n";
+        }
+        else
+        {
+            block(scope, 1, 0, rng_.range(3, 8));
+            out_ << "    return " << intExpr(scope, 0) << ";\n";
+        }
+        out_ << "}\n\n";
+
+        if(!isMain)
+            fns_.push_back(Fn{name, params});
+    }
+
+    void block(Scope scope, int indent, int loops, int statements)
+    {
+        for(int k = 0; k < statements; ++k)
+            statement(scope, indent, loops);
+    }
+
+    void statement(Scope& scope, int indent, int loops)
+    {
+        std::string pad(static_cast<size_t>(indent) * 4, ' ');
+
+        switch(rng_.range(0, 9))
+        {
+            case 0:
+            case 1: {
+                std::string v = var("v");
+                out_ << pad << "int " << v << " = " << intExpr(scope, 0) << ";\n";
+                scope.ints_.push_back(v);
+                break;
+            }
+            case 2:
+            case 3: {
+                if(scope.ints_.empty())
+                    return statement(scope, indent, loops);
+
+                out_ << pad << pick(scope.ints_) << " = " << intExpr(scope, 0) << ";\n";
+                break;
+            }
+            case 4: {
+                out_ << pad << "if " << cond(scope) << " {\n";
+                block(scope, indent + 1, loops, rng_.range(1, 3));
+                if(rng_.chance(50))
+                {
+                    out_ << pad << "} else {\n";
+                    block(scope, indent + 1, loops, rng_.range(1, 3));
+                }
+                out_ << pad << "}\n";
+                break;
+            }
+            case 5: {
+                if(loops >= 2)
+                    return statement(scope, indent, loops);
+
+                // Counters are never assigned in the body, so every loop ends
+                std::string i = var("i");
+                out_ << pad << "int " << i << " = 0;\n";
+                out_ << pad << "while " << i << " < " << rng_.range(1, 10) << " {\n";
+
+                Scope inner = scope;
+                inner.counters_.push_back(i);
+                block(inner, indent + 1, loops + 1, rng_.range(1, 4));
+
+                out_ << pad << "    " << i << " = " << i << " + 1;\n";
+                out_ << pad << "}\n";
+                break;
+            }
+            case 6: {
+                ArrayVar a{var("a"), rng_.range(1, 8)};
+                out_ << pad << "int[" << a.size_ << "] " << a.name_ << ";\n";
+                scope.arrays_.push_back(a);
+                break;
+            }
+            case 7: {
+                if(scope.arrays_.empty())
+                    return statement(scope, indent, loops);
+
+                const auto& a = pick(scope.arrays_);
+                out_ << pad << a.name_ << "[" << index(scope, a) << "] = " << intExpr(scope, 0) << ";\n";
+                break;
+            }
+            case 8: {
+                std::string s = var("s");
+                out_ << pad << "str " << s << " = \"" << word() << "\";\n";
+                scope.strs_.push_back(s);
+                break;
+            }
+            case 9: {
+                // Only main prints, the output is compared as a whole
+                if(!isMain_)
+                    return statement(scope, indent, loops);
+
+                out_ << pad << "print(" << intExpr(scope, 0) << ");\n";
+                break;
+            }
+        }
+    }
+
+    std::string intExpr(const Scope& scope, int depth)
+    {
+        int choice = depth > 3 ? rng_.range(0, 2) : rng_.range(0, 12);
+        switch(choice)
+        {
+            case 0: return std::to_string(rng_.range(0, 100));
+            case 1:
+            case 2: {
+                auto vars = readable(scope);
+                return vars.empty() ? std::to_string(rng_.range(0, 9)) : pick(vars);
+            }
+            case 3:
+            case 4:
+            case 5: {
+                static const char* const ops[] = {"+", "-", "*"};
+                return "(" + intExpr(scope, depth + 1) + " " + ops[rng_.range(0, 2)] + " " + intExpr(scope, depth + 1)
+                       + ")";
+            }
+            case 6: {
+                // Constant divisors only, -1 included for the wrap-around case
+                static const int divisors[] = {-7, -1, 1, 2, 3, 5, 9};
+                return "(" + intExpr(scope, depth + 1) + (rng_.chance(50) ? " / " : " % ") + "("
+                       + std::to_string(divisors[rng_.range(0, 6)]) + "))";
+            }
+            case 7: return "(" + cond(scope) + ")";
+            case 8: return "-(" + intExpr(scope, depth + 1) + ")";
+            case 9: {
+                if(scope.arrays_.empty())
+                    return "9223372036854775807";
+
+                const auto& a = pick(scope.arrays_);
+                return rng_.chance(70) ? a.name_ + "[" + index(scope, a) + "]" : "len(" + a.name_ + ")";
+            }
+            case 10: {
+                if(scope.strs_.empty())
+                    return "len(\"" + word() + "\")";
+
+                return "len(" + pick(scope.strs_) + ")";
+            }
+            default: {
+                // Calls from other functions would multiply the running time
+                if(fns_.empty() || !isMain_)
+                    return std::to_string(rng_.range(0, 50));
+
+                return call(pick(fns_), scope, depth + 1);
+            }
+        }
+    }
+
+    std::string cond(const Scope& scope)
+    {
+        static const char* const cmps[] = {"<", "<=", ">", ">=", "==", "!="};
+        const char* op = cmps[rng_.range(0, 5)];
+
+        // Strings only compare for equality
+        if(!scope.strs_.empty() && rng_.chance(25))
+            return pick(scope.strs_) + (rng_.chance(50) ? " == \"" : " != \"") + word() + "\"";
+
+        return intExpr(scope, 2) + " " + op + " " + intExpr(scope, 2);
+    }
+
+    // Always in bounds: ((e % n) + n) % n
+    std::string index(const Scope& scope, const ArrayVar& a)
+    {
+        std::string n = std::to_string(a.size_);
+        return "((" + intExpr(scope, 2) + " % " + n + ") + " + n + ") % " + n;
+    }
+
+    std::string call(const Fn& fn, const Scope& scope, int depth)
+    {
+        std::string s = fn.name_ + "(";
+        for(int p = 0; p < fn.params_; ++p)
+            s += (p ? ", " : "") + intExpr(scope, depth + 2);
+
+        return s + ")";
+    }
+
+    std::vector<std::string> readable(const Scope& scope) const
+    {
+        auto vars = scope.ints_;
+        vars.insert(vars.end(), scope.counters_.begin(), scope.counters_.end());
+        return vars;
+    }
+
+    std::string word()
+    {
+        static const char* const words[] = {"", "a", "ab", "abc", "b", "ba", "guu", "z"};
+        return words[rng_.range(0, 7)];
+    }
+
+    std::string var(const char* prefix)
+    {
+        return prefix + std::to_string(nextVar_++);
+    }
+
+    template <typename T>
+    const T& pick(const std::vector<T>& v)
+    {
+        return v[static_cast<size_t>(rng_.range(0, static_cast<int>(v.size()) - 1))];
+    }
+
+private:
+    Rng rng_;
+    std::ostringstream out_;
+    std::vector<Fn> fns_;
+    int nextVar_ = 0;
+    bool isMain_ = false;
+};
+
+}
+
+int main(int argc, char** argv)
+{
+    if(argc != 2)
+    {
+        std::cerr << "Usage: gen_program SEED" << std::endl;
+        return 1;
+    }
+
+    std::cout << Generator(std::strtoull(argv[1], nullptr, 10)).program();
+    return 0;
+}
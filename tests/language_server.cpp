@@ -0,0 +1,346 @@
+// Drives the LanguageServer through a session on a generated file of 100k
+// lines: opening it, editing a function body, breaking and fixing it,
+// renaming a function its caller depends on, symbols and definitions. Fails
+// unless every response is right, every edit only parses the chunk it touches
+// and resolves what depends on it, and the median of several edits and of
+// several definition requests answers within TARGET_MS, of several symbol
+// requests within SYMBOLS_TARGET_MS. The times are only checked in optimized
+// builds, other builds report them.
+//
+// Usage: language_server
+
+#include "../guu/language_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../util/json.h"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int FUNCTIONS      = 5000;
+constexpr int FUNCTION_LINES = 20;
+constexpr int TIMED_RUNS     = 10;
+constexpr double TARGET_MS   = 5;
+
+// The symbols of every function make a megabyte of JSON that takes its time to write
+constexpr double SYMBOLS_TARGET_MS = 20;
+
+// GUU_BUILD_TYPE is the $<CONFIG> of the build, empty without a CMAKE_BUILD_TYPE
+bool optimized()
+{
+    std::string_view type = GUU_BUILD_TYPE;
+    return type == "Release" || type == "RelWithDebInfo" || type == "MinSizeRel";
+}
+
+const char* const URI = "file:///big.guu";
+
+// FUNCTIONS functions of FUNCTION_LINES lines, each calling the one before, and main
+std::string bigProgram()
+{
+    std::string s;
+    for(int i = 0; i < FUNCTIONS; ++i)
+    {
+        std::string n    = std::to_string(i);
+        std::string call = i ? "f" + std::to_string(i - 1) + "(b % 10)" : "b";
+
+        s += "fn f" + n + "(n: int) -> int {\n";
+        s += "    int a = n + " + n + ";\n";
+        s += "    int b = a * 2;\n";
+        s += "    if b > 100 {\n";
+        s += "        b = b - 100;\n";
+        s += "    } else {\n";
+        s += "        b = b + 1;\n";
+        s += "    }\n";
+        s += "    while a > 0 {\n";
+        s += "        a = a - 1;\n";
+        s += "        b = b + a % 3;\n";
+        s += "    }\n";
+        s += "    str s = \"f" + n + "\";\n";
+        s += "    int[4] xs = [1, 2, 3, 4];\n";
+        s += "    xs[0] = b + len(s);\n";
+        s += "    int c = xs[0] - xs[1];\n";
+        s += "    print(c);\n";
+        s += "    return " + call + " + c;\n";
+        s += "}\n";
+        s += "\n";
+    }
+
+    // U+1F600 takes 4 bytes and 2 UTF-16 units, é 2 bytes and 1 unit
+    s += "fn main() -> int {\n";
+    s += "    str greeting = \"h\xC3\xA9llo\";\n";
+    s += "    str both = \"\xF0\x9F\x98\x80\" + greeting;\n";
+    s += "    print(both);\n";
+    s += "    return f" + std::to_string(FUNCTIONS - 1) + "(1);\n";
+    s += "}\n";
+    return s;
+}
+
+size_t lineOf(int fn, int line)
+{
+    return static_cast<size_t>(fn * FUNCTION_LINES + line);
+}
+
+// One LanguageServer fed a message at a time, with its output and log of each
+class Session
+{
+public:
+    Session() : server_(in_, out_)
+    {
+        server_.setLog(&log_);
+    }
+
+    std::vector<util::Json> send(const util::JsonWriter& msg, double* ms = nullptr)
+    {
+        in_.clear();
+        in_.str("Content-Length: " + std::to_string(msg.str().size()) + "\r\n\r\n" + msg.str());
+        out_.str("");
+        log_.str("");
+
+        auto start = Clock::now();
+        server_.run();
+        if(ms)
+            *ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::vector<util::Json> result;
+        std::string out = out_.str();
+        for(size_t pos = out.find("Content-Length: "); pos != std::string::npos;
+            pos         = out.find("Content-Length: ", pos))
+        {
+            size_t length = std::stoul(out.substr(pos + 16));
+            size_t body   = out.find("\r\n\r\n", pos) + 4;
+            result.push_back(util::Json::parse(out.substr(body, length)));
+            pos = body + length;
+        }
+        return result;
+    }
+
+    std::string log() const
+    {
+        return log_.str();
+    }
+
+private:
+    std::stringstream in_;
+    std::ostringstream out_;
+    std::ostringstream log_;
+    Guu::LanguageServer server_;
+};
+
+int failures = 0;
+
+void check(bool ok, const std::string& what)
+{
+    if(!ok)
+    {
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+}
+
+util::JsonWriter request(int id, const char* method)
+{
+    util::JsonWriter w;
+    w.beginObject().field("jsonrpc", "2.0").field("id", id).field("method", method).key("params").beginObject();
+    return w;
+}
+
+util::JsonWriter notification(const char* method)
+{
+    util::JsonWriter w;
+    w.beginObject().field("jsonrpc", "2.0").field("method", method).key("params").beginObject();
+    return w;
+}
+
+util::JsonWriter& position(util::JsonWriter& w, size_t line, size_t character)
+{
+    return w.beginObject().field("line", line).field("character", character).endObject();
+}
+
+util::JsonWriter change(size_t line, size_t col, size_t endLine, size_t endCol, const std::string& text)
+{
+    auto w = notification("textDocument/didChange");
+    w.key("textDocument").beginObject().field("uri", URI).endObject();
+    w.key("contentChanges").beginArray().beginObject().key("range").beginObject().key("start");
+    position(w, line, col).key("end");
+    position(w, endLine, endCol).endObject().field("text", text).endObject().endArray();
+    w.endObject().endObject();
+    return w;
+}
+
+util::JsonWriter definitionAt(int id, size_t line, size_t character)
+{
+    auto w = request(id, "textDocument/definition");
+    w.key("textDocument").beginObject().field("uri", URI).endObject().key("position");
+    position(w, line, character).endObject().endObject();
+    return w;
+}
+
+// The diagnostics of the only message, a publishDiagnostics
+std::vector<util::Json> diagnosticsOf(const std::vector<util::Json>& msgs)
+{
+    if(msgs.size() != 1 || msgs[0]["method"].asString() != "textDocument/publishDiagnostics")
+        return {util::Json()};
+
+    return msgs[0]["params"]["diagnostics"].elements();
+}
+
+bool definedAt(const std::vector<util::Json>& msgs, size_t line, size_t character)
+{
+    if(msgs.size() != 1)
+        return false;
+
+    const auto& start = msgs[0]["result"]["range"]["start"];
+    return start["line"].asInt() == static_cast<std::int64_t>(line)
+        && start["character"].asInt() == static_cast<std::int64_t>(character);
+}
+
+bool logged(const Session& s, const std::string& text)
+{
+    if(s.log().find(text) != std::string::npos)
+        return true;
+
+    std::cerr << s.log();
+    return false;
+}
+
+void report(const char* what, std::vector<double> ms, double target)
+{
+    std::sort(ms.begin(), ms.end());
+    std::cout << what << ": fastest " << ms.front() << " ms, median " << ms[ms.size() / 2] << " ms" << std::endl;
+    if(optimized())
+        check(ms[ms.size() / 2] < target, std::string(what) + " within " + std::to_string(target) + " ms");
+}
+
+}
+
+int main()
+{
+    Session s;
+
+    auto init = request(1, "initialize");
+    init.key("capabilities").beginObject().endObject().endObject().endObject();
+    auto msgs = s.send(init);
+    check(msgs.size() == 1 && msgs[0]["result"]["capabilities"]["positionEncoding"].asString() == "utf-16",
+          "initialize answers with UTF-16 positions");
+
+    // Opening parses and resolves everything once
+    std::string text = bigProgram();
+    auto open        = notification("textDocument/didOpen");
+    open.key("textDocument").beginObject().field("uri", URI).field("text", text).endObject().endObject().endObject();
+
+    double ms = 0;
+    msgs      = s.send(open, &ms);
+    std::cout << "didOpen of " << FUNCTIONS * FUNCTION_LINES << " lines: " << ms << " ms" << std::endl;
+    check(diagnosticsOf(msgs).empty(), "the generated program has no errors");
+
+    std::string chunks = " of " + std::to_string(FUNCTIONS + 1) + " chunks";
+    int target         = FUNCTIONS / 2;
+
+    // Typing a statement into a body and taking it out again touches that body alone
+    std::vector<double> edits;
+    for(int i = 0; i < TIMED_RUNS; ++i)
+    {
+        std::string statement = "    int added = f" + std::to_string(target - 1) + "(a);\n";
+        msgs                  = s.send(change(lineOf(target, 2), 0, lineOf(target, 2), 0, statement), &ms);
+        edits.push_back(ms);
+        check(diagnosticsOf(msgs).empty(), "inserting a statement");
+        check(logged(s, "parsed 1" + chunks + ", resolved 1\n"), "inserting reparses and resolves one chunk");
+
+        msgs = s.send(change(lineOf(target, 2), 0, lineOf(target, 3), 0, ""), &ms);
+        edits.push_back(ms);
+        check(diagnosticsOf(msgs).empty(), "removing a statement");
+    }
+
+    // A missing semicolon is reported on its line, and the function is gone for its caller until it parses again
+    msgs      = s.send(change(lineOf(target, 2), 17, lineOf(target, 2), 18, ""));
+    auto diag = diagnosticsOf(msgs);
+    check(diag.size() == 2 && diag[0]["range"]["start"]["line"].asInt() == static_cast<int>(lineOf(target, 2))
+              && diag[1]["message"].asString()
+                     == "Unknown function 'f" + std::to_string(target) + "' on line "
+                            + std::to_string(lineOf(target + 1, 17) + 1),
+          "a syntax error is reported in its function and its caller");
+    check(logged(s, "parsed 1" + chunks + ", resolved 2\n"), "a syntax error resolves the function and its caller");
+
+    msgs = s.send(change(lineOf(target, 2), 17, lineOf(target, 2), 17, ";"));
+    check(diagnosticsOf(msgs).empty(), "fixing the syntax error");
+
+    // Renaming a function breaks its caller, only the two are resolved again
+    msgs = s.send(change(lineOf(100, 0), 3, lineOf(100, 0), 7, "g100"));
+    diag = diagnosticsOf(msgs);
+    check(diag.size() == 1 && diag[0]["message"].asString() == "Unknown function 'f100' on line "
+                                                                   + std::to_string(lineOf(101, 17) + 1),
+          "renaming a function reports its caller");
+    check(logged(s, "parsed 1" + chunks + ", resolved 2\n"), "renaming resolves the function and its caller");
+
+    msgs = s.send(change(lineOf(100, 0), 3, lineOf(100, 0), 7, "f100"));
+    check(diagnosticsOf(msgs).empty(), "renaming the function back");
+
+    // Symbols of every function
+    auto symbols = request(2, "textDocument/documentSymbol");
+    symbols.key("textDocument").beginObject().field("uri", URI).endObject().endObject().endObject();
+
+    std::vector<double> symbolTimes;
+    for(int i = 0; i < TIMED_RUNS; ++i)
+    {
+        msgs = s.send(symbols, &ms);
+        symbolTimes.push_back(ms);
+    }
+    check(msgs.size() == 1 && msgs[0]["result"].elements().size() == FUNCTIONS + 1, "a symbol per function");
+    if(msgs.size() == 1 && msgs[0]["result"].elements().size() > 7)
+    {
+        const auto& sym = msgs[0]["result"].elements()[7];
+        check(sym["name"].asString() == "f7" && sym["detail"].asString() == "(n: int) -> int"
+                  && sym["range"]["start"]["line"].asInt() == static_cast<int>(lineOf(7, 0))
+                  && sym["range"]["end"]["line"].asInt() == static_cast<int>(lineOf(7, 18)),
+              "the symbol of f7");
+    }
+
+    // A call goes to the function, a variable to its declaration
+    std::vector<double> definitionTimes;
+    for(int i = 0; i < TIMED_RUNS; ++i)
+    {
+        msgs = s.send(definitionAt(3, lineOf(target, 17), 12), &ms);
+        definitionTimes.push_back(ms);
+    }
+    check(definedAt(msgs, lineOf(target - 1, 0), 3), "definition of a called function");
+
+    check(definedAt(s.send(definitionAt(4, lineOf(target, 17), 27)), lineOf(target, 15), 8),
+          "definition of a local variable");
+    check(definedAt(s.send(definitionAt(5, lineOf(target, 1), 12)), lineOf(target, 0), 9),
+          "definition of a parameter");
+
+    // After the emoji, 2 UTF-16 units but 4 bytes
+    size_t mainLine = lineOf(FUNCTIONS, 0);
+    check(definedAt(s.send(definitionAt(6, mainLine + 2, 22)), mainLine + 1, 8), "definition in UTF-16 units");
+
+    if(!optimized())
+    {
+        std::string_view type = GUU_BUILD_TYPE;
+        std::cout << "Times of a " << (type.empty() ? "default" : type) << " build are not checked" << std::endl;
+    }
+    report("didChange", edits, TARGET_MS);
+    report("definition", definitionTimes, TARGET_MS);
+    report("documentSymbol", symbolTimes, SYMBOLS_TARGET_MS);
+
+    util::JsonWriter shutdown;
+    shutdown.beginObject().field("jsonrpc", "2.0").field("id", 7).field("method", "shutdown").endObject();
+    s.send(shutdown);
+
+    util::JsonWriter exit;
+    exit.beginObject().field("jsonrpc", "2.0").field("method", "exit").endObject();
+    check(s.send(exit).empty(), "exit");
+
+    if(failures)
+        std::cerr << failures << " checks failed" << std::endl;
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,523 @@
+// Runs fixed workloads through the phases of the engine and fails if they got
+// slower or allocate more than tests/perf_baseline.txt allows. The front end
+// gets a large generated program, execution the benchmarks on the VM.
+//
+// Times are the lowest of several runs, divided by the lowest time of a
+// calibration loop of plain C++ run in between. That evens out some of the
+// difference between machines but not all of it, so times have a wide band
+// that only catches slowdowns of the code, like a phase taking twice as long.
+// They are only compared in the build type the baseline was written in.
+// Allocation counts do not depend on the machine and have a tight band. Every
+// metric has its tolerance in the baseline, in percent.
+//
+// Usage: perf_regression --baseline=FILE [--update] SCRIPT...
+//
+// --update rewrites the baseline from this run, keeping the tolerances.
+
+#include "../guu/compiler.h"
+#include "../guu/escape.h"
+#include "../guu/lexer.h"
+#include "../guu/optimizer.h"
+#include "../guu/parser.h"
+#include "../guu/resolver.h"
+#include "../guu/stats.h"
+#include "../guu/tail_calls.h"
+#include "../guu/vm.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef GUU_BUILD_TYPE
+#define GUU_BUILD_TYPE ""
+#endif
+
+using namespace Guu;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int RUNS = 5;
+
+// Of all the runs, by --update and when a check fails
+constexpr int ATTEMPTS = 3;
+
+constexpr double DEFAULT_TIME_TOLERANCE   = 100;
+constexpr double DEFAULT_ALLOCS_TOLERANCE = 2;
+
+// Swallows the output of the benchmarks
+class NullBuffer : public std::streambuf
+{
+public:
+    NullBuffer()
+    {
+        setp(buffer_, buffer_ + sizeof(buffer_));
+    }
+
+private:
+    int overflow(int c) override
+    {
+        setp(buffer_, buffer_ + sizeof(buffer_));
+        return traits_type::not_eof(c);
+    }
+
+private:
+    char buffer_[256];
+};
+
+double msSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Sorting and hashing strings, work of the same kind as the engine's. Measured
+// right before every run of a workload, since the speed of a shared machine
+// drifts over seconds.
+double calibrate()
+{
+    static volatile size_t sink = 0;
+
+    auto start = Clock::now();
+
+    std::vector<std::string> words;
+    for(std::uint32_t i = 0; i < 20000; ++i)
+    {
+        words.push_back(std::to_string(i * 2654435761u % 1000003));
+    }
+    std::sort(words.begin(), words.end());
+
+    std::unordered_map<std::string, int> prefixes;
+    for(const auto& w: words)
+    {
+        ++prefixes[w.substr(0, 3)];
+    }
+    sink = sink + prefixes.size();
+
+    return msSince(start);
+}
+
+// Fastest time and fewest allocations of every phase over the runs, and the
+// fastest calibration among them
+class Phases
+{
+public:
+    struct Result
+    {
+        double ms_                 = std::numeric_limits<double>::max();
+        std::uint64_t allocations_ = std::numeric_limits<std::uint64_t>::max();
+    };
+
+    // Before every run
+    void calibrate()
+    {
+        calibrationMs_ = std::min(calibrationMs_, ::calibrate());
+    }
+
+    double calibrationMs() const
+    {
+        return calibrationMs_;
+    }
+
+    template <typename Fn>
+    void run(const std::string& phase, Fn&& fn)
+    {
+        auto before = Stats::counters().snapshot();
+        auto start  = Clock::now();
+        fn();
+        double ms  = msSince(start);
+        auto delta = Stats::counters().snapshot() - before;
+
+        auto it = std::find_if(results_.begin(), results_.end(), [&](const auto& r) { return r.first == phase; });
+        if(it == results_.end())
+            it = results_.insert(results_.end(), {phase, Result{}});
+
+        it->second.ms_          = std::min(it->second.ms_, ms);
+        it->second.allocations_ = std::min(it->second.allocations_, delta.allocations_);
+    }
+
+    // In the order they ran
+    const std::vector<std::pair<std::string, Result>>& results() const
+    {
+        return results_;
+    }
+
+private:
+    std::vector<std::pair<std::string, Result>> results_;
+    double calibrationMs_ = std::numeric_limits<double>::max();
+};
+
+// About 800 KiB of functions with loops, branches, arrays and strings, all
+// called from main so the Optimizer keeps them
+std::string frontEndProgram()
+{
+    constexpr int FUNCTIONS = 2000;
+
+    std::ostringstream s;
+    for(int i = 0; i < FUNCTIONS; ++i)
+    {
+        s << "fn work" << i << "(n: int, s: str) -> int {\n"
+          << "    int[8] a = [1, 2, 3, 4, 5, 6, 7, 8];\n"
+          << "    int total = 0;\n"
+          << "    int k = 0;\n"
+          << "    while k < n {\n"
+          << "        if a[k % 8] > " << i % 7 << " {\n"
+          << "            total = total + a[k % 8] * (k - " << i << ") / 3;\n"
+          << "        } else {\n"
+          << "            total = total - len(s) % 5;\n"
+          << "        }\n"
+          << "        k = k + 1;\n"
+          << "    }\n"
+          << "    str t = s + \"-" << i << "\";\n"
+          << "    return total + len(t);\n"
+          << "}\n\n";
+    }
+
+    s << "fn main() -> int {\n    int total = 0;\n";
+    for(int i = 0; i < FUNCTIONS; ++i)
+    {
+        s << "    total = total + work" << i << "(2, \"x\");\n";
+    }
+    s << "    return total;\n}\n";
+
+    return s.str();
+}
+
+struct Metric
+{
+    std::string name_;
+    double value_;
+    bool time_;
+};
+
+void addPhases(std::vector<Metric>& metrics, const std::string& workload, const Phases& phases)
+{
+    for(const auto& [phase, r]: phases.results())
+    {
+        metrics.push_back({workload + "." + phase + ".time", r.ms_ / phases.calibrationMs(), true});
+        metrics.push_back({workload + "." + phase + ".allocs", static_cast<double>(r.allocations_), false});
+    }
+}
+
+void printPhases(const std::string& workload, const Phases& phases, size_t bytes)
+{
+    std::cout << workload << std::endl;
+    for(const auto& [phase, r]: phases.results())
+    {
+        std::cout << "  " << std::left << std::setw(12) << phase << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(10) << r.ms_ << " ms";
+        if(bytes)
+            std::cout << std::setw(10) << std::setprecision(1) << bytes / r.ms_ / 1000 << " MB/s";
+        std::cout << std::setw(10) << r.allocations_ << " allocations" << std::endl;
+    }
+    std::cout << std::defaultfloat;
+}
+
+// Lexing on its own and every pass up to the bytecode
+Phases runFrontEnd(const std::string& source)
+{
+    Phases phases;
+    for(int run = 0; run < RUNS; ++run)
+    {
+        phases.calibrate();
+        phases.run("lex", [&] {
+            Tokenizer t(source);
+            while(t.getNext().type_ != TokenType::END)
+            {
+            }
+        });
+
+        // The parser pulls the tokens, so this includes lexing
+        std::unique_ptr<AST::Node> ast;
+        phases.run("parse", [&] { ast = Parser(Tokenizer(source)).buildAST(); });
+
+        TypeTable types;
+        phases.run("resolve", [&] { Resolver(types).resolve(*ast); });
+        phases.run("optimize", [&] { Optimizer(types, Optimizer::MAX_LEVEL).run(*ast); });
+        phases.run("escape", [&] { EscapeAnalysis(types).run(*ast); });
+        phases.run("tail_calls", [&] { TailCalls().run(*ast); });
+
+        Bytecode::Module module;
+        phases.run("compile", [&] { module = Compiler(types).compile(*ast); });
+        phases.run("free", [&] { ast.reset(); });
+    }
+    return phases;
+}
+
+// The script compiled once and run on the VM
+Phases runScript(const std::string& source)
+{
+    auto ast = Parser(Tokenizer(source)).buildAST();
+
+    TypeTable types;
+    Resolver(types).resolve(*ast);
+    Optimizer(types, Optimizer::MAX_LEVEL).run(*ast);
+    EscapeAnalysis(types).run(*ast);
+    TailCalls().run(*ast);
+    Bytecode::Module module = Compiler(types).compile(*ast);
+
+    NullBuffer discard;
+    std::ostream out(&discard);
+
+    Phases phases;
+    for(int run = 0; run < RUNS; ++run)
+    {
+        phases.calibrate();
+        phases.run("execute", [&] { VM(module, out, CallStack::DEFAULT_MAX_DEPTH).run({}); });
+    }
+    return phases;
+}
+
+struct Baseline
+{
+    std::string buildType_;
+
+    // Value and tolerance in percent by metric
+    std::map<std::string, std::pair<double, double>> metrics_;
+};
+
+Baseline readBaseline(const std::string& path)
+{
+    Baseline baseline;
+
+    std::ifstream in(path);
+    std::string line;
+    while(std::getline(in, line))
+    {
+        std::istringstream ss(line);
+        std::string name;
+        if(!(ss >> name) || name[0] == '#')
+            continue;
+
+        if(name == "build")
+        {
+            ss >> baseline.buildType_;
+            continue;
+        }
+
+        double value     = 0;
+        double tolerance = 0;
+        if(!(ss >> value >> tolerance))
+            throw std::runtime_error("Bad line in '" + path + "': " + line);
+
+        baseline.metrics_[name] = {value, tolerance};
+    }
+
+    return baseline;
+}
+
+void writeBaseline(const std::string& path, const Baseline& old, const std::vector<Metric>& metrics)
+{
+    std::ofstream out(path);
+    if(!out)
+        throw std::runtime_error("Cannot open '" + path + "'");
+
+    out << "# Baseline of the perf_regression test, see tests/perf_regression.cpp. Rewrite it with\n"
+        << "# `cmake --build <build dir> --target perf_baseline` after a change that is meant to move it.\n"
+        << "#\n"
+        << "# <metric> <value> <tolerance in percent>, times are relative to the calibration loop\n"
+        << "build " << GUU_BUILD_TYPE << "\n";
+
+    for(const auto& m: metrics)
+    {
+        auto it          = old.metrics_.find(m.name_);
+        double tolerance = it != old.metrics_.end()
+                               ? it->second.second
+                               : (m.time_ ? DEFAULT_TIME_TOLERANCE : DEFAULT_ALLOCS_TOLERANCE);
+
+        out << m.name_ << " " << std::setprecision(m.time_ ? 4 : 15) << m.value_ << " " << tolerance << "\n";
+    }
+}
+
+// Returns the number of metrics beyond their band, prints them all if `print` is set
+int compare(const Baseline& baseline, const std::vector<Metric>& metrics, bool print)
+{
+    bool compareTimes = baseline.buildType_ == GUU_BUILD_TYPE;
+    if(!compareTimes && print)
+    {
+        std::cout << "The baseline is of a " << (baseline.buildType_.empty() ? "default" : baseline.buildType_)
+                  << " build, only allocations are compared" << std::endl;
+    }
+
+    int regressions = 0;
+
+    if(print)
+    {
+        std::cout << std::left << std::setw(32) << "metric" << std::right << std::setw(12) << "baseline"
+                  << std::setw(12) << "now" << std::setw(10) << "change" << std::setw(8) << "band" << std::endl;
+    }
+
+    for(const auto& m: metrics)
+    {
+        auto it = baseline.metrics_.find(m.name_);
+        if(it == baseline.metrics_.end())
+        {
+            if(print)
+                std::cout << std::left << std::setw(32) << m.name_ << std::right << std::setw(12) << "-"
+                          << std::setw(12) << m.value_ << "  new, not in the baseline" << std::endl;
+            continue;
+        }
+
+        auto [base, tolerance] = it->second;
+
+        // Allocation counts of 0 stay 0
+        double change = base > 0 ? (m.value_ - base) / base * 100 : (m.value_ > 0 ? 100 : 0);
+
+        const char* verdict = "";
+        if(m.time_ && !compareTimes)
+        {
+            verdict = "  not compared";
+        }
+        else if(change > tolerance)
+        {
+            verdict = "  REGRESSION";
+            ++regressions;
+        }
+        else if(change < -tolerance)
+        {
+            verdict = "  better, update the baseline";
+        }
+
+        if(print)
+        {
+            std::cout << std::left << std::setw(32) << m.name_ << std::right << std::setw(12) << base
+                      << std::setw(12) << m.value_ << std::setw(9) << std::fixed << std::setprecision(1) << change
+                      << "%" << std::setw(7) << tolerance << "%" << verdict << std::defaultfloat
+                      << std::setprecision(6) << std::endl;
+        }
+    }
+
+    return regressions;
+}
+
+std::string readFile(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if(!in)
+        throw std::runtime_error("Cannot open '" + path + "'");
+
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Every workload once, printing the times and allocations if `print` is set
+std::vector<Metric> measure(const std::vector<std::string>& scripts, bool print)
+{
+    std::vector<Metric> metrics;
+
+    static const std::string source = frontEndProgram();
+    Phases frontEnd                 = runFrontEnd(source);
+    if(print)
+        printPhases("front end, " + std::to_string(source.size() / 1024) + " KiB", frontEnd, source.size());
+    addPhases(metrics, "frontend", frontEnd);
+
+    for(const auto& path: scripts)
+    {
+        auto name = path.substr(path.find_last_of("/\\") + 1);
+        name      = name.substr(0, name.find('.'));
+
+        Phases phases = runScript(readFile(path));
+        if(print)
+            printPhases(name, phases, 0);
+        addPhases(metrics, name, phases);
+    }
+
+    return metrics;
+}
+
+// The lower value of every metric, both come from measure() with the same scripts
+void keepBest(std::vector<Metric>& best, const std::vector<Metric>& next)
+{
+    for(size_t i = 0; i < best.size(); ++i)
+    {
+        best[i].value_ = std::min(best[i].value_, next[i].value_);
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string baselinePath;
+    bool update = false;
+    std::vector<std::string> scripts;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg.compare(0, 11, "--baseline=") == 0)
+        {
+            baselinePath = arg.substr(11);
+        }
+        else if(arg == "--update")
+        {
+            update = true;
+        }
+        else
+        {
+            scripts.push_back(arg);
+        }
+    }
+
+    if(baselinePath.empty())
+    {
+        std::cerr << "Usage: perf_regression --baseline=FILE [--update] SCRIPT..." << std::endl;
+        return 2;
+    }
+
+    try
+    {
+        std::vector<Metric> metrics = measure(scripts, true);
+        std::cout << std::endl;
+
+        Baseline baseline = readBaseline(baselinePath);
+        if(update)
+        {
+            for(int attempt = 1; attempt < ATTEMPTS; ++attempt)
+            {
+                keepBest(metrics, measure(scripts, false));
+            }
+
+            writeBaseline(baselinePath, baseline, metrics);
+            std::cout << "Wrote " << metrics.size() << " metrics to " << baselinePath << std::endl;
+            return 0;
+        }
+
+        if(baseline.metrics_.empty())
+        {
+            std::cerr << "No baseline in '" << baselinePath << "'" << std::endl;
+            return 1;
+        }
+
+        // A slow moment of the machine is no regression, one in the code stays
+        for(int attempt = 1; attempt < ATTEMPTS && compare(baseline, metrics, false); ++attempt)
+        {
+            std::cout << "Beyond the baseline, measuring again" << std::endl;
+            keepBest(metrics, measure(scripts, false));
+        }
+
+        int regressions = compare(baseline, metrics, true);
+        if(regressions)
+        {
+            std::cerr << regressions << " metrics regressed beyond their band" << std::endl;
+            return 1;
+        }
+    } catch(const std::runtime_error& e)
+    {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,25 @@
+# Profiles SCRIPT, tests/parallel_calls.guu, and fails unless the collapsed
+# stacks go through the parallel loop and the join of main on their lines.
+# The frames run by either are nested entry frames above main. Invoked by
+# CTest with -P.
+#
+#   -DGUU=<Guu> -DSCRIPT=<script.guu> -DSTACKS=<collapsed stacks path>
+
+file(REMOVE ${STACKS})
+
+execute_process(COMMAND ${GUU} --profile=${STACKS} ${SCRIPT} OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0 OR NOT EXISTS ${STACKS})
+    message(FATAL_ERROR "Profiling ${SCRIPT} failed (exit ${rc}):\n${out}${err}")
+endif()
+
+file(READ ${STACKS} stacks)
+foreach(expected "(^|\n)main:14;main:15;work:[4-7] " "(^|\n)main:18;work:[4-7] ")
+    if(NOT stacks MATCHES "${expected}")
+        message(FATAL_ERROR "The stacks lack '${expected}':\n${stacks}")
+    endif()
+endforeach()
+
+# Every frame on a line of the script
+if(stacks MATCHES ":(0|[2-9][0-9]|[0-9][0-9][0-9]+)[; ]")
+    message(FATAL_ERROR "The stacks have frames on lines outside the script:\n${stacks}")
+endif()
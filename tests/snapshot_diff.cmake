@@ -0,0 +1,33 @@
+# Round trip of an image: saves SCRIPT at its checkpoint(), resumes the image
+# with ARGS and fails unless both runs behave like the AST interpreter. The
+# script must not print before its checkpoint, nor depend on its arguments
+# there. Invoked by CTest with -P.
+#
+#   -DGUU=<Guu> -DSCRIPT=<script.guu> -DIMAGE=<image path> [-DARGS=<program arguments>]
+
+separate_arguments(ARGS)
+
+function(run_guu prefix)
+    execute_process(COMMAND ${GUU} ${ARGN}
+                    OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+    set(${prefix}Out "${out}" PARENT_SCOPE)
+    set(${prefix}Err "${err}" PARENT_SCOPE)
+    set(${prefix}Rc "${rc}" PARENT_SCOPE)
+endfunction()
+
+file(REMOVE ${IMAGE})
+
+run_guu(saved --snapshot=${IMAGE} ${SCRIPT})
+run_guu(savedExpected --engine=ast ${SCRIPT})
+if(NOT savedOut STREQUAL savedExpectedOut OR NOT savedErr STREQUAL savedExpectedErr
+   OR NOT savedRc STREQUAL savedExpectedRc OR NOT EXISTS ${IMAGE})
+    message(FATAL_ERROR "Saving ${SCRIPT} changed the run:\n${savedOut}${savedErr}")
+endif()
+
+run_guu(restored --restore ${IMAGE} ${ARGS})
+run_guu(expected --engine=ast ${SCRIPT} ${ARGS})
+if(NOT restoredOut STREQUAL expectedOut OR NOT restoredErr STREQUAL expectedErr OR NOT restoredRc STREQUAL expectedRc)
+    message(FATAL_ERROR "The image of ${SCRIPT} disagrees with the interpreter\n"
+                        "interpreter (exit ${expectedRc}):\n${expectedOut}${expectedErr}\n"
+                        "image (exit ${restoredRc}):\n${restoredOut}${restoredErr}")
+endif()
@@ -0,0 +1,35 @@
+# Differential test of tiered execution: generates COUNT programs with GEN and
+# fails unless every one, and every script in SCRIPTS, behaves the same under
+# the AST interpreter and --engine=tiered. The thresholds are low, so most
+# functions are compiled after a few calls or iterations, some in the middle
+# of a recursion. Invoked by CTest with -P.
+#
+#   -DGUU=<Guu> -DGEN=<gen_program> -DDIR=<scratch dir> -DCOUNT=<n> [-DSCRIPTS=<scripts>]
+
+file(MAKE_DIRECTORY ${DIR})
+separate_arguments(SCRIPTS)
+
+set(programs ${SCRIPTS})
+foreach(seed RANGE 1 ${COUNT})
+    set(program ${DIR}/program_${seed}.guu)
+    execute_process(COMMAND ${GEN} ${seed} OUTPUT_FILE ${program} RESULT_VARIABLE rc)
+    if(NOT rc EQUAL 0)
+        message(FATAL_ERROR "Generating ${program} failed")
+    endif()
+    list(APPEND programs ${program})
+endforeach()
+
+foreach(program ${programs})
+    execute_process(COMMAND ${GUU} --engine=ast ${program}
+                    OUTPUT_VARIABLE expectedOut ERROR_VARIABLE expectedErr RESULT_VARIABLE expectedRc)
+
+    foreach(opt -O0 -O1)
+        execute_process(COMMAND ${GUU} --engine=tiered --tier-calls=3 --tier-loops=20 ${opt} ${program}
+                        OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+        if(NOT out STREQUAL expectedOut OR NOT err STREQUAL expectedErr OR NOT rc STREQUAL expectedRc)
+            message(FATAL_ERROR "${program} ${opt} disagrees with the interpreter\n"
+                                "interpreter (exit ${expectedRc}):\n${expectedOut}${expectedErr}\n"
+                                "tiered (exit ${rc}):\n${out}${err}")
+        endif()
+    endforeach()
+endforeach()
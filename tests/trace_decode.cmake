@@ -0,0 +1,32 @@
+# Runs SCRIPT, which must fail, with a trace, decodes the trace and fails
+# unless it ends in the failing call with the error, and holds the statements
+# that led there. Invoked by CTest with -P.
+#
+#   -DGUU=<Guu> -DSCRIPT=<script.guu> -DTRACE=<trace path>
+
+file(REMOVE ${TRACE})
+
+execute_process(COMMAND ${GUU} --trace=${TRACE} --trace-statements ${SCRIPT}
+                OUTPUT_VARIABLE out ERROR_VARIABLE err RESULT_VARIABLE rc)
+if(rc EQUAL 0 OR NOT EXISTS ${TRACE})
+    message(FATAL_ERROR "${SCRIPT} should have failed with a trace (exit ${rc}):\n${out}${err}")
+endif()
+
+execute_process(COMMAND ${GUU} --decode-trace=${TRACE}
+                OUTPUT_VARIABLE decoded ERROR_VARIABLE err RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "Cannot decode ${TRACE}:\n${err}")
+endif()
+
+# The last call, the statement failing in it and the error
+foreach(expected "call +walk:10 -> check\n" "enter +check:2 depth 3\n" "line +check:2\nFailed: .*check.* line 2")
+    if(NOT decoded MATCHES "${expected}")
+        message(FATAL_ERROR "The trace lacks '${expected}':\n${decoded}")
+    endif()
+endforeach()
+
+# A file that is not a trace
+execute_process(COMMAND ${GUU} --decode-trace=${SCRIPT} OUTPUT_QUIET ERROR_VARIABLE err RESULT_VARIABLE rc)
+if(rc EQUAL 0 OR NOT err MATCHES "not a trace")
+    message(FATAL_ERROR "Decoding ${SCRIPT} should have failed:\n${err}")
+endif()
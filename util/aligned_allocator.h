@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace util
+{
+
+// Allocator for std::vector whose storage starts on an `Align` byte boundary,
+// so vector loads of the first elements never straddle a cache line.
+template <typename T, size_t Align>
+class AlignedAllocator
+{
+    static_assert(Align >= alignof(T) && (Align & (Align - 1)) == 0, "Alignment must be a power of two");
+
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Align>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+
+    void deallocate(T* p, size_t) noexcept
+    {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Align>&) const noexcept
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Align>&) const noexcept
+    {
+        return false;
+    }
+};
+
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace util
+{
+
+// Open-addressing hash map with linear probing and backward-shift deletion.
+// Keys and values live inline in a single power-of-two sized array, so lookups
+// touch one cache line in the common case. K and V must be default constructible.
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class FlatMap
+{
+    static constexpr size_t MIN_CAPACITY = 16;
+
+    struct Slot
+    {
+        K key_{};
+        V value_{};
+        bool used_ = false;
+    };
+
+public:
+    explicit FlatMap(size_t capacity = MIN_CAPACITY)
+    {
+        size_t cap = MIN_CAPACITY;
+        while(cap < capacity)
+            cap <<= 1;
+
+        slots_.resize(cap);
+    }
+
+    V* find(const K& key)
+    {
+        size_t i = indexOf(key);
+        return i == npos ? nullptr : &slots_[i].value_;
+    }
+
+    const V* find(const K& key) const
+    {
+        size_t i = indexOf(key);
+        return i == npos ? nullptr : &slots_[i].value_;
+    }
+
+    bool contains(const K& key) const
+    {
+        return indexOf(key) != npos;
+    }
+
+    // Returns false and leaves the map untouched if the key already exists
+    bool insert(const K& key, V value)
+    {
+        reserveOneMore();
+
+        size_t i = probe(key);
+        if(slots_[i].used_)
+            return false;
+
+        slots_[i] = Slot{key, std::move(value), true};
+        ++size_;
+        return true;
+    }
+
+    V& operator[](const K& key)
+    {
+        reserveOneMore();
+
+        size_t i = probe(key);
+        if(!slots_[i].used_)
+        {
+            slots_[i] = Slot{key, V{}, true};
+            ++size_;
+        }
+
+        return slots_[i].value_;
+    }
+
+    bool erase(const K& key)
+    {
+        size_t i = indexOf(key);
+        if(i == npos)
+            return false;
+
+        // Shift following entries of the same cluster back, so probing never needs tombstones
+        size_t mask = slots_.size() - 1;
+        size_t hole = i;
+        for(size_t j = (i + 1) & mask; slots_[j].used_; j = (j + 1) & mask)
+        {
+            size_t home = hash_(slots_[j].key_) & mask;
+            if(((j - home) & mask) >= ((j - hole) & mask))
+            {
+                slots_[hole] = std::move(slots_[j]);
+                hole         = j;
+            }
+        }
+
+        slots_[hole] = Slot{};
+        --size_;
+        return true;
+    }
+
+    void clear()
+    {
+        for(auto& s: slots_)
+            s = Slot{};
+
+        size_ = 0;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    template <typename Fn>
+    void forEach(Fn&& fn) const
+    {
+        for(const auto& s: slots_)
+        {
+            if(s.used_)
+                fn(s.key_, s.value_);
+        }
+    }
+
+private:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    // Slot holding the key, or the empty slot where it would be inserted
+    size_t probe(const K& key) const
+    {
+        size_t mask = slots_.size() - 1;
+        size_t i    = hash_(key) & mask;
+        while(slots_[i].used_ && !eq_(slots_[i].key_, key))
+            i = (i + 1) & mask;
+
+        return i;
+    }
+
+    size_t indexOf(const K& key) const
+    {
+        size_t i = probe(key);
+        return slots_[i].used_ ? i : npos;
+    }
+
+    // Keeps the load factor at or below 1/2
+    void reserveOneMore()
+    {
+        if((size_ + 1) * 2 <= slots_.size())
+            return;
+
+        std::vector<Slot> old(slots_.size() * 2);
+        old.swap(slots_);
+        size_ = 0;
+
+        for(auto& s: old)
+        {
+            if(s.used_)
+            {
+                slots_[probe(s.key_)] = Slot{std::move(s.key_), std::move(s.value_), true};
+                ++size_;
+            }
+        }
+    }
+
+private:
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+    Hash hash_{};
+    Eq eq_{};
+};
+
+}
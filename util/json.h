@@ -0,0 +1,608 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace util
+{
+
+// A parsed JSON value. Objects keep their members in the order of the text and
+// are searched linearly, they are small in the protocols this reads. Numbers
+// are doubles, which holds every integer up to 2^53 exactly.
+class Json
+{
+public:
+    enum class Type
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    using Member = std::pair<std::string, Json>;
+
+    // Deepest nesting parse() accepts, it recurses per level
+    static constexpr size_t MAX_DEPTH = 256;
+
+    Json() = default;
+
+    // Throws std::runtime_error if `text` is not a single JSON value
+    static Json parse(std::string_view text)
+    {
+        Parser p{text};
+        Json result = p.value(0);
+        p.skipSpaces();
+        if(p.pos_ != text.size())
+            p.fail("trailing characters");
+
+        return result;
+    }
+
+    Type type() const
+    {
+        return type_;
+    }
+
+    bool isNull() const
+    {
+        return type_ == Type::Null;
+    }
+
+    bool isString() const
+    {
+        return type_ == Type::String;
+    }
+
+    bool isNumber() const
+    {
+        return type_ == Type::Number;
+    }
+
+    bool isArray() const
+    {
+        return type_ == Type::Array;
+    }
+
+    bool isObject() const
+    {
+        return type_ == Type::Object;
+    }
+
+    // The accessors return an empty value for another type, so optional members read as absent
+    bool asBool() const
+    {
+        return type_ == Type::Bool && bool_;
+    }
+
+    double asNumber() const
+    {
+        return type_ == Type::Number ? number_ : 0;
+    }
+
+    std::int64_t asInt() const
+    {
+        return static_cast<std::int64_t>(asNumber());
+    }
+
+    const std::string& asString() const
+    {
+        return string_;
+    }
+
+    const std::vector<Json>& elements() const
+    {
+        return elements_;
+    }
+
+    const std::vector<Member>& members() const
+    {
+        return members_;
+    }
+
+    bool has(std::string_view key) const
+    {
+        return find(key) != nullptr;
+    }
+
+    // A null value for a missing member
+    const Json& operator[](std::string_view key) const
+    {
+        const Json* v = find(key);
+        return v ? *v : null();
+    }
+
+private:
+    struct Parser
+    {
+        std::string_view text_;
+        size_t pos_ = 0;
+
+        Json value(size_t depth)
+        {
+            if(depth > MAX_DEPTH)
+                fail("nesting too deep");
+
+            skipSpaces();
+            if(pos_ == text_.size())
+                fail("unexpected end");
+
+            Json v;
+            switch(text_[pos_])
+            {
+                case '{':
+                    ++pos_;
+                    v.type_ = Type::Object;
+                    if(!close('}'))
+                    {
+                        do
+                        {
+                            skipSpaces();
+                            std::string key = string();
+                            expect(':');
+                            v.members_.emplace_back(std::move(key), value(depth + 1));
+                        } while(next(',', '}'));
+                    }
+                    break;
+
+                case '[':
+                    ++pos_;
+                    v.type_ = Type::Array;
+                    if(!close(']'))
+                    {
+                        do
+                        {
+                            v.elements_.push_back(value(depth + 1));
+                        } while(next(',', ']'));
+                    }
+                    break;
+
+                case '"':
+                    v.type_   = Type::String;
+                    v.string_ = string();
+                    break;
+
+                case 't':
+                case 'f':
+                    v.type_ = Type::Bool;
+                    v.bool_ = text_[pos_] == 't';
+                    literal(v.bool_ ? "true" : "false");
+                    break;
+
+                case 'n': literal("null"); break;
+
+                default:
+                    v.type_   = Type::Number;
+                    v.number_ = number();
+                    break;
+            }
+
+            return v;
+        }
+
+        std::string string()
+        {
+            expect('"');
+
+            std::string s;
+            while(true)
+            {
+                if(pos_ == text_.size())
+                    fail("string is not closed");
+
+                // Up to the next quote or escape at once, the text of a whole file comes as one string
+                size_t run = pos_;
+                while(pos_ < text_.size() && text_[pos_] != '"' && text_[pos_] != '\\'
+                      && static_cast<unsigned char>(text_[pos_]) >= 0x20)
+                    ++pos_;
+                s.append(text_.data() + run, pos_ - run);
+
+                if(pos_ == text_.size())
+                    fail("string is not closed");
+
+                char c = text_[pos_++];
+                if(c == '"')
+                    return s;
+
+                if(c != '\\')
+                    fail("control character in string");
+
+                if(pos_ == text_.size())
+                    fail("string is not closed");
+
+                switch(char e = text_[pos_++])
+                {
+                    case '"':
+                    case '\\':
+                    case '/': s += e; break;
+                    case 'b': s += '\b'; break;
+                    case 'f': s += '\f'; break;
+                    case 'n': s += '\n'; break;
+                    case 'r': s += '\r'; break;
+                    case 't': s += '\t'; break;
+                    case 'u': utf8(s, codePoint()); break;
+                    default: fail("unknown escape");
+                }
+            }
+        }
+
+        // After `\u`, a surrogate pair takes the `\u` that follows
+        std::uint32_t codePoint()
+        {
+            std::uint32_t cp = hex4();
+            if(cp >= 0xD800 && cp < 0xDC00 && text_.substr(pos_, 2) == "\\u")
+            {
+                pos_ += 2;
+                std::uint32_t low = hex4();
+                if(low < 0xDC00 || low >= 0xE000)
+                    fail("invalid surrogate pair");
+
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            return cp;
+        }
+
+        std::uint32_t hex4()
+        {
+            if(text_.size() - pos_ < 4)
+                fail("invalid \\u escape");
+
+            std::uint32_t cp = 0;
+            for(int i = 0; i < 4; ++i)
+            {
+                char c = text_[pos_++];
+                cp <<= 4;
+                if(c >= '0' && c <= '9')
+                    cp |= static_cast<std::uint32_t>(c - '0');
+                else if(c >= 'a' && c <= 'f')
+                    cp |= static_cast<std::uint32_t>(c - 'a' + 10);
+                else if(c >= 'A' && c <= 'F')
+                    cp |= static_cast<std::uint32_t>(c - 'A' + 10);
+                else
+                    fail("invalid \\u escape");
+            }
+            return cp;
+        }
+
+        static void utf8(std::string& s, std::uint32_t cp)
+        {
+            if(cp < 0x80)
+            {
+                s += static_cast<char>(cp);
+            }
+            else if(cp < 0x800)
+            {
+                s += static_cast<char>(0xC0 | (cp >> 6));
+                s += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else if(cp < 0x10000)
+            {
+                s += static_cast<char>(0xE0 | (cp >> 12));
+                s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                s += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                s += static_cast<char>(0xF0 | (cp >> 18));
+                s += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                s += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+        }
+
+        double number()
+        {
+            size_t begin = pos_;
+            if(pos_ < text_.size() && text_[pos_] == '-')
+                ++pos_;
+
+            size_t digits = pos_;
+            auto skipDigits = [&] {
+                while(pos_ < text_.size() && text_[pos_] >= '0' && text_[pos_] <= '9')
+                    ++pos_;
+            };
+
+            skipDigits();
+            if(pos_ == digits)
+                fail("unexpected character");
+
+            if(pos_ < text_.size() && text_[pos_] == '.')
+            {
+                ++pos_;
+                skipDigits();
+            }
+
+            if(pos_ < text_.size() && (text_[pos_] == 'e' || text_[pos_] == 'E'))
+            {
+                ++pos_;
+                if(pos_ < text_.size() && (text_[pos_] == '+' || text_[pos_] == '-'))
+                    ++pos_;
+                skipDigits();
+            }
+
+            // std::stod wants a terminated string, numbers are short
+            return std::stod(std::string(text_.substr(begin, pos_ - begin)));
+        }
+
+        void literal(std::string_view word)
+        {
+            if(text_.substr(pos_, word.size()) != word)
+                fail("unexpected character");
+
+            pos_ += word.size();
+        }
+
+        void skipSpaces()
+        {
+            while(pos_ < text_.size()
+                  && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r'))
+                ++pos_;
+        }
+
+        void expect(char c)
+        {
+            skipSpaces();
+            if(pos_ == text_.size() || text_[pos_] != c)
+                fail(std::string("expected '") + c + "'");
+
+            ++pos_;
+        }
+
+        // Consumes `c` if it comes next
+        bool close(char c)
+        {
+            skipSpaces();
+            if(pos_ < text_.size() && text_[pos_] == c)
+            {
+                ++pos_;
+                return true;
+            }
+            return false;
+        }
+
+        // True for another element, false at the end of the container
+        bool next(char separator, char end)
+        {
+            if(close(separator))
+                return true;
+
+            expect(end);
+            return false;
+        }
+
+        [[noreturn]] void fail(const std::string& what) const
+        {
+            throw std::runtime_error("Invalid JSON at offset " + std::to_string(pos_) + ": " + what);
+        }
+    };
+
+    const Json* find(std::string_view key) const
+    {
+        for(const auto& m: members_)
+        {
+            if(m.first == key)
+                return &m.second;
+        }
+        return nullptr;
+    }
+
+    static const Json& null()
+    {
+        static const Json value;
+        return value;
+    }
+
+private:
+    Type type_     = Type::Null;
+    bool bool_     = false;
+    double number_ = 0;
+    std::string string_;
+    std::vector<Json> elements_;
+    std::vector<Member> members_;
+};
+
+// Writes JSON text as it goes, without building a Json first. The commas
+// between members and elements are the writer's business:
+//
+//   JsonWriter w;
+//   w.beginObject().field("id", 1).key("items").beginArray().value("a").endArray().endObject();
+class JsonWriter
+{
+public:
+    JsonWriter& beginObject()
+    {
+        separate();
+        out_ += '{';
+        first_.push_back(true);
+        return *this;
+    }
+
+    JsonWriter& endObject()
+    {
+        first_.pop_back();
+        out_ += '}';
+        return *this;
+    }
+
+    JsonWriter& beginArray()
+    {
+        separate();
+        out_ += '[';
+        first_.push_back(true);
+        return *this;
+    }
+
+    JsonWriter& endArray()
+    {
+        first_.pop_back();
+        out_ += ']';
+        return *this;
+    }
+
+    // The value written next belongs to it
+    JsonWriter& key(std::string_view k)
+    {
+        separate();
+        quote(k);
+        out_ += ':';
+        afterKey_ = true;
+        return *this;
+    }
+
+    JsonWriter& value(std::string_view s)
+    {
+        separate();
+        quote(s);
+        return *this;
+    }
+
+    JsonWriter& value(const char* s)
+    {
+        return value(std::string_view(s));
+    }
+
+    JsonWriter& value(bool b)
+    {
+        separate();
+        out_ += b ? "true" : "false";
+        return *this;
+    }
+
+    template <typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+    JsonWriter& value(T n)
+    {
+        separate();
+
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), n);
+        out_.append(buf, res.ptr);
+        return *this;
+    }
+
+    JsonWriter& value(const Json& v)
+    {
+        switch(v.type())
+        {
+            case Json::Type::Null: return null();
+            case Json::Type::Bool: return value(v.asBool());
+            case Json::Type::String: return value(v.asString());
+
+            case Json::Type::Number: {
+                separate();
+                double n = v.asNumber();
+                auto i   = static_cast<std::int64_t>(n);
+                out_ += static_cast<double>(i) == n ? std::to_string(i) : std::to_string(n);
+                return *this;
+            }
+
+            case Json::Type::Array:
+                beginArray();
+                for(const auto& e: v.elements())
+                {
+                    value(e);
+                }
+                return endArray();
+
+            case Json::Type::Object:
+                beginObject();
+                for(const auto& [k, e]: v.members())
+                {
+                    key(k).value(e);
+                }
+                return endObject();
+        }
+        return *this;
+    }
+
+    JsonWriter& null()
+    {
+        separate();
+        out_ += "null";
+        return *this;
+    }
+
+    template <typename T>
+    JsonWriter& field(std::string_view k, const T& v)
+    {
+        return key(k).value(v);
+    }
+
+    const std::string& str() const
+    {
+        return out_;
+    }
+
+    void reserve(size_t bytes)
+    {
+        out_.reserve(bytes);
+    }
+
+private:
+    void separate()
+    {
+        if(afterKey_)
+        {
+            afterKey_ = false;
+            return;
+        }
+
+        if(!first_.empty())
+        {
+            if(!first_.back())
+                out_ += ',';
+            first_.back() = false;
+        }
+    }
+
+    void quote(std::string_view s)
+    {
+        static const char hex[] = "0123456789abcdef";
+
+        out_ += '"';
+
+        // Runs of characters that need no escape are appended at once
+        size_t run = 0;
+        for(size_t i = 0; i < s.size(); ++i)
+        {
+            char c = s[i];
+            if(c != '"' && c != '\\' && static_cast<unsigned char>(c) >= 0x20)
+                continue;
+
+            out_.append(s.data() + run, i - run);
+            run = i + 1;
+
+            switch(c)
+            {
+                case '"': out_ += "\\\""; break;
+                case '\\': out_ += "\\\\"; break;
+                case '\n': out_ += "\\n"; break;
+                case '\r': out_ += "\\r"; break;
+                case '\t': out_ += "\\t"; break;
+                default:
+                    out_ += "\\u00";
+                    out_ += hex[(c >> 4) & 0xF];
+                    out_ += hex[c & 0xF];
+            }
+        }
+        out_.append(s.data() + run, s.size() - run);
+
+        out_ += '"';
+    }
+
+private:
+    std::string out_;
+
+    // Per open container, whether nothing was written into it yet
+    std::vector<bool> first_;
+    bool afterKey_ = false;
+};
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define UTIL_MAPPED_FILE_MMAP
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+namespace util
+{
+
+// Read-only view of a whole file, mapped into memory where POSIX mmap is
+// available and read into a buffer elsewhere. Empty files have no data.
+class MappedFile
+{
+public:
+    // Throws std::runtime_error if the file cannot be opened or read, or is
+    // not a regular file
+    explicit MappedFile(const std::string& path)
+    {
+#ifdef UTIL_MAPPED_FILE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            throw std::runtime_error("Cannot open '" + path + "'");
+
+        // A directory opens too, but is no file to read
+        struct stat st;
+        void* p = MAP_FAILED;
+        if(::fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            size_ = static_cast<size_t>(st.st_size);
+            p     = size_ > 0 ? ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        }
+        ::close(fd);
+
+        if(p == MAP_FAILED)
+            throw std::runtime_error("Cannot read '" + path + "'");
+
+        data_ = static_cast<const char*>(p);
+#else
+        std::ifstream in(path, std::ios::binary);
+        if(!in)
+            throw std::runtime_error("Cannot open '" + path + "'");
+
+        copy_.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if(in.bad())
+            throw std::runtime_error("Cannot read '" + path + "'");
+
+        data_ = copy_.data();
+        size_ = copy_.size();
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef UTIL_MAPPED_FILE_MMAP
+        if(data_)
+            ::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    std::string_view view() const
+    {
+        return {data_, size_};
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_      = 0;
+
+#ifndef UTIL_MAPPED_FILE_MMAP
+    std::string copy_;
+#endif
+};
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace util
+{
+
+// Bounded single-producer single-consumer queue. The producer only writes
+// head_ and the consumer only writes tail_, so neither side ever blocks or
+// locks. Indices grow without wrapping and are masked on access.
+template <typename T>
+class RingBuffer
+{
+public:
+    // `capacity` is rounded up to a power of two
+    explicit RingBuffer(size_t capacity)
+    {
+        size_t cap = 1;
+        while(cap < capacity)
+            cap <<= 1;
+
+        mask_ = cap - 1;
+        data_.reset(new T[cap]);
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    // Producer side: appends all of [first, first + n) or, if they do not fit, nothing
+    bool push(const T* first, size_t n)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        if(capacity() - (head - tail) < n)
+            return false;
+
+        for(size_t i = 0; i < n; ++i)
+            data_[(head + i) & mask_] = first[i];
+
+        head_.store(head + n, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: returns false if the queue is empty
+    bool pop(T& out)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail == head_.load(std::memory_order_acquire))
+            return false;
+
+        out = data_[tail & mask_];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::unique_ptr<T[]> data_;
+    size_t mask_;
+
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+};
+
+}